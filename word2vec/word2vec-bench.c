@@ -0,0 +1,355 @@
+//  word2vec-bench: 训练热点函数的微基准测试
+//
+//  直接#include word2vec.c,测量的就是训练时使用的同一份代码;修改word2vec.c之后重新编译运行,
+//  对比前后两次的CSV即可单独衡量这次修改的影响.
+//
+//  编译: gcc word2vec-bench.c -o word2vec-bench -lm -pthread -O3 -march=native -Wall -funroll-loops
+//  运行: ./word2vec-bench -output bench.csv -reps 10
+//
+//  参数:
+//    -output <file>  CSV结果输出文件,默认输出到stdout
+//    -reps <int>     每项计时重复次数,默认10
+//    -warmup <int>   每项预热次数(不计时),默认2
+//    -vocab <int>    合成数据的词典大小,默认100000
+//    -huge-pages <int>  和word2vec相同,unigram table和syn0/syn1/syn1neg使用大页的方式,默认1
+//
+//  测试项:
+//    read-word       ReadWord分词速度(词/秒),读取一个临时生成的语料文件
+//    search-vocab    GetWordHash + SearchVocab查词
+//    negative-sample 从unigram table中抽取负样本
+//    sigmoid         expTable查表计算sigmoid(含MAX_EXP截断分支)
+//    dot / axpy      向量点积和 y += g * x,维度100/200/300
+//    cbow-ns, skipgram-ns, cbow-hs, skipgram-hs
+//                    TrainCbowWord / TrainSkipGramWord完整的一步(一个中心词),维度100/200/300
+//
+//  每项先运行warmup次预热,再运行reps次,输出每次操作耗时(ns)的中位数,最小值,均值和相对标准差.
+//  negative-sample和训练步骤分别在普通页(pages = normal)和大页(pages = huge)分配的数组上各测一次,
+//  dtlb_per_op是每次操作的dTLB miss数(perf计数器不可用时为-1),两行对比即为大页减少的TLB miss.
+
+#define WORD2VEC_NO_MAIN
+#include "word2vec.c"
+
+#define BENCH_MAX_REPS 1000
+#define BENCH_WORDS 2000000 // read-word语料的词数
+#define BENCH_DRAWS 1000000 // search-vocab, sigmoid每次重复的操作数
+#define BENCH_ROWS 65536    // dot / axpy随机访问的行数,模拟syn1neg的随机访问
+#define BENCH_SENTENCE 1000 // cbow / skip-gram每次重复训练的句子长度
+
+int bench_reps = 10, bench_warmup = 2;
+long long bench_vocab = 100000, bench_size;
+char bench_output[MAX_STRING], bench_corpus[MAX_STRING];
+FILE *bench_out;
+const char *bench_pages = "normal";
+int bench_perf[PERF_EVENTS];
+volatile double bench_sink;
+
+long long *bench_ids;  // 按Zipf分布抽样的词下标
+struct word2vec *wv;   // 训练状态,main中创建
+real *bench_f, *bench_rows, *bench_x;
+
+/**
+ * ======== BenchCompare ========
+ * qsort比较函数,double升序.
+ */
+int BenchCompare(const void *a, const void *b) {
+  double x = *(double *)a, y = *(double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * ======== RunBench ========
+ * 运行一项测试:fn执行一次重复并返回这次的操作数;先预热bench_warmup次,再计时bench_reps次,
+ * 每次的耗时换算成每个操作的纳秒数,输出统计结果到CSV.
+ */
+void RunBench(const char *name, long long size, double (*fn)()) {
+  double t[BENCH_MAX_REPS], ops = 0, total = 0, begin, mean = 0, var = 0, median, dtlb = -1;
+  long long base[PERF_EVENTS], values[PERF_EVENTS], misses = 0;
+  int r;
+  bench_size = size;
+  for (r = 0; r < bench_warmup; r++) fn();
+  for (r = 0; r < bench_reps; r++) {
+    PerfStart(bench_perf, base);
+    begin = WallTime();
+    ops = fn();
+    t[r] = (WallTime() - begin) / ops * 1e9;
+    PerfStop(bench_perf, base, values);
+    if ((values[PERF_DTLB_MISSES] < 0) || (misses < 0)) misses = -1; else misses += values[PERF_DTLB_MISSES];
+    total += ops;
+    mean += t[r];
+  }
+  if (misses >= 0) dtlb = misses / total;
+  mean /= bench_reps;
+  for (r = 0; r < bench_reps; r++) var += (t[r] - mean) * (t[r] - mean);
+  var = bench_reps > 1 ? var / (bench_reps - 1) : 0;
+  qsort(t, bench_reps, sizeof(double), BenchCompare);
+  median = (bench_reps % 2) ? t[bench_reps / 2] : (t[bench_reps / 2 - 1] + t[bench_reps / 2]) / 2;
+  fprintf(bench_out, "%s,%lld,%d,%.0f,%.3f,%.3f,%.3f,%.2f,%.0f,%s,%.4f\n", name, size, bench_reps, ops, median, t[0], mean,
+   mean > 0 ? sqrt(var) / mean * 100 : 0, 1e9 / median, bench_pages, dtlb);
+  fflush(bench_out);
+  if (bench_out != stdout) printf("%-16s %4lld  %-6s  %10.3f ns/op  %14.0f ops/sec  %8.4f dtlb/op\n", name, size, bench_pages, median,
+   1e9 / median, dtlb);
+}
+
+double BenchReadWord() {
+  char word[MAX_STRING];
+  long long words = 0, chars = 0;
+  FILE *fi = fopen(bench_corpus, "rb");
+  while (1) {
+    ReadWord(word, fi);
+    if (feof(fi)) break;
+    chars += word[0];
+    words++;
+  }
+  fclose(fi);
+  bench_sink += chars;
+  return words;
+}
+
+double BenchSearchVocab() {
+  long long a, sum = 0;
+  for (a = 0; a < BENCH_DRAWS; a++) sum += SearchVocab(wv, wv->vocab[bench_ids[a]].word);
+  bench_sink += sum;
+  return BENCH_DRAWS;
+}
+
+double BenchNegativeSample() {
+  long long a, target, sum = 0;
+  unsigned long long next_random = 1;
+  for (a = 0; a < BENCH_DRAWS * 10; a++) {
+    next_random = next_random * (unsigned long long)25214903917 + 11;
+    target = wv->table[(next_random >> 16) % table_size];
+    if (target == 0) target = next_random % (wv->vocab_size - 1) + 1;
+    sum += target;
+  }
+  bench_sink += sum;
+  return BENCH_DRAWS * 10;
+}
+
+double BenchSigmoid() {
+  long long a;
+  real f, g, sum = 0;
+  for (a = 0; a < BENCH_DRAWS; a++) {
+    f = bench_f[a];
+    if (f > MAX_EXP) g = 0;
+    else if (f < -MAX_EXP) g = 1;
+    else g = 1 - wv->expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))];
+    sum += g;
+  }
+  bench_sink += sum;
+  return BENCH_DRAWS;
+}
+
+double BenchDot() {
+  long long a, c, l2;
+  real f, sum = 0;
+  for (a = 0; a < BENCH_DRAWS; a++) {
+    l2 = (bench_ids[a] % BENCH_ROWS) * bench_size;
+    f = 0;
+    for (c = 0; c < bench_size; c++) f += bench_x[c] * bench_rows[c + l2];
+    sum += f;
+  }
+  bench_sink += sum;
+  return BENCH_DRAWS;
+}
+
+double BenchAxpy() {
+  long long a, c, l2;
+  real g = 1e-6;
+  for (a = 0; a < BENCH_DRAWS; a++) {
+    l2 = (bench_ids[a] % BENCH_ROWS) * bench_size;
+    for (c = 0; c < bench_size; c++) bench_rows[c + l2] += g * bench_x[c];
+    g = -g;
+  }
+  bench_sink += bench_rows[0];
+  return BENCH_DRAWS;
+}
+
+/**
+ * ======== BenchStep ========
+ * 用TrainCbowWord / TrainSkipGramWord训练若干个长度为BENCH_SENTENCE的句子(skip-gram每个中心词更慢,句子数更少),
+ * 句子内容来自bench_ids;窗口缩小量b的随机方式和TrainModelThread相同.
+ */
+double BenchStep() {
+  long long a, p, b, *sen;
+  long long sentences = BENCH_DRAWS / BENCH_SENTENCE / (wv->cbow ? 10 : 50);
+  unsigned long long next_random = 1;
+  struct thread_stat stat;
+  struct train_model model;
+  real *neu1 = (real *)calloc(wv->layer1_size, sizeof(real));
+  real *neu1e = (real *)calloc(wv->layer1_size, sizeof(real));
+  memset(&stat, 0, sizeof(stat));
+  GetModel(wv, &model);
+  for (a = 0; a < sentences; a++) {
+    sen = &bench_ids[a * BENCH_SENTENCE];
+    for (p = 0; p < BENCH_SENTENCE; p++) {
+      next_random = next_random * (unsigned long long)25214903917 + 11;
+      b = next_random % wv->window;
+      if (wv->cbow) TrainCbowWord(wv, &model, sen, BENCH_SENTENCE, p, b, neu1, neu1e, wv->starting_alpha, &next_random, &stat, 0);
+      else TrainSkipGramWord(wv, &model, sen, BENCH_SENTENCE, p, b, neu1e, wv->starting_alpha, &next_random, &stat, 0);
+    }
+  }
+  free(neu1);
+  free(neu1e);
+  return sentences * BENCH_SENTENCE;
+}
+
+/**
+ * ======== BenchInit ========
+ * 构造测试数据:bench_vocab个词,词频服从Zipf分布;建立词典,Huffman树,unigram table,
+ * 以及按词频抽样的词下标bench_ids和read-word用的临时语料文件.
+ */
+void BenchInit() {
+  long long a, lo, hi, mid;
+  double *cum, total = 0, r;
+  unsigned long long next_random = 1;
+  char word[MAX_STRING];
+  int fd;
+  FILE *fo;
+
+  wv->vocab = (struct vocab_word *)calloc(wv->vocab_max_size, sizeof(struct vocab_word));
+  wv->vocab_hash = (int *)calloc(vocab_hash_size, sizeof(int));
+  wv->expTable = (real *)malloc((EXP_TABLE_SIZE + 1) * sizeof(real));
+  for (a = 0; a < EXP_TABLE_SIZE; a++) {
+    wv->expTable[a] = exp((a / (real)EXP_TABLE_SIZE * 2 - 1) * MAX_EXP);
+    wv->expTable[a] = wv->expTable[a] / (wv->expTable[a] + 1);
+  }
+  for (a = 0; a < vocab_hash_size; a++) wv->vocab_hash[a] = -1;
+  AddWordToVocab(wv, (char *)"</s>");
+  wv->vocab[0].cn = BENCH_WORDS / 20;
+  cum = (double *)malloc(bench_vocab * sizeof(double));
+  for (a = 0; a < bench_vocab; a++) {
+    total += 1.0 / (a + 1);
+    cum[a] = total;
+  }
+  for (a = 1; a < bench_vocab; a++) {
+    sprintf(word, "w%lld", a);
+    mid = AddWordToVocab(wv, word);
+    wv->vocab[mid].cn = (long long)(BENCH_WORDS / (a + 1) / total) + 1;
+  }
+  wv->min_count = 1;
+  SortVocab(wv);
+  wv->starting_alpha = 0.025;
+
+  // 按Zipf分布抽样词下标(二分查找累积分布)
+  bench_ids = (long long *)malloc(BENCH_DRAWS * sizeof(long long));
+  for (a = 0; a < BENCH_DRAWS; a++) {
+    next_random = next_random * (unsigned long long)25214903917 + 11;
+    r = (next_random >> 16) / (double)(1LL << 48) * total;
+    lo = 0;
+    hi = bench_vocab - 1;
+    while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (cum[mid] < r) lo = mid + 1; else hi = mid;
+    }
+    bench_ids[a] = lo;
+  }
+  free(cum);
+  bench_f = (real *)malloc(BENCH_DRAWS * sizeof(real));
+  for (a = 0; a < BENCH_DRAWS; a++) {
+    next_random = next_random * (unsigned long long)25214903917 + 11;
+    bench_f[a] = ((next_random >> 16) & 0xFFFF) / (real)65536 * 16 - 8;
+  }
+
+  // read-word语料:BENCH_WORDS个词,每20个词一行
+  strcpy(bench_corpus, "/tmp/word2vec-bench-XXXXXX");
+  fd = mkstemp(bench_corpus);
+  if (fd < 0) {
+    printf("ERROR: cannot create temporary corpus file\n");
+    exit(1);
+  }
+  fo = fdopen(fd, "wb");
+  for (a = 0; a < BENCH_WORDS; a++) fprintf(fo, "%s%c", wv->vocab[bench_ids[a % BENCH_DRAWS]].word, (a % 20 == 19) ? '\n' : ' ');
+  fclose(fo);
+}
+
+/**
+ * ======== BenchPages ========
+ * 切换数组的分配方式:huge为0时用普通页,否则按-huge-pages;重新分配unigram table.
+ * 返回这种方式是否需要测试(-huge-pages 0时大页和普通页相同,不重复测试).
+ */
+int BenchPages(int huge, int mode) {
+  if (huge && (mode == 0)) return 0;
+  wv->huge_pages = huge ? mode : 0;
+  bench_pages = huge ? "huge" : "normal";
+  HugeFree(wv, wv->table);
+  InitUnigramTable(wv);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  int i, huge, mode;
+  long long sizes[3] = {100, 200, 300}, s;
+  wv = NewWord2vec();
+  if (wv == NULL) {
+    printf("Memory allocation failed\n");
+    return 1;
+  }
+  // 训练代码出错时Fail回到这里
+  if (setjmp(wv->fail) != 0) {
+    printf("%s\n", wv->error);
+    return 1;
+  }
+  mode = wv->huge_pages;
+  bench_output[0] = 0;
+  if ((i = ArgPos(wv, (char *)"-output", argc, argv)) > 0) strcpy(bench_output, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-reps", argc, argv)) > 0) bench_reps = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-warmup", argc, argv)) > 0) bench_warmup = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-vocab", argc, argv)) > 0) bench_vocab = atoll(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-huge-pages", argc, argv)) > 0) mode = atoi(argv[i + 1]);
+  if (bench_reps < 1) bench_reps = 1;
+  if (bench_reps > BENCH_MAX_REPS) bench_reps = BENCH_MAX_REPS;
+  if (bench_vocab < 10) bench_vocab = 10;
+  bench_out = stdout;
+  if (bench_output[0] != 0) {
+    bench_out = fopen(bench_output, "wb");
+    if (bench_out == NULL) {
+      printf("ERROR: cannot open %s\n", bench_output);
+      exit(1);
+    }
+  }
+  wv->debug_mode = 0;
+  BenchInit();
+  wv->huge_pages = 0;
+  InitUnigramTable(wv);
+  // CSV写到stdout时提示写到stderr,不混进CSV
+  if (PerfOpen(bench_perf, 0) == 0) fprintf(bench_out == stdout ? stderr : stdout, "perf counters are not available, dtlb_per_op is -1\n");
+  fprintf(bench_out, "benchmark,size,reps,ops,median_ns,min_ns,mean_ns,stddev_pct,ops_per_sec,pages,dtlb_per_op\n");
+
+  RunBench("read-word", 0, BenchReadWord);
+  RunBench("search-vocab", 0, BenchSearchVocab);
+  for (huge = 0; huge < 2; huge++) if (BenchPages(huge, mode)) RunBench("negative-sample", 0, BenchNegativeSample);
+  BenchPages(0, mode);
+  RunBench("sigmoid", 0, BenchSigmoid);
+  for (s = 0; s < 3; s++) {
+    bench_rows = (real *)calloc(BENCH_ROWS * sizes[s], sizeof(real));
+    bench_x = (real *)malloc(sizes[s] * sizeof(real));
+    for (i = 0; i < sizes[s]; i++) bench_x[i] = (i % 7) / (real)7 - 0.5;
+    RunBench("dot", sizes[s], BenchDot);
+    RunBench("axpy", sizes[s], BenchAxpy);
+    free(bench_rows);
+    free(bench_x);
+  }
+  for (s = 0; s < 3; s++) for (huge = 0; huge < 2; huge++) {
+    if (!BenchPages(huge, mode)) continue;
+    wv->layer1_size = sizes[s];
+    wv->hs = 1;
+    wv->negative = 5;
+    InitNet(wv);
+    wv->cbow = 1; wv->negative = 5; wv->hs = 0;
+    RunBench("cbow-ns", sizes[s], BenchStep);
+    wv->cbow = 0;
+    RunBench("skipgram-ns", sizes[s], BenchStep);
+    wv->cbow = 1; wv->negative = 0; wv->hs = 1;
+    RunBench("cbow-hs", sizes[s], BenchStep);
+    wv->cbow = 0;
+    RunBench("skipgram-hs", sizes[s], BenchStep);
+    HugeFree(wv, wv->syn0);
+    HugeFree(wv, wv->syn1);
+    HugeFree(wv, wv->syn1neg);
+    free(wv->word_row);
+  }
+  PerfClose(bench_perf);
+  unlink(bench_corpus);
+  if (bench_out != stdout) fclose(bench_out);
+  return 0;
+}
@@ -0,0 +1,231 @@
+//  word2vec-hnsw: 构建HNSW索引,测试召回率和查询延迟
+//
+//  在.w2vm模型(word2vec -binary 2的输出)上构建HNSW索引(也可以用word2vec -hnsw在训练结束时构建),
+//  然后随机取若干个词作为查询,先用精确搜索(word2vec-query.h,逐个查询)得到真正的k个最近邻,
+//  再对-ef列表中的每个ef用HNSW查询,统计recall@k(和精确结果的交集比例)和单个查询的延迟(均值,p50,p99),
+//  用来在召回率和延迟之间选择ef.查询词本身不算在结果里.
+//
+//  编译: gcc word2vec-hnsw.c -o word2vec-hnsw -lm -pthread -O3 -march=native -Wall -funroll-loops
+//  运行: ./word2vec-hnsw -model vec.w2vm -index vec.hnsw -build 1 -threads 8 -ef 10,20,40,80,160 -output recall.csv
+//
+//  参数:
+//    -model <file>            .w2vm模型文件
+//    -index <file>            HNSW索引文件
+//    -build <int>             1表示先在模型上构建索引并保存到-index,默认0(读取已有的索引)
+//    -m <int>                 构建时每层的最大邻居数,默认16
+//    -ef-construction <int>   构建时的候选集大小,默认200
+//    -threads <int>           构建和精确搜索的线程数,默认1;查询延迟总是单线程测量
+//    -queries <int>           查询数,默认1000
+//    -k <int>                 每个查询的近邻数,默认10
+//    -ef <list>               查询时的候选集大小列表,逗号分隔,默认10,20,40,80,160,320
+//    -output <file>           CSV结果输出文件,默认stdout
+
+#include "word2vec-hnsw.h"
+
+#define MAX_STRING 100
+#define HNSW_MAX_LIST 32
+
+/**
+ * ======== ArgPos ========
+ * 和word2vec相同的参数解析.
+ */
+int ArgPos(char *str, int argc, char **argv) {
+  int a;
+  for (a = 1; a < argc; a++) if (!strcmp(str, argv[a])) {
+    if (a == argc - 1) {
+      printf("Argument missing for %s\n", str);
+      exit(1);
+    }
+    return a;
+  }
+  return -1;
+}
+
+/**
+ * ======== ParseList ========
+ * 解析逗号分隔的整数列表,返回个数.
+ */
+int ParseList(char *str, long long *out) {
+  int n = 0;
+  char *tok, buf[MAX_STRING];
+  strncpy(buf, str, MAX_STRING - 1);
+  buf[MAX_STRING - 1] = 0;
+  for (tok = strtok(buf, ","); (tok != NULL) && (n < HNSW_MAX_LIST); tok = strtok(NULL, ",")) out[n++] = atoll(tok);
+  return n;
+}
+
+double Now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int CompareDouble(const void *a, const void *b) {
+  double x = *(double *)a, y = *(double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * ======== Report ========
+ * 输出一行结果:t为每个查询的耗时(秒),会被排序.
+ */
+void Report(FILE *fo, const char *method, long long ef, long long k, double recall, double *t, long long n) {
+  double total = 0;
+  long long a;
+  for (a = 0; a < n; a++) total += t[a];
+  qsort(t, n, sizeof(double), CompareDouble);
+  fprintf(fo, "%s,%lld,%lld,%.4f,%.1f,%.1f,%.1f,%.0f\n", method, ef, k, recall, total / n * 1e6, t[n / 2] * 1e6, t[n * 99 / 100] * 1e6,
+   n / (total + 1e-9));
+  fflush(fo);
+  if (fo != stdout) printf("%-6s ef %5lld: recall@%lld %.4f, mean %.1fus, p99 %.1fus\n", method, ef, k, recall, total / n * 1e6,
+   t[n * 99 / 100] * 1e6);
+}
+
+int main(int argc, char **argv) {
+  int i, build = 0, threads = 1, nef;
+  long long m_links = 16, ef_construction = 200, nq = 1000, k = 10, ef[HNSW_MAX_LIST], a, b, c, e, n, hits;
+  long long *rows, *exact, *ids, exclude[3];
+  unsigned long long next_random = 1;
+  char model_file[MAX_STRING], index_file[MAX_STRING], output_file[MAX_STRING];
+  float *scores, *query;
+  double *t, start;
+  struct w2vm_model m;
+  struct w2vh_index g;
+  struct w2vh_ctx ctx;
+  struct w2vq_index q;
+  FILE *fo = stdout;
+
+  if (argc == 1) {
+    printf("HNSW index builder and recall / latency benchmark for aligned word2vec models\n\n");
+    printf("Options:\n");
+    printf("\t-model <file>\n");//.w2vm模型文件
+    printf("\t\tModel written by word2vec -binary 2\n");
+    printf("\t-index <file>\n");//HNSW索引文件
+    printf("\t\tHNSW index file\n");
+    printf("\t-build <int>\n");//1表示先构建索引并保存到-index;默认0,读取已有的索引
+    printf("\t\tBuild the index from the model and save it to -index first; default is 0 (read an existing index)\n");
+    printf("\t-m <int>\n");//每层的最大邻居数,默认16
+    printf("\t\tMaximum number of links per node and layer when building; default is 16\n");
+    printf("\t-ef-construction <int>\n");//构建时的候选集大小,默认200
+    printf("\t\tCandidate list size when building; default is 200\n");
+    printf("\t-threads <int>\n");//构建和精确搜索的线程数,默认1
+    printf("\t\tThreads used for building and for the exact search (default 1); latencies are single-threaded\n");
+    printf("\t-queries <int>\n");//查询数,默认1000
+    printf("\t\tNumber of randomly chosen query words; default is 1000\n");
+    printf("\t-k <int>\n");//每个查询的近邻数,默认10
+    printf("\t\tNeighbours per query; default is 10\n");
+    printf("\t-ef <list>\n");//查询时的候选集大小列表,默认10,20,40,80,160,320
+    printf("\t\tComma separated list of query-time candidate list sizes; default is 10,20,40,80,160,320\n");
+    printf("\t-output <file>\n");//CSV结果输出文件,默认stdout
+    printf("\t\tWrite the CSV results to <file>; default is stdout\n");
+    printf("\nExamples:\n");
+    printf("./word2vec-hnsw -model vec.w2vm -index vec.hnsw -build 1 -threads 8 -ef 10,40,160\n\n");
+    return 0;
+  }
+  model_file[0] = 0;
+  index_file[0] = 0;
+  output_file[0] = 0;
+  nef = ParseList((char *)"10,20,40,80,160,320", ef);
+  if ((i = ArgPos((char *)"-model", argc, argv)) > 0) strcpy(model_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-index", argc, argv)) > 0) strcpy(index_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-build", argc, argv)) > 0) build = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-m", argc, argv)) > 0) m_links = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-ef-construction", argc, argv)) > 0) ef_construction = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) threads = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-queries", argc, argv)) > 0) nq = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-k", argc, argv)) > 0) k = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-ef", argc, argv)) > 0) nef = ParseList(argv[i + 1], ef);
+  if ((i = ArgPos((char *)"-output", argc, argv)) > 0) strcpy(output_file, argv[i + 1]);
+  if (w2vm_open(model_file, &m) != 0) {
+    printf("ERROR: cannot open model file %s\n", model_file);
+    exit(1);
+  }
+  if (k < 1) k = 1;
+  if (nq < 1) nq = 1;
+  if (m_links < 2) m_links = 2;
+
+  // 构建或者读取索引
+  if (build) {
+    start = Now();
+    if (w2vh_build(&g, m.vectors, m.header->words, m.header->dim, m.header->stride, m_links, ef_construction, threads, 1) != 0) {
+      printf("Memory allocation failed\n");
+      exit(1);
+    }
+    printf("Built HNSW index over %lld words in %.3fs (%d threads)\n", g.rows, Now() - start, threads);
+    if (w2vh_save(&g, index_file) != 0) {
+      printf("ERROR: cannot write index file %s\n", index_file);
+      exit(1);
+    }
+    w2vh_free(&g);
+  }
+  if (w2vh_open(index_file, &g) != 0) {
+    printf("ERROR: cannot open index file %s\n", index_file);
+    exit(1);
+  }
+  if ((g.rows != (long long)m.header->words) || (g.dim != (long long)m.header->dim)) {
+    printf("ERROR: index %s does not match model %s\n", index_file, model_file);
+    exit(1);
+  }
+  g.vectors = m.vectors;
+  g.stride = m.header->stride;
+  if (output_file[0] != 0) {
+    fo = fopen(output_file, "wb");
+    if (fo == NULL) {
+      printf("ERROR: cannot open %s\n", output_file);
+      exit(1);
+    }
+  }
+
+  // 随机取查询词,精确搜索得到真正的近邻(排除查询词本身)
+  rows = (long long *)malloc(nq * sizeof(long long));
+  exact = (long long *)malloc(nq * k * sizeof(long long));
+  ids = (long long *)malloc((k + 1) * sizeof(long long));
+  scores = (float *)malloc((k + 1) * sizeof(float));
+  t = (double *)malloc(nq * sizeof(double));
+  for (a = 0; a < nq; a++) {
+    next_random = next_random * (unsigned long long)25214903917 + 11;
+    rows[a] = (next_random >> 16) % g.rows;
+  }
+  if ((w2vq_init(&q, m.vectors, m.header->words, m.header->dim, m.header->stride) != 0) ||
+   (posix_memalign((void **)&query, 64, q.stride * sizeof(float)) != 0)) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  fprintf(fo, "method,ef,k,recall,mean_us,p50_us,p99_us,queries_per_sec\n");
+  for (a = 0; a < nq; a++) {
+    w2vq_make_query(&q, rows[a], -1, -1, query, exclude);
+    start = Now();
+    w2vq_search(&q, query, 1, exclude, k, threads, &exact[a * k], scores);
+    t[a] = Now() - start;
+  }
+  Report(fo, "exact", 0, k, 1.0, t, nq);
+  w2vq_free(&q);
+
+  // 每个ef的召回率和单线程延迟
+  w2vh_ctx_init(&ctx, &g);
+  for (e = 0; e < nef; e++) {
+    hits = 0;
+    for (a = 0; a < nq; a++) {
+      start = Now();
+      n = w2vh_search(&g, &ctx, w2vm_vector(&m, rows[a]), k + 1, ef[e] > k + 1 ? ef[e] : k + 1, ids, scores);
+      t[a] = Now() - start;
+      for (b = 0, c = 0; (b < n) && (c < k); b++) {
+        if (ids[b] == rows[a]) continue;
+        for (i = 0; i < k; i++) if (exact[a * k + i] == ids[b]) hits++;
+        c++;
+      }
+    }
+    Report(fo, "hnsw", ef[e], k, (double)hits / (nq * k), t, nq);
+  }
+  w2vh_ctx_free(&ctx);
+  if (fo != stdout) fclose(fo);
+  free(rows);
+  free(exact);
+  free(ids);
+  free(scores);
+  free(query);
+  free(t);
+  w2vh_free(&g);
+  w2vm_close(&m);
+  return 0;
+}
@@ -0,0 +1,542 @@
+//  word2vec-hnsw.h: 词向量的HNSW近似最近邻索引(余弦相似度)
+//
+//  HNSW(Hierarchical Navigable Small World):每个结点随机分到若干层,层数越高结点越少;
+//  查询从最高层的入口结点开始贪心地向相似度更高的邻居移动,逐层下降,在第0层用大小为ef的候选集做最佳优先搜索.
+//  ef越大召回率越高,查询越慢.
+//
+//  索引只保存图结构和每行向量长度的倒数,不保存向量本身:向量来自训练得到的syn0,或者.w2vm模型(行号相同),
+//  查询时由调用者提供(w2vh_open之后设置vectors / stride).
+//
+//  文件布局(.hnsw,所有偏移都是相对文件开头的字节数,每部分从64字节对齐的位置开始):
+//
+//    header      struct w2vh_header
+//    inv_norm    rows个float,每行向量长度的倒数(零向量为0)
+//    levels      rows个uint8_t,每个结点的最高层
+//    level0      rows * (1 + m0)个uint32_t:第0层每个结点的邻居数和邻居
+//    upper_offs  rows个uint64_t:结点在upper中的起始位置(以uint32_t计),没有上层的结点为0
+//    upper       第1..levels[i]层每层(1 + m)个uint32_t,格式同level0
+//
+//  用法:
+//    struct w2vh_index g;
+//    struct w2vh_ctx ctx;
+//    w2vh_open("vectors.hnsw", &g);
+//    g.vectors = w2vm_vector(&m, 0);
+//    g.stride = m.header->stride;
+//    w2vh_ctx_init(&ctx, &g);
+//    n = w2vh_search(&g, &ctx, query, 10, 100, ids, scores);
+
+#ifndef WORD2VEC_HNSW_H
+#define WORD2VEC_HNSW_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "word2vec-model.h"
+#include "word2vec-query.h"
+
+#define W2VH_MAGIC "W2VHNSW"
+#define W2VH_VERSION 1
+#define W2VH_MAX_LEVEL 16
+#define W2VH_LOCKS 4096 // 构建时结点锁的个数,结点i使用第i % W2VH_LOCKS个
+
+/*
+ * ======== w2vh_header ========
+ *   magic - "W2VHNSW\0"
+ *   rows, dim - 结点数(等于词数),向量维度
+ *   m, m0 - 第1层以上和第0层每个结点的最大邻居数
+ *   max_level, entry - 最高层和入口结点
+ *   *_pos - 各部分的位置;upper_size为upper的uint32_t个数
+ *   file_size - 文件总长度
+ */
+struct w2vh_header {
+  char magic[8];
+  uint32_t version, header_size;
+  uint64_t rows, dim, m, m0, max_level, entry;
+  uint64_t inv_norm_pos, levels_pos, level0_pos, upper_offs_pos, upper_pos, upper_size, file_size;
+  uint64_t reserved[8];
+};
+
+/*
+ * ======== w2vh_index ========
+ * 构建中(upper, locks非空)或者从文件mmap得到(base非空)的索引.
+ */
+struct w2vh_index {
+  const float *vectors;
+  long long rows, dim, stride, m, m0, max_level, entry;
+  float *inv_norm;
+  uint8_t *levels;
+  uint32_t *level0, **upper;
+  const uint64_t *upper_offs;
+  const uint32_t *upper_data;
+  pthread_mutex_t *locks, global;
+  void *base;
+  size_t size;
+};
+
+/*
+ * ======== w2vh_heap ========
+ * (key, id)的最小堆,容量不够时自动扩大;候选集用-相似度作key即为最大堆.
+ */
+struct w2vh_heap {
+  float *key;
+  uint32_t *id;
+  long long n, cap;
+};
+
+/*
+ * ======== w2vh_ctx ========
+ * 每个线程一份的搜索缓冲区:visited标记(tag递增,不用每次清零),归一化的查询,邻居表副本,候选集和结果集.
+ */
+struct w2vh_ctx {
+  uint32_t *visited, tag, *links;
+  float *q, *sel_sim;
+  uint32_t *sel_id;
+  struct w2vh_heap cand, res;
+};
+
+static inline void w2vh_heap_push(struct w2vh_heap *h, float key, uint32_t id) {
+  long long p;
+  if (h->n == h->cap) {
+    h->cap = h->cap ? h->cap * 2 : 64;
+    h->key = (float *)realloc(h->key, h->cap * sizeof(float));
+    h->id = (uint32_t *)realloc(h->id, h->cap * sizeof(uint32_t));
+  }
+  for (p = h->n++; (p > 0) && (h->key[(p - 1) / 2] > key); p = (p - 1) / 2) {
+    h->key[p] = h->key[(p - 1) / 2];
+    h->id[p] = h->id[(p - 1) / 2];
+  }
+  h->key[p] = key;
+  h->id[p] = id;
+}
+
+static inline void w2vh_heap_pop(struct w2vh_heap *h) {
+  long long p, c, n = --h->n;
+  float key = h->key[n];
+  uint32_t id = h->id[n];
+  for (p = 0; (c = 2 * p + 1) < n; p = c) {
+    if ((c + 1 < n) && (h->key[c + 1] < h->key[c])) c++;
+    if (h->key[c] >= key) break;
+    h->key[p] = h->key[c];
+    h->id[p] = h->id[c];
+  }
+  h->key[p] = key;
+  h->id[p] = id;
+}
+
+/**
+ * ======== w2vh_links ========
+ * 结点node在第layer层的邻居表:第一个元素为邻居数,之后是邻居.
+ */
+static inline uint32_t *w2vh_links(const struct w2vh_index *g, long long node, long long layer) {
+  if (layer == 0) return &g->level0[node * (1 + g->m0)];
+  if (g->upper != NULL) return &g->upper[node][(layer - 1) * (1 + g->m)];
+  return (uint32_t *)&g->upper_data[g->upper_offs[node] + (layer - 1) * (1 + g->m)];
+}
+
+/**
+ * ======== w2vh_copy_links ========
+ * 把邻居表复制到ctx->links;构建时其他线程可能同时修改,所以要加锁.返回邻居数.
+ */
+static inline uint32_t w2vh_copy_links(const struct w2vh_index *g, struct w2vh_ctx *ctx, long long node, long long layer) {
+  uint32_t *l = w2vh_links(g, node, layer), n;
+  if (g->locks != NULL) pthread_mutex_lock(&g->locks[node % W2VH_LOCKS]);
+  n = l[0];
+  memcpy(ctx->links, l + 1, n * sizeof(uint32_t));
+  if (g->locks != NULL) pthread_mutex_unlock(&g->locks[node % W2VH_LOCKS]);
+  return n;
+}
+
+/**
+ * ======== w2vh_sim ========
+ * 归一化的查询q和结点node的余弦相似度.
+ */
+static inline float w2vh_sim(const struct w2vh_index *g, const float *q, long long node) {
+  return w2vq_dot(q, &g->vectors[node * g->stride], g->dim) * g->inv_norm[node];
+}
+
+static inline void w2vh_ctx_init(struct w2vh_ctx *ctx, const struct w2vh_index *g) {
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->visited = (uint32_t *)calloc(g->rows, sizeof(uint32_t));
+  ctx->links = (uint32_t *)malloc((g->m0 + 1) * sizeof(uint32_t));
+  ctx->q = (float *)malloc(g->dim * sizeof(float));
+  ctx->sel_sim = (float *)malloc((g->m0 + 1) * sizeof(float));
+  ctx->sel_id = (uint32_t *)malloc((g->m0 + 1) * sizeof(uint32_t));
+}
+
+static inline void w2vh_ctx_free(struct w2vh_ctx *ctx) {
+  free(ctx->visited);
+  free(ctx->links);
+  free(ctx->q);
+  free(ctx->sel_sim);
+  free(ctx->sel_id);
+  free(ctx->cand.key);
+  free(ctx->cand.id);
+  free(ctx->res.key);
+  free(ctx->res.id);
+}
+
+/**
+ * ======== w2vh_greedy ========
+ * 在第layer层从cur出发,不断移动到和q更相似的邻居,直到没有更好的邻居,返回最后的结点.
+ */
+static inline long long w2vh_greedy(const struct w2vh_index *g, struct w2vh_ctx *ctx, const float *q, long long cur, long long layer) {
+  float best = w2vh_sim(g, q, cur), s;
+  uint32_t a, n;
+  int changed = 1;
+  while (changed) {
+    changed = 0;
+    n = w2vh_copy_links(g, ctx, cur, layer);
+    for (a = 0; a < n; a++) if ((s = w2vh_sim(g, q, ctx->links[a])) > best) {
+      best = s;
+      cur = ctx->links[a];
+      changed = 1;
+    }
+  }
+  return cur;
+}
+
+/**
+ * ======== w2vh_search_layer ========
+ * 在第layer层从ep出发做最佳优先搜索,结果集(最多ef个,堆顶为其中相似度最低的)留在ctx->res中.
+ */
+static inline void w2vh_search_layer(const struct w2vh_index *g, struct w2vh_ctx *ctx, const float *q, long long ep, long long ef,
+                                     long long layer) {
+  uint32_t a, n, c;
+  float s;
+  if (++ctx->tag == 0) {
+    memset(ctx->visited, 0, g->rows * sizeof(uint32_t));
+    ctx->tag = 1;
+  }
+  ctx->cand.n = 0;
+  ctx->res.n = 0;
+  ctx->visited[ep] = ctx->tag;
+  s = w2vh_sim(g, q, ep);
+  w2vh_heap_push(&ctx->cand, -s, ep);
+  w2vh_heap_push(&ctx->res, s, ep);
+  while (ctx->cand.n > 0) {
+    // 最好的候选比结果集中最差的还差,不可能再改进
+    if ((-ctx->cand.key[0] < ctx->res.key[0]) && (ctx->res.n >= ef)) break;
+    c = ctx->cand.id[0];
+    w2vh_heap_pop(&ctx->cand);
+    n = w2vh_copy_links(g, ctx, c, layer);
+    for (a = 0; a < n; a++) {
+      if (ctx->visited[ctx->links[a]] == ctx->tag) continue;
+      ctx->visited[ctx->links[a]] = ctx->tag;
+      s = w2vh_sim(g, q, ctx->links[a]);
+      if ((ctx->res.n < ef) || (s > ctx->res.key[0])) {
+        w2vh_heap_push(&ctx->cand, -s, ctx->links[a]);
+        w2vh_heap_push(&ctx->res, s, ctx->links[a]);
+        if (ctx->res.n > ef) w2vh_heap_pop(&ctx->res);
+      }
+    }
+  }
+}
+
+/**
+ * ======== w2vh_sorted_results ========
+ * 把ctx->res按相似度降序取出到sim / id(清空结果集),返回个数.
+ */
+static inline long long w2vh_sorted_results(struct w2vh_ctx *ctx, float *sim, uint32_t *id) {
+  long long n = ctx->res.n, a;
+  for (a = n - 1; a >= 0; a--) {
+    sim[a] = ctx->res.key[0];
+    id[a] = ctx->res.id[0];
+    w2vh_heap_pop(&ctx->res);
+  }
+  return n;
+}
+
+/**
+ * ======== w2vh_select ========
+ * 启发式选邻居:候选(按和base的相似度降序)依次加入,如果某个候选和已选中的某个结点比和base更相似就跳过,
+ * 这样邻居分布在不同方向,图的连通性更好.结果写回sim / id的前面,返回个数(不超过max).
+ */
+static inline long long w2vh_select(const struct w2vh_index *g, float *sim, uint32_t *id, long long n, long long max) {
+  long long a, b, k = 0;
+  const float *x;
+  for (a = 0; (a < n) && (k < max); a++) {
+    x = &g->vectors[id[a] * g->stride];
+    for (b = 0; b < k; b++) if (w2vq_dot(x, &g->vectors[id[b] * g->stride], g->dim) * g->inv_norm[id[a]] * g->inv_norm[id[b]] > sim[a]) break;
+    if (b < k) continue;
+    sim[k] = sim[a];
+    id[k++] = id[a];
+  }
+  return k;
+}
+
+/**
+ * ======== w2vh_insert ========
+ * 把结点node插入图中(构建用):从入口贪心下降到node的最高层,然后在每层搜索ef_construction个候选,
+ * 选出m个邻居互相连接;邻居的邻居表满了时,用同样的启发式在原有邻居和node中重新选.
+ */
+static inline void w2vh_insert(struct w2vh_index *g, struct w2vh_ctx *ctx, long long node, long long ef_construction) {
+  long long level = g->levels[node], top, ep, layer, a, b, n, p, k, max, cand_n;
+  uint32_t *l, nb, c;
+  float *x = (float *)&g->vectors[node * g->stride], s;
+  float *cand_sim = (float *)malloc((ef_construction + g->m0 + 1) * sizeof(float));
+  uint32_t *cand_id = (uint32_t *)malloc((ef_construction + g->m0 + 1) * sizeof(uint32_t));
+  for (a = 0; a < g->dim; a++) ctx->q[a] = x[a] * g->inv_norm[node];
+  // 比当前最高层还高的结点要更新入口,插入期间一直持有全局锁
+  pthread_mutex_lock(&g->global);
+  ep = g->entry;
+  top = g->max_level;
+  if (level <= top) pthread_mutex_unlock(&g->global);
+  for (layer = top; layer > level; layer--) ep = w2vh_greedy(g, ctx, ctx->q, ep, layer);
+  for (layer = level < top ? level : top; layer >= 0; layer--) {
+    max = layer == 0 ? g->m0 : g->m;
+    w2vh_search_layer(g, ctx, ctx->q, ep, ef_construction, layer);
+    cand_n = w2vh_sorted_results(ctx, cand_sim, cand_id);
+    ep = cand_id[0];
+    k = w2vh_select(g, cand_sim, cand_id, cand_n, g->m);
+    l = w2vh_links(g, node, layer);
+    pthread_mutex_lock(&g->locks[node % W2VH_LOCKS]);
+    l[0] = k;
+    memcpy(l + 1, cand_id, k * sizeof(uint32_t));
+    pthread_mutex_unlock(&g->locks[node % W2VH_LOCKS]);
+    // 反向连接
+    for (a = 0; a < k; a++) {
+      nb = cand_id[a];
+      l = w2vh_links(g, nb, layer);
+      pthread_mutex_lock(&g->locks[nb % W2VH_LOCKS]);
+      if (l[0] < max) l[++l[0]] = node;
+      else {
+        // 邻居表已满:原有邻居加上node按和nb的相似度降序排列后重新选
+        n = 0;
+        for (b = 0; b <= max; b++) {
+          c = b < max ? l[1 + b] : node;
+          s = w2vq_dot(&g->vectors[nb * g->stride], &g->vectors[c * g->stride], g->dim) * g->inv_norm[nb] * g->inv_norm[c];
+          for (p = n++; (p > 0) && (ctx->sel_sim[p - 1] < s); p--) {
+            ctx->sel_sim[p] = ctx->sel_sim[p - 1];
+            ctx->sel_id[p] = ctx->sel_id[p - 1];
+          }
+          ctx->sel_sim[p] = s;
+          ctx->sel_id[p] = c;
+        }
+        l[0] = w2vh_select(g, ctx->sel_sim, ctx->sel_id, n, max);
+        memcpy(l + 1, ctx->sel_id, l[0] * sizeof(uint32_t));
+      }
+      pthread_mutex_unlock(&g->locks[nb % W2VH_LOCKS]);
+    }
+  }
+  if (level > top) {
+    g->entry = node;
+    g->max_level = level;
+    pthread_mutex_unlock(&g->global);
+  }
+  free(cand_sim);
+  free(cand_id);
+}
+
+/*
+ * ======== w2vh_build_task ========
+ * 构建线程共享的参数,next为下一个要插入的结点(原子递增).
+ */
+struct w2vh_build_task {
+  struct w2vh_index *g;
+  long long ef_construction, next;
+};
+
+static void *w2vh_build_thread(void *arg) {
+  struct w2vh_build_task *t = (struct w2vh_build_task *)arg;
+  struct w2vh_ctx ctx;
+  long long node;
+  w2vh_ctx_init(&ctx, t->g);
+  while ((node = __sync_fetch_and_add(&t->next, 1)) < t->g->rows) w2vh_insert(t->g, &ctx, node, t->ef_construction);
+  w2vh_ctx_free(&ctx);
+  return NULL;
+}
+
+/**
+ * ======== w2vh_build ========
+ * 在vectors(rows行,dim维,行距stride)上用threads个线程构建索引,结点按行号顺序领取插入.
+ * m为每层最大邻居数(第0层为2m),ef_construction为插入时的候选集大小,seed决定每个结点的层数.成功返回0.
+ */
+static inline int w2vh_build(struct w2vh_index *g, const float *vectors, long long rows, long long dim, long long stride, long long m,
+                             long long ef_construction, int threads, unsigned long long seed) {
+  long long a;
+  double ml = 1 / log((double)(m > 1 ? m : 2)), u;
+  pthread_t *pt;
+  struct w2vh_build_task task;
+  memset(g, 0, sizeof(*g));
+  if ((rows <= 0) || (m < 2)) return -1;
+  g->vectors = vectors;
+  g->rows = rows;
+  g->dim = dim;
+  g->stride = stride;
+  g->m = m;
+  g->m0 = 2 * m;
+  g->inv_norm = (float *)malloc(rows * sizeof(float));
+  g->levels = (uint8_t *)malloc(rows);
+  g->level0 = (uint32_t *)calloc(rows * (1 + g->m0), sizeof(uint32_t));
+  g->upper = (uint32_t **)calloc(rows, sizeof(uint32_t *));
+  g->locks = (pthread_mutex_t *)malloc(W2VH_LOCKS * sizeof(pthread_mutex_t));
+  if ((g->inv_norm == NULL) || (g->levels == NULL) || (g->level0 == NULL) || (g->upper == NULL) || (g->locks == NULL)) return -1;
+  for (a = 0; a < W2VH_LOCKS; a++) pthread_mutex_init(&g->locks[a], NULL);
+  pthread_mutex_init(&g->global, NULL);
+  for (a = 0; a < rows; a++) {
+    u = sqrt(w2vq_dot(&vectors[a * stride], &vectors[a * stride], dim));
+    g->inv_norm[a] = u > 0 ? 1 / u : 0;
+    // 层数服从几何分布:floor(-ln(U) * ml)
+    seed = seed * (unsigned long long)25214903917 + 11;
+    u = ((seed >> 16) & 0xFFFFFFFF) / 4294967296.0;
+    u = floor(-log(1 - u) * ml);
+    g->levels[a] = u < W2VH_MAX_LEVEL ? (uint8_t)u : W2VH_MAX_LEVEL;
+    if (g->levels[a] > 0) g->upper[a] = (uint32_t *)calloc(g->levels[a] * (1 + m), sizeof(uint32_t));
+  }
+  // 第0个结点直接作为入口,其余结点由多个线程并发插入
+  g->entry = 0;
+  g->max_level = g->levels[0];
+  task.g = g;
+  task.ef_construction = ef_construction > m ? ef_construction : m;
+  task.next = 1;
+  if (threads < 1) threads = 1;
+  pt = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  for (a = 0; a < threads; a++) pthread_create(&pt[a], NULL, w2vh_build_thread, &task);
+  for (a = 0; a < threads; a++) pthread_join(pt[a], NULL);
+  free(pt);
+  return 0;
+}
+
+/**
+ * ======== w2vh_search ========
+ * 查询和q(不需要归一化)最相似的k个结点,ef(不小于k)越大召回率越高;结果按相似度降序写到ids / scores,返回个数.
+ */
+static inline long long w2vh_search(const struct w2vh_index *g, struct w2vh_ctx *ctx, const float *q, long long k, long long ef,
+                                    long long *ids, float *scores) {
+  long long a, layer, ep = g->entry, n;
+  float len = sqrtf(w2vq_dot(q, q, g->dim)), *sim;
+  uint32_t *id;
+  for (a = 0; a < g->dim; a++) ctx->q[a] = len > 0 ? q[a] / len : 0;
+  if (ef < k) ef = k;
+  for (layer = g->max_level; layer > 0; layer--) ep = w2vh_greedy(g, ctx, ctx->q, ep, layer);
+  w2vh_search_layer(g, ctx, ctx->q, ep, ef, 0);
+  sim = (float *)malloc(ctx->res.n * sizeof(float));
+  id = (uint32_t *)malloc(ctx->res.n * sizeof(uint32_t));
+  n = w2vh_sorted_results(ctx, sim, id);
+  if (n > k) n = k;
+  for (a = 0; a < n; a++) {
+    ids[a] = id[a];
+    scores[a] = sim[a];
+  }
+  free(sim);
+  free(id);
+  return n;
+}
+
+/**
+ * ======== w2vh_save ========
+ * 把构建好的索引写到文件,成功返回0.
+ */
+static inline int w2vh_save(const struct w2vh_index *g, const char *file) {
+  struct w2vh_header h;
+  long long a;
+  uint64_t *offs = (uint64_t *)calloc(g->rows, sizeof(uint64_t)), pos;
+  static const char zero[64];
+  FILE *fo = fopen(file, "wb");
+  if ((fo == NULL) || (offs == NULL)) return -1;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, W2VH_MAGIC, 8);
+  h.version = W2VH_VERSION;
+  h.header_size = sizeof(h);
+  h.rows = g->rows;
+  h.dim = g->dim;
+  h.m = g->m;
+  h.m0 = g->m0;
+  h.max_level = g->max_level;
+  h.entry = g->entry;
+  for (a = 0; a < g->rows; a++) if (g->levels[a] > 0) {
+    offs[a] = h.upper_size;
+    h.upper_size += g->levels[a] * (1 + g->m);
+  }
+  h.inv_norm_pos = w2vm_align(sizeof(h));
+  h.levels_pos = w2vm_align(h.inv_norm_pos + g->rows * sizeof(float));
+  h.level0_pos = w2vm_align(h.levels_pos + g->rows);
+  h.upper_offs_pos = w2vm_align(h.level0_pos + g->rows * (1 + g->m0) * sizeof(uint32_t));
+  h.upper_pos = w2vm_align(h.upper_offs_pos + g->rows * sizeof(uint64_t));
+  h.file_size = h.upper_pos + h.upper_size * sizeof(uint32_t);
+  // 按顺序写各部分,中间用0补齐到对齐位置
+  pos = fwrite(&h, sizeof(h), 1, fo) * sizeof(h);
+  pos += fwrite(zero, 1, h.inv_norm_pos - pos, fo);
+  pos += fwrite(g->inv_norm, sizeof(float), g->rows, fo) * sizeof(float);
+  pos += fwrite(zero, 1, h.levels_pos - pos, fo);
+  pos += fwrite(g->levels, 1, g->rows, fo);
+  pos += fwrite(zero, 1, h.level0_pos - pos, fo);
+  pos += fwrite(g->level0, sizeof(uint32_t), g->rows * (1 + g->m0), fo) * sizeof(uint32_t);
+  pos += fwrite(zero, 1, h.upper_offs_pos - pos, fo);
+  pos += fwrite(offs, sizeof(uint64_t), g->rows, fo) * sizeof(uint64_t);
+  pos += fwrite(zero, 1, h.upper_pos - pos, fo);
+  for (a = 0; a < g->rows; a++) if (g->levels[a] > 0)
+    pos += fwrite(g->upper[a], sizeof(uint32_t), g->levels[a] * (1 + g->m), fo) * sizeof(uint32_t);
+  free(offs);
+  if ((fclose(fo) != 0) || (pos != h.file_size)) return -1;
+  return 0;
+}
+
+/**
+ * ======== w2vh_open ========
+ * 只读mmap索引文件,成功返回0.之后由调用者设置g->vectors和g->stride(行号和建索引时的向量相同).
+ */
+static inline int w2vh_open(const char *file, struct w2vh_index *g) {
+  struct stat st;
+  const struct w2vh_header *h;
+  int fd = open(file, O_RDONLY);
+  memset(g, 0, sizeof(*g));
+  if (fd < 0) return -1;
+  if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(struct w2vh_header))) {
+    close(fd);
+    return -1;
+  }
+  g->size = st.st_size;
+  g->base = mmap(NULL, g->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (g->base == MAP_FAILED) {
+    g->base = NULL;
+    return -1;
+  }
+  h = (const struct w2vh_header *)g->base;
+  if (memcmp(h->magic, W2VH_MAGIC, 8) || (h->version != W2VH_VERSION) || (h->header_size < sizeof(struct w2vh_header)) ||
+   (h->file_size != g->size) || (h->rows == 0) || (h->entry >= h->rows)) {
+    munmap(g->base, g->size);
+    g->base = NULL;
+    return -1;
+  }
+  g->rows = h->rows;
+  g->dim = h->dim;
+  g->stride = h->dim;
+  g->m = h->m;
+  g->m0 = h->m0;
+  g->max_level = h->max_level;
+  g->entry = h->entry;
+  g->inv_norm = (float *)((char *)g->base + h->inv_norm_pos);
+  g->levels = (uint8_t *)((char *)g->base + h->levels_pos);
+  g->level0 = (uint32_t *)((char *)g->base + h->level0_pos);
+  g->upper_offs = (const uint64_t *)((char *)g->base + h->upper_offs_pos);
+  g->upper_data = (const uint32_t *)((char *)g->base + h->upper_pos);
+  return 0;
+}
+
+/**
+ * ======== w2vh_free ========
+ * 释放构建的索引或者关闭mmap的索引.
+ */
+static inline void w2vh_free(struct w2vh_index *g) {
+  long long a;
+  if (g->base != NULL) {
+    munmap(g->base, g->size);
+    g->base = NULL;
+    return;
+  }
+  if (g->upper != NULL) for (a = 0; a < g->rows; a++) free(g->upper[a]);
+  free(g->upper);
+  free(g->inv_norm);
+  free(g->levels);
+  free(g->level0);
+  free(g->locks);
+  g->upper = NULL;
+  g->locks = NULL;
+}
+
+#endif
@@ -0,0 +1,219 @@
+//  word2vec-knn: 计算整个词典的精确k近邻图
+//
+//  mmap读取.w2vm模型(word2vec -binary 2的输出),归一化后对[first, last)中的每个词求余弦相似度最高的k个词(不含自己).
+//  计算就是"所有行 x 所有行"的矩阵乘法:每次取-block个词作为一批查询,用word2vec-query.h的引擎分块计算
+//  (行按线程切分,每个线程按W2VQ_ROW_BLOCK行 x W2VQ_QUERY_BLOCK个查询分块,每个查询一个大小为k的最小堆).
+//  结果写到二进制的.knn文件(格式见word2vec-knn.h),每批写完并fdatasync之后更新文件头中的done,
+//  所以进程被杀掉之后可以用-resume 1从done继续;也可以用-first / -last把词典分成几段,分别在不同的机器上计算.
+//
+//  编译: gcc word2vec-knn.c -o word2vec-knn -lm -pthread -O3 -march=native -Wall -funroll-loops
+//  运行: ./word2vec-knn -model vec.w2vm -output vec.knn -k 10 -threads 8
+//
+//  参数:
+//    -model <file>    .w2vm模型文件
+//    -output <file>   k近邻图输出文件
+//    -k <int>         每个词的近邻数,默认10
+//    -first <int>     从第first个词开始,默认0
+//    -last <int>      到第last个词为止(不含),默认词典大小
+//    -block <int>     每批的词数,默认4096
+//    -threads <int>   线程数,默认1
+//    -resume <int>    1表示从已有的输出文件中记录的进度继续,默认0(重新计算)
+
+#include "word2vec-model.h"
+#include "word2vec-query.h"
+#include "word2vec-knn.h"
+
+#define MAX_STRING 100
+
+/**
+ * ======== ArgPos ========
+ * 和word2vec相同的参数解析.
+ */
+int ArgPos(char *str, int argc, char **argv) {
+  int a;
+  for (a = 1; a < argc; a++) if (!strcmp(str, argv[a])) {
+    if (a == argc - 1) {
+      printf("Argument missing for %s\n", str);
+      exit(1);
+    }
+    return a;
+  }
+  return -1;
+}
+
+double Now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ * ======== WriteAll ========
+ * pwrite直到写完,成功返回0.
+ */
+int WriteAll(int fd, const void *buf, size_t size, off_t pos) {
+  ssize_t n;
+  while (size > 0) {
+    n = pwrite(fd, buf, size, pos);
+    if (n <= 0) return -1;
+    buf = (const char *)buf + n;
+    size -= n;
+    pos += n;
+  }
+  return 0;
+}
+
+/**
+ * ======== OpenOutput ========
+ * resume时打开已有的输出文件,文件头和本次的参数一致时沿用其中的进度;否则新建文件,写入文件头并预留全部空间.
+ * 返回文件描述符,h为文件头.
+ */
+int OpenOutput(const char *file, int resume, struct w2vk_header *h) {
+  struct w2vk_header old;
+  uint64_t rows = h->last - h->first;
+  int fd;
+  if (resume) {
+    fd = open(file, O_RDWR);
+    if (fd >= 0) {
+      if ((pread(fd, &old, sizeof(old), 0) == sizeof(old)) && !memcmp(old.magic, W2VK_MAGIC, 6) && (old.version == W2VK_VERSION) &&
+       (old.words == h->words) && (old.dim == h->dim) && (old.k == h->k) && (old.first == h->first) && (old.last == h->last) &&
+       (old.done >= old.first) && (old.done <= old.last)) {
+        *h = old;
+        return fd;
+      }
+      printf("%s does not match the current parameters, starting over\n", file);
+      close(fd);
+    }
+  }
+  fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return -1;
+  memcpy(h->magic, W2VK_MAGIC, 6);
+  h->version = W2VK_VERSION;
+  h->header_size = sizeof(struct w2vk_header);
+  h->done = h->first;
+  h->ids_pos = (sizeof(struct w2vk_header) + 63) / 64 * 64;
+  h->scores_pos = (h->ids_pos + rows * h->k * sizeof(uint32_t) + 63) / 64 * 64;
+  h->file_size = h->scores_pos + rows * h->k * sizeof(float);
+  if ((ftruncate(fd, h->file_size) != 0) || (WriteAll(fd, h, sizeof(*h), 0) != 0)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  int i, fd, threads = 1, resume = 0;
+  long long k = 10, first = 0, last = -1, block = 4096, a, b, n, begin, *ids, *exclude;
+  char model_file[MAX_STRING], output_file[MAX_STRING];
+  uint32_t *out_ids;
+  float *scores;
+  double start, now;
+  struct w2vm_model m;
+  struct w2vq_index q;
+  struct w2vk_header h;
+
+  if (argc == 1) {
+    printf("Exact k nearest neighbour graph of an aligned word2vec model\n\n");
+    printf("Options:\n");
+    printf("\t-model <file>\n");//.w2vm模型文件
+    printf("\t\tModel written by word2vec -binary 2\n");
+    printf("\t-output <file>\n");//k近邻图输出文件
+    printf("\t\tWrite the neighbour graph to <file> (format described in word2vec-knn.h)\n");
+    printf("\t-k <int>\n");//每个词的近邻数,默认10
+    printf("\t\tNeighbours per word; default is 10\n");
+    printf("\t-first <int>\n");//从第first个词开始,默认0
+    printf("\t-last <int>\n");//到第last个词为止(不含),默认词典大小
+    printf("\t\tOnly compute the neighbours of words [first, last); default is the whole vocabulary\n");
+    printf("\t-block <int>\n");//每批的词数,默认4096
+    printf("\t\tNumber of words searched per batch (and per progress checkpoint); default is 4096\n");
+    printf("\t-threads <int>\n");//线程数,默认1
+    printf("\t\tUse <int> threads (default 1)\n");
+    printf("\t-resume <int>\n");//1表示从输出文件中记录的进度继续,默认0
+    printf("\t\tContinue from the progress recorded in an existing output file; default is 0 (start over)\n");
+    printf("\nExamples:\n");
+    printf("./word2vec-knn -model vec.w2vm -output vec.knn -k 10 -threads 8 -resume 1\n\n");
+    return 0;
+  }
+  model_file[0] = 0;
+  output_file[0] = 0;
+  if ((i = ArgPos((char *)"-model", argc, argv)) > 0) strcpy(model_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-output", argc, argv)) > 0) strcpy(output_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-k", argc, argv)) > 0) k = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-first", argc, argv)) > 0) first = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-last", argc, argv)) > 0) last = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-block", argc, argv)) > 0) block = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) threads = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-resume", argc, argv)) > 0) resume = atoi(argv[i + 1]);
+  if (w2vm_open(model_file, &m) != 0) {
+    printf("ERROR: cannot open model file %s\n", model_file);
+    exit(1);
+  }
+  if ((last < 0) || (last > (long long)m.header->words)) last = m.header->words;
+  if (first < 0) first = 0;
+  if (first > last) first = last;
+  if (k < 1) k = 1;
+  if (block < 1) block = 1;
+
+  memset(&h, 0, sizeof(h));
+  h.words = m.header->words;
+  h.dim = m.header->dim;
+  h.k = k;
+  h.first = first;
+  h.last = last;
+  fd = OpenOutput(output_file, resume, &h);
+  if (fd < 0) {
+    printf("ERROR: cannot write output file %s\n", output_file);
+    exit(1);
+  }
+  if ((long long)h.done > first) printf("Resuming at word %lld of [%lld, %lld)\n", (long long)h.done, first, last);
+  if (w2vq_init(&q, m.vectors, m.header->words, m.header->dim, m.header->stride) != 0) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  ids = (long long *)malloc(block * k * sizeof(long long));
+  exclude = (long long *)malloc(block * 3 * sizeof(long long));
+  out_ids = (uint32_t *)malloc(block * k * sizeof(uint32_t));
+  scores = (float *)malloc(block * k * sizeof(float));
+  if ((ids == NULL) || (exclude == NULL) || (out_ids == NULL) || (scores == NULL)) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+
+  // 每批block个词:查询向量直接用归一化矩阵中的行,排除词本身
+  start = Now();
+  begin = h.done;
+  for (a = begin; a < last; a += n) {
+    n = last - a < block ? last - a : block;
+    for (b = 0; b < n; b++) {
+      exclude[b * 3] = a + b;
+      exclude[b * 3 + 1] = -1;
+      exclude[b * 3 + 2] = -1;
+    }
+    w2vq_search(&q, &q.vectors[a * q.stride], n, exclude, k, threads, ids, scores);
+    for (b = 0; b < n * k; b++) out_ids[b] = ids[b] < 0 ? 0xffffffffu : (uint32_t)ids[b];
+    // 先写结果并落盘,再更新进度,保证done之前的结果都已经在文件里
+    if ((WriteAll(fd, out_ids, n * k * sizeof(uint32_t), h.ids_pos + (a - first) * k * sizeof(uint32_t)) != 0) ||
+     (WriteAll(fd, scores, n * k * sizeof(float), h.scores_pos + (a - first) * k * sizeof(float)) != 0) || (fdatasync(fd) != 0)) {
+      printf("ERROR: cannot write output file %s\n", output_file);
+      exit(1);
+    }
+    h.done = a + n;
+    if (WriteAll(fd, &h, sizeof(h), 0) != 0) {
+      printf("ERROR: cannot write output file %s\n", output_file);
+      exit(1);
+    }
+    now = Now();
+    printf("%cWords: %lld / %lld  Words/sec: %.0f  ", 13, a + n - first, last - first, (a + n - begin) / (now - start + 1e-9));
+    fflush(stdout);
+  }
+  fsync(fd);
+  close(fd);
+  printf("\nNeighbour graph of words [%lld, %lld) with k = %lld written to %s\n", first, last, k, output_file);
+  free(ids);
+  free(exclude);
+  free(out_ids);
+  free(scores);
+  w2vq_free(&q);
+  w2vm_close(&m);
+  return 0;
+}
@@ -0,0 +1,108 @@
+//  word2vec-knn.h: 精确k近邻图文件(.knn)
+//
+//  word2vec-knn输出这种格式:词典中[first, last)范围内每个词的k个余弦相似度最高的词(不含自己),按相似度降序.
+//  文件可以直接mmap:第i个词(first <= i < last)的邻居在ids + (i - first) * k,相似度在scores + (i - first) * k.
+//  行号和.w2vm模型相同.
+//
+//  文件布局(所有偏移都是相对文件开头的字节数,整数为小端):
+//
+//    header      struct w2vk_header
+//    ids         (last - first) * k个uint32_t,从64字节对齐的位置开始
+//    scores      (last - first) * k个float,从64字节对齐的位置开始
+//
+//  done < last表示计算还没完成(可以用word2vec-knn -resume 1继续),只有[first, done)的结果可用.
+
+#ifndef WORD2VEC_KNN_H
+#define WORD2VEC_KNN_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define W2VK_MAGIC "W2VKNN"
+#define W2VK_VERSION 1
+
+/*
+ * ======== w2vk_header ========
+ *   magic - "W2VKNN\0\0"
+ *   words, dim - 模型的词数和维度
+ *   k - 每个词的邻居数
+ *   first, last - 文件包含的行范围
+ *   done - [first, done)已经算完
+ *   ids_pos, scores_pos, file_size - 各部分的位置,文件总长度
+ */
+struct w2vk_header {
+  char magic[8];
+  uint32_t version, header_size;
+  uint64_t words, dim, k, first, last, done;
+  uint64_t ids_pos, scores_pos, file_size;
+  uint64_t reserved[8];
+};
+
+/*
+ * ======== w2vk_graph ========
+ * w2vk_open打开的k近邻图,指针指向mmap的文件内容.
+ */
+struct w2vk_graph {
+  void *base;
+  size_t size;
+  const struct w2vk_header *header;
+  const uint32_t *ids;
+  const float *scores;
+};
+
+/**
+ * ======== w2vk_open ========
+ * 只读mmap k近邻图文件并检查文件头,成功返回0.
+ */
+static inline int w2vk_open(const char *file, struct w2vk_graph *g) {
+  struct stat st;
+  const struct w2vk_header *h;
+  int fd = open(file, O_RDONLY);
+  memset(g, 0, sizeof(*g));
+  if (fd < 0) return -1;
+  if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(struct w2vk_header))) {
+    close(fd);
+    return -1;
+  }
+  g->size = st.st_size;
+  g->base = mmap(NULL, g->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (g->base == MAP_FAILED) {
+    g->base = NULL;
+    return -1;
+  }
+  h = (const struct w2vk_header *)g->base;
+  if (memcmp(h->magic, W2VK_MAGIC, 6) || (h->version != W2VK_VERSION) || (h->header_size < sizeof(struct w2vk_header)) ||
+   (h->file_size != g->size) || (h->first > h->last) || (h->done > h->last)) {
+    munmap(g->base, g->size);
+    g->base = NULL;
+    return -1;
+  }
+  g->header = h;
+  g->ids = (const uint32_t *)((const char *)g->base + h->ids_pos);
+  g->scores = (const float *)((const char *)g->base + h->scores_pos);
+  return 0;
+}
+
+/**
+ * ======== w2vk_neighbours ========
+ * 第row个词的邻居和相似度(各k个),row不在[first, done)中时返回-1.
+ */
+static inline int w2vk_neighbours(const struct w2vk_graph *g, uint64_t row, const uint32_t **ids, const float **scores) {
+  const struct w2vk_header *h = g->header;
+  if ((row < h->first) || (row >= h->done)) return -1;
+  *ids = g->ids + (row - h->first) * h->k;
+  *scores = g->scores + (row - h->first) * h->k;
+  return 0;
+}
+
+static inline void w2vk_close(struct w2vk_graph *g) {
+  if (g->base != NULL) munmap(g->base, g->size);
+  g->base = NULL;
+}
+
+#endif
@@ -0,0 +1,234 @@
+//  word2vec-lib.c: 训练库,接口见word2vec.h
+//
+//  直接#include word2vec.c,训练代码和命令行完全相同:w2v_train在调用方进程中创建一个struct word2vec,
+//  把context中的语料设为内存中的训练数据(train_data)或者回调(sentence_fn),用ParseArgs解析参数,调用TrainModel,
+//  训练完从各模型的syn0复制出词表和词向量,再释放struct word2vec;出错时Fail回到w2v_train,错误信息就是w2v_error.
+//
+//  编译: gcc word2vec-lib.c -o libword2vec.so -shared -fPIC -fvisibility=hidden -lm -pthread -O3 -march=native -funroll-loops
+
+#define WORD2VEC_NO_MAIN
+#include "word2vec.c"
+#include "word2vec.h"
+
+#define W2V_MAX_ARGS 256
+
+/*
+ * ======== w2v_context ========
+ *   options, argv, argc - 参数字符串的副本,按空白切分成argv(argv[0]为"word2vec")
+ *   text, text_size, text_max - 内存中的语料,格式和训练文件相同
+ *   fn, arg - 逐句提供语料的回调,见w2v_set_sentences
+ *   models, words, dims, vectors - 训练结果:模型数,词数,每个模型的维度和词向量矩阵
+ *   strings, word - 所有词('\0'结尾,连续存放)和每个词在strings中的偏移
+ *   error - 最近一次失败的原因
+ */
+struct w2v_context {
+  char *options, *argv[W2V_MAX_ARGS];
+  int argc;
+  char *text;
+  long long text_size, text_max;
+  w2v_sentence_fn fn;
+  void *arg;
+  int models;
+  long long words, *dims, *word;
+  float **vectors;
+  char *strings;
+  char error[MAX_STRING * 4];
+};
+
+/**
+ * ======== W2vFreeResult ========
+ * 释放训练结果.
+ */
+static void W2vFreeResult(struct w2v_context *c) {
+  int m;
+  if (c->vectors != NULL) for (m = 0; m < c->models; m++) free(c->vectors[m]);
+  free(c->vectors);
+  free(c->dims);
+  free(c->strings);
+  free(c->word);
+  c->vectors = NULL;
+  c->dims = NULL;
+  c->strings = NULL;
+  c->word = NULL;
+  c->models = 0;
+  c->words = 0;
+}
+
+/**
+ * ======== W2vAppend ========
+ * 向语料追加size个字节,空间不够时加倍.
+ */
+static int W2vAppend(struct w2v_context *c, const char *data, long long size) {
+  char *p;
+  long long max = c->text_max;
+  if (c->text_size + size > max) {
+    while (c->text_size + size > max) max = max ? max * 2 : 1 << 20;
+    p = (char *)realloc(c->text, max);
+    if (p == NULL) {
+      snprintf(c->error, sizeof(c->error), "Memory allocation failed");
+      return -1;
+    }
+    c->text = p;
+    c->text_max = max;
+  }
+  memcpy(c->text + c->text_size, data, size);
+  c->text_size += size;
+  return 0;
+}
+
+W2V_API struct w2v_context *w2v_create(const char *options) {
+  char *tok;
+  struct w2v_context *c = (struct w2v_context *)calloc(1, sizeof(struct w2v_context));
+  if (c == NULL) return NULL;
+  c->options = strdup(options != NULL ? options : "");
+  if (c->options == NULL) {
+    free(c);
+    return NULL;
+  }
+  c->argv[c->argc++] = (char *)"word2vec";
+  for (tok = strtok(c->options, " \t\r\n"); (tok != NULL) && (c->argc < W2V_MAX_ARGS); tok = strtok(NULL, " \t\r\n")) c->argv[c->argc++] = tok;
+  return c;
+}
+
+W2V_API int w2v_add_sentence(struct w2v_context *c, const char *const *tokens, long long n) {
+  long long a;
+  if (c->fn != NULL) {
+    snprintf(c->error, sizeof(c->error), "corpus is given by w2v_set_sentences");
+    return -1;
+  }
+  for (a = 0; a < n; a++) {
+    if (tokens[a][0] == 0) continue;
+    if (strpbrk(tokens[a], " \t\r\n") != NULL) {
+      snprintf(c->error, sizeof(c->error), "token '%.100s' contains whitespace", tokens[a]);
+      return -1;
+    }
+    if ((W2vAppend(c, tokens[a], strlen(tokens[a])) != 0) || (W2vAppend(c, a == n - 1 ? "\n" : " ", 1) != 0)) return -1;
+  }
+  return 0;
+}
+
+W2V_API int w2v_set_sentences(struct w2v_context *c, w2v_sentence_fn fn, void *arg) {
+  if (c->text_size > 0) {
+    snprintf(c->error, sizeof(c->error), "corpus is already given as text");
+    return -1;
+  }
+  c->fn = fn;
+  c->arg = arg;
+  return 0;
+}
+
+W2V_API int w2v_add_text(struct w2v_context *c, const char *text, long long size) {
+  if (c->fn != NULL) {
+    snprintf(c->error, sizeof(c->error), "corpus is given by w2v_set_sentences");
+    return -1;
+  }
+  if (W2vAppend(c, text, size) != 0) return -1;
+  // 保证最后一个词后面有分隔符,之后追加的内容不会和它连在一起
+  if ((size > 0) && !strchr(" \t\n", text[size - 1])) return W2vAppend(c, "\n", 1);
+  return 0;
+}
+
+/**
+ * ======== W2vCopyResult ========
+ * 训练完后从wv复制词表和每个模型的词向量:词连续存放在strings中,word[i]是第i个词在strings中的偏移;
+ * 分桶时几个词共用syn0的一行,按word_row取每个词的行.成功返回1,内存不够返回0.
+ */
+static int W2vCopyResult(struct w2v_context *c, struct word2vec *wv) {
+  long long a, b, size = 0;
+  int m;
+  c->models = wv->num_models;
+  c->words = wv->vocab_size;
+  c->dims = (long long *)calloc(c->models, sizeof(long long));
+  c->vectors = (float **)calloc(c->models, sizeof(float *));
+  c->word = (long long *)malloc(c->words * sizeof(long long));
+  if ((c->dims == NULL) || (c->vectors == NULL) || (c->word == NULL)) return 0;
+  for (a = 0; a < c->words; a++) {
+    c->word[a] = size;
+    size += strlen(wv->vocab[a].word) + 1;
+  }
+  c->strings = (char *)malloc(size);
+  if (c->strings == NULL) return 0;
+  for (a = 0; a < c->words; a++) strcpy(c->strings + c->word[a], wv->vocab[a].word);
+  for (m = 0; m < c->models; m++) {
+    c->dims[m] = wv->models[m].layer1_size;
+    c->vectors[m] = (float *)malloc(c->words * c->dims[m] * sizeof(float));
+    if (c->vectors[m] == NULL) return 0;
+    for (a = 0; a < c->words; a++) for (b = 0; b < c->dims[m]; b++)
+      c->vectors[m][a * c->dims[m] + b] = wv->models[m].syn0[wv->word_row[a] * c->dims[m] + b];
+  }
+  return 1;
+}
+
+W2V_API int w2v_train(struct w2v_context *c, int threads) {
+  struct word2vec *wv;
+
+  W2vFreeResult(c);
+  c->error[0] = 0;
+  if ((c->text_size == 0) && (c->fn == NULL)) {
+    snprintf(c->error, sizeof(c->error), "no training text");
+    return -1;
+  }
+  wv = NewWord2vec();
+  if (wv == NULL) {
+    snprintf(c->error, sizeof(c->error), "Memory allocation failed");
+    return -1;
+  }
+  // 训练代码出错时Fail回到这里,调用进程不会退出
+  if (setjmp(wv->fail) != 0) {
+    snprintf(c->error, sizeof(c->error), "%s", wv->error);
+    W2vFreeResult(c);
+    FreeWord2vec(wv);
+    return -1;
+  }
+  wv->debug_mode = 0;
+  wv->in_memory = 1;
+  ParseArgs(wv, c->argc, c->argv);
+  // 检查点由fork出的子进程写,不能在调用方进程中使用
+  if ((wv->checkpoint_file[0] != 0) || wv->resume) Fail(wv, "ERROR: -checkpoint and -resume are not supported by the library");
+  if (threads > 0) wv->num_threads = threads;
+  wv->train_file[0] = 0;
+  wv->output_file[0] = 0;
+  if (c->fn != NULL) {
+    wv->sentence_fn = c->fn;
+    wv->sentence_arg = c->arg;
+  } else {
+    wv->train_data = c->text;
+    wv->train_data_size = c->text_size;
+  }
+  InitTables(wv);
+  TrainModel(wv);
+  if (!W2vCopyResult(c, wv)) Fail(wv, "Memory allocation failed");
+  FreeWord2vec(wv);
+  return 0;
+}
+
+W2V_API int w2v_models(const struct w2v_context *c) {
+  return c->models;
+}
+
+W2V_API long long w2v_words(const struct w2v_context *c) {
+  return c->words;
+}
+
+W2V_API const char *w2v_word(const struct w2v_context *c, long long i) {
+  if ((i < 0) || (i >= c->words)) return NULL;
+  return c->strings + c->word[i];
+}
+
+W2V_API const float *w2v_vectors(const struct w2v_context *c, int model, long long *dim) {
+  if ((model < 0) || (model >= c->models)) return NULL;
+  if (dim != NULL) *dim = c->dims[model];
+  return c->vectors[model];
+}
+
+W2V_API const char *w2v_error(const struct w2v_context *c) {
+  return c->error;
+}
+
+W2V_API void w2v_free(struct w2v_context *c) {
+  if (c == NULL) return;
+  W2vFreeResult(c);
+  free(c->text);
+  free(c->options);
+  free(c);
+}
@@ -0,0 +1,218 @@
+//  word2vec-model.h: 对齐的二进制模型格式(.w2vm)
+//
+//  word2vec -binary 2 输出这种格式.文件可以直接mmap,不需要解析:
+//  第i个词和它的向量都能O(1)定位,向量矩阵每行按64字节对齐,可以直接用于SIMD计算.
+//  只依赖libc,其他程序include这个头文件就能读取模型.
+//
+//  文件布局(所有偏移都是相对文件开头的字节数,整数为小端,向量为float32):
+//
+//    header      struct w2vm_header,大小为header_size
+//    offsets     words + 1个uint64_t:第i个词在strings中的偏移,最后一项为strings_size
+//    strings     所有词,每个以'\0'结尾
+//    hash        hash_size个uint32_t,开放寻址的词->行号哈希表,空位为W2VM_EMPTY;hash_size为2的幂
+//    vectors     rows * stride个float,从64字节对齐的位置开始;每行stride个float(dim向上取整到16,即64字节),
+//                多出的部分填0;前words行是各个词的向量,之后buckets行是哈希桶(word2vec -buckets)
+//
+//  用法:
+//    struct w2vm_model m;
+//    if (w2vm_open("vectors.w2vm", &m) != 0) ...;
+//    long long row = w2vm_row(&m, "king");
+//    const float *v = w2vm_vector(&m, row);
+//    w2vm_close(&m);
+
+#ifndef WORD2VEC_MODEL_H
+#define WORD2VEC_MODEL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define W2VM_MAGIC "W2VMODEL"
+#define W2VM_VERSION 1
+#define W2VM_ALIGN 64
+#define W2VM_EMPTY 0xFFFFFFFFu
+
+/*
+ * ======== w2vm_header ========
+ *   magic - "W2VMODEL"(8字节,不含'\0')
+ *   version - 格式版本,W2VM_VERSION
+ *   header_size - sizeof(struct w2vm_header),新版本只在reserved中增加字段
+ *   words - 词数
+ *   rows - 向量矩阵行数,等于words + buckets
+ *   dim - 向量维度
+ *   stride - 每行的float数,dim向上取整到W2VM_ALIGN / sizeof(float)
+ *   offsets_pos, strings_pos, strings_size, hash_pos, hash_size, vectors_pos - 各部分的位置,见文件布局
+ *   file_size - 文件总长度,用于检查文件是否完整
+ *   buckets - 哈希桶数(原来的reserved[0],旧文件中为0):不在词表中的词(训练时的低频词,以及没见过的词)
+ *             共用第words + w2vm_hash(word) % buckets行,见w2vm_row
+ *   reserved - 保留,写0
+ */
+struct w2vm_header {
+  char magic[8];
+  uint32_t version, header_size;
+  uint64_t words, rows, dim, stride;
+  uint64_t offsets_pos, strings_pos, strings_size, hash_pos, hash_size, vectors_pos, file_size;
+  uint64_t buckets;
+  uint64_t reserved[15];
+};
+
+/*
+ * ======== w2vm_model ========
+ * w2vm_open打开的模型,所有指针都指向mmap的文件内容.
+ */
+struct w2vm_model {
+  void *base;
+  size_t size;
+  const struct w2vm_header *header;
+  const uint64_t *offsets;
+  const char *strings;
+  const uint32_t *hash;
+  const float *vectors;
+};
+
+/**
+ * ======== w2vm_hash ========
+ * 词的哈希值,和word2vec的GetWordHash相同的算法,不取模;表中位置为w2vm_hash(word) & (hash_size - 1).
+ */
+static inline uint64_t w2vm_hash(const char *word) {
+  uint64_t hash = 0;
+  for (; *word; word++) hash = hash * 257 + (unsigned char)*word;
+  return hash;
+}
+
+/**
+ * ======== w2vm_align ========
+ * 把偏移x向上取整到W2VM_ALIGN的倍数.
+ */
+static inline uint64_t w2vm_align(uint64_t x) {
+  return (x + W2VM_ALIGN - 1) / W2VM_ALIGN * W2VM_ALIGN;
+}
+
+/**
+ * ======== w2vm_fits ========
+ * 从偏移pos开始的count个大小为size的元素是否都在长度为file_size的文件内(不会溢出),并且pos是align的倍数.
+ */
+static inline int w2vm_fits(uint64_t pos, uint64_t count, uint64_t size, uint64_t align, uint64_t file_size) {
+  return (pos % align == 0) && (pos <= file_size) && (size > 0) && (count <= (file_size - pos) / size);
+}
+
+/**
+ * ======== w2vm_check_index ========
+ * 检查文件base(长度size)中的词表部分(offsets, strings, hash,布局同.w2vm)的范围和每一项,可用时返回1.
+ * offsets必须递增,每个词都以'\0'结尾且在strings之内;hash中的行号必须小于words,并且至少有一个空位(否则查找不会结束).
+ */
+static inline int w2vm_check_index(const char *base, uint64_t size, uint64_t words, uint64_t offsets_pos, uint64_t strings_pos,
+                                   uint64_t strings_size, uint64_t hash_pos, uint64_t hash_size) {
+  const uint64_t *offsets = (const uint64_t *)(base + offsets_pos);
+  const char *strings = base + strings_pos;
+  const uint32_t *hash = (const uint32_t *)(base + hash_pos);
+  uint64_t i, empty = 0;
+  if ((words >= W2VM_EMPTY) || (hash_size & (hash_size - 1)) || !w2vm_fits(offsets_pos, words + 1, sizeof(uint64_t), sizeof(uint64_t), size) ||
+   !w2vm_fits(strings_pos, strings_size, 1, 1, size) || !w2vm_fits(hash_pos, hash_size, sizeof(uint32_t), sizeof(uint32_t), size)) return 0;
+  if (offsets[words] != strings_size) return 0;
+  for (i = 0; i < words; i++) {
+    if ((offsets[i] >= offsets[i + 1]) || (offsets[i + 1] > strings_size) || (strings[offsets[i + 1] - 1] != 0)) return 0;
+  }
+  for (i = 0; i < hash_size; i++) {
+    if (hash[i] == W2VM_EMPTY) empty++;
+    else if (hash[i] >= words) return 0;
+  }
+  return (hash_size == 0) || (empty > 0);
+}
+
+/**
+ * ======== w2vm_check ========
+ * 检查文件头,各部分的范围,以及offsets和hash中的每一项(见w2vm_check_index),模型完整可用时返回1.
+ */
+static inline int w2vm_check(const struct w2vm_header *h, const char *base, uint64_t size) {
+  if (memcmp(h->magic, W2VM_MAGIC, 8) || (h->version != W2VM_VERSION) || (h->header_size < sizeof(struct w2vm_header)) ||
+   (h->file_size != size) || (h->dim > h->stride) || (h->buckets > size) || (h->rows != h->words + h->buckets)) return 0;
+  if ((h->stride > 0) && !w2vm_fits(h->vectors_pos, h->rows, h->stride * sizeof(float), W2VM_ALIGN, size)) return 0;
+  if ((h->stride == 0) && (h->vectors_pos % W2VM_ALIGN)) return 0;
+  return w2vm_check_index(base, size, h->words, h->offsets_pos, h->strings_pos, h->strings_size, h->hash_pos, h->hash_size);
+}
+
+/**
+ * ======== w2vm_open ========
+ * 只读mmap模型文件并检查文件头和各部分的范围(见w2vm_check),成功返回0,失败返回-1.
+ */
+static inline int w2vm_open(const char *file, struct w2vm_model *m) {
+  struct stat st;
+  const struct w2vm_header *h;
+  int fd = open(file, O_RDONLY);
+  memset(m, 0, sizeof(*m));
+  if (fd < 0) return -1;
+  if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(struct w2vm_header))) {
+    close(fd);
+    return -1;
+  }
+  m->size = st.st_size;
+  m->base = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m->base == MAP_FAILED) {
+    m->base = NULL;
+    return -1;
+  }
+  h = (const struct w2vm_header *)m->base;
+  if (!w2vm_check(h, (const char *)m->base, m->size)) {
+    munmap(m->base, m->size);
+    m->base = NULL;
+    return -1;
+  }
+  m->header = h;
+  m->offsets = (const uint64_t *)((const char *)m->base + h->offsets_pos);
+  m->strings = (const char *)m->base + h->strings_pos;
+  m->hash = (const uint32_t *)((const char *)m->base + h->hash_pos);
+  m->vectors = (const float *)((const char *)m->base + h->vectors_pos);
+  return 0;
+}
+
+/**
+ * ======== w2vm_close ========
+ */
+static inline void w2vm_close(struct w2vm_model *m) {
+  if (m->base != NULL) munmap(m->base, m->size);
+  m->base = NULL;
+}
+
+/**
+ * ======== w2vm_word / w2vm_vector ========
+ * 第i个词,第i行向量.
+ */
+static inline const char *w2vm_word(const struct w2vm_model *m, uint64_t i) {
+  return m->strings + m->offsets[i];
+}
+
+static inline const float *w2vm_vector(const struct w2vm_model *m, uint64_t i) {
+  return m->vectors + i * m->header->stride;
+}
+
+/**
+ * ======== w2vm_find ========
+ * 查找词的行号,不存在返回-1.
+ */
+static inline long long w2vm_find(const struct w2vm_model *m, const char *word) {
+  uint64_t mask = m->header->hash_size - 1, pos = w2vm_hash(word) & mask;
+  uint32_t row;
+  if (m->header->hash_size == 0) return -1;
+  while ((row = m->hash[pos]) != W2VM_EMPTY) {
+    if (!strcmp(w2vm_word(m, row), word)) return row;
+    pos = (pos + 1) & mask;
+  }
+  return -1;
+}
+
+/**
+ * ======== w2vm_row ========
+ * 词的向量行号:在词表中时同w2vm_find;否则模型有哈希桶时返回这个词所在的桶,没有桶时返回-1.
+ */
+static inline long long w2vm_row(const struct w2vm_model *m, const char *word) {
+  long long row = w2vm_find(m, word);
+  if ((row >= 0) || (m->header->buckets == 0)) return row;
+  return m->header->words + w2vm_hash(word) % m->header->buckets;
+}
+
+#endif
@@ -0,0 +1,426 @@
+//  word2vec-pq.h: 乘积量化(PQ)压缩的词向量(.w2vpq)
+//
+//  把归一化的词向量切成m段(第j段为[j * dim / m, (j + 1) * dim / m),各段维数最多相差1),每段用自己的256个质心(码本)做k-means,
+//  每个词每段只存最近质心的编号(1字节),一个词共m字节;300维float(1200字节)用m = 32时压缩约37倍.
+//  近似相似度用非对称距离(ADC):对查询q先算查找表table[j][c] = q的第j段和第j段第c个质心的点积,
+//  词的相似度就是m次查表相加,不需要解码.
+//
+//  文件布局(所有偏移都是相对文件开头的字节数,每部分从64字节对齐的位置开始):
+//
+//    header      struct w2vpq_header
+//    codebooks   m * 256 * dsub个float:第j段第c个质心;dsub = ceil(dim / m)为最长一段的维数,较短的段最后一维补0
+//    codes       words * m个uint8_t:第i个词第j段的质心编号
+//    offsets     words + 1个uint64_t,strings,hash:和.w2vm相同(见word2vec-model.h),用w2vpq_find查词
+//
+//  用法:
+//    struct w2vpq_model pq;
+//    w2vpq_open("vectors.w2vpq", &pq);
+//    w2vpq_table(&pq, query, table);     // table为m * 256个float
+//    score = w2vpq_score(&pq, table, row);
+
+#ifndef WORD2VEC_PQ_H
+#define WORD2VEC_PQ_H
+
+#include "word2vec-model.h"
+#include "word2vec-query.h"
+
+#define W2VPQ_MAGIC "W2VPQ"
+#define W2VPQ_VERSION 2
+#define W2VPQ_KSUB 256
+
+/*
+ * ======== w2vpq_header ========
+ *   magic - "W2VPQ\0\0\0"
+ *   words, dim - 词数,原始向量维度
+ *   m, ksub, dsub - 段数,每段质心数(256),每段维度
+ *   *_pos - 各部分的位置;strings_size, hash_size同.w2vm
+ *   file_size - 文件总长度
+ */
+struct w2vpq_header {
+  char magic[8];
+  uint32_t version, header_size;
+  uint64_t words, dim, m, ksub, dsub;
+  uint64_t codebooks_pos, codes_pos, offsets_pos, strings_pos, strings_size, hash_pos, hash_size, file_size;
+  uint64_t reserved[8];
+};
+
+/*
+ * ======== w2vpq_model ========
+ * 训练得到的(或者从文件mmap的)码本和编码.
+ */
+struct w2vpq_model {
+  long long words, dim, m, dsub;
+  float *codebooks;
+  uint8_t *codes;
+  const uint64_t *offsets;
+  const char *strings;
+  const uint32_t *hash;
+  uint64_t hash_size;
+  void *base;
+  size_t size;
+};
+
+/*
+ * ======== w2vpq_task ========
+ * 训练和编码线程共享的参数:x为n行归一化的向量(每行dim维),next为下一个要处理的段或者行块(原子递增).
+ */
+struct w2vpq_task {
+  struct w2vpq_model *pq;
+  const float *x;
+  long long n, iter, next;
+  unsigned long long seed;
+};
+
+/**
+ * ======== w2vpq_seg ========
+ * 第j段的起始维度写到first,返回这一段的维数.
+ */
+static inline long long w2vpq_seg(const struct w2vpq_model *pq, long long j, long long *first) {
+  *first = j * pq->dim / pq->m;
+  return (j + 1) * pq->dim / pq->m - *first;
+}
+
+/**
+ * ======== w2vpq_sub ========
+ * 第row行第j段,不足dsub维的部分补0,写到out.
+ */
+static inline void w2vpq_sub(const struct w2vpq_model *pq, const float *x, long long row, long long j, float *out) {
+  long long d, first, len = w2vpq_seg(pq, j, &first);
+  for (d = 0; d < pq->dsub; d++) out[d] = d < len ? x[row * pq->dim + first + d] : 0;
+}
+
+/**
+ * ======== w2vpq_nearest ========
+ * 第j段中离v最近的质心(欧氏距离),dist返回距离的平方.
+ */
+static inline int w2vpq_nearest(const struct w2vpq_model *pq, long long j, const float *v, float *dist) {
+  const float *c = &pq->codebooks[j * W2VPQ_KSUB * pq->dsub];
+  float best = 1e30f, s, t;
+  int b, best_c = 0;
+  long long d;
+  for (b = 0; b < W2VPQ_KSUB; b++, c += pq->dsub) {
+    s = 0;
+    for (d = 0; d < pq->dsub; d++) {
+      t = v[d] - c[d];
+      s += t * t;
+    }
+    if (s < best) {
+      best = s;
+      best_c = b;
+    }
+  }
+  if (dist != NULL) *dist = best;
+  return best_c;
+}
+
+/**
+ * ======== w2vpq_train_thread ========
+ * 每次领一个段,在该段上做iter轮k-means:随机取不同的训练向量作为初始质心,空的类重新随机取一个训练向量.
+ */
+static void *w2vpq_train_thread(void *arg) {
+  struct w2vpq_task *t = (struct w2vpq_task *)arg;
+  struct w2vpq_model *pq = t->pq;
+  long long j, i, it, d, n = t->n, dsub = pq->dsub;
+  float *sub = (float *)malloc(n * dsub * sizeof(float)), *sum = (float *)malloc(W2VPQ_KSUB * dsub * sizeof(float)), *c;
+  long long *count = (long long *)malloc(W2VPQ_KSUB * sizeof(long long));
+  int b;
+  unsigned long long next_random;
+  while ((j = __sync_fetch_and_add(&t->next, 1)) < pq->m) {
+    next_random = t->seed + j;
+    c = &pq->codebooks[j * W2VPQ_KSUB * dsub];
+    for (i = 0; i < n; i++) w2vpq_sub(pq, t->x, i, j, &sub[i * dsub]);
+    for (b = 0; b < W2VPQ_KSUB; b++) {
+      next_random = next_random * (unsigned long long)25214903917 + 11;
+      memcpy(&c[b * dsub], &sub[(next_random >> 16) % n * dsub], dsub * sizeof(float));
+    }
+    for (it = 0; it < t->iter; it++) {
+      memset(sum, 0, W2VPQ_KSUB * dsub * sizeof(float));
+      memset(count, 0, W2VPQ_KSUB * sizeof(long long));
+      for (i = 0; i < n; i++) {
+        b = w2vpq_nearest(pq, j, &sub[i * dsub], NULL);
+        count[b]++;
+        for (d = 0; d < dsub; d++) sum[b * dsub + d] += sub[i * dsub + d];
+      }
+      for (b = 0; b < W2VPQ_KSUB; b++) {
+        if (count[b] == 0) {
+          next_random = next_random * (unsigned long long)25214903917 + 11;
+          memcpy(&c[b * dsub], &sub[(next_random >> 16) % n * dsub], dsub * sizeof(float));
+        } else for (d = 0; d < dsub; d++) c[b * dsub + d] = sum[b * dsub + d] / count[b];
+      }
+    }
+  }
+  free(sub);
+  free(sum);
+  free(count);
+  return NULL;
+}
+
+/**
+ * ======== w2vpq_encode_thread ========
+ * 每次领4096行,每行每段取最近的质心.
+ */
+static void *w2vpq_encode_thread(void *arg) {
+  struct w2vpq_task *t = (struct w2vpq_task *)arg;
+  struct w2vpq_model *pq = t->pq;
+  float *v = (float *)malloc(pq->dsub * sizeof(float));
+  long long first, i, j;
+  while ((first = __sync_fetch_and_add(&t->next, 4096)) < t->n) {
+    for (i = first; (i < first + 4096) && (i < t->n); i++) for (j = 0; j < pq->m; j++) {
+      w2vpq_sub(pq, t->x, i, j, v);
+      pq->codes[i * pq->m + j] = w2vpq_nearest(pq, j, v, NULL);
+    }
+  }
+  free(v);
+  return NULL;
+}
+
+static inline void w2vpq_run(struct w2vpq_task *t, void *(*fn)(void *), int threads) {
+  pthread_t *pt = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  int a;
+  t->next = 0;
+  for (a = 0; a < threads; a++) pthread_create(&pt[a], NULL, fn, t);
+  for (a = 0; a < threads; a++) pthread_join(pt[a], NULL);
+  free(pt);
+}
+
+/**
+ * ======== w2vpq_train ========
+ * 在x(words行归一化的向量,每行dim维)上训练m段的码本并编码所有词:码本只用train个均匀抽取的词训练(0或者不少于words时用全部),
+ * k-means迭代iter轮,各段/各行块分给threads个线程.成功返回0;失败时不保留分配的内存.
+ */
+static inline int w2vpq_train(struct w2vpq_model *pq, const float *x, long long words, long long dim, long long m, long long train,
+                              long long iter, int threads, unsigned long long seed) {
+  struct w2vpq_task t;
+  float *sample = NULL;
+  long long i;
+  memset(pq, 0, sizeof(*pq));
+  if ((m < 1) || (m > dim) || (words < 1)) return -1;
+  pq->words = words;
+  pq->dim = dim;
+  pq->m = m;
+  pq->dsub = (dim + m - 1) / m;
+  pq->codebooks = (float *)malloc(m * W2VPQ_KSUB * pq->dsub * sizeof(float));
+  pq->codes = (uint8_t *)malloc(words * m);
+  if ((train > 0) && (train < words)) sample = (float *)malloc(train * dim * sizeof(float));
+  if ((pq->codebooks == NULL) || (pq->codes == NULL) || ((train > 0) && (train < words) && (sample == NULL))) {
+    free(sample);
+    free(pq->codebooks);
+    free(pq->codes);
+    pq->codebooks = NULL;
+    pq->codes = NULL;
+    return -1;
+  }
+  if (sample != NULL) {
+    for (i = 0; i < train; i++) memcpy(&sample[i * dim], &x[(i * words / train) * dim], dim * sizeof(float));
+  } else train = words;
+  if (threads < 1) threads = 1;
+  t.pq = pq;
+  t.x = sample != NULL ? sample : x;
+  t.n = train;
+  t.iter = iter;
+  t.seed = seed;
+  w2vpq_run(&t, w2vpq_train_thread, threads);
+  free(sample);
+  t.x = x;
+  t.n = words;
+  w2vpq_run(&t, w2vpq_encode_thread, threads);
+  return 0;
+}
+
+/**
+ * ======== w2vpq_decode ========
+ * 第row个词的近似向量(dim维).
+ */
+static inline void w2vpq_decode(const struct w2vpq_model *pq, long long row, float *out) {
+  long long j, d, first, len;
+  const float *c;
+  for (j = 0; j < pq->m; j++) {
+    len = w2vpq_seg(pq, j, &first);
+    c = &pq->codebooks[(j * W2VPQ_KSUB + pq->codes[row * pq->m + j]) * pq->dsub];
+    for (d = 0; d < len; d++) out[first + d] = c[d];
+  }
+}
+
+/**
+ * ======== w2vpq_table ========
+ * 查询q(dim维,应已归一化)的ADC查找表:table[j * 256 + c]为q第j段和第j段第c个质心的点积.
+ */
+static inline void w2vpq_table(const struct w2vpq_model *pq, const float *q, float *table) {
+  long long j, d, first, len;
+  int b;
+  const float *c;
+  float s;
+  for (j = 0; j < pq->m; j++) for (b = 0; b < W2VPQ_KSUB; b++) {
+    len = w2vpq_seg(pq, j, &first);
+    c = &pq->codebooks[(j * W2VPQ_KSUB + b) * pq->dsub];
+    s = 0;
+    for (d = 0; d < len; d++) s += q[first + d] * c[d];
+    table[j * W2VPQ_KSUB + b] = s;
+  }
+}
+
+/**
+ * ======== w2vpq_score ========
+ * 查询和第row个词的近似相似度:m次查表相加.
+ */
+static inline float w2vpq_score(const struct w2vpq_model *pq, const float *table, long long row) {
+  const uint8_t *code = &pq->codes[row * pq->m];
+  float s = 0;
+  long long j;
+  for (j = 0; j < pq->m; j++) s += table[j * W2VPQ_KSUB + code[j]];
+  return s;
+}
+
+/**
+ * ======== w2vpq_search ========
+ * 用查找表扫描所有编码,返回近似相似度最高的k个词(跳过exclude),按相似度降序写到ids / scores,返回个数.
+ */
+static inline long long w2vpq_search(const struct w2vpq_model *pq, const float *table, int k, long long exclude, long long *ids,
+                                     float *scores) {
+  long long i, id;
+  int n = 0, a, b;
+  float s;
+  for (i = 0; i < pq->words; i++) if (i != exclude) w2vq_heap_push(scores, ids, k, &n, w2vpq_score(pq, table, i), i);
+  for (a = 1; a < n; a++) {
+    s = scores[a];
+    id = ids[a];
+    for (b = a; (b > 0) && (scores[b - 1] < s); b--) {
+      scores[b] = scores[b - 1];
+      ids[b] = ids[b - 1];
+    }
+    scores[b] = s;
+    ids[b] = id;
+  }
+  return n;
+}
+
+/**
+ * ======== w2vpq_save ========
+ * 把码本,编码和词(word(i)返回第i个词)写到文件,成功返回0.
+ */
+static inline int w2vpq_save(const struct w2vpq_model *pq, const char *file, const char *(*word)(void *, long long), void *ctx) {
+  struct w2vpq_header h;
+  static const char zero[64];
+  uint64_t pos, off = 0, hpos;
+  uint32_t *hash;
+  long long a;
+  FILE *fo = fopen(file, "wb");
+  if (fo == NULL) return -1;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, W2VPQ_MAGIC, 6);
+  h.version = W2VPQ_VERSION;
+  h.header_size = sizeof(h);
+  h.words = pq->words;
+  h.dim = pq->dim;
+  h.m = pq->m;
+  h.ksub = W2VPQ_KSUB;
+  h.dsub = pq->dsub;
+  for (a = 0; a < pq->words; a++) h.strings_size += strlen(word(ctx, a)) + 1;
+  for (h.hash_size = 1; h.hash_size < 2 * (uint64_t)pq->words; h.hash_size *= 2);
+  h.codebooks_pos = w2vm_align(sizeof(h));
+  h.codes_pos = w2vm_align(h.codebooks_pos + pq->m * W2VPQ_KSUB * pq->dsub * sizeof(float));
+  h.offsets_pos = w2vm_align(h.codes_pos + pq->words * pq->m);
+  h.strings_pos = w2vm_align(h.offsets_pos + (pq->words + 1) * sizeof(uint64_t));
+  h.hash_pos = w2vm_align(h.strings_pos + h.strings_size);
+  h.file_size = h.hash_pos + h.hash_size * sizeof(uint32_t);
+  hash = (uint32_t *)malloc(h.hash_size * sizeof(uint32_t));
+  memset(hash, 0xFF, h.hash_size * sizeof(uint32_t));
+  for (a = 0; a < pq->words; a++) {
+    for (hpos = w2vm_hash(word(ctx, a)) & (h.hash_size - 1); hash[hpos] != W2VM_EMPTY; hpos = (hpos + 1) & (h.hash_size - 1));
+    hash[hpos] = a;
+  }
+  pos = fwrite(&h, sizeof(h), 1, fo) * sizeof(h);
+  pos += fwrite(zero, 1, h.codebooks_pos - pos, fo);
+  pos += fwrite(pq->codebooks, sizeof(float), pq->m * W2VPQ_KSUB * pq->dsub, fo) * sizeof(float);
+  pos += fwrite(zero, 1, h.codes_pos - pos, fo);
+  pos += fwrite(pq->codes, 1, pq->words * pq->m, fo);
+  pos += fwrite(zero, 1, h.offsets_pos - pos, fo);
+  for (a = 0; a <= pq->words; a++) {
+    pos += fwrite(&off, sizeof(off), 1, fo) * sizeof(off);
+    if (a < pq->words) off += strlen(word(ctx, a)) + 1;
+  }
+  pos += fwrite(zero, 1, h.strings_pos - pos, fo);
+  for (a = 0; a < pq->words; a++) pos += fwrite(word(ctx, a), 1, strlen(word(ctx, a)) + 1, fo);
+  pos += fwrite(zero, 1, h.hash_pos - pos, fo);
+  pos += fwrite(hash, sizeof(uint32_t), h.hash_size, fo) * sizeof(uint32_t);
+  free(hash);
+  if ((fclose(fo) != 0) || (pos != h.file_size)) return -1;
+  return 0;
+}
+
+/**
+ * ======== w2vpq_open ========
+ * 只读mmap .w2vpq文件并检查文件头,码本,编码和词表各部分的范围(词表见w2vm_check_index),成功返回0.
+ */
+static inline int w2vpq_open(const char *file, struct w2vpq_model *pq) {
+  struct stat st;
+  const struct w2vpq_header *h;
+  int fd = open(file, O_RDONLY);
+  memset(pq, 0, sizeof(*pq));
+  if (fd < 0) return -1;
+  if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(struct w2vpq_header))) {
+    close(fd);
+    return -1;
+  }
+  pq->size = st.st_size;
+  pq->base = mmap(NULL, pq->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (pq->base == MAP_FAILED) {
+    pq->base = NULL;
+    return -1;
+  }
+  h = (const struct w2vpq_header *)pq->base;
+  if (memcmp(h->magic, W2VPQ_MAGIC, 6) || (h->version != W2VPQ_VERSION) || (h->header_size < sizeof(struct w2vpq_header)) ||
+   (h->file_size != pq->size) || (h->ksub != W2VPQ_KSUB) || (h->m < 1) || (h->m > h->dim) || (h->dim > pq->size) ||
+   (h->dsub < 1) || (h->dsub > h->dim) || (h->m * h->dsub < h->dim) ||
+   !w2vm_fits(h->codebooks_pos, h->m * W2VPQ_KSUB, h->dsub * sizeof(float), sizeof(float), pq->size) ||
+   !w2vm_fits(h->codes_pos, h->words, h->m, 1, pq->size) ||
+   !w2vm_check_index((const char *)pq->base, pq->size, h->words, h->offsets_pos, h->strings_pos, h->strings_size, h->hash_pos, h->hash_size)) {
+    munmap(pq->base, pq->size);
+    pq->base = NULL;
+    return -1;
+  }
+  pq->words = h->words;
+  pq->dim = h->dim;
+  pq->m = h->m;
+  pq->dsub = h->dsub;
+  pq->codebooks = (float *)((char *)pq->base + h->codebooks_pos);
+  pq->codes = (uint8_t *)((char *)pq->base + h->codes_pos);
+  pq->offsets = (const uint64_t *)((char *)pq->base + h->offsets_pos);
+  pq->strings = (const char *)pq->base + h->strings_pos;
+  pq->hash = (const uint32_t *)((char *)pq->base + h->hash_pos);
+  pq->hash_size = h->hash_size;
+  return 0;
+}
+
+/**
+ * ======== w2vpq_find ========
+ * 查找词的行号,不存在返回-1;只能用于w2vpq_open打开的模型.
+ */
+static inline long long w2vpq_find(const struct w2vpq_model *pq, const char *word) {
+  uint64_t mask = pq->hash_size - 1, pos = w2vm_hash(word) & mask;
+  uint32_t row;
+  if (pq->hash_size == 0) return -1;
+  while ((row = pq->hash[pos]) != W2VM_EMPTY) {
+    if (!strcmp(pq->strings + pq->offsets[row], word)) return row;
+    pos = (pos + 1) & mask;
+  }
+  return -1;
+}
+
+/**
+ * ======== w2vpq_free ========
+ * 释放训练得到的模型或者关闭mmap的模型.
+ */
+static inline void w2vpq_free(struct w2vpq_model *pq) {
+  if (pq->base != NULL) munmap(pq->base, pq->size);
+  else {
+    free(pq->codebooks);
+    free(pq->codes);
+  }
+  pq->base = NULL;
+  pq->codebooks = NULL;
+  pq->codes = NULL;
+}
+
+#endif
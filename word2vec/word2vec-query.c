@@ -0,0 +1,114 @@
+//  word2vec-query: 在保存的模型上批量回答相似词和类比查询
+//
+//  mmap读取word2vec -binary 2输出的对齐模型(.w2vm,见word2vec-model.h),归一化后用word2vec-query.h中的引擎按批查询.
+//  查询每行一个:一个词为相似词查询,三个词a b c为类比查询(b - a + c);
+//  结果每行一个查询:查询原文,然后每个结果为一个制表符加"词 相似度",按相似度降序.
+//
+//  编译: gcc word2vec-query.c -o word2vec-query -lm -pthread -O3 -march=native -Wall -funroll-loops
+//  运行: ./word2vec-query -model vectors.w2vm -queries queries.txt -output results.txt -topk 10 -threads 8
+//
+//  参数:
+//    -model <file>    .w2vm模型文件
+//    -queries <file>  查询文件,默认stdin
+//    -output <file>   结果输出文件,默认stdout
+//    -topk <int>      每个查询返回的词数,默认10
+//    -batch <int>     每批查询数,默认256
+//    -threads <int>   线程数,默认1
+
+#include "word2vec-model.h"
+#include "word2vec-query.h"
+
+#define MAX_STRING 100
+
+/**
+ * ======== ArgPos ========
+ * 和word2vec相同的参数解析.
+ */
+int ArgPos(char *str, int argc, char **argv) {
+  int a;
+  for (a = 1; a < argc; a++) if (!strcmp(str, argv[a])) {
+    if (a == argc - 1) {
+      printf("Argument missing for %s\n", str);
+      exit(1);
+    }
+    return a;
+  }
+  return -1;
+}
+
+long long ModelLookup(void *ctx, const char *word) {
+  // 分桶的模型中不在词表里的词(低频词和没见过的词)用所在的桶
+  return w2vm_row((const struct w2vm_model *)ctx, word);
+}
+
+const char *ModelWord(void *ctx, long long row) {
+  return w2vm_word((const struct w2vm_model *)ctx, row);
+}
+
+int main(int argc, char **argv) {
+  int i, topk = 10, batch = 256, threads = 1;
+  char model_file[MAX_STRING], query_file[MAX_STRING], output_file[MAX_STRING];
+  struct w2vm_model m;
+  struct w2vq_index q;
+  long long n;
+  double seconds;
+  FILE *fi = stdin, *fo = stdout;
+
+  if (argc == 1) {
+    printf("Batched nearest neighbour and analogy queries over an aligned word2vec model\n\n");
+    printf("Options:\n");
+    printf("\t-model <file>\n");//.w2vm模型文件(word2vec -binary 2的输出)
+    printf("\t\tModel written by word2vec -binary 2\n");
+    printf("\t-queries <file>\n");//查询文件,每行一个词(相似词)或者三个词a b c(类比b - a + c);默认stdin
+    printf("\t\tOne query per line: a word for nearest neighbours, or three words a b c for the analogy b - a + c;\n");
+    printf("\t\tdefault is stdin\n");
+    printf("\t-output <file>\n");//结果输出文件,默认stdout
+    printf("\t\tWrite the results to <file>; default is stdout\n");
+    printf("\t-topk <int>\n");//每个查询返回的词数,默认10
+    printf("\t\tNumber of words returned per query; default is 10\n");
+    printf("\t-batch <int>\n");//每批查询数,默认256
+    printf("\t\tNumber of queries scored together as one batch; default is 256\n");
+    printf("\t-threads <int>\n");//线程数,默认1
+    printf("\t\tUse <int> threads (default 1)\n");
+    printf("\nExamples:\n");
+    printf("./word2vec-query -model vec.w2vm -queries queries.txt -topk 10 -threads 8\n\n");
+    return 0;
+  }
+  model_file[0] = 0;
+  query_file[0] = 0;
+  output_file[0] = 0;
+  if ((i = ArgPos((char *)"-model", argc, argv)) > 0) strcpy(model_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-queries", argc, argv)) > 0) strcpy(query_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-output", argc, argv)) > 0) strcpy(output_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-topk", argc, argv)) > 0) topk = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-batch", argc, argv)) > 0) batch = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) threads = atoi(argv[i + 1]);
+  if (topk < 1) topk = 1;
+  if (batch < 1) batch = 1;
+  if (w2vm_open(model_file, &m) != 0) {
+    printf("ERROR: cannot open model file %s\n", model_file);
+    exit(1);
+  }
+  if ((query_file[0] != 0) && ((fi = fopen(query_file, "rb")) == NULL)) {
+    printf("ERROR: cannot open query file %s\n", query_file);
+    exit(1);
+  }
+  if ((output_file[0] != 0) && ((fo = fopen(output_file, "wb")) == NULL)) {
+    printf("ERROR: cannot open output file %s\n", output_file);
+    exit(1);
+  }
+  // 桶的行也复制(查询向量可能来自桶),但只在前words行中搜索:ModelWord只能给出词表中的词
+  if (w2vq_init(&q, m.vectors, m.header->rows, m.header->dim, m.header->stride) != 0) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  q.rows = m.header->words;
+  n = w2vq_run(&q, fi, fo, topk, batch, threads, ModelLookup, ModelWord, &m, &seconds);
+  if (fi != stdin) fclose(fi);
+  if (fo != stdout) fclose(fo);
+  // 结果写到stdout时统计信息写到stderr,不混进结果
+  fprintf(fo == stdout ? stderr : stdout, "Answered %lld queries in %.3fs: %.0f queries/sec\n", n, seconds, n / (seconds + 1e-9));
+  w2vq_free(&q);
+  w2vm_close(&m);
+  return 0;
+}
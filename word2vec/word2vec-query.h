@@ -0,0 +1,319 @@
+//  word2vec-query.h: 批量top-k相似词/类比查询引擎
+//
+//  向量先归一化,存成每行64字节对齐的矩阵(struct w2vq_index),查询(也是归一化向量)按批处理:
+//  矩阵按行切分给多个线程,每个线程按"W2VQ_ROW_BLOCK行 x W2VQ_QUERY_BLOCK个查询"分块计算点积(即余弦相似度),
+//  每个查询在每个线程里维护一个大小为k的最小堆,最后合并各线程的堆,按相似度降序输出.
+//
+//  支持两种查询:
+//    word          和word最相似的k个词(不含word本身)
+//    a b c         类比:和b - a + c最相似的k个词(不含a, b, c),即"a之于b相当于c之于?"
+//
+//  只依赖libc和pthread,word2vec(-queries,在训练得到的syn0上查询)和word2vec-query(在.w2vm模型上查询)共用.
+
+#ifndef WORD2VEC_QUERY_H
+#define WORD2VEC_QUERY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#define W2VQ_ROW_BLOCK 256
+#define W2VQ_QUERY_BLOCK 8
+#define W2VQ_MAX_LINE 1024
+
+/*
+ * ======== w2vq_index ========
+ * 归一化后的向量矩阵:rows行,每行dim个float,行距stride(dim向上取整到16),起始地址64字节对齐.
+ */
+struct w2vq_index {
+  float *vectors;
+  long long rows, dim, stride;
+};
+
+/**
+ * ======== w2vq_dot ========
+ * 点积,8路部分和互相独立,-O3时可以向量化.
+ */
+static inline float w2vq_dot(const float *x, const float *y, long long n) {
+  float s[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  long long a, b;
+  for (a = 0; a + 8 <= n; a += 8) for (b = 0; b < 8; b++) s[b] += x[a + b] * y[a + b];
+  for (; a < n; a++) s[0] += x[a] * y[a];
+  return ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7]));
+}
+
+/**
+ * ======== w2vq_dot4 ========
+ * 4个查询和同一行的点积,行只读一次;n为stride(16的倍数,多出的部分为0),所以没有尾部循环.
+ */
+static inline void w2vq_dot4(const float *q0, const float *q1, const float *q2, const float *q3, const float *y, long long n,
+                             float *out) {
+  float s[4][16];
+  long long a, b;
+  memset(s, 0, sizeof(s));
+  for (a = 0; a < n; a += 16) for (b = 0; b < 16; b++) {
+    s[0][b] += q0[a + b] * y[a + b];
+    s[1][b] += q1[a + b] * y[a + b];
+    s[2][b] += q2[a + b] * y[a + b];
+    s[3][b] += q3[a + b] * y[a + b];
+  }
+  for (a = 0; a < 4; a++) {
+    for (b = 1; b < 16; b++) s[a][0] += s[a][b];
+    out[a] = s[a][0];
+  }
+}
+
+/**
+ * ======== w2vq_normalize ========
+ * 把x归一化为单位长度(零向量保持不变).
+ */
+static inline void w2vq_normalize(float *x, long long n) {
+  long long a;
+  float len = sqrtf(w2vq_dot(x, x, n));
+  if (len > 0) for (a = 0; a < n; a++) x[a] /= len;
+}
+
+/**
+ * ======== w2vq_init ========
+ * 从src(rows行,行距src_stride)复制并归一化,建立查询矩阵.成功返回0.
+ */
+static inline int w2vq_init(struct w2vq_index *q, const float *src, long long rows, long long dim, long long src_stride) {
+  long long a;
+  q->rows = rows;
+  q->dim = dim;
+  q->stride = (dim + 15) / 16 * 16;
+  if (posix_memalign((void **)&q->vectors, 64, rows * q->stride * sizeof(float) + 64) != 0) return -1;
+  for (a = 0; a < rows; a++) {
+    memcpy(&q->vectors[a * q->stride], &src[a * src_stride], dim * sizeof(float));
+    memset(&q->vectors[a * q->stride + dim], 0, (q->stride - dim) * sizeof(float));
+    w2vq_normalize(&q->vectors[a * q->stride], dim);
+  }
+  return 0;
+}
+
+static inline void w2vq_free(struct w2vq_index *q) {
+  free(q->vectors);
+  q->vectors = NULL;
+}
+
+/**
+ * ======== w2vq_heap_push ========
+ * 大小为k的最小堆(堆顶为当前第k大的相似度),n为当前元素个数;s比堆顶大时替换堆顶.
+ */
+static inline void w2vq_heap_push(float *score, long long *id, int k, int *n, float s, long long i) {
+  int p, c;
+  if (*n < k) {
+    // 上浮
+    for (p = (*n)++; (p > 0) && (score[(p - 1) / 2] > s); p = (p - 1) / 2) {
+      score[p] = score[(p - 1) / 2];
+      id[p] = id[(p - 1) / 2];
+    }
+  } else {
+    if (s <= score[0]) return;
+    // 替换堆顶后下沉
+    for (p = 0; (c = 2 * p + 1) < k; p = c) {
+      if ((c + 1 < k) && (score[c + 1] < score[c])) c++;
+      if (score[c] >= s) break;
+      score[p] = score[c];
+      id[p] = id[c];
+    }
+  }
+  score[p] = s;
+  id[p] = i;
+}
+
+/*
+ * ======== w2vq_task ========
+ * 一个线程的查询任务:行范围[first, last),所有nq个查询各自的堆(score, id, count).
+ */
+struct w2vq_task {
+  const struct w2vq_index *q;
+  const float *queries;
+  const long long *exclude;
+  long long nq, first, last;
+  int k, *count;
+  float *score;
+  long long *id;
+};
+
+static void *w2vq_search_thread(void *arg) {
+  struct w2vq_task *t = (struct w2vq_task *)arg;
+  const struct w2vq_index *q = t->q;
+  long long r, re, rb, j, qb, qe;
+  const float *row, *qv;
+  const long long *ex;
+  float s, s4[4];
+  for (j = 0; j < t->nq; j++) t->count[j] = 0;
+  for (rb = t->first; rb < t->last; rb += W2VQ_ROW_BLOCK) {
+    re = rb + W2VQ_ROW_BLOCK < t->last ? rb + W2VQ_ROW_BLOCK : t->last;
+    // 一块行(在L2中)依次和每组查询(在L1中)计算
+    for (qb = 0; qb < t->nq; qb += W2VQ_QUERY_BLOCK) {
+      qe = qb + W2VQ_QUERY_BLOCK < t->nq ? qb + W2VQ_QUERY_BLOCK : t->nq;
+      for (r = rb; r < re; r++) {
+        row = &q->vectors[r * q->stride];
+        for (j = qb; j < qe; j++) {
+          if ((j % 4 == 0) && (j + 4 <= qe)) {
+            qv = &t->queries[j * q->stride];
+            w2vq_dot4(qv, qv + q->stride, qv + 2 * q->stride, qv + 3 * q->stride, row, q->stride, s4);
+          }
+          ex = &t->exclude[j * 3];
+          if ((ex[0] == r) || (ex[1] == r) || (ex[2] == r)) continue;
+          s = (j - j % 4 + 4 <= qe) ? s4[j % 4] : w2vq_dot(&t->queries[j * q->stride], row, q->dim);
+          w2vq_heap_push(&t->score[j * t->k], &t->id[j * t->k], t->k, &t->count[j], s, r);
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * ======== w2vq_search ========
+ * nq个查询(queries,每个q->stride个float,已归一化)的top-k,每个查询最多排除3行(exclude,nq x 3,-1表示不排除).
+ * 结果按相似度降序写到ids / scores(nq x k),不足k个时ids为-1.
+ */
+static inline void w2vq_search(const struct w2vq_index *q, const float *queries, long long nq, const long long *exclude, int k,
+                               int threads, long long *ids, float *scores) {
+  long long a, j, i;
+  int n, m, b;
+  float s;
+  pthread_t *pt;
+  struct w2vq_task *tasks;
+  if (threads < 1) threads = 1;
+  if (threads > q->rows) threads = q->rows > 0 ? q->rows : 1;
+  pt = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  tasks = (struct w2vq_task *)calloc(threads, sizeof(struct w2vq_task));
+  for (a = 0; a < threads; a++) {
+    tasks[a].q = q;
+    tasks[a].queries = queries;
+    tasks[a].exclude = exclude;
+    tasks[a].nq = nq;
+    tasks[a].k = k;
+    tasks[a].first = q->rows * a / threads;
+    tasks[a].last = q->rows * (a + 1) / threads;
+    tasks[a].count = (int *)malloc(nq * sizeof(int));
+    tasks[a].score = (float *)malloc(nq * k * sizeof(float));
+    tasks[a].id = (long long *)malloc(nq * k * sizeof(long long));
+    pthread_create(&pt[a], NULL, w2vq_search_thread, &tasks[a]);
+  }
+  for (a = 0; a < threads; a++) pthread_join(pt[a], NULL);
+  // 合并各线程的堆,再按相似度降序排列(插入排序,k很小)
+  for (j = 0; j < nq; j++) {
+    n = 0;
+    for (a = 0; a < threads; a++) for (b = 0; b < tasks[a].count[j]; b++)
+      w2vq_heap_push(&scores[j * k], &ids[j * k], k, &n, tasks[a].score[j * k + b], tasks[a].id[j * k + b]);
+    for (b = 1; b < n; b++) {
+      s = scores[j * k + b];
+      i = ids[j * k + b];
+      for (m = b; (m > 0) && (scores[j * k + m - 1] < s); m--) {
+        scores[j * k + m] = scores[j * k + m - 1];
+        ids[j * k + m] = ids[j * k + m - 1];
+      }
+      scores[j * k + m] = s;
+      ids[j * k + m] = i;
+    }
+    for (b = n; b < k; b++) {
+      scores[j * k + b] = 0;
+      ids[j * k + b] = -1;
+    }
+  }
+  for (a = 0; a < threads; a++) {
+    free(tasks[a].count);
+    free(tasks[a].score);
+    free(tasks[a].id);
+  }
+  free(tasks);
+  free(pt);
+}
+
+/**
+ * ======== w2vq_make_query ========
+ * 由行号构造查询向量:b < 0时为相似词查询(a的向量),否则为类比查询(b - a + c,归一化);exclude记录要排除的行.
+ */
+static inline void w2vq_make_query(const struct w2vq_index *q, long long a, long long b, long long c, float *out, long long *exclude) {
+  long long d;
+  const float *va = &q->vectors[a * q->stride];
+  if (b < 0) memcpy(out, va, q->stride * sizeof(float));
+  else {
+    for (d = 0; d < q->stride; d++) out[d] = q->vectors[b * q->stride + d] - va[d] + q->vectors[c * q->stride + d];
+    w2vq_normalize(out, q->dim);
+  }
+  exclude[0] = a;
+  exclude[1] = b;
+  exclude[2] = c;
+}
+
+/**
+ * ======== w2vq_run ========
+ * 从in逐行读取查询(一个词为相似词查询,三个词为类比查询),每batch个一批查询,结果写到out:
+ *   查询原文,然后每个结果为一个制表符加"词 相似度".
+ * 含有不在词典中的词,格式不对或者超过W2VQ_MAX_LINE - 1个字符的查询只输出查询原文.
+ * lookup / word为词和行号的互相转换(由调用者提供,ctx原样传入).返回查询数,耗时(秒)写到seconds.
+ */
+static inline long long w2vq_run(const struct w2vq_index *q, FILE *in, FILE *out, int k, int batch, int threads,
+                                 long long (*lookup)(void *, const char *), const char *(*word)(void *, long long), void *ctx,
+                                 double *seconds) {
+  char *lines = (char *)malloc((long long)batch * W2VQ_MAX_LINE), *p, *tok[4], buf[W2VQ_MAX_LINE];
+  float *queries, *scores = (float *)malloc((long long)batch * k * sizeof(float));
+  long long *exclude = (long long *)malloc((long long)batch * 3 * sizeof(long long));
+  long long *ids = (long long *)malloc((long long)batch * k * sizeof(long long));
+  long long *slot = (long long *)malloc(batch * sizeof(long long)), rows[3], total = 0, a, nq;
+  int n, j, ntok, ok, ch, truncated, eof = 0;
+  struct timespec t0, t1;
+  *seconds = 0;
+  if (posix_memalign((void **)&queries, 64, (long long)batch * q->stride * sizeof(float)) != 0) return 0;
+  while (!eof) {
+    // 读一批查询,slot记录每行对应的查询编号(-1表示无效)
+    n = 0;
+    nq = 0;
+    while (n < batch) {
+      if (fgets(&lines[(long long)n * W2VQ_MAX_LINE], W2VQ_MAX_LINE, in) == NULL) {
+        eof = 1;
+        break;
+      }
+      p = &lines[(long long)n * W2VQ_MAX_LINE];
+      // 超过W2VQ_MAX_LINE的行:跳过剩余部分,作为无效查询(只输出截断的查询原文)
+      truncated = 0;
+      if ((strchr(p, '\n') == NULL) && ((ch = fgetc(in)) != EOF) && (ch != '\n') && (ch != '\r')) {
+        truncated = 1;
+        while (((ch = fgetc(in)) != EOF) && (ch != '\n'));
+      }
+      p[strcspn(p, "\r\n")] = 0;
+      strcpy(buf, p);
+      ntok = 0;
+      for (tok[0] = strtok(buf, " \t"); (tok[ntok] != NULL) && (ntok < 3); tok[ntok] = strtok(NULL, " \t")) ntok++;
+      if (ntok == 0) continue;
+      ok = !truncated && ((ntok == 1) || (ntok == 3)) && (tok[ntok] == NULL);
+      for (j = 0; ok && (j < ntok); j++) ok = (rows[j] = lookup(ctx, tok[j])) >= 0;
+      slot[n] = -1;
+      if (ok) {
+        w2vq_make_query(q, rows[0], ntok == 3 ? rows[1] : -1, ntok == 3 ? rows[2] : -1, &queries[nq * q->stride], &exclude[nq * 3]);
+        slot[n] = nq++;
+      }
+      n++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (nq > 0) w2vq_search(q, queries, nq, exclude, k, threads, ids, scores);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    *seconds += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    for (j = 0; j < n; j++) {
+      fputs(&lines[(long long)j * W2VQ_MAX_LINE], out);
+      if (slot[j] >= 0) for (a = 0; (a < k) && (ids[slot[j] * k + a] >= 0); a++)
+        fprintf(out, "\t%s %.6f", word(ctx, ids[slot[j] * k + a]), scores[slot[j] * k + a]);
+      fputc('\n', out);
+    }
+    total += nq;
+  }
+  free(lines);
+  free(queries);
+  free(scores);
+  free(exclude);
+  free(ids);
+  free(slot);
+  return total;
+}
+
+#endif
@@ -0,0 +1,268 @@
+//  word2vec-scaling: 端到端训练吞吐量和多线程扩展性测试
+//
+//  不需要真实语料:先生成一个词频服从Zipf分布的合成语料(词典大小,句子长度可配置),
+//  然后对每一组配置(模型 x 维度 x 窗口 x 线程数)fork一个子进程调用TrainModel训练,
+//  统计训练阶段的墙上时间吞吐量(words/sec),子进程的峰值内存(peak RSS),以及相对-threads列表中第一个线程数的加速比和扩展效率.
+//  指定-ooc-dir时,每组配置再按-ooc-memory中的每个内存预算用外存模式训练一次,
+//  vs_memory是相对同一配置全部在内存中训练的吞吐量,major_faults是子进程的major page fault数.
+//  直接#include word2vec.c,测的就是word2vec本身的训练代码.
+//
+//  编译: gcc word2vec-scaling.c -o word2vec-scaling -lm -pthread -O3 -march=native -Wall -funroll-loops
+//  运行: ./word2vec-scaling -threads 1,2,4,8 -sizes 100,300 -models cbow-ns,sg-ns -output scaling.csv
+//
+//  参数:
+//    -corpus <file>       语料文件;文件不存在时生成合成语料并保存到这里,默认生成到临时文件,测试结束后删除
+//    -words <int>         合成语料的词数,默认5000000
+//    -vocab <int>         合成语料的词典大小,默认100000
+//    -zipf <float>        Zipf分布指数s,第r个词的词频正比于1 / r^s,默认1.0
+//    -min-sentence <int>  句子最短长度,默认5
+//    -max-sentence <int>  句子最长长度,默认40
+//    -threads <list>      线程数列表,逗号分隔,默认1,2,4
+//    -sizes <list>        词向量维度列表,默认100
+//    -windows <list>      窗口大小列表,默认5
+//    -models <list>       模型列表: cbow-ns, sg-ns, cbow-hs, sg-hs;默认cbow-ns,sg-ns
+//    -negative <int>      负样本数,默认5
+//    -iter <int>          训练轮数,默认1
+//    -output <file>       CSV结果输出文件,默认stdout
+//    -ooc-dir <dir>       外存模式映射文件所在的目录,默认不测试外存模式
+//    -ooc-memory <list>   外存模式下syn0和syn1neg在内存中的部分(MB)列表,默认64
+
+#define WORD2VEC_NO_MAIN
+#include "word2vec.c"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define SCALING_MAX_LIST 32
+
+char scaling_corpus[MAX_STRING], scaling_output[MAX_STRING];
+long long scaling_words = 5000000, scaling_vocab = 100000, min_sentence = 5, max_sentence = 40;
+real zipf_s = 1.0;
+struct word2vec *wv;  // 训练参数,main中创建,子进程中训练
+
+/**
+ * ======== ParseList ========
+ * 解析逗号分隔的整数列表,返回个数.
+ */
+int ParseList(char *str, long long *out) {
+  int n = 0;
+  char *tok, buf[MAX_STRING];
+  strncpy(buf, str, MAX_STRING - 1);
+  buf[MAX_STRING - 1] = 0;
+  for (tok = strtok(buf, ","); (tok != NULL) && (n < SCALING_MAX_LIST); tok = strtok(NULL, ",")) out[n++] = atoll(tok);
+  return n;
+}
+
+/**
+ * ======== GenerateCorpus ========
+ * 生成合成语料:scaling_words个词,词"w<r>"的概率正比于1 / r^zipf_s(r从1开始),
+ * 句子长度在[min_sentence, max_sentence]内均匀分布,一句一行.
+ */
+void GenerateCorpus(char *file) {
+  long long a, w, lo, hi, mid, len = 0;
+  double *cum, total = 0, r;
+  unsigned long long next_random = 1;
+  FILE *fo = fopen(file, "wb");
+  if (fo == NULL) {
+    printf("ERROR: cannot create corpus file %s\n", file);
+    exit(1);
+  }
+  cum = (double *)malloc(scaling_vocab * sizeof(double));
+  for (a = 0; a < scaling_vocab; a++) {
+    total += 1 / pow(a + 1, zipf_s);
+    cum[a] = total;
+  }
+  for (w = 0; w < scaling_words; w++) {
+    if (len == 0) {
+      next_random = next_random * (unsigned long long)25214903917 + 11;
+      len = min_sentence + (next_random >> 16) % (max_sentence - min_sentence + 1);
+    }
+    next_random = next_random * (unsigned long long)25214903917 + 11;
+    r = (next_random >> 16) / (double)(1LL << 48) * total;
+    lo = 0;
+    hi = scaling_vocab - 1;
+    while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (cum[mid] < r) lo = mid + 1; else hi = mid;
+    }
+    len--;
+    fprintf(fo, "w%lld%c", lo + 1, len == 0 ? '\n' : ' ');
+  }
+  if (len != 0) fprintf(fo, "\n");
+  free(cum);
+  fclose(fo);
+}
+
+/**
+ * ======== RunTraining ========
+ * fork一个子进程,按当前全局参数调用TrainModel训练(输出写到/dev/null);
+ * 子进程通过管道返回训练词数和训练阶段耗时,父进程通过wait4得到子进程的峰值RSS(KB)和major fault数.
+ * 返回0表示子进程失败.
+ */
+int RunTraining(long long *words, double *seconds, long long *rss_kb, long long *faults) {
+  int fds[2], status, a;
+  pid_t pid;
+  struct rusage ru;
+  double result[2];
+  if (pipe(fds) != 0) return 0;
+  // 先清空stdio缓冲区,否则子进程会把继承来的未输出内容再输出一遍
+  fflush(NULL);
+  pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    if (freopen("/dev/null", "w", stdout) == NULL) _exit(1);
+    // 训练出错时Fail回到这里,子进程以状态1退出
+    if (setjmp(wv->fail) != 0) _exit(1);
+    strcpy(wv->output_file, "/dev/null");
+    InitTables(wv);
+    TrainModel(wv);
+    result[0] = wv->word_count_actual;
+    result[1] = wv->phase_seconds[PHASE_TRAIN];
+    if (write(fds[1], result, sizeof(result)) != sizeof(result)) _exit(1);
+    _exit(0);
+  }
+  close(fds[1]);
+  if (pid < 0) {
+    close(fds[0]);
+    return 0;
+  }
+  a = read(fds[0], result, sizeof(result)) == sizeof(result);
+  close(fds[0]);
+  wait4(pid, &status, 0, &ru);
+  if (!a || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) return 0;
+  *words = (long long)result[0];
+  *seconds = result[1];
+  *rss_kb = ru.ru_maxrss;
+  *faults = ru.ru_majflt;
+  return 1;
+}
+
+/**
+ * ======== ScalingArgPos ========
+ * ArgPos;参数缺少值时ArgPos调用Fail,这里输出错误信息后退出.
+ */
+int ScalingArgPos(char *str, int argc, char **argv) {
+  if (setjmp(wv->fail) != 0) {
+    printf("%s\n", wv->error);
+    exit(1);
+  }
+  return ArgPos(wv, str, argc, argv);
+}
+
+/**
+ * ======== FormatRatio ========
+ * 把x / base格式化到buf;作为基准的那一组训练失败(base为0)时为n/a.
+ */
+const char *FormatRatio(char *buf, int size, double x, double base) {
+  if (base > 0) snprintf(buf, size, "%.3f", x / base);
+  else snprintf(buf, size, "n/a");
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  int i, m, s, w, t, o, nthreads, nsizes, nwindows, nooc, nmodels = 0, generated = 0;
+  long long threads[SCALING_MAX_LIST], sizes[SCALING_MAX_LIST], windows[SCALING_MAX_LIST], ooc[SCALING_MAX_LIST];
+  long long words, rss_kb, faults, neg = 5, iters = 1;
+  double seconds, wps, base_wps = 0, memory_wps = 0;
+  char models[SCALING_MAX_LIST][MAX_STRING], list[MAX_STRING], dir[MAX_STRING], *tok, speedup[32], efficiency[32], vs_memory[32];
+  FILE *fo = stdout, *fi;
+
+  scaling_corpus[0] = 0;
+  scaling_output[0] = 0;
+  strcpy(list, "cbow-ns,sg-ns");
+  nthreads = ParseList((char *)"1,2,4", threads);
+  nsizes = ParseList((char *)"100", sizes);
+  nwindows = ParseList((char *)"5", windows);
+  nooc = ParseList((char *)"64", ooc);
+  dir[0] = 0;
+  wv = NewWord2vec();
+  if (wv == NULL) {
+    printf("Memory allocation failed\n");
+    return 1;
+  }
+  if ((i = ScalingArgPos((char *)"-corpus", argc, argv)) > 0) strcpy(scaling_corpus, argv[i + 1]);
+  if ((i = ScalingArgPos((char *)"-words", argc, argv)) > 0) scaling_words = atoll(argv[i + 1]);
+  if ((i = ScalingArgPos((char *)"-vocab", argc, argv)) > 0) scaling_vocab = atoll(argv[i + 1]);
+  if ((i = ScalingArgPos((char *)"-zipf", argc, argv)) > 0) zipf_s = atof(argv[i + 1]);
+  if ((i = ScalingArgPos((char *)"-min-sentence", argc, argv)) > 0) min_sentence = atoll(argv[i + 1]);
+  if ((i = ScalingArgPos((char *)"-max-sentence", argc, argv)) > 0) max_sentence = atoll(argv[i + 1]);
+  if ((i = ScalingArgPos((char *)"-threads", argc, argv)) > 0) nthreads = ParseList(argv[i + 1], threads);
+  if ((i = ScalingArgPos((char *)"-sizes", argc, argv)) > 0) nsizes = ParseList(argv[i + 1], sizes);
+  if ((i = ScalingArgPos((char *)"-windows", argc, argv)) > 0) nwindows = ParseList(argv[i + 1], windows);
+  if ((i = ScalingArgPos((char *)"-models", argc, argv)) > 0) strcpy(list, argv[i + 1]);
+  if ((i = ScalingArgPos((char *)"-negative", argc, argv)) > 0) neg = atoll(argv[i + 1]);
+  if ((i = ScalingArgPos((char *)"-iter", argc, argv)) > 0) iters = atoll(argv[i + 1]);
+  if ((i = ScalingArgPos((char *)"-output", argc, argv)) > 0) strcpy(scaling_output, argv[i + 1]);
+  if ((i = ScalingArgPos((char *)"-ooc-dir", argc, argv)) > 0) strcpy(dir, argv[i + 1]);
+  if ((i = ScalingArgPos((char *)"-ooc-memory", argc, argv)) > 0) nooc = ParseList(argv[i + 1], ooc);
+  for (tok = strtok(list, ","); (tok != NULL) && (nmodels < SCALING_MAX_LIST); tok = strtok(NULL, ",")) {
+    if (strcmp(tok, "cbow-ns") && strcmp(tok, "sg-ns") && strcmp(tok, "cbow-hs") && strcmp(tok, "sg-hs")) {
+      printf("ERROR: unknown model %s (use cbow-ns, sg-ns, cbow-hs, sg-hs)\n", tok);
+      exit(1);
+    }
+    strcpy(models[nmodels++], tok);
+  }
+  if (max_sentence < min_sentence) max_sentence = min_sentence;
+  if (min_sentence < 1) min_sentence = 1;
+
+  // 准备语料:指定的文件存在就直接用,否则生成
+  if (scaling_corpus[0] == 0) {
+    strcpy(scaling_corpus, "/tmp/word2vec-scaling-XXXXXX");
+    i = mkstemp(scaling_corpus);
+    if (i < 0) {
+      printf("ERROR: cannot create temporary corpus file\n");
+      exit(1);
+    }
+    close(i);
+    generated = 1;
+    GenerateCorpus(scaling_corpus);
+  } else if ((fi = fopen(scaling_corpus, "rb")) != NULL) fclose(fi);
+  else GenerateCorpus(scaling_corpus);
+  printf("Corpus: %s\n", scaling_corpus);
+
+  if (scaling_output[0] != 0) {
+    fo = fopen(scaling_output, "wb");
+    if (fo == NULL) {
+      printf("ERROR: cannot open %s\n", scaling_output);
+      exit(1);
+    }
+  }
+  fprintf(fo, "model,size,window,threads,ooc_memory_mb,words,train_seconds,words_per_sec,speedup,efficiency,vs_memory,peak_rss_mb,major_faults\n");
+  strcpy(wv->train_file, scaling_corpus);
+  wv->debug_mode = 0;
+  wv->iter = iters;
+  wv->min_count = 5;
+  if (dir[0] == 0) nooc = 0;
+  for (m = 0; m < nmodels; m++) for (s = 0; s < nsizes; s++) for (w = 0; w < nwindows; w++) for (t = 0; t < nthreads; t++) for (o = -1; o < nooc; o++) {
+    wv->cbow = !strncmp(models[m], "cbow", 4);
+    wv->hs = strstr(models[m], "-hs") != NULL;
+    wv->negative = wv->hs ? 0 : neg;
+    wv->alpha = wv->cbow ? 0.05 : 0.025;
+    wv->layer1_size = sizes[s];
+    wv->window = windows[w];
+    wv->num_threads = threads[t];
+    // o = -1: 全部在内存中;否则外存模式,内存预算ooc[o] MB
+    if (o < 0) wv->ooc_dir[0] = 0; else strcpy(wv->ooc_dir, dir);
+    wv->ooc_memory = o < 0 ? 0 : ooc[o];
+    // 基准训练失败时不能沿用上一组配置的基准
+    if ((t == 0) && (o < 0)) base_wps = 0;
+    if (o < 0) memory_wps = 0;
+    if (!RunTraining(&words, &seconds, &rss_kb, &faults)) {
+      printf("ERROR: training failed for %s size %lld window %lld threads %d\n", models[m], wv->layer1_size, (long long)wv->window, wv->num_threads);
+      continue;
+    }
+    wps = words / (seconds + 1e-9);
+    // 加速比和扩展效率都相对于列表中第一个线程数(内存中训练),外存模式相对同一配置的内存中训练
+    if (o < 0) memory_wps = wps;
+    if ((t == 0) && (o < 0)) base_wps = wps;
+    fprintf(fo, "%s,%lld,%d,%d,%lld,%lld,%.3f,%.0f,%s,%s,%s,%.1f,%lld\n", models[m], wv->layer1_size, wv->window, wv->num_threads, wv->ooc_memory, words,
+     seconds, wps, FormatRatio(speedup, sizeof(speedup), wps, base_wps),
+     FormatRatio(efficiency, sizeof(efficiency), wps, base_wps * ((double)threads[t] / threads[0])), FormatRatio(vs_memory, sizeof(vs_memory), wps, memory_wps), rss_kb / 1024.0, faults);
+    fflush(fo);
+    if (fo != stdout) printf("%-8s size %4lld window %2d threads %3d memory %6s: %10.0f words/sec (%s x memory), peak RSS %.1f MB, %lld major faults\n",
+     models[m], wv->layer1_size, wv->window, wv->num_threads, o < 0 ? "all" : "ooc", wps, vs_memory, rss_kb / 1024.0, faults);
+  }
+  if (fo != stdout) fclose(fo);
+  if (generated) unlink(scaling_corpus);
+  return 0;
+}
@@ -0,0 +1,840 @@
+//  word2vec-server: 本机的词向量查询服务
+//
+//  把.w2vm模型(word2vec -binary 2的输出)mmap一次,通过Unix domain socket和/或127.0.0.1上的TCP端口提供查询,
+//  同一台机器上的所有进程共用这一份模型(page cache),不用每个进程各自加载整个向量文件.
+//  协议见word2vec-server.h:词->向量,词->k个最相似的词,可以批量,可以pipelining.
+//
+//  结构:
+//    主线程     accept新连接,轮流分给工作线程;定期检查模型文件,变化时加载新模型(热加载);定期输出延迟统计
+//    工作线程   每个线程一个epoll,负责分到的连接:非阻塞读,处理所有完整的请求,响应写到输出缓冲区,写不完时等EPOLLOUT
+//  模型带引用计数:热加载后正在处理的请求继续用旧模型,最后一个引用释放时才munmap.
+//  有-index(HNSW索引,见word2vec-hnsw.h)时相似词查询用索引,否则扫描全部向量.
+//
+//  编译: gcc word2vec-server.c -o word2vec-server -lm -pthread -O3 -march=native -Wall -funroll-loops
+//  运行: ./word2vec-server -model vec.w2vm -index vec.hnsw -socket /tmp/word2vec.sock -threads 4
+//  测试: ./word2vec-server -socket /tmp/word2vec.sock -bench 100000 -queries words.txt -op neighbours -pipeline 32
+//
+//  参数:
+//    -model <file>            .w2vm模型文件;文件被替换(比如rename新文件过来)时自动重新加载
+//    -index <file>            HNSW索引文件(可选),同样自动重新加载
+//    -socket <file>           Unix domain socket路径
+//    -port <int>              在127.0.0.1上监听的TCP端口,默认0(不监听)
+//    -threads <int>           工作线程数,默认4
+//    -ef <int>                HNSW查询的候选集大小,默认100
+//    -reload-interval <float> 检查模型文件的间隔(秒),默认1,0表示不检查
+//    -stats-interval <float>  输出延迟统计的间隔(秒),默认10,0表示不输出
+//  客户端测试模式(-bench > 0):
+//    -bench <int>             连接-socket或者-port,发送<int>个请求,统计客户端看到的延迟分位数和吞吐量
+//    -queries <file>          请求中的词,每行一个,循环使用
+//    -op <string>             vector或者neighbours,默认vector
+//    -k <int>                 neighbours的近邻数,默认10
+//    -batch <int>             每个请求的词数,默认1
+//    -pipeline <int>          同时在途的请求数,默认16
+
+#define _GNU_SOURCE // accept4
+#include "word2vec-hnsw.h"
+#include "word2vec-server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_STRING 100
+#define MAX_EVENTS 64
+#define READ_SIZE 65536
+#define LATENCY_BUCKETS 512 // 每个2的幂分8个桶,覆盖1ns到2^64ns
+
+/*
+ * ======== server_model ========
+ * 一个加载的模型:mmap的.w2vm,可选的HNSW索引,每行向量长度的倒数(扫描时计算余弦相似度用).
+ * refs为引用计数,current_model持有一个引用;generation为加载序号;model_stat / index_stat用于检查文件是否变化.
+ */
+struct server_model {
+  struct w2vm_model m;
+  struct w2vh_index g;
+  int has_index;
+  float *inv_norm;
+  long long refs, generation;
+  struct stat model_stat, index_stat;
+};
+
+/*
+ * ======== connection ========
+ * 一个客户端连接:输入缓冲区(收到但还没处理的字节),输出缓冲区(还没写出去的响应),是否在等EPOLLOUT.
+ */
+struct connection {
+  int fd, want_write;
+  char *in, *out;
+  long long in_len, in_cap, out_len, out_pos, out_cap;
+};
+
+/*
+ * ======== worker ========
+ * 工作线程:自己的epoll,HNSW搜索缓冲区(属于哪个generation的模型),扫描用的top-k堆,各种请求的延迟直方图.
+ */
+struct worker {
+  pthread_t tid;
+  int epfd;
+  struct w2vh_ctx ctx;
+  long long ctx_generation;
+  float *q, *score;
+  long long *ids, hist[W2VS_OPS][LATENCY_BUCKETS];
+};
+
+char model_file[MAX_STRING], index_file[MAX_STRING], socket_file[MAX_STRING], query_file[MAX_STRING], op_name[MAX_STRING];
+int port = 0, num_workers = 4, hnsw_ef = 100;
+double reload_interval = 1, stats_interval = 10;
+struct server_model *current_model;
+long long generation = 0;
+pthread_mutex_t model_lock = PTHREAD_MUTEX_INITIALIZER;
+struct worker *workers;
+volatile sig_atomic_t stopping = 0;
+
+/**
+ * ======== ArgPos ========
+ * 和word2vec相同的参数解析.
+ */
+int ArgPos(char *str, int argc, char **argv) {
+  int a;
+  for (a = 1; a < argc; a++) if (!strcmp(str, argv[a])) {
+    if (a == argc - 1) {
+      printf("Argument missing for %s\n", str);
+      exit(1);
+    }
+    return a;
+  }
+  return -1;
+}
+
+double Now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ * ======== LatencyBucket / BucketValue ========
+ * 延迟直方图:纳秒数按最高位分组,每组再按接下来3位分成8个桶,相对误差不超过12.5%.
+ */
+int LatencyBucket(unsigned long long ns) {
+  int bits = 0;
+  if (ns < 8) return ns;
+  while ((ns >> bits) >= 16) bits++;
+  return (bits + 1) * 8 + (int)((ns >> bits) & 7);
+}
+
+double BucketValue(int b) {
+  if (b < 8) return b;
+  return (double)(8 + (b & 7)) * (1ULL << (b / 8 - 1));
+}
+
+/**
+ * ======== Percentile ========
+ * 直方图中第p分位数(0..1)所在桶的值(纳秒),total为总数.
+ */
+double Percentile(const long long *hist, long long total, double p) {
+  long long seen = 0;
+  int b;
+  for (b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += hist[b];
+    if (seen > p * total) return BucketValue(b);
+  }
+  return 0;
+}
+
+/**
+ * ======== SumHistograms ========
+ * 把所有工作线程的直方图加起来.
+ */
+void SumHistograms(long long hist[W2VS_OPS][LATENCY_BUCKETS]) {
+  int w, o, b;
+  memset(hist, 0, sizeof(long long) * W2VS_OPS * LATENCY_BUCKETS);
+  for (w = 0; w < num_workers; w++) for (o = 0; o < W2VS_OPS; o++) for (b = 0; b < LATENCY_BUCKETS; b++)
+    hist[o][b] += __atomic_load_n(&workers[w].hist[o][b], __ATOMIC_RELAXED);
+}
+
+/**
+ * ======== FormatStats ========
+ * 每种请求的个数和延迟分位数(微秒),格式化到buf.
+ */
+int FormatStats(char *buf, int size, long long hist[W2VS_OPS][LATENCY_BUCKETS], double seconds) {
+  static const char *names[W2VS_OPS] = {"info", "vector", "neighbours", "stats"};
+  long long total;
+  int o, b, len = 0;
+  for (o = 0; o < W2VS_OPS; o++) {
+    total = 0;
+    for (b = 0; b < LATENCY_BUCKETS; b++) total += hist[o][b];
+    if (total == 0) continue;
+    len += snprintf(buf + len, size - len, "%-10s %10lld requests %10.0f/sec  p50 %8.1fus  p99 %8.1fus  p99.9 %8.1fus\n", names[o], total,
+     total / (seconds + 1e-9), Percentile(hist[o], total, 0.5) / 1e3, Percentile(hist[o], total, 0.99) / 1e3,
+     Percentile(hist[o], total, 0.999) / 1e3);
+    if (len >= size) return size - 1;
+  }
+  return len;
+}
+
+/**
+ * ======== LoadModel ========
+ * 打开模型文件和索引文件(如果有),返回引用计数为1的模型;失败返回NULL.
+ * 索引和模型的行数或维度不一致时(比如新模型已经换上,索引还没重建)忽略索引,扫描全部向量.
+ */
+struct server_model *LoadModel() {
+  struct server_model *sm = (struct server_model *)calloc(1, sizeof(struct server_model));
+  long long a;
+  double len;
+  if ((stat(model_file, &sm->model_stat) != 0) || (w2vm_open(model_file, &sm->m) != 0)) {
+    free(sm);
+    return NULL;
+  }
+  if ((index_file[0] != 0) && (stat(index_file, &sm->index_stat) == 0) && (w2vh_open(index_file, &sm->g) == 0)) {
+    if ((sm->g.rows == (long long)sm->m.header->words) && (sm->g.dim == (long long)sm->m.header->dim)) {
+      sm->has_index = 1;
+      sm->g.vectors = sm->m.vectors;
+      sm->g.stride = sm->m.header->stride;
+    } else {
+      printf("Index %s does not match model %s, searching without it\n", index_file, model_file);
+      w2vh_free(&sm->g);
+    }
+  }
+  // 哈希桶的行也算,不在词表中的词用所在桶的向量查询近邻
+  sm->inv_norm = (float *)malloc(sm->m.header->rows * sizeof(float));
+  for (a = 0; a < (long long)sm->m.header->rows; a++) {
+    len = sqrt(w2vq_dot(w2vm_vector(&sm->m, a), w2vm_vector(&sm->m, a), sm->m.header->dim));
+    sm->inv_norm[a] = len > 0 ? 1 / len : 0;
+  }
+  sm->refs = 1;
+  sm->generation = ++generation;
+  return sm;
+}
+
+struct server_model *AcquireModel() {
+  struct server_model *sm;
+  pthread_mutex_lock(&model_lock);
+  sm = current_model;
+  sm->refs++;
+  pthread_mutex_unlock(&model_lock);
+  return sm;
+}
+
+void ReleaseModel(struct server_model *sm) {
+  long long refs;
+  pthread_mutex_lock(&model_lock);
+  refs = --sm->refs;
+  pthread_mutex_unlock(&model_lock);
+  if (refs > 0) return;
+  if (sm->has_index) w2vh_free(&sm->g);
+  w2vm_close(&sm->m);
+  free(sm->inv_norm);
+  free(sm);
+}
+
+/**
+ * ======== FileChanged ========
+ * 文件是否和上次加载时不同(被替换或者被修改).
+ */
+int FileChanged(const char *file, const struct stat *old) {
+  struct stat st;
+  if (stat(file, &st) != 0) return 0;
+  return (st.st_ino != old->st_ino) || (st.st_dev != old->st_dev) || (st.st_size != old->st_size) ||
+         (st.st_mtim.tv_sec != old->st_mtim.tv_sec) || (st.st_mtim.tv_nsec != old->st_mtim.tv_nsec);
+}
+
+/**
+ * ======== CheckReload ========
+ * 模型文件或者索引文件变化时加载新模型并替换current_model;加载失败(比如文件还没写完)时下次再试.
+ */
+void CheckReload() {
+  struct server_model *sm = current_model, *next;
+  if (!FileChanged(model_file, &sm->model_stat) && ((index_file[0] == 0) || !FileChanged(index_file, &sm->index_stat))) return;
+  next = LoadModel();
+  if (next == NULL) return;
+  pthread_mutex_lock(&model_lock);
+  current_model = next;
+  pthread_mutex_unlock(&model_lock);
+  printf("Reloaded model %s: %lld words, generation %lld%s\n", model_file, (long long)next->m.header->words, next->generation,
+   next->has_index ? ", with index" : "");
+  fflush(stdout);
+  ReleaseModel(sm);
+}
+
+/**
+ * ======== OutReserve ========
+ * 在连接的输出缓冲区末尾预留n字节,返回写入位置.
+ */
+char *OutReserve(struct connection *c, long long n) {
+  if (c->out_len + n > c->out_cap) {
+    while (c->out_len + n > c->out_cap) c->out_cap = c->out_cap ? c->out_cap * 2 : READ_SIZE;
+    c->out = (char *)realloc(c->out, c->out_cap);
+  }
+  c->out_len += n;
+  return c->out + c->out_len - n;
+}
+
+void OutPut(struct connection *c, const void *data, long long n) {
+  memcpy(OutReserve(c, n), data, n);
+}
+
+/**
+ * ======== Neighbours ========
+ * row的k个最相似的词(不含row本身),结果写到w->ids / w->score,返回个数.
+ * 有索引时用HNSW,否则扫描所有行:相似度为dot(归一化的查询, 向量) * inv_norm.
+ */
+long long Neighbours(struct worker *w, struct server_model *sm, long long row, int k) {
+  long long a, n = 0, dim = sm->m.header->dim, words = sm->m.header->words;
+  const float *v = w2vm_vector(&sm->m, row);
+  int count = 0;
+  if (sm->has_index) {
+    if (w->ctx_generation != sm->generation) {
+      if (w->ctx_generation != 0) w2vh_ctx_free(&w->ctx);
+      w2vh_ctx_init(&w->ctx, &sm->g);
+      w->ctx_generation = sm->generation;
+    }
+    n = w2vh_search(&sm->g, &w->ctx, v, k + 1, hnsw_ef > k + 1 ? hnsw_ef : k + 1, w->ids, w->score);
+    for (a = 0; a < n; a++) if (w->ids[a] == row) break;
+    if (a < n) {
+      memmove(&w->ids[a], &w->ids[a + 1], (n - a - 1) * sizeof(long long));
+      memmove(&w->score[a], &w->score[a + 1], (n - a - 1) * sizeof(float));
+      n--;
+    }
+    return n < k ? n : k;
+  }
+  for (a = 0; a < dim; a++) w->q[a] = v[a] * sm->inv_norm[row];
+  for (a = 0; a < words; a++) if (a != row)
+    w2vq_heap_push(w->score, w->ids, k, &count, w2vq_dot(w->q, w2vm_vector(&sm->m, a), dim) * sm->inv_norm[a], a);
+  // 按相似度降序排列(插入排序)
+  for (n = 1; n < count; n++) {
+    float s = w->score[n];
+    long long id = w->ids[n];
+    for (a = n; (a > 0) && (w->score[a - 1] < s); a--) {
+      w->score[a] = w->score[a - 1];
+      w->ids[a] = w->ids[a - 1];
+    }
+    w->score[a] = s;
+    w->ids[a] = id;
+  }
+  return count;
+}
+
+/**
+ * ======== HandleRequest ========
+ * 处理一个完整的请求(req之后是size字节的内容),把响应追加到输出缓冲区.
+ */
+void HandleRequest(struct worker *w, struct connection *c, struct server_model *sm, const struct w2vs_request *req, const char *body) {
+  struct w2vs_response resp;
+  long long start = c->out_len, a, b, row, n, dim = sm->m.header->dim;
+  const char *p = body, *end = body + req->size, *word, *result;
+  uint64_t info[4];
+  uint32_t count;
+  int32_t r32;
+  int k = req->k ? req->k : 10;
+  char stats[4096];
+  long long hist[W2VS_OPS][LATENCY_BUCKETS];
+  resp.id = req->id;
+  resp.op = req->op;
+  resp.status = W2VS_OK;
+  resp.count = 0;
+  OutReserve(c, sizeof(resp));
+  // 先检查所有词都完整地在内容中
+  for (a = 0; a < req->count; a++) {
+    word = p;
+    while ((p < end) && (*p != 0)) p++;
+    if (p == end) break;
+    p++;
+  }
+  if ((a < req->count) || (p != end) || (req->op >= W2VS_OPS) || (k > W2VS_MAX_K)) resp.status = W2VS_BAD_REQUEST;
+  else if (req->op == W2VS_OP_INFO) {
+    info[0] = sm->m.header->words;
+    info[1] = dim;
+    info[2] = sm->generation;
+    info[3] = sm->has_index;
+    OutPut(c, info, sizeof(info));
+  } else if (req->op == W2VS_OP_STATS) {
+    SumHistograms(hist);
+    OutPut(c, stats, FormatStats(stats, sizeof(stats), hist, 1e9));
+  } else {
+    resp.count = req->count;
+    for (a = 0, word = body; a < req->count; a++, word += strlen(word) + 1) {
+      row = w2vm_row(&sm->m, word);
+      if (req->op == W2VS_OP_VECTOR) {
+        r32 = row;
+        OutPut(c, &r32, sizeof(r32));
+        if (row >= 0) OutPut(c, w2vm_vector(&sm->m, row), dim * sizeof(float));
+        continue;
+      }
+      n = row >= 0 ? Neighbours(w, sm, row, k) : 0;
+      count = n;
+      OutPut(c, &count, sizeof(count));
+      for (b = 0; b < n; b++) {
+        OutPut(c, &w->score[b], sizeof(float));
+        result = w2vm_word(&sm->m, w->ids[b]);
+        OutPut(c, result, strlen(result) + 1);
+      }
+    }
+  }
+  if (resp.status != W2VS_OK) {
+    c->out_len = start + sizeof(resp);
+    resp.count = 0;
+  }
+  resp.size = c->out_len - start - sizeof(resp);
+  memcpy(c->out + start, &resp, sizeof(resp));
+}
+
+/**
+ * ======== ProcessInput ========
+ * 处理输入缓冲区中所有完整的请求(pipelining),每个请求的延迟(从收到到响应放入输出缓冲区)记入直方图.
+ * 请求过大时返回0,调用者在发出响应后关闭连接.
+ */
+int ProcessInput(struct worker *w, struct connection *c, double received) {
+  struct w2vs_request req;
+  struct w2vs_response resp;
+  struct server_model *sm = NULL;
+  long long pos = 0, ns;
+  int ok = 1;
+  while (c->in_len - pos >= (long long)sizeof(req)) {
+    memcpy(&req, c->in + pos, sizeof(req));
+    if (req.size > W2VS_MAX_FRAME) {
+      memset(&resp, 0, sizeof(resp));
+      resp.id = req.id;
+      resp.op = req.op;
+      resp.status = W2VS_TOO_LARGE;
+      OutPut(c, &resp, sizeof(resp));
+      ok = 0;
+      break;
+    }
+    if (c->in_len - pos < (long long)sizeof(req) + req.size) break;
+    if (sm == NULL) sm = AcquireModel();
+    HandleRequest(w, c, sm, &req, c->in + pos + sizeof(req));
+    pos += sizeof(req) + req.size;
+    ns = (Now() - received) * 1e9;
+    if (req.op < W2VS_OPS) {
+      long long *h = &w->hist[req.op][LatencyBucket(ns > 0 ? ns : 0)];
+      __atomic_store_n(h, *h + 1, __ATOMIC_RELAXED);
+    }
+  }
+  if (sm != NULL) ReleaseModel(sm);
+  memmove(c->in, c->in + pos, c->in_len - pos);
+  c->in_len -= pos;
+  return ok;
+}
+
+void CloseConnection(struct connection *c) {
+  close(c->fd);
+  free(c->in);
+  free(c->out);
+  free(c);
+}
+
+/**
+ * ======== FlushOutput ========
+ * 尽量写出输出缓冲区;写不完时等EPOLLOUT,写完后不再等.返回0表示连接出错.
+ */
+int FlushOutput(struct worker *w, struct connection *c) {
+  struct epoll_event ev;
+  long long n;
+  while (c->out_pos < c->out_len) {
+    n = write(c->fd, c->out + c->out_pos, c->out_len - c->out_pos);
+    if (n > 0) c->out_pos += n;
+    else if ((n < 0) && (errno == EINTR)) continue;
+    else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) break;
+    else return 0;
+  }
+  if (c->out_pos == c->out_len) c->out_pos = c->out_len = 0;
+  if ((c->out_len > 0) != c->want_write) {
+    c->want_write = c->out_len > 0;
+    ev.events = EPOLLIN | (c->want_write ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+  }
+  return 1;
+}
+
+/**
+ * ======== WorkerThread ========
+ * 工作线程的事件循环.
+ */
+void *WorkerThread(void *arg) {
+  struct worker *w = (struct worker *)arg;
+  struct epoll_event events[MAX_EVENTS];
+  struct connection *c;
+  long long n;
+  int a, nev, alive;
+  double received;
+  while (!stopping) {
+    nev = epoll_wait(w->epfd, events, MAX_EVENTS, 500);
+    for (a = 0; a < nev; a++) {
+      c = (struct connection *)events[a].data.ptr;
+      alive = 1;
+      if (events[a].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        // 读到EAGAIN为止,然后处理所有完整的请求
+        while (1) {
+          if (c->in_cap - c->in_len < READ_SIZE) {
+            c->in_cap = c->in_cap * 2 > c->in_len + READ_SIZE ? c->in_cap * 2 : c->in_len + READ_SIZE;
+            c->in = (char *)realloc(c->in, c->in_cap);
+          }
+          n = read(c->fd, c->in + c->in_len, c->in_cap - c->in_len);
+          if (n > 0) c->in_len += n;
+          else if ((n < 0) && (errno == EINTR)) continue;
+          else {
+            if ((n == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) alive = 0;
+            break;
+          }
+        }
+        received = Now();
+        if (!ProcessInput(w, c, received)) {
+          FlushOutput(w, c);
+          alive = 0;
+        }
+      }
+      if (alive) alive = FlushOutput(w, c);
+      if (!alive) CloseConnection(c);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * ======== Listen ========
+ * 创建非阻塞的监听socket:file非空时为Unix domain socket,否则为127.0.0.1:port.
+ */
+int Listen(const char *file, int tcp_port) {
+  struct sockaddr_un un;
+  struct sockaddr_in in;
+  int fd, one = 1;
+  if (file != NULL) {
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strncpy(un.sun_path, file, sizeof(un.sun_path) - 1);
+    unlink(file);
+    if ((fd < 0) || (bind(fd, (struct sockaddr *)&un, sizeof(un)) != 0) || (listen(fd, 128) != 0)) return -1;
+  } else {
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons(tcp_port);
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(fd, (struct sockaddr *)&in, sizeof(in)) != 0) || (listen(fd, 128) != 0)) return -1;
+  }
+  return fd;
+}
+
+void Stop(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+/**
+ * ======== RunServer ========
+ * 主线程:accept连接并轮流分给工作线程,定期检查热加载和输出延迟统计.
+ */
+void RunServer() {
+  struct epoll_event ev, events[2];
+  struct connection *c;
+  int epfd = epoll_create1(0), fds[2], nfds = 0, a, b, fd, next = 0, one = 1;
+  long long hist[W2VS_OPS][LATENCY_BUCKETS], prev[W2VS_OPS][LATENCY_BUCKETS], delta;
+  double last_reload = Now(), last_stats = Now(), start = Now();
+  char stats[4096];
+  current_model = LoadModel();
+  if (current_model == NULL) {
+    printf("ERROR: cannot open model file %s\n", model_file);
+    exit(1);
+  }
+  if ((socket_file[0] != 0) && ((fds[nfds++] = Listen(socket_file, 0)) < 0)) {
+    printf("ERROR: cannot listen on %s\n", socket_file);
+    exit(1);
+  }
+  if ((port > 0) && ((fds[nfds++] = Listen(NULL, port)) < 0)) {
+    printf("ERROR: cannot listen on 127.0.0.1:%d\n", port);
+    exit(1);
+  }
+  if (nfds == 0) {
+    printf("ERROR: give -socket and/or -port\n");
+    exit(1);
+  }
+  for (a = 0; a < nfds; a++) {
+    ev.events = EPOLLIN;
+    ev.data.fd = fds[a];
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fds[a], &ev);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, Stop);
+  signal(SIGTERM, Stop);
+  workers = (struct worker *)calloc(num_workers, sizeof(struct worker));
+  for (a = 0; a < num_workers; a++) {
+    workers[a].epfd = epoll_create1(0);
+    workers[a].q = (float *)malloc(current_model->m.header->dim * sizeof(float));
+    workers[a].score = (float *)malloc((W2VS_MAX_K + 1) * sizeof(float));
+    workers[a].ids = (long long *)malloc((W2VS_MAX_K + 1) * sizeof(long long));
+    pthread_create(&workers[a].tid, NULL, WorkerThread, &workers[a]);
+  }
+  printf("Serving %s: %lld words, %lld dimensions%s, %d worker threads\n", model_file, (long long)current_model->m.header->words,
+   (long long)current_model->m.header->dim, current_model->has_index ? ", HNSW index" : "", num_workers);
+  fflush(stdout);
+  memset(prev, 0, sizeof(prev));
+  while (!stopping) {
+    a = epoll_wait(epfd, events, 2, 200);
+    for (b = 0; b < a; b++) while ((fd = accept4(events[b].data.fd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      c = (struct connection *)calloc(1, sizeof(struct connection));
+      c->fd = fd;
+      ev.events = EPOLLIN;
+      ev.data.ptr = c;
+      epoll_ctl(workers[next].epfd, EPOLL_CTL_ADD, fd, &ev);
+      next = (next + 1) % num_workers;
+    }
+    if ((reload_interval > 0) && (Now() - last_reload >= reload_interval)) {
+      CheckReload();
+      last_reload = Now();
+    }
+    if ((stats_interval > 0) && (Now() - last_stats >= stats_interval)) {
+      // 只统计这段时间内的请求
+      SumHistograms(hist);
+      for (a = 0; a < W2VS_OPS; a++) for (b = 0; b < LATENCY_BUCKETS; b++) {
+        delta = hist[a][b] - prev[a][b];
+        prev[a][b] = hist[a][b];
+        hist[a][b] = delta;
+      }
+      if (FormatStats(stats, sizeof(stats), hist, Now() - last_stats) > 0) {
+        printf("%.0fs:\n%s", Now() - start, stats);
+        fflush(stdout);
+      }
+      last_stats = Now();
+    }
+  }
+  if (socket_file[0] != 0) unlink(socket_file);
+  printf("Stopped\n");
+}
+
+/**
+ * ======== Connect ========
+ * 客户端连接-socket或者127.0.0.1:-port(阻塞socket).
+ */
+int Connect() {
+  struct sockaddr_un un;
+  struct sockaddr_in in;
+  int fd, one = 1;
+  if (socket_file[0] != 0) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strncpy(un.sun_path, socket_file, sizeof(un.sun_path) - 1);
+    if ((fd < 0) || (connect(fd, (struct sockaddr *)&un, sizeof(un)) != 0)) return -1;
+  } else {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons(port);
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((fd < 0) || (connect(fd, (struct sockaddr *)&in, sizeof(in)) != 0)) return -1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+int ReadAll(int fd, void *buf, long long n) {
+  long long r;
+  while (n > 0) {
+    r = read(fd, buf, n);
+    if ((r < 0) && (errno == EINTR)) continue;
+    if (r <= 0) return 0;
+    buf = (char *)buf + r;
+    n -= r;
+  }
+  return 1;
+}
+
+int WriteAll(int fd, const void *buf, long long n) {
+  long long r;
+  while (n > 0) {
+    r = write(fd, buf, n);
+    if ((r < 0) && (errno == EINTR)) continue;
+    if (r <= 0) return 0;
+    buf = (const char *)buf + r;
+    n -= r;
+  }
+  return 1;
+}
+
+int CompareDouble(const void *a, const void *b) {
+  double x = *(double *)a, y = *(double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * ======== RunBench ========
+ * 客户端测试:保持pipeline个请求在途,共发送requests个请求,统计每个请求从发出到收到响应的延迟.
+ */
+void RunBench(long long requests, int k, int batch, int pipeline) {
+  struct w2vs_request req;
+  struct w2vs_response resp;
+  char **words = NULL, line[MAX_STRING], *frame, *body = NULL;
+  long long nwords = 0, cap = 0, sent = 0, done = 0, missing = 0, errors = 0, a, len;
+  double *sent_at = (double *)malloc(requests * sizeof(double)), *lat = (double *)malloc(requests * sizeof(double)), start;
+  int fd = Connect(), op = strcmp(op_name, "neighbours") ? W2VS_OP_VECTOR : W2VS_OP_NEIGHBOURS, b;
+  uint64_t info[4];
+  uint32_t count;
+  int32_t row;
+  FILE *fi = fopen(query_file, "rb");
+  if (fd < 0) {
+    printf("ERROR: cannot connect to the server\n");
+    exit(1);
+  }
+  if (fi == NULL) {
+    printf("ERROR: cannot open query file %s\n", query_file);
+    exit(1);
+  }
+  while (fgets(line, MAX_STRING, fi) != NULL) {
+    line[strcspn(line, " \t\r\n")] = 0;
+    if (line[0] == 0) continue;
+    if (nwords == cap) words = (char **)realloc(words, (cap = cap * 2 + 1024) * sizeof(char *));
+    words[nwords++] = strdup(line);
+  }
+  fclose(fi);
+  if (nwords == 0) {
+    printf("ERROR: no words in %s\n", query_file);
+    exit(1);
+  }
+  // 先查询模型信息,解析向量响应需要维度
+  memset(&req, 0, sizeof(req));
+  req.op = W2VS_OP_INFO;
+  if (!WriteAll(fd, &req, sizeof(req)) || !ReadAll(fd, &resp, sizeof(resp)) || (resp.status != W2VS_OK) ||
+   (resp.size != sizeof(info)) || !ReadAll(fd, info, sizeof(info))) {
+    printf("ERROR: cannot query the server\n");
+    exit(1);
+  }
+  printf("Server model: %lld words, %lld dimensions, generation %lld%s\n", (long long)info[0], (long long)info[1], (long long)info[2],
+   info[3] ? ", HNSW index" : "");
+  frame = (char *)malloc(sizeof(req) + batch * MAX_STRING);
+  start = Now();
+  while (done < requests) {
+    // 发送到在途请求数达到pipeline
+    while ((sent < requests) && (sent - done < pipeline)) {
+      len = 0;
+      for (b = 0; b < batch; b++) {
+        strcpy(frame + sizeof(req) + len, words[(sent * batch + b) % nwords]);
+        len += strlen(words[(sent * batch + b) % nwords]) + 1;
+      }
+      req.size = len;
+      req.id = sent;
+      req.op = op;
+      req.k = k;
+      req.count = batch;
+      memcpy(frame, &req, sizeof(req));
+      sent_at[sent++] = Now();
+      if (!WriteAll(fd, frame, sizeof(req) + len)) {
+        printf("ERROR: connection closed\n");
+        exit(1);
+      }
+    }
+    if (!ReadAll(fd, &resp, sizeof(resp))) {
+      printf("ERROR: connection closed\n");
+      exit(1);
+    }
+    body = (char *)realloc(body, resp.size + 1);
+    if (!ReadAll(fd, body, resp.size)) {
+      printf("ERROR: connection closed\n");
+      exit(1);
+    }
+    lat[done++] = Now() - sent_at[resp.id];
+    if (resp.status != W2VS_OK) errors++;
+    else for (a = 0, len = 0; a < resp.count; a++) {
+      // 统计不在词典中的词
+      if (op == W2VS_OP_VECTOR) {
+        memcpy(&row, body + len, sizeof(row));
+        len += sizeof(row) + (row >= 0 ? info[1] * sizeof(float) : 0);
+        if (row < 0) missing++;
+      } else {
+        memcpy(&count, body + len, sizeof(count));
+        len += sizeof(count);
+        for (b = 0; b < (int)count; b++) len += sizeof(float) + strlen(body + len + sizeof(float)) + 1;
+        if (count == 0) missing++;
+      }
+    }
+  }
+  start = Now() - start;
+  qsort(lat, requests, sizeof(double), CompareDouble);
+  printf("%lld requests (%d words each, pipeline %d) in %.3fs: %.0f requests/sec, %.0f words/sec\n", requests, batch, pipeline, start,
+   requests / start, requests * batch / start);
+  printf("Latency p50 %.1fus, p99 %.1fus, p99.9 %.1fus, max %.1fus; %lld errors, %lld unknown words\n", lat[requests / 2] * 1e6,
+   lat[requests * 99 / 100] * 1e6, lat[requests * 999 / 1000] * 1e6, lat[requests - 1] * 1e6, errors, missing);
+  close(fd);
+  for (a = 0; a < nwords; a++) free(words[a]);
+  free(words);
+  free(frame);
+  free(body);
+  free(sent_at);
+  free(lat);
+}
+
+int main(int argc, char **argv) {
+  int i, k = 10, batch = 1, pipeline = 16;
+  long long bench = 0;
+  if (argc == 1) {
+    printf("Local word vector lookup server\n\n");
+    printf("Options:\n");
+    printf("\t-model <file>\n");//.w2vm模型文件,文件被替换时自动重新加载
+    printf("\t\tModel written by word2vec -binary 2; reloaded automatically when the file is replaced\n");
+    printf("\t-index <file>\n");//HNSW索引文件(可选)
+    printf("\t\tOptional HNSW index (word2vec -hnsw) used for neighbour queries; reloaded like the model\n");
+    printf("\t-socket <file>\n");//Unix domain socket路径
+    printf("\t\tListen on the Unix domain socket <file>\n");
+    printf("\t-port <int>\n");//127.0.0.1上的TCP端口,默认0(不监听)
+    printf("\t\tListen on 127.0.0.1:<int>; default is 0 (off)\n");
+    printf("\t-threads <int>\n");//工作线程数,默认4
+    printf("\t\tUse <int> worker threads (default 4)\n");
+    printf("\t-ef <int>\n");//HNSW查询的候选集大小,默认100
+    printf("\t\tCandidate list size for HNSW queries; default is 100\n");
+    printf("\t-reload-interval <float>\n");//检查模型文件的间隔,默认1秒
+    printf("\t\tSeconds between checks for a new model file; default is 1, 0 = never\n");
+    printf("\t-stats-interval <float>\n");//输出延迟统计的间隔,默认10秒
+    printf("\t\tSeconds between latency reports; default is 10, 0 = never\n");
+    printf("\t-bench <int>\n");//客户端测试模式:发送<int>个请求并统计延迟
+    printf("\t\tRun as a benchmark client instead: send <int> requests to -socket or -port and report latencies\n");
+    printf("\t-queries <file>\n");//测试请求中的词,每行一个
+    printf("\t\tWords used by -bench, one per line\n");
+    printf("\t-op <string>\n");//测试请求类型:vector或者neighbours,默认vector
+    printf("\t\tRequest type used by -bench: vector or neighbours; default is vector\n");
+    printf("\t-k <int>\n");//neighbours的近邻数,默认10
+    printf("\t\tNeighbours per word for -op neighbours; default is 10\n");
+    printf("\t-batch <int>\n");//每个请求的词数,默认1
+    printf("\t\tWords per request for -bench; default is 1\n");
+    printf("\t-pipeline <int>\n");//同时在途的请求数,默认16
+    printf("\t\tRequests in flight for -bench; default is 16\n");
+    printf("\nExamples:\n");
+    printf("./word2vec-server -model vec.w2vm -index vec.hnsw -socket /tmp/word2vec.sock -threads 4\n");
+    printf("./word2vec-server -socket /tmp/word2vec.sock -bench 100000 -queries words.txt -op neighbours\n\n");
+    return 0;
+  }
+  model_file[0] = 0;
+  index_file[0] = 0;
+  socket_file[0] = 0;
+  query_file[0] = 0;
+  strcpy(op_name, "vector");
+  if ((i = ArgPos((char *)"-model", argc, argv)) > 0) strcpy(model_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-index", argc, argv)) > 0) strcpy(index_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-socket", argc, argv)) > 0) strcpy(socket_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-port", argc, argv)) > 0) port = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) num_workers = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-ef", argc, argv)) > 0) hnsw_ef = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-reload-interval", argc, argv)) > 0) reload_interval = atof(argv[i + 1]);
+  if ((i = ArgPos((char *)"-stats-interval", argc, argv)) > 0) stats_interval = atof(argv[i + 1]);
+  if ((i = ArgPos((char *)"-bench", argc, argv)) > 0) bench = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-queries", argc, argv)) > 0) strcpy(query_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-op", argc, argv)) > 0) strcpy(op_name, argv[i + 1]);
+  if ((i = ArgPos((char *)"-k", argc, argv)) > 0) k = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-batch", argc, argv)) > 0) batch = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-pipeline", argc, argv)) > 0) pipeline = atoi(argv[i + 1]);
+  if (num_workers < 1) num_workers = 1;
+  if (batch < 1) batch = 1;
+  if (pipeline < 1) pipeline = 1;
+  if (bench > 0) RunBench(bench, k, batch, pipeline);
+  else RunServer();
+  return 0;
+}
@@ -0,0 +1,61 @@
+//  word2vec-server.h: word2vec-server的二进制协议
+//
+//  请求和响应都是"固定16字节的头 + 变长内容",整数为小端,向量为float32.
+//  一个连接上可以连续发送多个请求而不等待响应(pipelining),服务器按请求顺序返回响应,id原样带回.
+//  一个请求可以包含多个词(批量查询),响应中的结果和请求中的词一一对应.
+//
+//  请求内容:count个以'\0'结尾的词.
+//  响应内容(status为W2VS_OK时):
+//    W2VS_OP_INFO        uint64_t words, dim, generation(模型重新加载的次数),has_index(是否有HNSW索引)
+//    W2VS_OP_VECTOR      每个词:int32_t行号(-1表示不在词典中),行号不是-1时接着dim个float;
+//                        模型有哈希桶时不在词典中的词返回所在桶的行号(>= words)和向量
+//    W2VS_OP_NEIGHBOURS  每个词:uint32_t结果数n,然后n个{float相似度, 以'\0'结尾的词},按相似度降序;k为0时取10
+//    W2VS_OP_STATS       文本格式的统计信息(请求数,每种请求的延迟分位数)
+//  status不是W2VS_OK时没有内容;请求的size超过W2VS_MAX_FRAME时服务器返回W2VS_TOO_LARGE并关闭连接.
+
+#ifndef WORD2VEC_SERVER_H
+#define WORD2VEC_SERVER_H
+
+#include <stdint.h>
+
+#define W2VS_MAX_FRAME (1 << 20)
+#define W2VS_MAX_K 1000
+
+#define W2VS_OP_INFO 0
+#define W2VS_OP_VECTOR 1
+#define W2VS_OP_NEIGHBOURS 2
+#define W2VS_OP_STATS 3
+#define W2VS_OPS 4
+
+#define W2VS_OK 0
+#define W2VS_BAD_REQUEST 1
+#define W2VS_TOO_LARGE 2
+
+/*
+ * ======== w2vs_request ========
+ *   size - 头之后内容的字节数
+ *   id - 客户端自己编号,响应中原样返回
+ *   op - W2VS_OP_*
+ *   k - W2VS_OP_NEIGHBOURS每个词返回的近邻数,最多W2VS_MAX_K
+ *   count - 词数
+ */
+struct w2vs_request {
+  uint32_t size, id;
+  uint16_t op, k;
+  uint32_t count;
+};
+
+/*
+ * ======== w2vs_response ========
+ *   size - 头之后内容的字节数
+ *   id, op - 和请求相同
+ *   status - W2VS_OK, W2VS_BAD_REQUEST, W2VS_TOO_LARGE
+ *   count - 结果数,等于请求的词数
+ */
+struct w2vs_response {
+  uint32_t size, id;
+  uint16_t op, status;
+  uint32_t count;
+};
+
+#endif
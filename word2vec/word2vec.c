@@ -16,13 +16,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <linux/perf_event.h>
+#include "word2vec-model.h"
+#include "word2vec-query.h"
+#include "word2vec-hnsw.h"
+#include "word2vec-pq.h"
 
 #define MAX_STRING 100 // 指定路径长度,最大为100 char;单个词的最大长度
 #define EXP_TABLE_SIZE 1000 // 取值范围等距切分,切分粒度;将[-6,6)切分成EEXP_TABLE_SIZE份
 #define MAX_EXP 6 //sigmoid 自变量取值范围
 #define MAX_SENTENCE_LENGTH 1000 // 单句最大长度;用于对语料库中句子进行切分,如果句子长度太长的话;
 #define MAX_CODE_LENGTH 40 //huffman编码最大长度;Huffman Tree叶子结点编码
+#define LOSS_SAMPLE 64 // 每LOSS_SAMPLE个中心词抽样计算一次loss,loss只用于监控,不参与训练
 
 /*
  * The size of the hash table for the vocabulary.
@@ -55,19 +70,17 @@ struct vocab_word {
 };
 
 /*
- * ======== Global Variables ========
+ * ======== Parameters and State ========
+ * 以下各节说明训练的参数和中间状态,它们都是struct word2vec(见下文)的成员.
  * train_file: 用来指定训练语料文本存储地址,存储路径,for example: /home/xxx/text8
  * output_file: 词向量保存文件路径
 */
-char train_file[MAX_STRING], output_file[MAX_STRING];
-char save_vocab_file[MAX_STRING], read_vocab_file[MAX_STRING];
 
 /*
  * ======== vocab ========
  * This array will hold all of the words in the vocabulary.
  * This is internal state.
  */
-struct vocab_word *vocab;//词典
 
 /* 
  * 运行选择参数
@@ -80,13 +93,11 @@ struct vocab_word *vocab;//词典
  * num_threads: 线程数,多线程运行;
  * min_reduce: 
 */
-int binary = 0, cbow = 1, debug_mode = 2, window = 5, min_count = 5, num_threads = 12, min_reduce = 1;
 
 /*
  * ======== vocab_hash ========
  * 存储字典的hash值,键为word的hash code,值为word在词典中的下标index;
  */
-int *vocab_hash;
 
 /*
  * ======== vocab_max_size ========
@@ -102,12 +113,15 @@ int *vocab_hash;
  * This is the number of features in the word vectors.
  * It is the number of neurons in the hidden layer of the model.
  */
-long long vocab_max_size = 1000, vocab_size = 0, layer1_size = 100;
 
 /*
  *
  */
-long long train_words = 0, word_count_actual = 0, iter = 5, file_size = 0, classes = 0;
+/*
+ * ======== sample_words ========
+ * 降采样计算词频时用的总词数.通常等于train_words;
+ * 增量训练时词频是旧模型和新语料合并后的,train_words只是新语料的词数(决定学习率衰减),两者不同.
+ */
 
 /*
  * ======== alpha ========
@@ -123,24 +137,658 @@ long long train_words = 0, word_count_actual = 0, iter = 5, file_size = 0, class
  * Set 'sample' to 0 to disable subsampling.
  * See the comments in the subsampling section for more details.
  */
-real alpha = 0.025, starting_alpha, sample = 1e-3;
 /*
  * syn0: 词向量数组
  * syn1: 参数数组
  * syn1neg: negative sampling 采样样本集
  * expTable: negative sampling中用到的带权采样表
 */
-real *syn0, *syn1, *syn1neg, *expTable;
-clock_t start;
 /*
  * hs:hierarchical softmax;
  * negative: 默认negative sampling采样样本数目;
  * table_size: [0,1]等距划分数目;
  * table: 采样转换表, input: random number, output: the index of the sampling word in the vocabulary.
 */
-int hs = 0, negative = 5;
 const int table_size = 1e8;
-int *table;
+
+/*
+ * ======== Chunk Scheduler ========
+ * 语料不再按线程数静态切分,而是切成num_chunks个小块,所有线程从同一个原子计数器领取;
+ * 快线程自然多领几块,不会出现快线程提前结束空等最慢线程的情况.
+ *
+ * num_chunks: 块数,0表示自动取num_threads * 32;
+ * chunk_start: 每个块的起始偏移,对齐到词首(前一个字符是分隔符),共num_chunks + 1项,最后一项为file_size;
+ * next_chunk: 全局领取计数,第k次领取对应第k / num_chunks轮(epoch)的第k % num_chunks块,
+ *             计数达到iter * num_chunks时全部训练完成;
+ * thread_finish: 每个线程退出时的时间,用于统计线程空闲时间;
+ * thread_chunks: 每个线程处理的块数.
+ */
+
+/*
+ * ======== thread_stat ========
+ * 每个训练线程的统计计数,只有所属线程写,监控线程MonitorThread定期读取汇总,不需要加锁.
+ * 按cache line(64字节)对齐,每个线程独占一行,避免相邻线程的计数落在同一cache line上产生伪共享(false sharing).
+ *
+ *   words - 已处理的词数
+ *   loss - 抽样样本的loss累计(负对数似然)
+ *   loss_count - 抽样样本数(每个二分类算一个样本)
+ *   alpha - 线程当前的学习率
+ *   chunk - 线程正在处理的块的领取序号(见next_chunk),-1表示没有;检查点据此记录未完成的块
+ *   chunk_pos - 线程在该块中已读到的文件位置
+ */
+struct thread_stat {
+  long long words, loss_count, chunk, chunk_pos;
+  double loss;
+  real alpha;
+} __attribute__((aligned(64)));
+
+/*
+ * ======== Telemetry ========
+ * telemetry: JSON lines输出文件,-telemetry指定,一行一个事件,方便画图;
+ * telemetry_interval: 监控线程汇总输出的间隔(秒,按墙上时间);
+ * train_start: 训练开始时间(墙上时间);
+ * training_done: 训练线程全部结束后置1,通知监控线程退出;
+ * phase_start: 当前阶段开始时间,见PhaseBegin/PhaseEnd.
+ */
+#define PHASE_VOCAB 0
+#define PHASE_INIT 1
+#define PHASE_TABLE 2
+#define PHASE_TRAIN 3
+#define PHASE_SAVE 4
+#define PHASE_PHRASE 5
+#define PHASE_COUNT 6
+const char *phase_names[PHASE_COUNT] = {"vocab", "init", "table", "train", "save", "phrase"};
+
+/*
+ * ======== Hardware Performance Counters ========
+ * -perf 1 时用perf_event_open统计每个阶段和每个训练线程的硬件计数:
+ * cycles, instructions, LLC misses(syn1neg等大矩阵的cache miss), dTLB misses(unigram table等大数组的TLB miss),
+ * branch misses(MAX_EXP截断等分支预测失败).
+ *
+ * perf_fds: 进程级计数器,inherit=1,之后创建的线程(训练线程)结束后计数会累加进来,用于分阶段统计;
+ * perf_base: 阶段开始时的计数,阶段计数 = 结束时计数 - perf_base;
+ *            (继承来的子线程计数不会被PERF_EVENT_IOC_RESET清零,所以用差值而不是reset)
+ * perf_phase: 每个阶段的计数,-1表示该计数器不可用;
+ * perf_thread: 每个训练线程的计数,num_threads * PERF_EVENTS.
+ * PERF_CYCLES等是各计数器在计数数组(以及perf_names)中的下标.
+ */
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_LLC_MISSES 2
+#define PERF_DTLB_MISSES 3
+#define PERF_BRANCH_MISSES 4
+#define PERF_EVENTS 5
+const char *perf_names[PERF_EVENTS] = {[PERF_CYCLES] = "cycles", [PERF_INSTRUCTIONS] = "instructions", [PERF_LLC_MISSES] = "llc-misses",
+                                       [PERF_DTLB_MISSES] = "dtlb-misses", [PERF_BRANCH_MISSES] = "branch-misses"};
+
+/*
+ * ======== Checkpoint ========
+ * -checkpoint <file> 时,监控线程每隔checkpoint_interval秒fork一个子进程写检查点:
+ * fork得到的是训练状态在这一时刻的写时复制(copy-on-write)快照,子进程慢慢写盘,训练线程只在fork的瞬间受影响;
+ * 子进程先写<file>.tmp,写完再rename,任何时刻<file>都是一个完整的检查点.
+ *
+ * 检查点内容: checkpoint_header,词典(词频,词),syn0(vocab_rows行),syn1(hs),syn1neg(negative,vocab_rows行),
+ * 以及未完成的块(领取序号,已读到的位置):先是每个线程正在处理的块(threads项),再是恢复后还没有重新分配出去的块(pending项).
+ * 领取序号小于next_chunk且不在其中的块都已训练完;恢复时这些未完成的块放进pending_chunk/pending_pos,
+ * GetChunk优先分配,从记录的位置继续读,然后再从next_chunk继续领取.
+ * 领取块和登记到thread_stat在chunk_lock内完成,fork也在chunk_lock内进行,快照中不会有已领取但还没登记的块.
+ *
+ * resume: -resume 1 时从checkpoint_file恢复训练;
+ * resumed_words: 恢复时检查点中已训练的词数,进度按它继续计算,吞吐量只统计本次训练的词;
+ * checkpoint_offset, checkpoint_inflight: 读检查点时词典之后的文件偏移和记录的未完成块数,见ReadCheckpointWeights.
+ */
+#define CHECKPOINT_MAGIC "W2VCKPT"
+#define CHECKPOINT_VERSION 5
+struct checkpoint_header {
+  char magic[8];
+  int version, hs, negative, cbow, window, threads;
+  long long vocab_size, layer1_size, train_words, file_size, iter, num_chunks, next_chunk, word_count_actual, sample_words;
+  real alpha, starting_alpha;
+  long long buckets, bucket_words, shuffle, pending;
+};
+
+/*
+ * ======== Incremental Training ========
+ * -save-model <file>: 训练结束后把词典(含词频)和权重按检查点格式保存,供之后增量训练;
+ * -load-model <file>: 在新语料(-train)上继续训练已有模型,不从头训练:
+ *   新语料中达到min_count的新词追加到词典,旧词的词频加上新语料中的词频,合并后重新按词频排序;
+ *   旧词的syn0/syn1neg按新的行号搬过去,新词随机初始化;Huffman树和unigram table按合并后的词频重建,
+ *   syn1(hs)的行对应Huffman树的内部结点,树变了无法对应,所以清零重新训练.
+ *   学习率没有用-alpha指定时,从旧模型初始学习率的一半开始衰减,衰减进度只按新语料的词数计算.
+ *
+ * model_row: 旧模型第i行在合并后词典中的行号;
+ * model_size, model_hs, model_negative, model_offset: 旧模型的词数,结构,以及权重在文件中的偏移.
+ */
+
+/*
+ * ======== Text Export ========
+ * export_precision: 文本输出的小数位数,默认6,和原来的"%lf"完全相同;0表示输出能读回同一个float的最短十进制表示.
+ */
+
+/*
+ * ======== K-means ========
+ * -classes > 0 时对词向量做球面k-means:按和质心的余弦相似度分配类别,质心取类内词向量的均值再归一化.
+ * kmeans_iter: 最多迭代次数,所有词的类别都不再变化时提前结束;
+ * kmeans_seed: k-means++初始化的随机数种子;
+ * kmeans_batch: 大于0时改用mini-batch k-means,每批随机取kmeans_batch个词,适合几万以上的类别数,见KMeansMiniBatch;
+ * kmeans_probe: mini-batch模式下近似最近质心索引每次查找扫描的质心组数.
+ */
+
+/*
+ * ======== Query ========
+ * -queries <file>: 训练结束后在syn0上回答文件中的相似词/类比查询,见word2vec-query.h;
+ * query_topk: 每个查询返回的词数;query_batch: 每批查询数.
+ */
+
+/*
+ * ======== HNSW ========
+ * -hnsw <file>: 训练结束后在syn0上构建HNSW近似最近邻索引并保存,见word2vec-hnsw.h;
+ * hnsw_m: 每个结点每层的最大邻居数(第0层为2倍);hnsw_ef: 构建时的候选集大小,越大索引质量越好,构建越慢.
+ */
+
+/*
+ * ======== PQ ========
+ * -pq <file>: 训练结束后把归一化的词向量用乘积量化压缩,保存码本和每个词pq_m字节的编码,见word2vec-pq.h;
+ * pq_m: 段数(每个词的字节数);pq_iter: 每段k-means的迭代次数;pq_train: 训练码本用的词数(均匀抽取),0表示全部.
+ */
+
+/*
+ * ======== PCA ========
+ * -pca <file>: 训练结束后用PCA把词向量降到pca_dim维,按-binary指定的格式写到文件;
+ * -pca-matrix <file>: 投影矩阵(均值和前pca_dim个主成分)的输出文件,默认为<-pca文件>.proj.
+ * pca_mean: 每维的均值;pca_comp: 主成分矩阵(pca_dim x layer1_size);
+ * pca_task: 每个线程处理一段连续的词[first, last),协方差cov(上三角)是线程私有的部分和,最后再汇总.
+ */
+#define PCA_BLOCK 64
+struct pca_task {
+  struct word2vec *wv;
+  long long first, last;
+  double *cov;
+};
+
+/*
+ * ======== Phrases ========
+ * -phrase <float> 大于0时,建词典之前先多线程统计语料中的词频和相邻词对的频次,
+ * 得分 (cn(ab) - min_count) / cn(a) / cn(b) * phrase_words 超过阈值的词对作为短语(和word2phrase相同的公式);
+ * 之后建词典和训练读语料时,相邻两个词是短语就合并成一个词"a_b",不需要先用word2phrase生成中间文件.
+ *
+ * phrase_threshold: 得分阈值,0表示不识别短语;phrase_words: 统计到的总词数;
+ * phrases: 短语表,key为"a b"(空格不会出现在词中,和本来就带下划线的词区分开);
+ * phrase_table: 开放寻址哈希表(hash_size为2的幂),统计时每个线程一个,超过70%时像ReduceVocab一样删掉频次小于reduce的项;
+ * phrase_task: 统计线程的参数,从phrase_next领取块;
+ * phrase_reader: 读语料的状态,当前块和预读的下一个词,见ReadToken.
+ */
+#define PHRASE_HASH_SIZE (1 << 21)
+struct phrase_entry {
+  char *word;
+  long long cn;
+};
+struct phrase_table {
+  struct phrase_entry *entries;
+  int *hash;
+  long long size, hash_size, reduce;
+};
+struct phrase_task {
+  struct word2vec *wv;
+  struct phrase_table table;
+  long long words, parts, *start;
+};
+struct phrase_reader {
+  long long chunk, next_pos;
+  int has_next;
+  char next[MAX_STRING];
+};
+
+/*
+ * ======== Hash Buckets ========
+ * -buckets <int> 大于0时,词频低于bucket_min_count的词不再各占一行,而是按哈希值共用bucket_count行:
+ * 词典按词频降序,前bucket_words个词的行号就是词典下标,其余的词在第bucket_words + w2vm_hash(word) % bucket_count行.
+ * syn0和syn1neg只有vocab_rows = bucket_words + bucket_count行,长尾的词不用min_count丢掉,内存也不随词典增长;
+ * -binary 2输出的模型只保存前bucket_words个词,其余的词(包括训练时没见过的词)查询时按同样的哈希找到桶,见w2vm_row.
+ * syn1(hs)的行是Huffman树的内部结点,不分桶.
+ *
+ * word_row: 每个词在syn0/syn1neg中的行号,不分桶时就是词典下标,见InitRows.
+ */
+
+/*
+ * ======== Huge Pages ========
+ * syn0, syn1neg和1e8项的unigram table都是随机访问的大数组,4KB的页TLB装不下,训练时大量时间花在页表遍历上;
+ * 用HugeAlloc分配,尽量用2MB(或1GB)的大页,见HugeAlloc.
+ * huge_pages: 0为普通的posix_memalign,1为2MB大页(默认),2为先尝试1GB大页;
+ * huge_blocks: HugeAlloc分配的区域和映射长度(-1表示posix_memalign分配的),HugeFree据此释放.
+ */
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define HUGE_PAGE_2M (2LL << 20)
+#define HUGE_PAGE_1G (1LL << 30)
+#define HUGE_BLOCKS 16
+struct huge_block {
+  void *base;
+  long long size;
+};
+
+/*
+ * ======== Out of Core ========
+ * 词典很大时(3000万词 x 300维),syn0 + syn1neg超过内存,用-ooc-dir把低频词的行放到本地盘上的映射文件中,见OocAlloc.
+ * ooc_dir: 映射文件所在目录,空表示不启用;
+ * ooc_memory: syn0和syn1neg的头部(高频词的行)一共可以使用的内存(MB);ooc_head: 由此算出的每个矩阵在内存中的行数;
+ * ooc_writeback: 尾部脏页写回的间隔(秒);ooc_tail: 各矩阵的尾部映射;
+ * ooc_faults: 训练开始时的major fault数,训练结束时报告训练期间的缺页数.
+ * syn1(hierarchical softmax的内部节点)不按词频排列,仍然全部在内存中.
+ */
+struct ooc_map {
+  char *base;
+  long long size;
+};
+
+/*
+ * ======== Models ========
+ * -models时一次读语料同时训练多个模型(超参数搜索):词典,unigram table,Huffman树和降采样共用,
+ * 每个句子只读一次,依次交给每个模型的训练函数.
+ * train_model: 一个模型的参数和权重;TrainCbowWord / TrainSkipGramWord只从这里取,不读wv中对应的成员,
+ *              所以同一个线程可以交替训练多个模型;初始化和保存等其余代码仍然使用wv中的成员,用SetModel / GetModel切换.
+ * models, num_models: 所有模型;没有-models时只有一个,即命令行参数指定的模型.
+ */
+struct train_model {
+  int cbow, hs, negative, window;
+  long long layer1_size;
+  real alpha;
+  real *syn0, *syn1, *syn1neg;
+  char output_file[MAX_STRING];
+};
+
+/*
+ * ======== Library ========
+ * word2vec-lib.c(见word2vec.h)在调用方进程中训练时使用:
+ * train_data, train_data_size: 内存中的语料,非NULL时代替train_file,见OpenTrainFile;
+ * sentence_fn, sentence_arg: 逐句提供语料的回调,非NULL时代替train_file和train_data,训练时边读边训练,
+ *                            语料不复制到内存中;sentence_fn(arg, NULL)回到第一句,见ReadSentence;
+ * sentence_pass: 回调语料已读完的轮数;
+ * in_memory: 非0时不写输出文件,训练结果留在每个模型的syn0中,由调用方读取.
+ */
+
+/*
+ * ======== Block Shuffle ========
+ * -shuffle 1 时每一轮(epoch)按不同的伪随机排列访问语料块,而不是每轮都从头到尾按同样的顺序读:
+ * 按日期,来源排序的语料主题是聚集的,顺序读时一段时间内只看到同一类文本,收敛慢;
+ * 块的排列由固定的种子生成,同样的参数结果可以复现,检查点恢复后排列也相同.
+ *
+ * SHUFFLE_BLOCK: 打乱时自动切块的目标块大小,块数至少为num_threads * 32,见InitChunks;
+ * chunk_order: 第k次领取对应的块号,共iter * num_chunks项,没有打乱时为NULL(块号为k % num_chunks);
+ * prefetch_blocks: 领取一个块时用posix_fadvise(POSIX_FADV_WILLNEED)预读之后第prefetch_blocks次领取的块,
+ *                  随机读的I/O和训练重叠;-1表示取num_threads(每个线程下一次领取的块都已在预读),0表示不预读;
+ * epoch_blocks: 每一轮已训练完的块数,达到num_chunks时这一轮结束;
+ * epoch_end: 每一轮结束的时间(相对train_start的秒数),监控线程据此输出每轮耗时,0表示还没有结束,-1表示恢复前已经结束.
+ */
+#define SHUFFLE_BLOCK (4 << 20)
+
+/*
+ * ======== Evaluation ========
+ * -eval <file> 时训练过程中在后台线程评估syn0的快照,训练线程不停下来;分数不再上升时可以提前结束训练.
+ * 测试集每行一题,词按词典原样匹配(区分大小写):
+ *   a b c d   - 类比题,b - a + c最相似的词(不含a, b, c)是d为正确,分数为正确率,和compute-accuracy相同;
+ *   a b score - 相似度题,分数为词对的余弦相似度和人工分数score的Spearman秩相关系数;
+ *   以':'开头的行(类比题的分组标题)和空行跳过.
+ * 两种题都有时,综合分数score取两者的平均.
+ *
+ * eval_every: 每训练eval_every轮(可以是小数)评估一次,训练结束后再评估一次;
+ * eval_vocab: 只用词频最高的eval_vocab个词(题目中的词和候选词),0表示整个词典,默认30000和compute-accuracy相同;
+ * eval_threads: 评估线程数,类比题按批(query_batch)用word2vec-query.h的引擎多线程打分;
+ * eval_patience: 连续eval_patience次评估分数没有比最好的分数高出eval_min_delta时提前结束训练,0表示不提前结束;
+ * eval_target: 分数达到eval_target时提前结束训练,0表示不设目标;
+ * eval_rows: 参与评估的行数(快照的行数);
+ * eval_question: 类比题的词下标,每题4个;eval_pair, eval_human: 相似度题的词下标(每题2个)和人工分数;
+ * eval_busy: 后台评估线程正在运行;training_stop: 置1后训练线程不再领取新块,尽快结束.
+ */
+struct eval_result {
+  double time, epochs, analogy, similarity, score;
+};
+
+/**
+ * ======== word2vec ========
+ * 一次训练的全部状态:上面各节说明的参数和中间结果都是它的成员,默认值见NewWord2vec.
+ * 引擎函数的第一个参数wv就是它,同一个进程中可以有多个互不影响的训练(word2vec-lib.c就是这样在调用方进程中训练的).
+ *
+ * fail, error: 出错时Fail把信息写到error,longjmp回到调用方setjmp(fail)的地方,不调用exit;
+ *              只能在调用setjmp的线程中调用Fail,其余线程出错时置标志,由主线程报告.
+ */
+struct word2vec {
+  // 文件
+  char train_file[MAX_STRING], output_file[MAX_STRING];
+  char save_vocab_file[MAX_STRING], read_vocab_file[MAX_STRING];
+  char telemetry_file[MAX_STRING], checkpoint_file[MAX_STRING];
+  char load_model_file[MAX_STRING], save_model_file[MAX_STRING];
+  char query_file[MAX_STRING], query_output_file[MAX_STRING], hnsw_file[MAX_STRING], pq_file[MAX_STRING];
+  char pca_file[MAX_STRING], pca_matrix_file[MAX_STRING];
+
+  // 词典和运行参数
+  struct vocab_word *vocab;
+  int binary, cbow, debug_mode, window, min_count, num_threads, min_reduce;
+  int *vocab_hash;
+  long long vocab_max_size, vocab_size, layer1_size;
+  long long train_words, word_count_actual, iter, file_size, classes;
+  long long sample_words;
+  real alpha, starting_alpha, sample;
+  real *syn0, *syn1, *syn1neg, *expTable;
+  int hs, negative;
+  int *table;
+
+  // Chunk Scheduler
+  long long num_chunks, *chunk_start, next_chunk, *thread_chunks;
+  double *thread_finish;
+  struct thread_stat *thread_stats;
+
+  // Telemetry
+  FILE *telemetry;
+  real telemetry_interval;
+  double train_start, phase_start, phase_seconds[PHASE_COUNT];
+  volatile int training_done;
+
+  // Hardware Performance Counters
+  int perf_mode, perf_fds[PERF_EVENTS];
+  long long perf_base[PERF_EVENTS], perf_phase[PHASE_COUNT][PERF_EVENTS], *perf_thread;
+
+  // Checkpoint
+  real checkpoint_interval;
+  int resume;
+  long long checkpoint_inflight;
+  pthread_mutex_t chunk_lock;
+  long long *pending_chunk, *pending_pos, pending_count, pending_next, resumed_words, checkpoint_offset;
+
+  // Incremental Training
+  long long *model_row, model_size, model_offset;
+  int model_hs, model_negative;
+
+  // Text Export
+  int export_precision;
+
+  // K-means, 以及K-means Engine和Mini-batch K-means中的中间结果
+  int kmeans_iter, kmeans_batch, kmeans_probe;
+  unsigned long long kmeans_seed;
+  real *kmeans_cent, *kmeans_inv_norm;
+  double *kmeans_dist;
+  int *kmeans_cl;
+  long long kmeans_next;
+  struct kmeans_task *kmeans_tasks;
+  real *kmeans_mean, *kmeans_coarse;
+  long long *kmeans_seen, kmeans_nlist, *kmeans_list_start, *kmeans_list_ids, *kmeans_owner, *kmeans_items;
+  int *kmeans_item_cl;
+
+  // Query, HNSW, PQ, PCA
+  int query_topk, query_batch;
+  int hnsw_m, hnsw_ef;
+  int pq_m, pq_iter;
+  long long pq_train;
+  int pca_dim;
+  double *pca_mean;
+  real *pca_comp, *pca_out;
+
+  // Phrases
+  real phrase_threshold;
+  long long phrase_words, phrase_next;
+  struct phrase_table phrases;
+
+  // Hash Buckets
+  long long bucket_count, bucket_min_count, bucket_words, vocab_rows, *word_row;
+
+  // Huge Pages
+  struct huge_block huge_blocks[HUGE_BLOCKS];
+  int huge_pages;
+
+  // Out of Core
+  char ooc_dir[MAX_STRING];
+  long long ooc_memory, ooc_head, ooc_faults;
+  real ooc_writeback;
+  struct ooc_map ooc_tail[2];
+  int ooc_tails;
+
+  // Models
+  struct train_model *models;
+  int num_models;
+  char models_file[MAX_STRING];
+
+  // Library
+  const char *train_data;
+  long long train_data_size;
+  long long (*sentence_fn)(void *arg, const char *const **tokens);
+  void *sentence_arg;
+  long long sentence_pass;
+  int in_memory;
+
+  // Block Shuffle
+  int shuffle_blocks, prefetch_blocks;
+  long long *chunk_order, *epoch_blocks;
+  double *epoch_end;
+
+  // Evaluation
+  char eval_file[MAX_STRING];
+  real eval_every, eval_min_delta, eval_target;
+  int eval_threads, eval_patience;
+  long long eval_vocab, eval_rows, eval_questions, eval_pairs, eval_skipped, *eval_question, *eval_pair;
+  real *eval_human;
+  struct eval_result eval_last, eval_best;
+  int eval_count, eval_stale;
+  volatile int eval_busy, training_stop, thread_failed;
+
+  jmp_buf fail;
+  char error[MAX_STRING * 4];
+};
+
+/**
+ * ======== Fail ========
+ * 报告错误:把信息(不带换行)写到wv->error,然后longjmp到wv->fail,不调用exit.
+ * 命令行的main输出wv->error后返回1,输出和以前的printf + exit(1)相同;word2vec-lib.c把它作为w2v_error返回.
+ */
+void Fail(struct word2vec *wv, const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(wv->error, sizeof(wv->error), format, ap);
+  va_end(ap);
+  longjmp(wv->fail, 1);
+}
+
+/**
+ * ======== HugePagesMode ========
+ * 透明大页的系统设置(/sys/kernel/mm/transparent_hugepage/enabled中方括号里的值),用于日志.
+ */
+void HugePagesMode(char *mode, int size) {
+  char line[256], *a, *b;
+  FILE *fi = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "rb");
+  snprintf(mode, size, "unknown");
+  if (fi == NULL) return;
+  if ((fgets(line, sizeof(line), fi) != NULL) && ((a = strchr(line, '[')) != NULL) && ((b = strchr(a, ']')) != NULL)) {
+    *b = 0;
+    snprintf(mode, size, "%s", a + 1);
+  }
+  fclose(fi);
+}
+
+/**
+ * ======== HugeAlloc ========
+ * 为大数组(syn0, syn1, syn1neg, table)分配size字节,按huge_pages依次尝试:
+ *   1GB大页(huge_pages为2) -> 2MB大页(MAP_HUGETLB,需要预留的大页) -> 透明大页(2MB对齐的匿名映射 + madvise(MADV_HUGEPAGE))
+ *   -> 普通页;huge_pages为0时直接用posix_memalign,和原来相同.
+ * -checkpoint时不用MAP_HUGETLB:fork之后写时复制需要大页池中有空闲的大页,不够时子进程会收到SIGBUS.
+ * 分配的方式输出到日志和telemetry,用HugeFree释放;分配失败时调用Fail.
+ */
+void *HugeAlloc(struct word2vec *wv, const char *name, long long size) {
+  void *p = MAP_FAILED;
+  char *q, mode[32];
+  long long len = (size + HUGE_PAGE_2M - 1) / HUGE_PAGE_2M * HUGE_PAGE_2M;
+  const char *how = "normal pages";
+  int b, huge;
+  if (size <= 0) size = 1;
+  // 记录的区域已满时用posix_memalign,HugeFree仍然可以用free释放
+  for (b = 0; (b < HUGE_BLOCKS) && (wv->huge_blocks[b].base != NULL); b++);
+  huge = b < HUGE_BLOCKS ? wv->huge_pages : 0;
+  if ((huge >= 2) && (wv->checkpoint_file[0] == 0)) {
+    len = (size + HUGE_PAGE_1G - 1) / HUGE_PAGE_1G * HUGE_PAGE_1G;
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), -1, 0);
+    how = "1 GB huge pages (MAP_HUGETLB)";
+  }
+  if ((p == MAP_FAILED) && (huge >= 1) && (wv->checkpoint_file[0] == 0)) {
+    len = (size + HUGE_PAGE_2M - 1) / HUGE_PAGE_2M * HUGE_PAGE_2M;
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    how = "2 MB huge pages (MAP_HUGETLB)";
+  }
+  if ((p == MAP_FAILED) && (huge >= 1)) {
+    // 多映射2MB,截掉首尾,得到2MB对齐的区域,透明大页才能覆盖整个数组
+    len = (size + HUGE_PAGE_2M - 1) / HUGE_PAGE_2M * HUGE_PAGE_2M;
+    q = (char *)mmap(NULL, len + HUGE_PAGE_2M, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (q != MAP_FAILED) {
+      p = (void *)(((unsigned long long)q + HUGE_PAGE_2M - 1) / HUGE_PAGE_2M * HUGE_PAGE_2M);
+      if ((char *)p > q) munmap(q, (char *)p - q);
+      munmap((char *)p + len, q + HUGE_PAGE_2M - (char *)p);
+      HugePagesMode(mode, sizeof(mode));
+      if ((madvise(p, len, MADV_HUGEPAGE) == 0) && strcmp(mode, "never")) how = "transparent huge pages (madvise)";
+      else how = "normal pages (transparent huge pages are not available)";
+    }
+  }
+  if (p == MAP_FAILED) {
+    len = -1;
+    if (posix_memalign(&p, 128, size) != 0) p = NULL;
+    how = "normal pages";
+  }
+  if (p == NULL) {
+    Fail(wv, "Memory allocation failed");
+  }
+  if (b < HUGE_BLOCKS) {
+    wv->huge_blocks[b].base = p;
+    wv->huge_blocks[b].size = len;
+  }
+  if (wv->debug_mode > 0) printf("Allocated %s: %.1f MB, %s\n", name, size / 1048576.0, how);
+  if (wv->telemetry != NULL) {
+    fprintf(wv->telemetry, "{\"event\":\"alloc\",\"name\":\"%s\",\"bytes\":%lld,\"pages\":\"%s\"}\n", name, size, how);
+    fflush(wv->telemetry);
+  }
+  return p;
+}
+
+/**
+ * ======== HugeFree ========
+ * 释放HugeAlloc分配的数组:mmap的用munmap,posix_memalign的用free.
+ */
+void HugeFree(struct word2vec *wv, void *p) {
+  int b;
+  if (p == NULL) return;
+  for (b = 0; b < HUGE_BLOCKS; b++) if (wv->huge_blocks[b].base == p) {
+    if (wv->huge_blocks[b].size > 0) munmap(p, wv->huge_blocks[b].size); else free(p);
+    wv->huge_blocks[b].base = NULL;
+    return;
+  }
+  free(p);
+}
+
+/**
+ * ======== OocAlloc ========
+ * -ooc-dir时分配syn0 / syn1neg:SortVocab之后行按词频降序排列,前ooc_head行(高频词)在内存中,其余的行映射到ooc_dir下的文件.
+ * 先保留整个矩阵的地址区间(PROT_NONE),再用MAP_FIXED分两段覆盖:
+ *   头部 - 匿名内存,madvise(MADV_HUGEPAGE)并mlock,不会被换出;
+ *   尾部 - MAP_SHARED映射的临时文件(创建后立即unlink,进程退出后自动删除),madvise(MADV_RANDOM)关闭预读.
+ * 所以训练代码不需要区分,仍然按syn0[row * layer1_size]访问.两段都是新映射,内容全为0.
+ */
+real *OocAlloc(struct word2vec *wv, const char *name, long long rows) {
+  long long page = sysconf(_SC_PAGESIZE), size = rows * wv->layer1_size * sizeof(real), head, b;
+  char file[MAX_STRING * 2], *base;
+  int fd;
+  if (size <= 0) size = page;
+  size = (size + page - 1) / page * page;
+  // 头部按页对齐,跨页的那一行一部分在内存中,一部分在文件中
+  head = (wv->ooc_head < rows ? wv->ooc_head : rows) * wv->layer1_size * sizeof(real);
+  head = (head + page - 1) / page * page;
+  if (head > size) head = size;
+  base = (char *)mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) {
+    Fail(wv, "ERROR: cannot reserve %.1f MB of address space for %s", size / 1048576.0, name);
+  }
+  if (head > 0) {
+    if (mmap(base, head, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+      Fail(wv, "Memory allocation failed");
+    }
+    madvise(base, head, MADV_HUGEPAGE);
+    if (mlock(base, head) != 0) printf("WARNING: cannot mlock the %.1f MB of %s kept in memory (see ulimit -l)\n", head / 1048576.0, name);
+  }
+  if (size > head) {
+    snprintf(file, sizeof(file), "%s/word2vec-%s-XXXXXX", wv->ooc_dir, name);
+    fd = mkstemp(file);
+    if (fd < 0) {
+      Fail(wv, "ERROR: cannot create %s", file);
+    }
+    unlink(file);
+    if ((ftruncate(fd, size - head) != 0) ||
+     (mmap(base + head, size - head, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, 0) == MAP_FAILED)) {
+      Fail(wv, "ERROR: cannot map %.1f MB of %s to %s", (size - head) / 1048576.0, name, wv->ooc_dir);
+    }
+    close(fd);
+    madvise(base + head, size - head, MADV_RANDOM);
+    wv->ooc_tail[wv->ooc_tails].base = base + head;
+    wv->ooc_tail[wv->ooc_tails].size = size - head;
+    wv->ooc_tails++;
+  }
+  for (b = 0; (b < HUGE_BLOCKS) && (wv->huge_blocks[b].base != NULL); b++);
+  if (b < HUGE_BLOCKS) {
+    wv->huge_blocks[b].base = base;
+    wv->huge_blocks[b].size = size;
+  }
+  if (wv->debug_mode > 0) printf("Allocated %s: %.1f MB in memory, %.1f MB mapped to %s\n", name, head / 1048576.0, (size - head) / 1048576.0, wv->ooc_dir);
+  if (wv->telemetry != NULL) {
+    fprintf(wv->telemetry, "{\"event\":\"alloc\",\"name\":\"%s\",\"bytes\":%lld,\"memory_bytes\":%lld,\"file_bytes\":%lld}\n", name, size, head, size - head);
+    fflush(wv->telemetry);
+  }
+  return (real *)base;
+}
+
+/**
+ * ======== OocWriteback ========
+ * 把尾部映射中的脏页写回文件(MonitorThread每隔ooc_writeback秒调用一次).
+ * 不主动写回时,脏页积累到内核的dirty_ratio才集中写回,那时写内存的训练线程会被阻塞;
+ * 写回后的干净页在内存不足时可以直接丢弃,换出不再需要先写文件.
+ */
+void OocWriteback(struct word2vec *wv) {
+  int a;
+  for (a = 0; a < wv->ooc_tails; a++) msync(wv->ooc_tail[a].base, wv->ooc_tail[a].size, MS_SYNC);
+}
+
+/**
+ * ======== MajorFaults ========
+ * 进程到目前为止的major page fault数(需要读文件的缺页).
+ */
+long long MajorFaults() {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+  return ru.ru_majflt;
+}
+
+/**
+ * ======== GetModel / SetModel ========
+ * GetModel把wv中当前的模型参数和权重保存到m;SetModel反过来,把m设为当前模型.
+ */
+void GetModel(struct word2vec *wv, struct train_model *m) {
+  m->cbow = wv->cbow;
+  m->hs = wv->hs;
+  m->negative = wv->negative;
+  m->window = wv->window;
+  m->layer1_size = wv->layer1_size;
+  m->alpha = wv->alpha;
+  m->syn0 = wv->syn0;
+  m->syn1 = wv->syn1;
+  m->syn1neg = wv->syn1neg;
+  strcpy(m->output_file, wv->output_file);
+}
+
+void SetModel(struct word2vec *wv, struct train_model *m) {
+  wv->cbow = m->cbow;
+  wv->hs = m->hs;
+  wv->negative = m->negative;
+  wv->window = m->window;
+  wv->layer1_size = m->layer1_size;
+  wv->alpha = m->alpha;
+  wv->syn0 = m->syn0;
+  wv->syn1 = m->syn1;
+  wv->syn1neg = m->syn1neg;
+  strcpy(wv->output_file, m->output_file);
+}
 
 /**
  * ======== InitUnigramTable ========
@@ -160,29 +808,29 @@ int *table;
  * 
  * 输入一个第二种划分方法的标识,可以得到一个第一种划分的标识[词].
  */
-void InitUnigramTable() {
+void InitUnigramTable(struct word2vec *wv) {
   int a, i;
   double train_words_pow = 0;
   double d1, power = 0.75;
   //抽样表
-  table = (int *)malloc(table_size * sizeof(int));
-  for (a = 0; a < vocab_size; a++) train_words_pow += pow(vocab[a].cn, power);
+  wv->table = (int *)HugeAlloc(wv, "table", (long long)table_size * sizeof(int));
+  for (a = 0; a < wv->vocab_size; a++) train_words_pow += pow(wv->vocab[a].cn, power);
   i = 0;
   // 当前词的归一化词频,小区间长度
-  d1 = pow(vocab[i].cn, power) / train_words_pow;
+  d1 = pow(wv->vocab[i].cn, power) / train_words_pow;
   for (a = 0; a < table_size; a++) {//将[0,1]划分为table_size个小区间,左边界作为区间标识
-    table[a] = i;//可能存在多个随机数抽样结果都是i
+    wv->table[a] = i;//可能存在多个随机数抽样结果都是i
     // [Chris] - If the fraction of the table we have filled is greater than the
     //           fraction of this words weight / all word weights, then move to the next word.
     // 等距划分每个子区间长度为:1/table_size;
     // 随机数对应第二种方法得到的子区间长度映射到第一种方法,得到映射后结果
     if (a / (double)table_size > d1) {//如果等距划分大于当前词的区间长度,划分到下一个词
       i++;
-      d1 += pow(vocab[i].cn, power) / train_words_pow;//累加上计算下一个词的区间长度;得到下一个词对应区间的右边界
+      d1 += pow(wv->vocab[i].cn, power) / train_words_pow;//累加上计算下一个词的区间长度;得到下一个词对应区间的右边界
       // 大于这个边界,映射后就是下一个词
     }
     // 划分结束
-    if (i >= vocab_size) i = vocab_size - 1;
+    if (i >= wv->vocab_size) i = wv->vocab_size - 1;
   }
 }
 
@@ -280,7 +928,7 @@ int GetWordHash(char *word) {
  * 查找词:输入一个词,如果词在词典中,返回下标;如果不在,返回-1.
  * 借助vocab_hash表格:存储词hash与词在vocab中下标的映射关系
  */
-int SearchVocab(char *word) {
+int SearchVocab(struct word2vec *wv, char *word) {
   // 1. 计算查找词的hash值
   unsigned int hash = GetWordHash(word);
   
@@ -292,7 +940,7 @@ int SearchVocab(char *word) {
   */
   while (1) {
     // 如果查找hash表返回-1,表示hash表中不存在,那么vocab中也不存在这个词,返回-1
-    if (vocab_hash[hash] == -1) return -1;
+    if (wv->vocab_hash[hash] == -1) return -1;
     
     // 如果当前词和有hash表计算出下标然后在vocab中取出的词相同,那么返回vocab中的下标
     /*
@@ -301,7 +949,7 @@ int SearchVocab(char *word) {
     * 返回值 > 0: str1 大于 str2;
     * 返回值 = 0: str1 等于 str2;
     */
-    if (!strcmp(word, vocab[vocab_hash[hash]].word)) return vocab_hash[hash];
+    if (!strcmp(word, wv->vocab[wv->vocab_hash[hash]].word)) return wv->vocab_hash[hash];
     
     // 否则,发生冲突,地址重复;hash表解决策略是线性探索,查看下一个位置,接着循环
     hash = (hash + 1) % vocab_hash_size;
@@ -314,14 +962,14 @@ int SearchVocab(char *word) {
  * ======== ReadWordIndex ========
  * 从训练文件中读取一个词,同时返回这个词在vocab词典中的下标index
  */
-int ReadWordIndex(FILE *fin) {
+int ReadWordIndex(struct word2vec *wv, FILE *fin) {
   char word[MAX_STRING];
   //读取词,保存在word中
   ReadWord(word, fin);
   // 如果文件结束,返回-1--没有读取到词
   if (feof(fin)) return -1;
   // 否则,返回读取词在vocab词典中的下标index
-  return SearchVocab(word);
+  return SearchVocab(wv, word);
 }
 
 /**
@@ -329,7 +977,7 @@ int ReadWordIndex(FILE *fin) {
  * 将一个没有出现过的新词添加到vocab词典中,
  * 同时保存在vocab_hash表中---要完成冲突的处理.
  */
-int AddWordToVocab(char *word) {
+int AddWordToVocab(struct word2vec *wv, char *word) {
   // Measure word length.
   unsigned int hash, length = strlen(word) + 1;
   
@@ -339,22 +987,24 @@ int AddWordToVocab(char *word) {
   
   // Allocate and store the word string.
   // 分配空间,存储当前词
-  vocab[vocab_size].word = (char *)calloc(length, sizeof(char));
+  wv->vocab[wv->vocab_size].word = (char *)calloc(length, sizeof(char));
   // char *strcpy(char *dest, const char *src):把src所指向的字符串复制到dest
-  strcpy(vocab[vocab_size].word, word);
+  strcpy(wv->vocab[wv->vocab_size].word, word);
   
   // Initialize the word frequency to 0.
   // 初始化当前词的count计数
-  vocab[vocab_size].cn = 0;//并没有加1,还是0
+  wv->vocab[wv->vocab_size].cn = 0;//并没有加1,还是0
   
   // Increment the vocabulary size.
-  vocab_size++;
+  wv->vocab_size++;
   
   // Reallocate memory if needed
   // vocab重新分配空间,增加1000个位置;并不是一次性分配完,需要重新分配,每次重新分配增加1000个位置
-  if (vocab_size + 2 >= vocab_max_size) {
-    vocab_max_size += 1000;
-    vocab = (struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
+  if (wv->vocab_size + 2 >= wv->vocab_max_size) {
+    wv->vocab_max_size += 1000;
+    wv->vocab = (struct vocab_word *)realloc(wv->vocab, wv->vocab_max_size * sizeof(struct vocab_word));
+    // 新增的位置清零,code/point在SortVocab之前为NULL,出错时FreeWord2vec可以直接释放
+    memset(&wv->vocab[wv->vocab_max_size - 1000], 0, 1000 * sizeof(struct vocab_word));
   }
   
   // Add the word to the 'vocab_hash' table so that we can map quickly from the
@@ -366,16 +1016,16 @@ int AddWordToVocab(char *word) {
   
   // If the spot is already taken in the hash table, find the next empty spot.
   // 将当前词保存到vocab_hash表中,但是要处理重复问题;采用线性探索,解决冲突
-  while (vocab_hash[hash] != -1) //如果当前位置,已经被占用(冲突),查看下一个位置
+  while (wv->vocab_hash[hash] != -1) //如果当前位置,已经被占用(冲突),查看下一个位置
     hash = (hash + 1) % vocab_hash_size;
   
   // Map the hash code to the index of the word in the 'vocab' array. 
   // 存储到vocab_hash表中,键是hash值,值是词在vocab中的下标index
-  vocab_hash[hash] = vocab_size - 1;
+  wv->vocab_hash[hash] = wv->vocab_size - 1;
   
   // Return the index of the word in the 'vocab' array.
   // 返回当前词在vocab中的下标index
-  return vocab_size - 1;
+  return wv->vocab_size - 1;
 }
 
 /**
@@ -402,7 +1052,7 @@ int VocabCompare(const void *a, const void *b) {
  * vocab需要重新分配空间,包括每个词对应的point,code字段
  * 
  */
-void SortVocab() {
+void SortVocab(struct word2vec *wv) {
   int a, size;
   unsigned int hash;
   
@@ -425,50 +1075,50 @@ void SortVocab() {
    * size: 每个元素所占用的空间,sizeof(struct)计算;
    * cmp_f_p: 排序函数指针
    */
-  qsort(&vocab[1], vocab_size - 1, sizeof(struct vocab_word), VocabCompare);
+  qsort(&wv->vocab[1], wv->vocab_size - 1, sizeof(struct vocab_word), VocabCompare);
   
   // 2. 清空(初始化)vocab_hash,方便重新计算
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
+  for (a = 0; a < vocab_hash_size; a++) wv->vocab_hash[a] = -1;
   
   // 保存初始vocab_size,方便循环,因为循环过程中,vocab_size会动态变化
-  size = vocab_size;
+  size = wv->vocab_size;
   
   // 重新计算训练样本中出现词的总次数,或者说训练样本长度(每个词可能出现多次)
-  train_words = 0;
+  wv->train_words = 0;
   
   // For every word currently in the vocab...
   // 3. 遍历当前降序排序vocab,筛选低频次,同时完成vocab_hash表的计算
   for (a = 0; a < size; a++) {
     // If it occurs fewer than 'min_count' times, remove it from the vocabulary.
     // 如果当前词的词频属于低频词,但不是</s>----删除;
-    if ((vocab[a].cn < min_count) && (a != 0)) {
+    if ((wv->vocab[a].cn < wv->min_count) && (a != 0)) {
       // vocab_size变化
-      vocab_size--;
+      wv->vocab_size--;
       
       // Free the memory associated with the word string.
       // 释放词典中当前词的word字段,并没有释放vocab空间!
-      free(vocab[a].word);
+      free(wv->vocab[a].word);
     } else {// 不属于低频词,正常计算:对vocab_hash计算,统计train_words
       // Hash will be re-computed, as after the sorting it is not actual
       // 计算hash值
-      hash = GetWordHash(vocab[a].word);
+      hash = GetWordHash(wv->vocab[a].word);
       // 如果发生冲突,处理
-      while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-      vocab_hash[hash] = a;// 存储下标
-      train_words += vocab[a].cn;//添加符合条件词的出现频率
+      while (wv->vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
+      wv->vocab_hash[hash] = a;// 存储下标
+      wv->train_words += wv->vocab[a].cn;//添加符合条件词的出现频率
     }
   }
    
   // Reallocate the vocab array, chopping off all of the low-frequency words at
   // the end of the table.
   // 重新分配vocab空间
-  vocab = (struct vocab_word *)realloc(vocab, (vocab_size + 1) * sizeof(struct vocab_word));
+  wv->vocab = (struct vocab_word *)realloc(wv->vocab, (wv->vocab_size + 1) * sizeof(struct vocab_word));
   
   // Allocate memory for the binary tree construction
   // 为筛选后词典中词分配code, point字段存储空间
-  for (a = 0; a < vocab_size; a++) {
-    vocab[a].code = (char *)calloc(MAX_CODE_LENGTH, sizeof(char));
-    vocab[a].point = (int *)calloc(MAX_CODE_LENGTH, sizeof(int));
+  for (a = 0; a < wv->vocab_size; a++) {
+    wv->vocab[a].code = (char *)calloc(MAX_CODE_LENGTH, sizeof(char));
+    wv->vocab[a].point = (int *)calloc(MAX_CODE_LENGTH, sizeof(int));
   }
 }
 
@@ -484,24 +1134,24 @@ void SortVocab() {
  * 
  * 处理过程和sortVocab类似,但没有进行排序;vocab_hash都需要重新计算
  */
-void ReduceVocab() {
+void ReduceVocab(struct word2vec *wv) {
   int a, b = 0;
   unsigned int hash;
-  for (a = 0; a < vocab_size; a++) if (vocab[a].cn > min_reduce) {
-    vocab[b].cn = vocab[a].cn;
-    vocab[b].word = vocab[a].word;
+  for (a = 0; a < wv->vocab_size; a++) if (wv->vocab[a].cn > wv->min_reduce) {
+    wv->vocab[b].cn = wv->vocab[a].cn;
+    wv->vocab[b].word = wv->vocab[a].word;
     b++;
-  } else free(vocab[a].word);
-  vocab_size = b;
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  for (a = 0; a < vocab_size; a++) {
+  } else free(wv->vocab[a].word);
+  wv->vocab_size = b;
+  for (a = 0; a < vocab_hash_size; a++) wv->vocab_hash[a] = -1;
+  for (a = 0; a < wv->vocab_size; a++) {
     // Hash will be re-computed, as it is not actual
-    hash = GetWordHash(vocab[a].word);
-    while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-    vocab_hash[hash] = a;
+    hash = GetWordHash(wv->vocab[a].word);
+    while (wv->vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
+    wv->vocab_hash[hash] = a;
   }
   fflush(stdout);
-  min_reduce++;
+  wv->min_reduce++;
 }
 
 /**
@@ -517,22 +1167,22 @@ void ReduceVocab() {
  * 
  * 后面也就是保存着Huffman Tree的中间结点,或者说非叶子结点.
  */
-void CreateBinaryTree() {
+void CreateBinaryTree(struct word2vec *wv) {
   long long a, b, i, min1i, min2i, pos1, pos2, point[MAX_CODE_LENGTH];
   char code[MAX_CODE_LENGTH];
-  long long *count = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));//词典词count数组,统计词频
-  long long *binary = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
-  long long *parent_node = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
+  long long *count = (long long *)calloc(wv->vocab_size * 2 + 1, sizeof(long long));//词典词count数组,统计词频
+  long long *binary = (long long *)calloc(wv->vocab_size * 2 + 1, sizeof(long long));
+  long long *parent_node = (long long *)calloc(wv->vocab_size * 2 + 1, sizeof(long long));
   //词频数组count初始化:容量为vocab_size *2 + 1
   // 词典中词初始化,正常初始化
-  for (a = 0; a < vocab_size; a++) count[a] = vocab[a].cn;
+  for (a = 0; a < wv->vocab_size; a++) count[a] = wv->vocab[a].cn;
   // 超出词典大小的词频,设置为1e15(一个极大数)
-  for (a = vocab_size; a < vocab_size * 2; a++) count[a] = 1e15;
-  pos1 = vocab_size - 1;
-  pos2 = vocab_size;
+  for (a = wv->vocab_size; a < wv->vocab_size * 2; a++) count[a] = 1e15;
+  pos1 = wv->vocab_size - 1;
+  pos2 = wv->vocab_size;
   // Following algorithm constructs the Huffman tree by adding one node at a time
   // 创建Huffman Tree过程: vocab_size个词,一共有vocab_size-1个中间结点(非叶子结点),也就是说进行vocab_size-1次循环
-  for (a = 0; a < vocab_size - 1; a++) {
+  for (a = 0; a < wv->vocab_size - 1; a++) {
     // First, find two smallest nodes 'min1, min2'
     // 查找两个最小数的下标min1i, min2i;但是min1i对应的数比min2i要小;
     // 在这里Huffman编码时,默认大数编码为1,小数编码为0,所以min2i编码为1
@@ -561,14 +1211,14 @@ void CreateBinaryTree() {
       pos2++;
     }
     // 找到两个最小值后,合并,count保存合并后的结点权值;同时这个结点也是这两个叶子节点的双亲
-    count[vocab_size + a] = count[min1i] + count[min2i];
-    parent_node[min1i] = vocab_size + a;//记录叶子结点双亲
-    parent_node[min2i] = vocab_size + a;
+    count[wv->vocab_size + a] = count[min1i] + count[min2i];
+    parent_node[min1i] = wv->vocab_size + a;//记录叶子结点双亲
+    parent_node[min2i] = wv->vocab_size + a;
     binary[min2i] = 1;//对两个最小值中的较大值编码,编码为1;一次编码
   }
   // Now assign binary code to each vocabulary word
   // 对从根节点到叶子节点的路径进行编码,同时将编码保存到每个叶子节点上;vocab的code字段
-  for (a = 0; a < vocab_size; a++) {//针对每个叶子节点来说,当前遍历是从下往上,所以还要进行一次自上而下的赋值;
+  for (a = 0; a < wv->vocab_size; a++) {//针对每个叶子节点来说,当前遍历是从下往上,所以还要进行一次自上而下的赋值;
     b = a;
     i = 0;
     while (1) {//针对每个叶子结点,自下而上记录编码以及路径;循环次数等于路径长度
@@ -576,15 +1226,15 @@ void CreateBinaryTree() {
       point[i] = b;
       i++;
       b = parent_node[b];
-      if (b == vocab_size * 2 - 2) break;//自下而上遍历到根节点,退出循环
+      if (b == wv->vocab_size * 2 - 2) break;//自下而上遍历到根节点,退出循环
     }
     // 记录路径长度codelen
-    vocab[a].codelen = i;
+    wv->vocab[a].codelen = i;
     // 先保存根节点,下标是vocab_size-2; 因为一共有2*vocab_size-1个点,最后一个点的下标是2*vocab_size-2
-    vocab[a].point[0] = vocab_size - 2;
+    wv->vocab[a].point[0] = wv->vocab_size - 2;
     for (b = 0; b < i; b++) {//自上而下遍历,将路径以及Huffman codes记录到当前叶子结点上
-      vocab[a].code[i - b - 1] = code[b];//放到尾巴处
-      vocab[a].point[i - b] = point[b] - vocab_size;//将非叶子结点下标映射到[0,vocab_size-1]范围内
+      wv->vocab[a].code[i - b - 1] = code[b];//放到尾巴处
+      wv->vocab[a].point[i - b] = point[b] - wv->vocab_size;//将非叶子结点下标映射到[0,vocab_size-1]范围内
     }
   }
   // 释放空间
@@ -593,6 +1243,335 @@ void CreateBinaryTree() {
   free(parent_node);
 }
 
+/**
+ * ======== OpenTrainFile ========
+ * 打开训练语料:内存中的语料(train_data)用fmemopen,和文件一样可以fseek / ftell;否则打开train_file.
+ */
+FILE *OpenTrainFile(struct word2vec *wv) {
+  if (wv->train_data != NULL) return fmemopen((void *)wv->train_data, wv->train_data_size, "rb");
+  return fopen(wv->train_file, "rb");
+}
+
+/**
+ * ======== SplitFile ========
+ * 将训练文件切分成n个块,块i的起始偏移为start[i],start[n]为file_size.
+ *
+ * 先按file_size等分得到名义边界,再向后扫描:跳过当前词剩余部分,再跳过分隔符,停在下一个词的词首.
+ * 这样每个块的起点都是词首,并且前一个字符一定是分隔符(space tab EOL);
+ * 读取时,如果读完一个词后ftell超过块尾,说明这个词起始于块尾之后,属于下一个块.
+ */
+void SplitFile(struct word2vec *wv, long long n, long long *start) {
+  long long a, pos;
+  int ch;
+  FILE *fi = OpenTrainFile(wv);
+  if (fi == NULL) {
+    Fail(wv, "ERROR: training data file not found!");
+  }
+  start[0] = 0;
+  for (a = 1; a < n; a++) {
+    pos = wv->file_size / n * a;
+    if (pos < start[a - 1]) pos = start[a - 1];
+    fseek(fi, pos, SEEK_SET);
+    // 跳过当前词剩余部分
+    while ((ch = fgetc(fi)) != EOF) if ((ch == ' ') || (ch == '\t') || (ch == '\n')) break;
+    // 跳过分隔符,停在下一个词的词首
+    while ((ch = fgetc(fi)) != EOF) if ((ch != ' ') && (ch != '\t') && (ch != '\n') && (ch != 13)) break;
+    start[a] = (ch == EOF) ? wv->file_size : ftell(fi) - 1;
+  }
+  start[n] = wv->file_size;
+  fclose(fi);
+}
+
+/**
+ * ======== InitChunks ========
+ * 将训练文件切分成num_chunks个块,计算每个块的起始偏移chunk_start,见SplitFile;
+ * 打乱块顺序(-shuffle)时再生成每一轮的块排列chunk_order.
+ */
+void InitChunks(struct word2vec *wv) {
+  long long a, b, e, t;
+  unsigned long long next_random = 1;
+  if (wv->num_chunks <= 0) {
+    wv->num_chunks = (long long)wv->num_threads * 32;
+    if (wv->shuffle_blocks && (wv->file_size / SHUFFLE_BLOCK > wv->num_chunks)) wv->num_chunks = wv->file_size / SHUFFLE_BLOCK;
+  }
+  if (wv->num_chunks > wv->file_size) wv->num_chunks = wv->file_size > 0 ? wv->file_size : 1;
+  wv->chunk_start = (long long *)malloc((wv->num_chunks + 1) * sizeof(long long));
+  if (wv->chunk_start == NULL) Fail(wv, "Memory allocation failed");
+  SplitFile(wv, wv->num_chunks, wv->chunk_start);
+  if (!wv->shuffle_blocks) return;
+  // 每一轮一个Fisher-Yates排列,随机数和训练线程相同的线性同余生成器
+  wv->chunk_order = (long long *)malloc(wv->iter * wv->num_chunks * sizeof(long long));
+  if (wv->chunk_order == NULL) Fail(wv, "Memory allocation failed");
+  for (e = 0; e < wv->iter; e++) {
+    long long *order = wv->chunk_order + e * wv->num_chunks;
+    for (a = 0; a < wv->num_chunks; a++) order[a] = a;
+    for (a = wv->num_chunks - 1; a > 0; a--) {
+      next_random = next_random * (unsigned long long)25214903917 + 11;
+      b = (next_random >> 16) % (a + 1);
+      t = order[a];
+      order[a] = order[b];
+      order[b] = t;
+    }
+  }
+}
+
+/**
+ * ======== ChunkBlock ========
+ * 第k次领取(见next_chunk)对应的块号.
+ */
+long long ChunkBlock(struct word2vec *wv, long long k) {
+  return wv->chunk_order != NULL ? wv->chunk_order[k] : k % wv->num_chunks;
+}
+
+/**
+ * ======== PhraseHash ========
+ * 和GetWordHash相同的哈希函数,不取模.
+ */
+unsigned long long PhraseHash(const char *word) {
+  unsigned long long hash = 0;
+  for (; *word; word++) hash = hash * 257 + *word;
+  return hash;
+}
+
+void PhraseTableInit(struct word2vec *wv, struct phrase_table *t, long long hash_size) {
+  long long a;
+  t->hash_size = hash_size;
+  t->size = 0;
+  t->reduce = 1;
+  t->hash = (int *)malloc(hash_size * sizeof(int));
+  t->entries = (struct phrase_entry *)malloc((long long)(hash_size * 0.7 + 2) * sizeof(struct phrase_entry));
+  if ((t->hash == NULL) || (t->entries == NULL)) {
+    Fail(wv, "Memory allocation failed");
+  }
+  for (a = 0; a < hash_size; a++) t->hash[a] = -1;
+}
+
+void PhraseTableFree(struct phrase_table *t) {
+  long long a;
+  for (a = 0; a < t->size; a++) free(t->entries[a].word);
+  free(t->entries);
+  free(t->hash);
+  t->size = 0;
+}
+
+/**
+ * ======== PhraseFind ========
+ * 在表中查找word,返回下标,没有找到返回-1.
+ */
+long long PhraseFind(const struct phrase_table *t, const char *word) {
+  long long h = PhraseHash(word) & (t->hash_size - 1);
+  while (t->hash[h] != -1) {
+    if (!strcmp(t->entries[t->hash[h]].word, word)) return t->hash[h];
+    h = (h + 1) & (t->hash_size - 1);
+  }
+  return -1;
+}
+
+/**
+ * ======== PhraseReduce ========
+ * 和ReduceVocab相同:删掉频次小于reduce的项,重建哈希,reduce加1.
+ */
+void PhraseReduce(struct phrase_table *t) {
+  long long a, b = 0, h;
+  for (a = 0; a < t->size; a++) if (t->entries[a].cn >= t->reduce) t->entries[b++] = t->entries[a];
+  else free(t->entries[a].word);
+  t->size = b;
+  for (a = 0; a < t->hash_size; a++) t->hash[a] = -1;
+  for (a = 0; a < t->size; a++) {
+    h = PhraseHash(t->entries[a].word) & (t->hash_size - 1);
+    while (t->hash[h] != -1) h = (h + 1) & (t->hash_size - 1);
+    t->hash[h] = a;
+  }
+  t->reduce++;
+}
+
+/**
+ * ======== PhraseAdd ========
+ * word的频次加cn,不在表中时添加;表超过70%时删掉低频项.
+ */
+void PhraseAdd(struct phrase_table *t, const char *word, long long cn) {
+  long long h = PhraseHash(word) & (t->hash_size - 1);
+  while (t->hash[h] != -1) {
+    if (!strcmp(t->entries[t->hash[h]].word, word)) {
+      t->entries[t->hash[h]].cn += cn;
+      return;
+    }
+    h = (h + 1) & (t->hash_size - 1);
+  }
+  t->entries[t->size].word = (char *)malloc(strlen(word) + 1);
+  strcpy(t->entries[t->size].word, word);
+  t->entries[t->size].cn = cn;
+  t->hash[h] = t->size++;
+  if (t->size > t->hash_size * 0.7) PhraseReduce(t);
+}
+
+/**
+ * ======== PhraseKey ========
+ * 词对a b在表中的key "a b";合并后的词"a_b"超过MAX_STRING - 1时返回0(不能作为短语).
+ */
+int PhraseKey(char *key, const char *a, const char *b) {
+  long long la = strlen(a), lb = strlen(b);
+  if (la + lb + 1 >= MAX_STRING) return 0;
+  memcpy(key, a, la);
+  key[la] = ' ';
+  memcpy(key + la + 1, b, lb + 1);
+  return 1;
+}
+
+/**
+ * ======== PhraseCountThread ========
+ * 从phrase_next领取块,统计块内的词频和相邻词对的频次;句子边界(</s>)和块边界两侧的词不组成词对.
+ */
+void *PhraseCountThread(void *arg) {
+  struct phrase_task *p = (struct phrase_task *)arg;
+  struct word2vec *wv = p->wv;
+  char word[MAX_STRING], prev[MAX_STRING], key[MAX_STRING];
+  long long k;
+  FILE *fi = OpenTrainFile(wv);
+  while ((k = __sync_fetch_and_add(&wv->phrase_next, 1)) < p->parts) {
+    fseek(fi, p->start[k], SEEK_SET);
+    prev[0] = 0;
+    while (1) {
+      ReadWord(word, fi);
+      if (feof(fi) || (ftell(fi) > p->start[k + 1])) break;
+      if (!strcmp(word, "</s>")) {
+        prev[0] = 0;
+        continue;
+      }
+      p->words++;
+      PhraseAdd(&p->table, word, 1);
+      if ((prev[0] != 0) && PhraseKey(key, prev, word)) PhraseAdd(&p->table, key, 1);
+      strcpy(prev, word);
+    }
+  }
+  fclose(fi);
+  return NULL;
+}
+
+/**
+ * ======== PhraseScore ========
+ * 词对(all中第i项,key为"a b")的得分,和word2phrase相同:(cn(ab) - min_count) / cn(a) / cn(b) * phrase_words;
+ * 不是词对,或者任何一个频次小于min_count时返回-1.
+ */
+double PhraseScore(struct word2vec *wv, const struct phrase_table *all, long long i) {
+  char a[MAX_STRING], *b;
+  long long ia, ib;
+  if ((all->entries[i].cn < wv->min_count) || ((b = strchr(all->entries[i].word, ' ')) == NULL)) return -1;
+  memcpy(a, all->entries[i].word, b - all->entries[i].word);
+  a[b - all->entries[i].word] = 0;
+  ia = PhraseFind(all, a);
+  ib = PhraseFind(all, b + 1);
+  if ((ia < 0) || (ib < 0) || (all->entries[ia].cn < wv->min_count) || (all->entries[ib].cn < wv->min_count)) return -1;
+  return (all->entries[i].cn - wv->min_count) / (double)all->entries[ia].cn / all->entries[ib].cn * wv->phrase_words;
+}
+
+/**
+ * ======== LearnPhrases ========
+ * 多线程统计词频和词对频次(每个线程一个表),合并后按得分选出短语,保存在phrases中.
+ */
+void LearnPhrases(struct word2vec *wv) {
+  long long a, b, parts, *start, count = 0, bigrams = 0;
+  struct phrase_table all;
+  struct phrase_task *tasks;
+  pthread_t *pt;
+  FILE *fi = OpenTrainFile(wv);
+  if (fi == NULL) {
+    Fail(wv, "ERROR: training data file not found!");
+  }
+  fseek(fi, 0, SEEK_END);
+  wv->file_size = ftell(fi);
+  fclose(fi);
+
+  // 和训练一样切块,线程从phrase_next领取
+  parts = (long long)wv->num_threads * 32;
+  if (parts > wv->file_size) parts = wv->file_size > 0 ? wv->file_size : 1;
+  start = (long long *)malloc((parts + 1) * sizeof(long long));
+  SplitFile(wv, parts, start);
+  pt = (pthread_t *)malloc(wv->num_threads * sizeof(pthread_t));
+  tasks = (struct phrase_task *)calloc(wv->num_threads, sizeof(struct phrase_task));
+  wv->phrase_next = 0;
+  for (a = 0; a < wv->num_threads; a++) {
+    PhraseTableInit(wv, &tasks[a].table, PHRASE_HASH_SIZE);
+    tasks[a].wv = wv;
+    tasks[a].start = start;
+    tasks[a].parts = parts;
+    pthread_create(&pt[a], NULL, PhraseCountThread, &tasks[a]);
+  }
+  for (a = 0; a < wv->num_threads; a++) pthread_join(pt[a], NULL);
+
+  // 合并各线程的表;合并时超过70%同样删掉低频项,极大的语料上低频词对的频次是近似的
+  PhraseTableInit(wv, &all, PHRASE_HASH_SIZE * 8);
+  wv->phrase_words = 0;
+  for (a = 0; a < wv->num_threads; a++) {
+    wv->phrase_words += tasks[a].words;
+    for (b = 0; b < tasks[a].table.size; b++) PhraseAdd(&all, tasks[a].table.entries[b].word, tasks[a].table.entries[b].cn);
+    PhraseTableFree(&tasks[a].table);
+  }
+
+  // 得分超过阈值的词对作为短语
+  for (a = 0; a < all.size; a++) {
+    if (strchr(all.entries[a].word, ' ') != NULL) bigrams++;
+    if (PhraseScore(wv, &all, a) > wv->phrase_threshold) count++;
+  }
+  for (b = 1024; b < count * 2; b *= 2);
+  PhraseTableInit(wv, &wv->phrases, b);
+  for (a = 0; a < all.size; a++) if (PhraseScore(wv, &all, a) > wv->phrase_threshold) PhraseAdd(&wv->phrases, all.entries[a].word, all.entries[a].cn);
+  if (wv->debug_mode > 0) printf("Phrases: %lld of %lld bigrams (threshold %g, %lld words)\n", wv->phrases.size, bigrams, wv->phrase_threshold,
+   wv->phrase_words);
+  PhraseTableFree(&all);
+  free(start);
+  free(tasks);
+  free(pt);
+}
+
+/**
+ * ======== ReadToken ========
+ * 读取一个词,识别短语时如果它和下一个词组成短语,合并成"a_b"返回.
+ * pos为这个词(或短语)之后的文件位置,文件结束时为-1.
+ *
+ * 判断是否合并需要预读下一个词,不合并时预读的词保存在r中,下次直接返回.
+ * r->chunk为当前词所在的块,下一个词在块尾之后时不合并:每个块的合并结果只取决于块内的内容,
+ * 训练时各线程分别读块,和建词典时顺序读整个文件合并出的词完全相同.
+ */
+void ReadToken(struct word2vec *wv, char *word, FILE *fin, struct phrase_reader *r, long long *pos) {
+  char key[MAX_STRING];
+  if (r->has_next) {
+    strcpy(word, r->next);
+    *pos = r->next_pos;
+    r->has_next = 0;
+  } else {
+    ReadWord(word, fin);
+    if (feof(fin)) {
+      *pos = -1;
+      return;
+    }
+    *pos = ftell(fin);
+  }
+  if ((wv->phrases.size == 0) || !strcmp(word, "</s>")) return;
+  while ((r->chunk < wv->num_chunks - 1) && (*pos > wv->chunk_start[r->chunk + 1])) r->chunk++;
+  ReadWord(r->next, fin);
+  if (feof(fin)) return;
+  r->next_pos = ftell(fin);
+  r->has_next = 1;
+  if ((r->next_pos <= wv->chunk_start[r->chunk + 1]) && PhraseKey(key, word, r->next) && (PhraseFind(&wv->phrases, key) >= 0)) {
+    key[strlen(word)] = '_';
+    strcpy(word, key);
+    *pos = r->next_pos;
+    r->has_next = 0;
+  }
+}
+
+/**
+ * ======== ReadTokenIndex ========
+ * ReadToken,返回词(或短语)在vocab词典中的下标index.
+ */
+int ReadTokenIndex(struct word2vec *wv, FILE *fin, struct phrase_reader *r, long long *pos) {
+  char word[MAX_STRING];
+  ReadToken(wv, word, fin, r, pos);
+  if (*pos < 0) return -1;
+  return SearchVocab(wv, word);
+}
+
 /**
  * ======== LearnVocabFromTrainFile ========
  * 从训练语料中动态创建词典vocab,同时完成vocab_hash的计算.
@@ -600,23 +1579,22 @@ void CreateBinaryTree() {
  *
  * 如果单词words出现次数小于min_count次,会从词典中筛选掉.
  */
-void LearnVocabFromTrainFile() {
+void LearnVocabFromTrainFile(struct word2vec *wv) {
   char word[MAX_STRING];
-  FILE *fin;
-  long long a, i;
+  FILE *fin = NULL;
+  long long a, i, pos, n = -1, k = 0;
+  const char *const *tokens = NULL;
+  struct phrase_reader reader;
   
   // 0. 预处理:vocab_hash初始化.
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
+  for (a = 0; a < vocab_hash_size; a++) wv->vocab_hash[a] = -1;
   
-  // 1. 打开语料文件
+  // 1. 打开语料文件;回调提供语料时回到第一句
   // 以指定方式打开指定路径的训练文件: train_file路径, rb:r读,b二进制文件;读取后会返回一个FILE对象,这个对象完成对文件的后续操作
-  fin = fopen(train_file, "rb");
-  if (fin == NULL) {// 打开失败,输出原因:文件没有找到
-    printf("ERROR: training data file not found!\n");
-    exit(1);
-  }
+  if (wv->sentence_fn != NULL) wv->sentence_fn(wv->sentence_arg, NULL);
+  else if ((fin = OpenTrainFile(wv)) == NULL) Fail(wv, "ERROR: training data file not found!");// 打开失败,输出原因:文件没有找到
   
-  vocab_size = 0;//记录词典大小
+  wv->vocab_size = 0;//记录词典大小
   
   // The special token </s> is used to mark the end of a sentence. In training,
   // the context window does not go beyond the ends of a sentence.
@@ -625,43 +1603,58 @@ void LearnVocabFromTrainFile() {
   // </s>表示句子终止符
   // 上下文采样时,不能超出句子,也就是说如果遇到</s>停止上下文采样
   // 3. 处理特殊字符</s>
-  AddWordToVocab((char *)"</s>");//将</s>保存在vocab第一个位置
+  AddWordToVocab(wv, (char *)"</s>");//将</s>保存在vocab第一个位置
+  
+  // 识别短语时按训练的块合并短语,先切块
+  memset(&reader, 0, sizeof(reader));
+  if ((wv->phrases.size > 0) && (wv->chunk_start == NULL)) InitChunks(wv);
   
   // 4. 开始读取词,并处理
   while (1) {
-    // Read the next word from the file into the string 'word'.
-    // 从文件中读取一个词
-    ReadWord(word, fin);
-    
-    // 读取到文件末尾,退出.
-    if (feof(fin)) break;
+    if (wv->sentence_fn != NULL) {
+      // 回调提供的语料:逐句读,每句之后是一个</s>,和训练文件中的换行相同;过长的词和ReadWord一样截断
+      if (k > n) {
+        n = wv->sentence_fn(wv->sentence_arg, &tokens);
+        if (n < 0) break;
+        k = 0;
+      }
+      snprintf(word, MAX_STRING, "%s", k < n ? tokens[k] : "</s>");
+      k++;
+    } else {
+      // Read the next word (or phrase) from the file into the string 'word'.
+      // 从文件中读取一个词(或者合并后的短语)
+      ReadToken(wv, word, fin, &reader, &pos);
+      
+      // 读取到文件末尾,退出.
+      if (pos < 0) break;
+    }
     
     // Count the total number of tokens in the training text.
     // train_words增加(读取次数,或者说训练语料长度)
-    train_words++;
+    wv->train_words++;
     
     // Print progress at every 100,000 words
     // 每处理10万个词,输出训练过程信息
-    if ((debug_mode > 1) && (train_words % 100000 == 0)) {
-      printf("%lldK%c", train_words / 1000, 13);
+    if ((wv->debug_mode > 1) && (wv->train_words % 100000 == 0)) {
+      printf("%lldK%c", wv->train_words / 1000, 13);
       fflush(stdout);
     }
     
     // Look up this word in the vocab to see if we've already added it.
     // 在词典中查找当前词,返回下标
-    i = SearchVocab(word);
+    i = SearchVocab(wv, word);
     
     // If it's not in the vocab...
     // 没有找到,将当前词添加到词典中,并完成词count的初始化(设置为1,出现了一次)
     if (i == -1) {
       // ...add it.
-      a = AddWordToVocab(word);
+      a = AddWordToVocab(wv, word);
       
       // Initialize the word frequency to 1.
-      vocab[a].cn = 1;
+      wv->vocab[a].cn = 1;
     
     // 如果已经出现过,更新count字段
-    } else vocab[i].cn++;
+    } else wv->vocab[i].cn++;
     
     // If the vocabulary has grown too large, trim out the most infrequent 
     // words. The vocabulary is considered "too large" when it's filled more
@@ -674,28 +1667,30 @@ void LearnVocabFromTrainFile() {
      * 怎么算增长速度过快? vocab_size > vocab_hash_size * 0.7; 0.7倍是比较合理空间,vocab_hash冲突情况不会经常发生.
      * 
      */
-    if (vocab_size > vocab_hash_size * 0.7) ReduceVocab();
+    if (wv->vocab_size > vocab_hash_size * 0.7) ReduceVocab(wv);
   }
   
   // Sort the vocabulary in descending order by number of word occurrences.
   // Remove (and free the associated memory) for all the words that occur
   // fewer than 'min_count' times.
   // 词典建成,语料文件遍历完成,依据min_count对词典中低频次进行处理,删除低频次
-  SortVocab();
+  SortVocab(wv);
   
   // Report the final vocabulary size, and the total number of words 
   // (excluding those filtered from the vocabulary) in the training set.
   // 输出筛选后vocab信息,vocab大小,语料库中词数train_words(已经筛选后,处理了低频次)
-  if (debug_mode > 0) {
-    printf("Vocab size: %lld\n", vocab_size);
-    printf("Words in train file: %lld\n", train_words);
+  if (wv->debug_mode > 0) {
+    printf("Vocab size: %lld\n", wv->vocab_size);
+    printf("Words in train file: %lld\n", wv->train_words);
   }
   /**
    *  long int ftell(FILE *stream) 返回给定流 stream 的当前文件位置,
    * 也就是文件大小filesize.
    */
-  file_size = ftell(fin);
-  fclose(fin);//关闭文件流
+  if (fin != NULL) {
+    wv->file_size = ftell(fin);
+    fclose(fin);//关闭文件流
+  }
 }
 
 /**
@@ -706,10 +1701,10 @@ void LearnVocabFromTrainFile() {
  * 
  * 一行一条记录: word count
  */
-void SaveVocab() {
+void SaveVocab(struct word2vec *wv) {
   long long i;
-  FILE *fo = fopen(save_vocab_file, "wb");
-  for (i = 0; i < vocab_size; i++) fprintf(fo, "%s %lld\n", vocab[i].word, vocab[i].cn);
+  FILE *fo = fopen(wv->save_vocab_file, "wb");
+  for (i = 0; i < wv->vocab_size; i++) fprintf(fo, "%s %lld\n", wv->vocab[i].word, wv->vocab[i].cn);
   fclose(fo);
 }
 
@@ -718,26 +1713,25 @@ void SaveVocab() {
  * ====================================
  * 从指定路径中读取vocab文件
  */
-void ReadVocab() {
+void ReadVocab(struct word2vec *wv) {
   long long a, i = 0;
   char c;
   char word[MAX_STRING];
   // 打开保存词典的文件
-  FILE *fin = fopen(read_vocab_file, "rb");
+  FILE *fin = fopen(wv->read_vocab_file, "rb");
   if (fin == NULL) {
-    printf("Vocabulary file not found\n");
-    exit(1);
+    Fail(wv, "Vocabulary file not found");
   }
   // vocab_hash初始化
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  vocab_size = 0;
+  for (a = 0; a < vocab_hash_size; a++) wv->vocab_hash[a] = -1;
+  wv->vocab_size = 0;
   // 读取词典文件
   while (1) {
     // 从文件中读取一个词
     ReadWord(word, fin);
     if (feof(fin)) break;
     // 添加到词典中
-    a = AddWordToVocab(word);
+    a = AddWordToVocab(wv, word);
     /**
      * 读取词典文件中的词count字段,赋值给vocab词的cn
      * 
@@ -745,741 +1739,3364 @@ void ReadVocab() {
      * 读取的不同格式数据,赋值给后边的变量
      * c可能是\n,换行符????
      */
-    fscanf(fin, "%lld%c", &vocab[a].cn, &c);
+    fscanf(fin, "%lld%c", &wv->vocab[a].cn, &c);
     i++;
   }
   // 词典处理
-  SortVocab();
-  if (debug_mode > 0) {
-    printf("Vocab size: %lld\n", vocab_size);
-    printf("Words in train file: %lld\n", train_words);
+  SortVocab(wv);
+  if (wv->debug_mode > 0) {
+    printf("Vocab size: %lld\n", wv->vocab_size);
+    printf("Words in train file: %lld\n", wv->train_words);
   }
-  fin = fopen(train_file, "rb");
+  if (wv->sentence_fn != NULL) return;
+  fin = OpenTrainFile(wv);
   if (fin == NULL) {
-    printf("ERROR: training data file not found!\n");
-    exit(1);
+    Fail(wv, "ERROR: training data file not found!");
   }
   // 打开训练语料文件,读取file_size大小
   fseek(fin, 0, SEEK_END);
-  file_size = ftell(fin);
+  wv->file_size = ftell(fin);
   fclose(fin);
 }
 
 /**
- * ======== InitNet ========
- *
+ * ======== InitRows ========
+ * 计算每个词在syn0/syn1neg中的行号word_row和总行数vocab_rows,见Hash Buckets.
+ * 从检查点恢复时bucket_words来自检查点,不重新计算.
+ */
+void InitRows(struct word2vec *wv) {
+  long long a;
+  if (wv->bucket_count > 0) {
+    if (!wv->resume) for (wv->bucket_words = 1; (wv->bucket_words < wv->vocab_size) && (wv->vocab[wv->bucket_words].cn >= wv->bucket_min_count); wv->bucket_words++);
+    wv->vocab_rows = wv->bucket_words + wv->bucket_count;
+  } else wv->vocab_rows = wv->bucket_words = wv->vocab_size;
+  wv->word_row = (long long *)malloc(wv->vocab_size * sizeof(long long));
+  if (wv->word_row == NULL) Fail(wv, "Memory allocation failed");
+  for (a = 0; a < wv->vocab_size; a++) wv->word_row[a] = a < wv->bucket_words ? a : wv->bucket_words + (long long)(w2vm_hash(wv->vocab[a].word) % wv->bucket_count);
+  if ((wv->debug_mode > 0) && (wv->bucket_count > 0))
+    printf("Rows: %lld words with their own rows, %lld words in %lld buckets\n", wv->bucket_words, wv->vocab_size - wv->bucket_words, wv->bucket_count);
+}
+
+/**
+ * ======== InitWeights ========
+ * 按当前模型的参数(layer1_size, hs, negative)分配并初始化syn0, syn1, syn1neg;InitRows之后调用.
  */
-void InitNet() {
+void InitWeights(struct word2vec *wv) {
   long long a, b;
   unsigned long long next_random = 1;
   
   // Allocate the hidden layer of the network, which is what becomes the word vectors.
   // The variable for this layer is 'syn0'.
   // 为隐藏层分配空间,syn0;word vectors;长数组,并不是矩阵形式;所以每次取之前,都要计算词向量在长数组中的index;
-  a = posix_memalign((void **)&syn0, 128, (long long)vocab_size * layer1_size * sizeof(real));
+  if (wv->ooc_dir[0] != 0) {
+    wv->ooc_head = wv->ooc_memory * 1048576 / ((wv->negative > 0 ? 2 : 1) * wv->layer1_size * sizeof(real));
+    if (wv->ooc_head > wv->vocab_rows) wv->ooc_head = wv->vocab_rows;
+    if (wv->debug_mode > 0) printf("Out of core: %lld of %lld rows per matrix in memory\n", wv->ooc_head, wv->vocab_rows);
+    wv->syn0 = OocAlloc(wv, "syn0", wv->vocab_rows);
+  } else wv->syn0 = (real *)HugeAlloc(wv, "syn0", (long long)wv->vocab_rows * wv->layer1_size * sizeof(real));
   
-  if (syn0 == NULL) {printf("Memory allocation failed\n"); exit(1);}
+  if (wv->syn0 == NULL) Fail(wv, "Memory allocation failed");
   
   // If we're using hierarchical softmax for training...
-  if (hs) {//如果使用hierarchical softmax,对应的,会生成huffman tree,进而需要theta参数,节点参数theta
+  if (wv->hs) {//如果使用hierarchical softmax,对应的,会生成huffman tree,进而需要theta参数,节点参数theta
     //theta向量大小和layer1_size大小相同,其实并没有这么大,非叶子结点个数为n-1个(n是叶子节点个数,大小等于vocab_size)
-    a = posix_memalign((void **)&syn1, 128, (long long)vocab_size * layer1_size * sizeof(real));
-    if (syn1 == NULL) {printf("Memory allocation failed\n"); exit(1);}
-    for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++)
-     syn1[a * layer1_size + b] = 0;
+    wv->syn1 = (real *)HugeAlloc(wv, "syn1", (long long)wv->vocab_size * wv->layer1_size * sizeof(real));
+    if (wv->syn1 == NULL) Fail(wv, "Memory allocation failed");
+    for (a = 0; a < wv->vocab_size; a++) for (b = 0; b < wv->layer1_size; b++)
+     wv->syn1[a * wv->layer1_size + b] = 0;
   }
   
   // If we're using negative sampling for training...
-  if (negative>0) {
+  if (wv->negative>0) {
     // Allocate the output layer of the network. 
     // The variable for this layer is 'syn1neg'.
     // This layer has the same size as the hidden layer, but is the transpose.
     // 输出层的数据,大小和hidden层向量相同;存储输出层词向量数组
-    a = posix_memalign((void **)&syn1neg, 128, (long long)vocab_size * layer1_size * sizeof(real));
+    if (wv->ooc_dir[0] != 0) wv->syn1neg = OocAlloc(wv, "syn1neg", wv->vocab_rows);
+    else wv->syn1neg = (real *)HugeAlloc(wv, "syn1neg", (long long)wv->vocab_rows * wv->layer1_size * sizeof(real));
     
-    if (syn1neg == NULL) {printf("Memory allocation failed\n"); exit(1);}
+    if (wv->syn1neg == NULL) Fail(wv, "Memory allocation failed");
     
     // Set all of the weights in the output layer to 0.
-    for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++)
-     syn1neg[a * layer1_size + b] = 0;
+    // 映射文件新建时内容就是0,不再逐个写0,否则整个文件都会变成脏页
+    if (wv->ooc_dir[0] == 0) for (a = 0; a < wv->vocab_rows; a++) for (b = 0; b < wv->layer1_size; b++)
+     wv->syn1neg[a * wv->layer1_size + b] = 0;
   }
   
   // Randomly initialize the weights for the hidden layer (word vector layer).
   // TODO - What's the equation here?
   // 隐藏层word vector layer 权重初始化
-  for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++) {
+  for (a = 0; a < wv->vocab_rows; a++) for (b = 0; b < wv->layer1_size; b++) {
     next_random = next_random * (unsigned long long)25214903917 + 11;
-    syn0[a * layer1_size + b] = (((next_random & 0xFFFF) / (real)65536) - 0.5) / layer1_size;
+    wv->syn0[a * wv->layer1_size + b] = (((next_random & 0xFFFF) / (real)65536) - 0.5) / wv->layer1_size;
   }
+}
+
+/**
+ * ======== InitNet ========
+ * 词到行的映射,当前模型的权重,Huffman树.
+ */
+void InitNet(struct word2vec *wv) {
+  InitRows(wv);
+  InitWeights(wv);
   
   // Create a binary tree for Huffman coding.
   // TODO - As best I can tell, this is only used for hierarchical softmax training...
-  CreateBinaryTree();
+  CreateBinaryTree(wv);
 }
 
 /**
- * ======== TrainModelThread ========
- * This function performs the training of the model.
- * 模型训练子例程,方便多线程调用
+ * ======== WallTime ========
+ * 返回单调时钟的当前时间(秒).
+ * clock()统计的是进程所有线程CPU时间之和,多线程时不能用来计算真实耗时.
  */
-void *TrainModelThread(void *id) {
-
-  /*
-   * word - Stores the index of a word in the vocab table.
-   * word_count - Stores the total number of training words processed.
-   */
-  long long a, b, d, cw, word, last_word, sentence_length = 0, sentence_position = 0;
-  long long word_count = 0, last_word_count = 0, sen[MAX_SENTENCE_LENGTH + 1];
-  long long l1, l2, c, target, label, local_iter = iter;
-  unsigned long long next_random = (long long)id;
-  real f, g;
-  clock_t now;
-  
-  // neu1 is only used by the CBOW architecture.
-  // neu1仅仅在CBOW模型中使用
-  real *neu1 = (real *)calloc(layer1_size, sizeof(real));
-  
-  // neu1e is used by both architectures.
-  // neu1e在两个模型中都用到;输出层对projection layer向量的梯度更新量
-  real *neu1e = (real *)calloc(layer1_size, sizeof(real));
-  
-  
-  // Open the training file and seek to the portion of the file that this 
-  // thread is responsible for.
-  // 处理数据,由于是多线程,需要对输入文件根据线程数目划分出每个线程负责的数量,用于线程训练;
-  FILE *fi = fopen(train_file, "rb");
-  fseek(fi, file_size / (long long)num_threads * (long long)id, SEEK_SET);
-  
-  // This loop covers the whole training operation...
-  while (1) {
-    // This block prints a progress update, and also adjusts the training 
-    // 'alpha' parameter.
-    if (word_count - last_word_count > 10000) {
-      word_count_actual += word_count - last_word_count;
-      last_word_count = word_count;
-      if ((debug_mode > 1)) {
-        now=clock();
-        printf("%cAlpha: %f  Progress: %.2f%%  Words/thread/sec: %.2fk  ", 13, alpha,
-         word_count_actual / (real)(iter * train_words + 1) * 100,
-         word_count_actual / ((real)(now - start + 1) / (real)CLOCKS_PER_SEC * 1000));
-        fflush(stdout);
-      }
-      // 修改学习率;动态修改,随着训练过程地进行,学习率逐渐降低
-      alpha = starting_alpha * (1 - word_count_actual / (real)(iter * train_words + 1));
-      if (alpha < starting_alpha * 0.0001) alpha = starting_alpha * 0.0001;
-    }
-    
-    // This 'if' block retrieves the next sentence from the training text and
-    // stores it in 'sen'.
-    // TODO - Under what condition would sentence_length not be zero?
-    // 从训练数据中,读取下一条句子,句子长度为MAX_SENTENCE_LENGTH
-    if (sentence_length == 0) {//是否需要读取一个新句子get a new sentence,保存到sen数组中[sen数组保存处理的当前句]
-      while (1) {
-        // Read the next word from the training data and lookup its index in 
-        // the vocab table. 'word' is the word's vocab index.
-        word = ReadWordIndex(fi);
-        
-        if (feof(fi)) break;
-        
-        // If the word doesn't exist in the vocabulary, skip it.
-        if (word == -1) continue;
-        
-        // Track the total number of training words processed.
-        word_count++;
-        
-        // 'vocab' word 0 is a special token "</s>" which indicates the end of 
-        // a sentence.
-        if (word == 0) break;//句子终止符
-        
-        /* 
-         * =================================
-         *   Subsampling of Frequent Words
-         * =================================
-         * This code randomly discards training words, but is designed to 
-         * keep the relative frequencies the same. That is, less frequent
-         * words will be discarded less often. 
-         *
-         * We first calculate the probability that we want to *keep* the word;
-         * this is the value 'ran'. Then, to decide whether to keep the word,
-         * we generate a random fraction (0.0 - 1.0), and if 'ran' is smaller
-         * than this number, we discard the word. This means that the smaller 
-         * 'ran' is, the more likely it is that we'll discard this word. 
-         *
-         * The quantity (vocab[word].cn / train_words) is the fraction of all 
-         * the training words which are 'word'. Let's represent this fraction
-         * by x.
-         *
-         * Using the default 'sample' value of 0.001, the equation for ran is:
-         *   ran = (sqrt(x / 0.001) + 1) * (0.001 / x)
-         * 
-         * You can plot this function to see it's behavior; it has a curved 
-         * L shape.
-         * 
-         * Here are some interesting points in this function (again this is
-         * using the default sample value of 0.001).
-         *   - ran = 1 (100% chance of being kept) when x <= 0.0026.
-         *      - That is, any word which is 0.0026 of the words *or fewer* 
-         *        will be kept 100% of the time. Only words which represent 
-         *        more than 0.26% of the total words will be subsampled.
-         *   - ran = 0.5 (50% chance of being kept) when x = 0.00746. 
-         *   - ran = 0.033 (3.3% chance of being kept) when x = 1.
-         *       - That is, if a word represented 100% of the training set
-         *         (which of course would never happen), it would only be
-         *         kept 3.3% of the time.
-         *
-         * NOTE: Seems like it would be more efficient to pre-calculate this 
-         *       probability for each word and store it in the vocab table...
-         *
-         * Words that are discarded by subsampling aren't added to our training
-         * 'sentence'. This means the discarded word is neither used as an 
-         * input word or a context word for other inputs.
-         */
-        /** 
-         * 对高频词进行降采样 subsamping for frequent words
-         * 
-         */
-        if (sample > 0) {//是否对高频词进行subsampling过程
-          // Calculate the probability of keeping 'word'.
-          // 计算词word保存的概率ran: ran = \sqrt(sample/f(w)) + sample/f(w);f(w)表示w的归一化频率;sample,降采样力度;
-          // 生成随机数大于ran,则跳过这个高频词
-          // 这里的ran计算公式 = (sqrt(f(w)/sample)+1)*(sample/f(w))
-          real ran = (sqrt(vocab[word].cn / (sample * train_words)) + 1) * (sample * train_words) / vocab[word].cn;
-          
-          // Generate a random number.
-          // The multiplier is 25.xxx billion, so 'next_random' is a 64-bit integer.
-          // 生成一个随机数
-          next_random = next_random * (unsigned long long)25214903917 + 11;
+double WallTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-          // If the probability is less than a random fraction, discard the word.
-          //
-          // (next_random & 0xFFFF) extracts just the lower 16 bits of the 
-          // random number. Dividing this by 65536 (2^16) gives us a fraction
-          // between 0 and 1. So the code is just generating a random fraction.
-          // 随机数归一化,然后和保存概率ran比较,判断词word是否应该删除
-          if (ran < (next_random & 0xFFFF) / (real)65536) continue;//大于保存概率,跳过
-        }
-        
-        // If we kept the word, add it to the sentence.
-        // 如果保留,添加到句子(数组)中,添加的是这个词word在字典中对应的下标index
-        sen[sentence_length] = word;
-        sentence_length++;
-        
-        // Verify the sentence isn't too long.
-        // 如果句子长度过长,截断处理
-        if (sentence_length >= MAX_SENTENCE_LENGTH) break;
-      }
-      //句子中指针位置,中心词w位置
-      sentence_position = 0;
-    }
-    // feof(fi)文件结束,返回非0值;反之,返回0
-    // 处理语料末尾数据:语料终止,最后数据量不足
-    if (feof(fi) || (word_count > train_words / num_threads)) {
-      word_count_actual += word_count - last_word_count;
-      local_iter--;
-      if (local_iter == 0) break;
-      word_count = 0;
-      last_word_count = 0;
-      sentence_length = 0;
-      fseek(fi, file_size / (long long)num_threads * (long long)id, SEEK_SET);
-      continue;
-    }
-    
-    // Get the next word in the sentence. The word is represented by its index
-    // into the vocab table.
-    // 得到当前中心词;在句子中取一个词word,取出的是word在字典中对应的下标index
-    word = sen[sentence_position];
-    
-    if (word == -1) continue;//如果没找到,继续
+/**
+ * ======== PrefetchChunk ========
+ * 提示内核预读第k次领取的块(只在打乱块顺序时需要,顺序读时内核自己会预读);内存中的语料没有文件描述符,不需要预读.
+ */
+void PrefetchChunk(struct word2vec *wv, FILE *fi, long long k) {
+  int fd = fileno(fi);
+  if ((wv->chunk_order == NULL) || (wv->prefetch_blocks == 0) || (k >= wv->iter * wv->num_chunks) || (fd < 0)) return;
+  k = ChunkBlock(wv, k);
+  posix_fadvise(fd, wv->chunk_start[k], wv->chunk_start[k + 1] - wv->chunk_start[k], POSIX_FADV_WILLNEED);
+}
 
-    // 模型参数初始化
-    //cbow模型中,xw向量,输入向量累和 neu1 projection layer向量
-    for (c = 0; c < layer1_size; c++) neu1[c] = 0;
-    //e,用来对词向量进行更新 output layer every non-leaf node's theta parameters,the dimension of vector theta is same with the neu1
-    for (c = 0; c < layer1_size; c++) neu1e[c] = 0;
-    
-    // b随机初始化, b是中心词两边读取词长度大小
-    next_random = next_random * (unsigned long long)25214903917 + 11;
-    // 'b' becomes a random integer between 0 and 'window'.
-    // This is the amount we will shrink the window size by.
-    // 确定b大小,[0,window);
-    b = next_random % window;//每个中心词对应上下文取值边界范围,由于是随机数,导致每个中心词上下文取值范围是不同的,window还有什么用,只是指定了一个范围
-    
-    /* 
-     * ====================================
-     *        CBOW Architecture
-     * ====================================
-     */
-    if (cbow) {  //train the cbow architecture
-      // in -> hidden, sum up all the word vectors of all the words in the window
-      // 输入层->隐层;将window里词的词向量累加,得到映射层向量xw
-      cw = 0;//cw保存选择词的数目,词向量的个数
-      /*
-      * 扫描目标单词的左右几个单词
-      * ===================================
-      * sentence_position:i 处理的当前中心词
-      * 上下文边界取值c: [i-(window-b), i+(window-b)];
-      * window-b是上下文边界范围;中心词i前面window-b个,后面window-b个;window-b=c,一共2c个上下文向量,一般情况;
-      * 如果上下文取值超出句子边界(超过句子头,超出句子尾),上下文向量就不一定了,所以需要cw来统计取值到的上下文向量个数
-      * 当a=window时,c=i-window+a=i-window+window=i;等于当前中心词,跳过;
-      * 这样就保证neu1是sentence_position中心词的上下文向量累积和,而且不包括当前中心词.
-      */
-      for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
-        c = sentence_position - window + a;
-        if (c < 0) continue;
-        if (c >= sentence_length) continue;
-        last_word = sen[c];
-        if (last_word == -1) continue;
-        //syn0: 应该是将所有的词向量拼接到一个长向量里了;向量长度为:layer1_size*n_words,所以需要确定是word在常向量里的位置
-        // syn0 词典词向量数组; 将读取的上下文累加,得到projection layer向量neu1
-        for (c = 0; c < layer1_size; c++) neu1[c] += syn0[c + last_word * layer1_size];//syn0[index] index词的词向量
-        cw++;//统计读取词向量数目
-      }
-      if (cw) {
-        // 对projection layer累加向量neu1取平均;
-        for (c = 0; c < layer1_size; c++) neu1[c] /= cw;//对累加向量取均值
-        /* 
-        * 开始训练
-        * 不同策略的训练过程有所不同
-        */
-       //=======================================================================
-        /*
-        * 1.hierarchical softmax sgd更新方法:每个样本(w,context(w))进行一次更新
-        * 这种策略依赖于huffman树,每个非叶子结点对应有一个参数,参数维度和词向量维度相同;
-        * 而每次分支,也就是说每个非叶子结点都看做是一次二分类过程,分类方法采用logistic regression方法;
-        * 而分类结果由每条分支的Huffman编码确定,word2vec认为左分支编码为1,分为负类;右分支编码为0,分为正类;
-        * huffman树的构造主要是用来拟合条件概率p(w|context(w)),我们用一个函数来拟合这个条件概率F(w,context(w);\theta) = p(w|context(w)),
-        * 避免繁琐的统计过程来计算条件概率,大大节省了空间以及时间.
-        * 依据huffman树结构,比如说叶子节点w对应的huffman编码为111,那么条件概率p(w|context(w))计算过程为:
-        * p(w|context(w)) = (1-sigma(theta_1*c))*(1-sigma(theta_2*c))*(1-sigma(theta_4*c)) 
-        * 所以,我们需要先得到非叶子结点的参数theta,然后才能计算条件概率;
-        */
-        // 针对当前中心词,计算条件概率p(w|context(w));计算过程依赖于中心词word的huffman code;codelen存储huffman code的code length
-        if (hs) for (d = 0; d < vocab[word].codelen; d++) {//word中心词
-          //1. 前向传播
-          f = 0;//保存sigma(theta*c),分为正类的概率(编码为0)
-          //vocab结构体中point存储着叶子节点路径[点集,从根节点到这个叶子节点]
-          l2 = vocab[word].point[d] * layer1_size;//得到当前非叶子结点index,然后计算在参数数组中的偏移位置
-          // Propagate hidden -> output
-          // 一次分类:非叶子结点分类logistic regression
-          for (c = 0; c < layer1_size; c++) f += neu1[c] * syn1[c + l2];
-          if (f <= -MAX_EXP) continue;
-          else if (f >= MAX_EXP) continue;
-          else f = expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))];
-          //2. 反向传播 sgd更新
-          //L(w,j)对theta偏导数以及L(w,j)对c_w偏导数中的重合量,两个梯度中都有这个量
-          //为了方便,我们提前计算,之后重复使用
-          g = (1 - vocab[word].code[d] - f) * alpha;
-          // Propagate errors output -> hidden;可以看做是output->hidden的反向传播过程
-          // 计算当前非叶子结点对上下文向量c_w的更新量;由于c_w参与了路径上的所有非叶子结点的分类过程,
-          // 所以对context(w)上下文中的每个向量更新时,都需要先累计所有分类过程的更新量,最后再对上下文中词向量进行更新
-          // 累计梯度更新量;对c_w的梯度
-          for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1[c + l2];
-          // 更新当前非叶子结点的参数theta
-          for (c = 0; c < layer1_size; c++) syn1[c + l2] += g * neu1[c];
-        }
-        /* 
-        * 2.NEGATIVE SAMPLING方法
-        * 网络结构也是三层(如果输入层算一层的话): Input -> Projection -> Output
-        * Input layer是上下文向量集context(w);
-        * Projection layer是上下文向量和c(w),有可能会取平均;上下文向量context(w)也是通过采样选择的;
-        * Output layer是vocab_size大小的词向量集;
-        * 
-        * Same with hierarchical softmax neural network, 这个网络结构也是用来计算条件概率p(w|context(w)).
-        * 这种方法依赖于负采样策略;
-        * 
-        * 负采样策略:简单来说是对vocab_size大小的词集的带权负采样过程,权重是word在语料中的词频大小,通常会做归一化;权重越大,越有可能被选中,权重小,选中可能性就比较小.
-        * 这里将vocab_size个词的归一化权重,累积到[0,1]线段上,不同权的词所占的长度不同,但这个长度正好是它的权重大小-----权重统计;
-        * 我们的采样过程,始终要对应到采样的词上,但并不是直接选词,还要考虑到权重;所以,这里存在一个与权重相关的映射关系,考虑到[0,1]线段;
-        * 我们将这个线段分为M份(M >> N),然后生成一个大小在M范围内的随机数,然后这个随机数在映射到[0,1]线段上,看它落在哪个区间,这个区间对应权重的词,就是我们的取样词.
-        * 
-        * 存在一个trick:[0,1]线段的每个词的权重,并不是真正的词频,而是取了一个3/4次幂,为什么是这个数?因为效果好.
-        * 
-        * 最重要的条件概率p(w|context(w))怎么计算?举例来说,已知中心词w和上下文词向量context(w),以及中心词w的负采样样本neg(w);neg(w)中不包含中心词w本身;
-        * 这个计算过程包括多个分类过程,每个分类过程:在上下文context(w)已知的情况下,计算p(u|context(w))出现的概率,其中词u取值范围$u \in \{w\} \cup neg(w)$,
-        * 语言描述就是说,u属于中心词w和w的负采样本集neg(w)两个集合的并集内;那么正负类的确定,如果u=w,就属于正类,反之,属于负类,将两个统一后,label表示分类结果,可以得到:
-        * p(u|context(w))={sigma(u*c)}^label * {1-sigma(u*c)}^(1-label).
-        * 了解了上下文已知的情况下,每个词的分类效果,那么条件概率p(w|context(w))怎么计算呢?
-        * 
-        * 类似于cbow+hs方法,条件概率是多次分类过程的连乘积;negative sampling方法,这个条件概率是negative+1个分类过程决定;
-        * p(w|context(w))=p(w|context(w))* \prod_{u \in neg(w)} p(u|context(w))
-        * 
-        * 这是一个样本的条件概率
-        */
-        if (negative > 0) for (d = 0; d < negative + 1; d++) {
-          if (d == 0) {//处理当前中心词
-            target = word;
-            label = 1;
-          } else {//neg(w)采样
-            next_random = next_random * (unsigned long long)25214903917 + 11;
-            target = table[(next_random >> 16) % table_size];//负采样结果,词下标
-            if (target == 0) target = next_random % (vocab_size - 1) + 1;
-            // 如果采样到当前中心词,跳过,进行下一次采样
-            if (target == word) continue;
-            label = 0;
-          }
-          // 获取当前词的词向量
-          l2 = target * layer1_size;// 计算偏置
-          f = 0;//sigmoid函数值
-          // 前向传播
-          //neu1存储projection 的上下文词向量和c(w);syn1neg存储词向量数组,输出层结果,
-          for (c = 0; c < layer1_size; c++) f += neu1[c] * syn1neg[c + l2];//找到抽样词的词向量
-          //计算 关于上下文和c(w)和当前抽样词word u梯度的重合部分g
-          if (f > MAX_EXP) g = (label - 1) * alpha;//sigmoid = 1
-          else if (f < -MAX_EXP) g = (label - 0) * alpha;//sigmoid = 0
-          else g = (label - expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * alpha;
-          // 更新c(w)
-          for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1neg[c + l2];
-          // 更新抽样词u的词向量v(u)
-          for (c = 0; c < layer1_size; c++) syn1neg[c + l2] += g * neu1[c];
-        }
-        // hidden -> in
-        // 对上下文context(w)中词向量更新[组成上下文的每个词向量]
-        for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
-          c = sentence_position - window + a;
-          if (c < 0) continue;
-          if (c >= sentence_length) continue;
-          last_word = sen[c];
-          if (last_word == -1) continue;
-          // 更新context(w)中的词向量
-          for (c = 0; c < layer1_size; c++) syn0[c + last_word * layer1_size] += neu1e[c];
-        }
-      }
-    } 
-    /* 
-     * ====================================
-     *        Skip-gram Architecture
-     * ====================================
-     * 
-     * 神经网路的用途在于计算条件概率p(context(w)|w),用神经网络来拟合条件概率函数F(w,context(w),theta) = p(context(w)|w)
-     * 
-     * sen - This is the array of words in the sentence. Subsampling has already been
-     *       applied. I don't know what the word representation is...
-     *
-     * sentence_position - This is the index of the current input word.
-     *
-     * a - Offset into the current window, relative to the window start.
-     *     a will range from 0 to (window * 2) (TODO - not sure if it's inclusive or
-     *      not).
-     *
-     * c - 'c' is the index of the current context word *within the sentence*
-     *
-     * syn0 - The hidden layer weights.
-     *
-     * l1 - Index into the hidden layer (syn0). Index of the start of the
-     *      weights for the current input word.
-     */
-    else {  
-      // Loop over the positions in the context window (skipping the word at
-      // the center). 'a' is just the offset within the window, it's not 
-      // the index relative to the beginning of the sentence.
-      // 上下文抽样context(w)
-      for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
-        
-        // Convert the window offset 'a' into an index 'c' into the sentence 
-        // array.
-        c = sentence_position - window + a;//上下文抽样词u
-        
-        // Verify c isn't outisde the bounds of the sentence.
-        if (c < 0) continue;
-        if (c >= sentence_length) continue;
-        
-        // Get the context word. That is, get the id of the word (its index in
-        // the vocab table).
-        // 上下文抽样词u,得到index
-        last_word = sen[c];
-        
-        // At this point we have two words identified:
-        //   'word' - The word at our current position in the sentence (in the
-        //            center of a context window).
-        //   'last_word' - The word at a position within the context window.
-        
-        // Verify that the word exists in the vocab (I don't think this should
-        // ever be the case?)
-        if (last_word == -1) continue;
-        
-        // Calculate the index of the start of the weights for 'last_word'.
-        // 得到上下文抽样词的词向量,先计算词向量在总词向量数组中的偏置
-        l1 = last_word * layer1_size;
-        // 累计更新,关于v(w);
-        for (c = 0; c < layer1_size; c++) neu1e[c] = 0;
+/**
+ * ======== ChunkDone ========
+ * 第k次领取的块训练完,这一轮的块都训练完时记录结束时间.
+ */
+void ChunkDone(struct word2vec *wv, long long k) {
+  long long e = k / wv->num_chunks;
+  if (__sync_add_and_fetch(&wv->epoch_blocks[e], 1) == wv->num_chunks) wv->epoch_end[e] = WallTime() - wv->train_start;
+}
 
-        /*
-        * 1. HIERARCHICAL SOFTMAX
-        * =======================================
-        * 拟合的函数形式F(w,context(w),theta) = p(context(w)|w).
-        * 首先,需要知道的一点是由中心词w预测上下文context(w);上下文context(w)并不是一个词,或者说不是一个向量,
-        * 包括中心词前c个向量,后c个向量.所以条件概率p(context(w)|w)会和之前的p(w|context(w))有所不同.
-        * 假设,中心词w的上下文向量context(w),其中抽样词u \in context(w).
-        * 那么,条件概率p(context(w)|w)计算方法:
-        * p(context(w)|w) = \prod p(u|w)
-        * 
-        * 这样就转换成求每个条件向量p(u|w),把v(w)当做输出向量,u当做预测.但是,由于context(w)中包含不同的u.
-        * 
-        * 为了和之前的更新方式同意起来,代码一致.
-        * 
-        * Google工程师发现:如果w为中心词时,u在w的上下文窗口内;那么,当u为中心词时,w也在u的上下文窗口内.
-        * 那么,cost function可以转换,变成和cbow形式差不多的形式,只不过context(w)变成了一个向量,这里是抽样词,
-        * 也就是说cbow的p(w|context(w)),skip-gram原来的p(u|w)变成p(w|u),u是上下文,不过变成了一个向量;w还是中心词.
-        * 
-        * 这样两种模型loss function几乎相同,统一起来了.
-        * 
-        * 语料库的loss function为:
-        * \sum_{s=1}^S \sum_{t=1}^T \sum_{-c<=j<=c}log(w_{t+j}|w_t) = \sum_{s=1}^S \sum_{t=1}^T \sum_{-c<=j<=c}log(w_t|w_{t+j})
-        * 
-        * 意思是:计算语料库中所有句子的语言概率---遍历语料库中所有句子,每条句子每个中心词,每个中心词对应的上下文的条件概率.
-        * 从右到左,最里的sum是计算上下文概率p(context(w)|w),再外一层是计算句子概率,最外层是计算整个语料库所有句子的语言概率和.
-        * 
-        * 
-        * 转换成和cbow类似的分类过程,也是p(w|context(w)),不过context(w)是由一个向量组成.
-        * p(w|u)
-        */
-        if (hs) for (d = 0; d < vocab[word].codelen; d++) {//计算p(w|u) u是上下文抽样词的一个;进行codelen次分类过程
-          f = 0;
-          l2 = vocab[word].point[d] * layer1_size;
-          // Propagate hidden -> output
-          // syn0抽样词,和cbow中的c(w)一样; syn1是每个非叶子结点的参数theta
-          // l1上下文抽样词下标;l2非叶子结点分类过程对应参数
-          for (c = 0; c < layer1_size; c++) f += syn0[c + l1] * syn1[c + l2];
-          if (f <= -MAX_EXP) continue;
-          else if (f >= MAX_EXP) continue;
-          else f = expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))];
-          // 'g' is the gradient multiplied by the learning rate
-          // 计算两个梯度中的重合量,方便重复使用
-          g = (1 - vocab[word].code[d] - f) * alpha;
-          // Propagate errors output -> hidden
-          // 计算关于u累积量,因为u参与了所有word的分类过程,所以要累计,最后在用累计量对u词向量进行一次更新
-          for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1[c + l2];
-          // Learn weights hidden -> output
-          // 更新每个分类过程的参数
-          for (c = 0; c < layer1_size; c++) syn1[c + l2] += g * syn0[c + l1];
-        }
-        
-        /* 
-        * 2. NEGATIVE SAMPLING p(context(w)|w)
-        * ===========================================================
-        * 和cbow+neg方法类似,并不是对所有词向量更新,只更新负采样的样本集
-        * 
-        * 同时和skip-gram模型的特点
-        * p(context(w)|w) = \prod_{u \in context(w)} p(u|w) = \prod_{u \in context(w)}p(w|u)
-        * 
-        */
-        if (negative > 0) for (d = 0; d < negative + 1; d++) {//负采样过程
-          // On the first iteration, we're going to train the positive sample.
-          // 使用负采样,抽取一个负样本;d=0时,采样正样本,所以负采样次数为negative + 1次
-          if (d == 0) {
-            target = word;
-            label = 1;
-          // On the other iterations, we'll train the negative samples.
-          } else {
-            // Pick a random word to use as a 'negative sample'; do this using 
-            // the unigram table.
-            
-            // Get a random integer.
-            next_random = next_random * (unsigned long long)25214903917 + 11;
-            
-            // 'target' becomes the index of the word in the vocab to use as
-            // the negative sample.
-            target = table[(next_random >> 16) % table_size];
-            
-            // If the target is the special end of sentence token, then just
-            // pick a random word from the vocabulary instead.
-            if (target == 0) target = next_random % (vocab_size - 1) + 1;
-            
-            // Don't use the positive sample as a negative sample!
-            if (target == word) continue;
-            
-            // Mark this as a negative example.
-            label = 0;
-          }
-          
-          // Get the index of the target word in the output layer.
-          l2 = target * layer1_size;
-          
-          // At this point, our two words are represented by their index into
-          // the layer weights.
-          // l1 - The index of our input word within the hidden layer weights.
-          // l2 - The index of our output word within the output layer weights.
-          // label - Whether this is a positive (1) or negative (0) example.
-          
-          // Calculate the dot-product between the input words weights (in 
-          // syn0) and the output word's weights (in syn1neg).
-          f = 0;
-          //syn0 上下文向量,条件; syn1neg 负采样样本
-          for (c = 0; c < layer1_size; c++) f += syn0[c + l1] * syn1neg[c + l2];
-          
-          // This block does two things:
-          //   1. Calculates the output of the network for this training
-          //      pair, using the expTable to evaluate the output layer
-          //      activation function.
-          //   2. Calculate the error at the output, stored in 'g', by
-          //      subtracting the network output from the desired output, 
-          //      and finally multiply this by the learning rate.
-          // 计算两个梯度计算过程的重合量
-          if (f > MAX_EXP) g = (label - 1) * alpha;
-          else if (f < -MAX_EXP) g = (label - 0) * alpha;
-          else g = (label - expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * alpha;
-          
-          // Multiply the error by the output layer weights.
-          // (I think this is the gradient calculation?)
-          // Accumulate these gradients over all of the negative samples.
-          // 关于条件u的累计梯度更新量
-          for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1neg[c + l2];
-          
-          // Update the output layer weights by multiplying the output error
-          // by the hidden layer weights.
-          // 负采样抽样样本梯度更新
-          for (c = 0; c < layer1_size; c++) syn1neg[c + l2] += g * syn0[c + l1];
-        }
-        // Once the hidden layer gradients for all of the negative samples have
-        // been accumulated, update the hidden layer weights.
-        // 负采样完成后,对条件u对应向量进行一次性更新
-        for (c = 0; c < layer1_size; c++) syn0[c + l1] += neu1e[c];
-      }
-    }
-    
-    // Advance to the next word in the sentence.
-    // 获取下一个训练样本--当前句子,更换w,context(w)
-    sentence_position++;
-    
-    // Check if we've reached the end of the sentence.
-    // If so, set sentence_length to 0 and we'll read a new sentence at the
-    // beginning of this loop.
-    // 如果到当前句子末尾,读取下一个句子
-    if (sentence_position >= sentence_length) {
-      sentence_length = 0;
-      continue;
-    }
+/**
+ * ======== GetChunk ========
+ * 从全局计数器领取下一个块,将fi定位到块首,领取序号保存在chunk中,块尾偏移保存在chunk_end中.
+ * 第k次领取的块号见ChunkBlock,同时预读之后要领取的块,见PrefetchChunk.
+ * 从检查点恢复时,先分配检查点中未完成的块(pending_chunk),定位到记录的位置继续读.
+ * 领取和登记到stat(供检查点记录)在chunk_lock内一起完成,见Checkpoint.
+ * 所有轮次的块都已领取完,或者评估决定提前结束训练(training_stop)时返回0.
+ */
+int GetChunk(struct word2vec *wv, FILE *fi, struct thread_stat *stat, long long *chunk, long long *chunk_end) {
+  long long k, pos, fresh = 0;
+  if (wv->training_stop) return 0;
+  pthread_mutex_lock(&wv->chunk_lock);
+  if (wv->pending_next < wv->pending_count) {
+    k = wv->pending_chunk[wv->pending_next];
+    pos = wv->pending_pos[wv->pending_next++];
+  } else if (wv->next_chunk < wv->iter * wv->num_chunks) {
+    k = wv->next_chunk++;
+    pos = wv->chunk_start[ChunkBlock(wv, k)];
+    fresh = 1;
+  } else {
+    pthread_mutex_unlock(&wv->chunk_lock);
+    return 0;
   }
-  fclose(fi);
-  free(neu1);
-  free(neu1e);
-  pthread_exit(NULL);
+  stat->chunk_pos = pos;
+  stat->chunk = k;
+  pthread_mutex_unlock(&wv->chunk_lock);
+  *chunk = k;
+  if (fresh) PrefetchChunk(wv, fi, k + (wv->prefetch_blocks < 0 ? wv->num_threads : wv->prefetch_blocks));
+  fseek(fi, pos, SEEK_SET);
+  *chunk_end = wv->chunk_start[ChunkBlock(wv, k) + 1];
+  return 1;
 }
 
 /**
- * ======== TrainModel ========
- * Main entry point to the training process.
+ * ======== SampleLoss ========
+ * 一次二分类的负对数似然:label = 1时为-log sigmoid(f),label = 0时为-log sigmoid(-f);
+ * 写成log1p的形式,f超出[-MAX_EXP, MAX_EXP]时也不会溢出.
  */
-void TrainModel() {
-  long a, b, c, d;
-  FILE *fo;
-  
-  //线程指针pthread_t
-  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));//多线程;线程数组
-  
-  printf("Starting training using file %s\n", train_file);
-  
-  starting_alpha = alpha;//初始学习率;学习率动态变动
-  
-  // Either load a pre-existing vocabulary, or learn the vocabulary from 
-  // the training file.
-  // 区分是否指定词库;如果指定,读取词库文件;否则,从训练语料中学习;
-  if (read_vocab_file[0] != 0) ReadVocab(); else LearnVocabFromTrainFile();
-  
-  // Save the vocabulary.判断是否需要保存词库
-  if (save_vocab_file[0] != 0) SaveVocab();
-  
-  // Stop here if no output_file was specified. 如果没有指定保存文件,直接退出;[保存文件是指词向量保存文件]
-  if (output_file[0] == 0) return;
-  
-  // Allocate the weight matrices and initialize them.
-  // 网络初始化
-  InitNet();
+double SampleLoss(real f, int label) {
+  double x = label ? f : -f;
+  return x > 0 ? log1p(exp(-x)) : -x + log1p(exp(x));
+}
 
-  // If we're using negative sampling, initialize the unigram table, which
-  // is used to pick words to use as "negative samples" (with more frequent
-  // words being picked more often).
-  // 如果使用负采样,初始化unigram table  
-  if (negative > 0) InitUnigramTable();
-  
-  // Record the start time of training.
-  // 计时,debug提示信息
-  start = clock();
-  
-  // Run training, which occurs in the 'TrainModelThread' function.
-  // 多线程训练,加快训练速度
-  // 创建num_threads个线程,指定线程地址,线程属性,线程调用函数,传递给线程调用函数的参数(引用传递,传递指针)
-  for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, TrainModelThread, (void *)a);
-  for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);//用于等待其他线程;一个线程仅允许一个线程使用pthread_join()等待它的终止
-  
-  // 输出最终的词向量训练结果
-  fo = fopen(output_file, "wb");
-
-  // 词向量已经训练完,之后对词向量的不同应用
-  if (classes == 0) {// 词向量保存
-    // Save the word vectors
-    // 保存,将内容写到fo文件中,先写字典长度,词向量长度参数
-    fprintf(fo, "%lld %lld\n", vocab_size, layer1_size);
-    for (a = 0; a < vocab_size; a++) {
-      // 保存格式: word --- word_vector
-      // 先写词word
-      fprintf(fo, "%s ", vocab[a].word);
-      // 保存这个词的词向量;判断是否以二进制形式保存
-      if (binary) for (b = 0; b < layer1_size; b++) fwrite(&syn0[a * layer1_size + b], sizeof(real), 1, fo);
-      else for (b = 0; b < layer1_size; b++) fprintf(fo, "%lf ", syn0[a * layer1_size + b]);
-      fprintf(fo, "\n");
-    }
-  } else {// 词向量kmeans聚类
-    // Run K-means on the word vectors
-    int clcn = classes, iter = 10, closeid;
-    int *centcn = (int *)malloc(classes * sizeof(int));
-    int *cl = (int *)calloc(vocab_size, sizeof(int));
-    real closev, x;
-    real *cent = (real *)calloc(classes * layer1_size, sizeof(real));
-    for (a = 0; a < vocab_size; a++) cl[a] = a % clcn;
-    for (a = 0; a < iter; a++) {
-      for (b = 0; b < clcn * layer1_size; b++) cent[b] = 0;
-      for (b = 0; b < clcn; b++) centcn[b] = 1;
-      for (c = 0; c < vocab_size; c++) {
-        for (d = 0; d < layer1_size; d++) cent[layer1_size * cl[c] + d] += syn0[c * layer1_size + d];
-        centcn[cl[c]]++;
-      }
-      for (b = 0; b < clcn; b++) {
-        closev = 0;
-        for (c = 0; c < layer1_size; c++) {
-          cent[layer1_size * b + c] /= centcn[b];
-          closev += cent[layer1_size * b + c] * cent[layer1_size * b + c];
-        }
-        closev = sqrt(closev);
-        for (c = 0; c < layer1_size; c++) cent[layer1_size * b + c] /= closev;
-      }
-      for (c = 0; c < vocab_size; c++) {
-        closev = -10;
-        closeid = 0;
-        for (d = 0; d < clcn; d++) {
-          x = 0;
-          for (b = 0; b < layer1_size; b++) x += cent[layer1_size * d + b] * syn0[c * layer1_size + b];
-          if (x > closev) {
-            closev = x;
-            closeid = d;
-          }
-        }
-        cl[c] = closeid;
-      }
+/**
+ * ======== PerfOpen ========
+ * 为调用线程(inherit = 1时包括之后创建的子线程)打开PERF_EVENTS个硬件计数器,打开后即开始计数.
+ * 打开失败(内核不允许,虚拟机不支持该事件等)的计数器fd为-1,之后读出的值记为-1.
+ * 返回成功打开的计数器个数.
+ */
+int PerfOpen(int *fds, int inherit) {
+  struct perf_event_attr attr;
+  int e, opened = 0;
+  for (e = 0; e < PERF_EVENTS; e++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.inherit = inherit;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    switch (e) {
+      case PERF_CYCLES: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+      case PERF_INSTRUCTIONS: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+      case PERF_LLC_MISSES: attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16); break;
+      case PERF_DTLB_MISSES: attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16); break;
+      default: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
     }
-    // Save the K-means classes
-    for (a = 0; a < vocab_size; a++) fprintf(fo, "%s %d\n", vocab[a].word, cl[a]);
-    free(centcn);
-    free(cent);
-    free(cl);
+    // pid = 0, cpu = -1: 统计调用线程,不限CPU
+    fds[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fds[e] >= 0) opened++;
   }
+  return opened;
+}
+
+/**
+ * ======== PerfStart / PerfStop / PerfClose ========
+ * PerfStart读取当前计数到base;PerfStop再读一次,values = 当前计数 - base;PerfClose关闭计数器.
+ */
+void PerfStart(int *fds, long long *base) {
+  int e;
+  for (e = 0; e < PERF_EVENTS; e++) {
+    base[e] = -1;
+    if (fds[e] < 0) continue;
+    if (read(fds[e], &base[e], sizeof(long long)) != sizeof(long long)) base[e] = -1;
+  }
+}
+
+void PerfStop(int *fds, long long *base, long long *values) {
+  int e;
+  PerfStart(fds, values);
+  for (e = 0; e < PERF_EVENTS; e++) if ((values[e] >= 0) && (base[e] >= 0)) values[e] -= base[e]; else values[e] = -1;
+}
+
+void PerfClose(int *fds) {
+  int e;
+  for (e = 0; e < PERF_EVENTS; e++) if (fds[e] >= 0) {
+    close(fds[e]);
+    fds[e] = -1;
+  }
+}
+
+/**
+ * ======== PerfPrint ========
+ * 输出一组计数(一个阶段或一个线程),附带IPC;同时写入telemetry.
+ */
+void PerfPrint(struct word2vec *wv, const char *kind, const char *name, long long *values) {
+  int e;
+  if (wv->debug_mode > 0) {
+    printf("%-8s %-8s", kind, name);
+    for (e = 0; e < PERF_EVENTS; e++) {
+      if (values[e] < 0) printf("  %s n/a", perf_names[e]);
+      else printf("  %s %lld", perf_names[e], values[e]);
+    }
+    if ((values[0] > 0) && (values[1] >= 0)) printf("  ipc %.2f", values[1] / (double)values[0]);
+    printf("\n");
+  }
+  if (wv->telemetry != NULL) {
+    fprintf(wv->telemetry, "{\"event\":\"perf\",\"%s\":\"%s\"", kind, name);
+    for (e = 0; e < PERF_EVENTS; e++) fprintf(wv->telemetry, ",\"%s\":%lld", perf_names[e], values[e]);
+    fprintf(wv->telemetry, "}\n");
+    fflush(wv->telemetry);
+  }
+}
+
+/**
+ * ======== PhaseBegin / PhaseEnd ========
+ * 记录一个阶段(词典,初始化,采样表,训练,保存)的墙上时间,PhaseEnd输出耗时.
+ */
+void PhaseBegin(struct word2vec *wv) {
+  if (wv->perf_mode) PerfStart(wv->perf_fds, wv->perf_base);
+  wv->phase_start = WallTime();
+}
+
+void PhaseEnd(struct word2vec *wv, int phase) {
+  wv->phase_seconds[phase] = WallTime() - wv->phase_start;
+  if (wv->perf_mode) PerfStop(wv->perf_fds, wv->perf_base, wv->perf_phase[phase]);
+  if (wv->debug_mode > 0) printf("Phase %s: %.3fs\n", phase_names[phase], wv->phase_seconds[phase]);
+  if (wv->telemetry != NULL) {
+    fprintf(wv->telemetry, "{\"event\":\"phase\",\"phase\":\"%s\",\"seconds\":%.6f}\n", phase_names[phase], wv->phase_seconds[phase]);
+    fflush(wv->telemetry);
+  }
+}
+
+/**
+ * ======== WriteAll ========
+ * write()直到写完len字节,返回0表示写失败.
+ */
+int WriteAll(int fd, const void *buf, long long len) {
+  const char *p = (const char *)buf;
+  long long n;
+  while (len > 0) {
+    n = write(fd, p, len > (1 << 30) ? (1 << 30) : len);
+    if (n <= 0) return 0;
+    p += n;
+    len -= n;
+  }
+  return 1;
+}
+
+/**
+ * ======== WriteCheckpoint ========
+ * 把当前的训练状态写到file,格式见Checkpoint.成功返回1.
+ *
+ * 在fork出的子进程中调用:多线程进程fork后子进程里只有调用fork的线程,其他线程可能正持有stdio的锁,
+ * 所以这里只用open/write/rename,不用stdio也不分配内存.
+ */
+int WriteCheckpoint(struct word2vec *wv, const char *file) {
+  struct checkpoint_header h;
+  char tmp[MAX_STRING + 8], buf[65536];
+  long long a, len, used = 0, inflight[2];
+  int fd, ok;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  h.version = CHECKPOINT_VERSION;
+  h.hs = wv->hs;
+  h.negative = wv->negative;
+  h.cbow = wv->cbow;
+  h.window = wv->window;
+  h.threads = wv->thread_stats != NULL ? wv->num_threads : 0;
+  h.vocab_size = wv->vocab_size;
+  h.layer1_size = wv->layer1_size;
+  h.train_words = wv->train_words;
+  h.file_size = wv->file_size;
+  h.iter = wv->iter;
+  h.num_chunks = wv->num_chunks;
+  h.next_chunk = wv->next_chunk;
+  h.word_count_actual = wv->word_count_actual;
+  h.sample_words = wv->sample_words;
+  h.buckets = wv->bucket_count;
+  h.bucket_words = wv->bucket_words;
+  h.shuffle = wv->shuffle_blocks;
+  h.pending = wv->pending_count > wv->pending_next ? wv->pending_count - wv->pending_next : 0;
+  h.starting_alpha = wv->starting_alpha;
+  h.alpha = wv->starting_alpha;
+  for (a = 0; a < h.threads; a++) if (wv->thread_stats[a].alpha < h.alpha) h.alpha = wv->thread_stats[a].alpha;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return 0;
+  ok = WriteAll(fd, &h, sizeof(h));
+  // 词典: 词频,词长,词;攒满缓冲区再写
+  for (a = 0; ok && (a < wv->vocab_size); a++) {
+    len = strlen(wv->vocab[a].word);
+    if (used + 2 * sizeof(long long) + len > sizeof(buf)) {
+      ok = WriteAll(fd, buf, used);
+      used = 0;
+    }
+    memcpy(buf + used, &wv->vocab[a].cn, sizeof(long long));
+    memcpy(buf + used + sizeof(long long), &len, sizeof(long long));
+    memcpy(buf + used + 2 * sizeof(long long), wv->vocab[a].word, len);
+    used += 2 * sizeof(long long) + len;
+  }
+  if (ok) ok = WriteAll(fd, buf, used);
+  if (ok) ok = WriteAll(fd, wv->syn0, wv->vocab_rows * wv->layer1_size * sizeof(real));
+  if (ok && wv->hs) ok = WriteAll(fd, wv->syn1, wv->vocab_size * wv->layer1_size * sizeof(real));
+  if (ok && (wv->negative > 0)) ok = WriteAll(fd, wv->syn1neg, wv->vocab_rows * wv->layer1_size * sizeof(real));
+  for (a = 0; ok && (a < h.threads); a++) {
+    inflight[0] = wv->thread_stats[a].chunk;
+    inflight[1] = wv->thread_stats[a].chunk_pos;
+    ok = WriteAll(fd, inflight, sizeof(inflight));
+  }
+  for (a = 0; ok && (a < h.pending); a++) {
+    inflight[0] = wv->pending_chunk[wv->pending_next + a];
+    inflight[1] = wv->pending_pos[wv->pending_next + a];
+    ok = WriteAll(fd, inflight, sizeof(inflight));
+  }
+  if (ok) ok = fsync(fd) == 0;
+  if (close(fd) != 0) ok = 0;
+  if (ok) ok = rename(tmp, file) == 0;
+  else unlink(tmp);
+  return ok;
+}
+
+/**
+ * ======== StartCheckpoint ========
+ * fork一个子进程写检查点,返回子进程pid(失败返回-1).
+ * 父进程只等fork本身返回(复制页表),之后训练线程和子进程并行,被训练线程修改的页才会被复制.
+ * fork时持有chunk_lock,快照中每个已领取的块都已登记在领取它的线程的thread_stat中.
+ */
+pid_t StartCheckpoint(struct word2vec *wv) {
+  pid_t pid;
+  double start = WallTime();
+  pthread_mutex_lock(&wv->chunk_lock);
+  pid = fork();
+  if (pid == 0) _exit(WriteCheckpoint(wv, wv->checkpoint_file) ? 0 : 1);
+  pthread_mutex_unlock(&wv->chunk_lock);
+  if (pid < 0) printf("\nWARNING: fork failed, checkpoint skipped\n");
+  else if (wv->telemetry != NULL) {
+    fprintf(wv->telemetry, "{\"event\":\"checkpoint_start\",\"time\":%.3f,\"fork_ms\":%.3f}\n", start - wv->train_start, (WallTime() - start) * 1000);
+    fflush(wv->telemetry);
+  }
+  return pid;
+}
+
+/**
+ * ======== FinishCheckpoint ========
+ * 检查点子进程退出后调用,输出结果;seconds是从fork到子进程退出的时间.
+ */
+void FinishCheckpoint(struct word2vec *wv, int status, double seconds) {
+  int ok = WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+  if (!ok) printf("\nWARNING: writing checkpoint %s failed\n", wv->checkpoint_file);
+  else if (wv->debug_mode > 1) printf("\nCheckpoint written to %s in %.2fs\n", wv->checkpoint_file, seconds);
+  if (wv->telemetry != NULL) {
+    fprintf(wv->telemetry, "{\"event\":\"checkpoint\",\"time\":%.3f,\"seconds\":%.3f,\"ok\":%d}\n", WallTime() - wv->train_start, seconds, ok);
+    fflush(wv->telemetry);
+  }
+}
+
+/**
+ * ======== OpenCheckpoint ========
+ * 打开检查点(或-save-model保存的模型)文件并读出文件头,文件不存在或格式不对时退出.
+ */
+FILE *OpenCheckpoint(struct word2vec *wv, const char *file, struct checkpoint_header *h) {
+  FILE *fin = fopen(file, "rb");
+  if (fin == NULL) {
+    Fail(wv, "ERROR: checkpoint file %s not found", file);
+  }
+  if ((fread(h, sizeof(*h), 1, fin) != 1) || memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) || (h->version != CHECKPOINT_VERSION)) {
+    Fail(wv, "ERROR: %s is not a checkpoint file", file);
+  }
+  return fin;
+}
+
+/**
+ * ======== ReadCheckpointWord ========
+ * 从检查点的词典部分读一个词和它的词频,文件不完整时退出.
+ */
+void ReadCheckpointWord(struct word2vec *wv, FILE *fin, const char *file, char *word, long long *cn) {
+  long long len;
+  if ((fread(cn, sizeof(long long), 1, fin) != 1) || (fread(&len, sizeof(long long), 1, fin) != 1) || (len < 0) || (len >= MAX_STRING) ||
+   (fread(word, 1, len, fin) != (size_t)len)) {
+    Fail(wv, "ERROR: checkpoint file %s is truncated", file);
+  }
+  word[len] = 0;
+}
+
+/**
+ * ======== ReadCheckpointVocab ========
+ * -resume时代替LearnVocabFromTrainFile/ReadVocab:从检查点读词典和训练进度.
+ * 词典按检查点中的顺序原样恢复(不再排序),保证和保存的权重矩阵逐行对应;
+ * 训练轮数,块数,分块打乱,哈希桶数,初始学习率沿用检查点中的值(和命令行不同时debug_mode > 0输出说明),
+ * 模型结构和训练方式(size, hs, negative, cbow, window)必须和检查点一致.
+ */
+void ReadCheckpointVocab(struct word2vec *wv) {
+  struct checkpoint_header h;
+  long long a, b, cn;
+  char word[MAX_STRING];
+  FILE *fin = OpenCheckpoint(wv, wv->checkpoint_file, &h);
+  if ((h.layer1_size != wv->layer1_size) || (h.hs != wv->hs) || (h.negative != wv->negative) || (h.cbow != wv->cbow) || (h.window != wv->window)) {
+    Fail(wv, "ERROR: checkpoint was written with -size %lld -hs %d -negative %d -cbow %d -window %d", h.layer1_size, h.hs, h.negative, h.cbow, h.window);
+  }
+  for (a = 0; a < vocab_hash_size; a++) wv->vocab_hash[a] = -1;
+  wv->vocab_size = 0;
+  for (a = 0; a < h.vocab_size; a++) {
+    ReadCheckpointWord(wv, fin, wv->checkpoint_file, word, &cn);
+    b = AddWordToVocab(wv, word);
+    wv->vocab[b].cn = cn;
+  }
+  // 同SortVocab的结尾
+  wv->vocab = (struct vocab_word *)realloc(wv->vocab, (wv->vocab_size + 1) * sizeof(struct vocab_word));
+  for (a = 0; a < wv->vocab_size; a++) {
+    wv->vocab[a].code = (char *)calloc(MAX_CODE_LENGTH, sizeof(char));
+    wv->vocab[a].point = (int *)calloc(MAX_CODE_LENGTH, sizeof(int));
+  }
+  wv->checkpoint_offset = ftell(fin);
+  wv->checkpoint_inflight = h.threads + h.pending;
+  fclose(fin);
+  fin = OpenTrainFile(wv);
+  if (fin == NULL) {
+    Fail(wv, "ERROR: training data file not found!");
+  }
+  fseek(fin, 0, SEEK_END);
+  wv->file_size = ftell(fin);
+  fclose(fin);
+  if (wv->file_size != h.file_size) {
+    Fail(wv, "ERROR: training file %s has changed since the checkpoint was written", wv->train_file);
+  }
+  // 这些设置由检查点决定,和命令行不同时说明用的是检查点中的值
+  if (wv->debug_mode > 0) {
+    if (h.iter != wv->iter) printf("Using -iter %lld from the checkpoint instead of %lld\n", h.iter, wv->iter);
+    if ((wv->num_chunks > 0) && (h.num_chunks != wv->num_chunks)) printf("Using -chunks %lld from the checkpoint instead of %lld\n", h.num_chunks, wv->num_chunks);
+    if (h.shuffle != wv->shuffle_blocks) printf("Using -shuffle %lld from the checkpoint instead of %d\n", h.shuffle, wv->shuffle_blocks);
+    if (h.buckets != wv->bucket_count) printf("Using -buckets %lld from the checkpoint instead of %lld\n", h.buckets, wv->bucket_count);
+    if (h.starting_alpha != wv->starting_alpha) printf("Using -alpha %f from the checkpoint instead of %f\n", h.starting_alpha, wv->starting_alpha);
+  }
+  wv->train_words = h.train_words;
+  wv->sample_words = h.sample_words;
+  wv->iter = h.iter;
+  wv->num_chunks = h.num_chunks;
+  wv->bucket_count = h.buckets;
+  wv->bucket_words = h.bucket_words;
+  wv->shuffle_blocks = h.shuffle;
+  wv->starting_alpha = h.starting_alpha;
+  wv->word_count_actual = wv->resumed_words = h.word_count_actual;
+  wv->next_chunk = h.next_chunk < wv->iter * wv->num_chunks ? h.next_chunk : wv->iter * wv->num_chunks;
+  if (wv->debug_mode > 0) {
+    printf("Resuming from %s: %lld of %lld words trained, alpha %f\n", wv->checkpoint_file, wv->word_count_actual, wv->iter * wv->train_words, h.alpha);
+    printf("Vocab size: %lld\n", wv->vocab_size);
+    printf("Words in train file: %lld\n", wv->train_words);
+  }
+}
+
+/**
+ * ======== ReadCheckpointWeights ========
+ * InitNet之后调用:用检查点中的权重覆盖随机初始化的syn0/syn1/syn1neg,并恢复未完成的块.
+ */
+void ReadCheckpointWeights(struct word2vec *wv) {
+  struct checkpoint_header h;
+  long long a, n = wv->vocab_size * wv->layer1_size, rows = wv->vocab_rows * wv->layer1_size, inflight[2];
+  int ok;
+  FILE *fin = OpenCheckpoint(wv, wv->checkpoint_file, &h);
+  fseek(fin, wv->checkpoint_offset, SEEK_SET);
+  ok = fread(wv->syn0, sizeof(real), rows, fin) == (size_t)rows;
+  if (ok && wv->hs) ok = fread(wv->syn1, sizeof(real), n, fin) == (size_t)n;
+  if (ok && (wv->negative > 0)) ok = fread(wv->syn1neg, sizeof(real), rows, fin) == (size_t)rows;
+  wv->pending_chunk = (long long *)malloc((wv->checkpoint_inflight + 1) * sizeof(long long));
+  wv->pending_pos = (long long *)malloc((wv->checkpoint_inflight + 1) * sizeof(long long));
+  wv->pending_count = 0;
+  wv->pending_next = 0;
+  for (a = 0; ok && (a < wv->checkpoint_inflight); a++) {
+    ok = fread(inflight, sizeof(inflight), 1, fin) == 1;
+    if (!ok || (inflight[0] < 0) || (inflight[0] >= wv->iter * wv->num_chunks)) continue;
+    wv->pending_chunk[wv->pending_count] = inflight[0];
+    wv->pending_pos[wv->pending_count] = inflight[1];
+    wv->pending_count++;
+  }
+  if (!ok) {
+    Fail(wv, "ERROR: checkpoint file %s is truncated", wv->checkpoint_file);
+  }
+  fclose(fin);
+}
+
+/**
+ * ======== ModelWordCompare ========
+ * 合并词典排序用:按词频降序,词频相同时按合并前的顺序(旧词在前),排序结果是确定的.
+ */
+struct model_word {
+  long long cn, row;
+  char *word;
+};
+
+int ModelWordCompare(const void *a, const void *b) {
+  const struct model_word *x = (const struct model_word *)a, *y = (const struct model_word *)b;
+  if (x->cn != y->cn) return x->cn > y->cn ? -1 : 1;
+  return x->row < y->row ? -1 : (x->row > y->row);
+}
+
+/**
+ * ======== ReadModelVocab ========
+ * 增量训练:从新语料建好词典(min_count = 1,不筛选)之后调用,和-load-model的旧词典合并,见Incremental Training.
+ * 旧词全部保留,新词只保留出现次数达到min_count的;train_words重新计算为新语料中属于合并后词典的词数.
+ */
+void ReadModelVocab(struct word2vec *wv) {
+  struct checkpoint_header h;
+  struct model_word *merged;
+  long long a, d, n = 0, cn, new_words = 0;
+  unsigned int hash;
+  char word[MAX_STRING], *seen;
+  FILE *fin = OpenCheckpoint(wv, wv->load_model_file, &h);
+  // 分桶时新旧词典的行对应不起来
+  if ((h.buckets > 0) || (wv->bucket_count > 0)) {
+    Fail(wv, "ERROR: -load-model does not support models trained with -buckets");
+  }
+  if (h.layer1_size != wv->layer1_size) {
+    printf("Using -size %lld from %s\n", h.layer1_size, wv->load_model_file);
+    wv->layer1_size = h.layer1_size;
+  }
+  wv->model_size = h.vocab_size;
+  wv->model_hs = h.hs;
+  wv->model_negative = h.negative;
+  merged = (struct model_word *)malloc((wv->model_size + wv->vocab_size) * sizeof(struct model_word));
+  seen = (char *)calloc(wv->vocab_size, sizeof(char));
+  // 旧词:词频加上新语料中的词频;row记录旧模型中的行号
+  wv->train_words = 0;
+  for (a = 0; a < wv->model_size; a++) {
+    ReadCheckpointWord(wv, fin, wv->load_model_file, word, &cn);
+    d = SearchVocab(wv, word);
+    if (d >= 0) {
+      cn += wv->vocab[d].cn;
+      wv->train_words += wv->vocab[d].cn;
+      seen[d] = 1;
+    }
+    merged[n].cn = cn;
+    merged[n].row = a;
+    merged[n].word = (char *)calloc(strlen(word) + 1, sizeof(char));
+    strcpy(merged[n].word, word);
+    n++;
+  }
+  wv->model_offset = ftell(fin);
+  fclose(fin);
+  // 达到min_count的新词追加在后面
+  for (d = 0; d < wv->vocab_size; d++) {
+    if (seen[d] || (wv->vocab[d].cn < wv->min_count)) {
+      free(wv->vocab[d].word);
+    } else {
+      merged[n].cn = wv->vocab[d].cn;
+      merged[n].row = wv->model_size + d;
+      merged[n].word = wv->vocab[d].word;
+      wv->train_words += wv->vocab[d].cn;
+      n++;
+      new_words++;
+    }
+    free(wv->vocab[d].code);
+    free(wv->vocab[d].point);
+  }
+  free(seen);
+  // </s>在两个词典中都是第0个,保持在第一位,其余按词频排序
+  qsort(&merged[1], n - 1, sizeof(struct model_word), ModelWordCompare);
+  wv->vocab = (struct vocab_word *)realloc(wv->vocab, (n + 1) * sizeof(struct vocab_word));
+  wv->model_row = (long long *)malloc(wv->model_size * sizeof(long long));
+  for (a = 0; a < vocab_hash_size; a++) wv->vocab_hash[a] = -1;
+  wv->sample_words = 0;
+  for (a = 0; a < n; a++) {
+    wv->vocab[a].cn = merged[a].cn;
+    wv->vocab[a].word = merged[a].word;
+    wv->vocab[a].code = (char *)calloc(MAX_CODE_LENGTH, sizeof(char));
+    wv->vocab[a].point = (int *)calloc(MAX_CODE_LENGTH, sizeof(int));
+    if (merged[a].row < wv->model_size) wv->model_row[merged[a].row] = a;
+    hash = GetWordHash(wv->vocab[a].word);
+    while (wv->vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
+    wv->vocab_hash[hash] = a;
+    wv->sample_words += wv->vocab[a].cn;
+  }
+  wv->vocab_size = n;
+  free(merged);
+  // 学习率热启动
+  if (wv->alpha <= 0) wv->alpha = h.starting_alpha / 2;
+  wv->starting_alpha = wv->alpha;
+  if (wv->debug_mode > 0) {
+    printf("Loaded model %s: %lld words, %lld new words, vocab size %lld, alpha %f\n", wv->load_model_file, wv->model_size,
+     new_words, wv->vocab_size, wv->starting_alpha);
+    printf("Words to train: %lld\n", wv->train_words);
+  }
+}
+
+/**
+ * ======== ReadModelWeights ========
+ * InitNet之后调用:把旧模型的syn0(以及两边都用negative sampling时的syn1neg)逐行读到合并后词典中的新行号.
+ */
+void ReadModelWeights(struct word2vec *wv) {
+  struct checkpoint_header h;
+  long long a;
+  int ok = 1;
+  FILE *fin = OpenCheckpoint(wv, wv->load_model_file, &h);
+  fseek(fin, wv->model_offset, SEEK_SET);
+  for (a = 0; ok && (a < wv->model_size); a++) ok = fread(&wv->syn0[wv->model_row[a] * wv->layer1_size], sizeof(real), wv->layer1_size, fin) == (size_t)wv->layer1_size;
+  if (ok && wv->model_hs) ok = fseek(fin, wv->model_size * wv->layer1_size * sizeof(real), SEEK_CUR) == 0;
+  if (wv->model_negative && (wv->negative > 0)) {
+    for (a = 0; ok && (a < wv->model_size); a++) ok = fread(&wv->syn1neg[wv->model_row[a] * wv->layer1_size], sizeof(real), wv->layer1_size, fin) == (size_t)wv->layer1_size;
+  }
+  if (!ok) {
+    Fail(wv, "ERROR: checkpoint file %s is truncated", wv->load_model_file);
+  }
+  fclose(fin);
+  free(wv->model_row);
+  wv->model_row = NULL;
+}
+
+/**
+ * ======== ReadEval ========
+ * 读取-eval指定的测试集,题目中的词转换成词典下标;含有不在前eval_rows个词中的词的题跳过(计入eval_skipped).
+ */
+void ReadEval(struct word2vec *wv) {
+  char line[MAX_STRING * 4], *tok[5], *end;
+  long long a, idx[4], lines = 0;
+  int n, ok;
+  double human;
+  FILE *fin = fopen(wv->eval_file, "rb");
+  if (fin == NULL) {
+    Fail(wv, "ERROR: cannot open eval file %s", wv->eval_file);
+  }
+  wv->eval_rows = wv->vocab_size;
+  if ((wv->eval_vocab > 0) && (wv->eval_vocab < wv->eval_rows)) wv->eval_rows = wv->eval_vocab;
+  // 分桶时只有前bucket_words个词有自己的行
+  if ((wv->bucket_count > 0) && (wv->bucket_words < wv->eval_rows)) wv->eval_rows = wv->bucket_words;
+  wv->eval_questions = wv->eval_pairs = wv->eval_skipped = 0;
+  while (fgets(line, sizeof(line), fin) != NULL) {
+    if (line[0] == ':') continue;
+    n = 0;
+    for (tok[0] = strtok(line, " \t,\r\n"); (tok[n] != NULL) && (n < 4); tok[n] = strtok(NULL, " \t,\r\n")) n++;
+    if (n == 0) continue;
+    lines++;
+    if ((n == 3) && (human = strtod(tok[2], &end), (end != tok[2]) && (*end == 0))) n = 2;
+    else if ((n != 4) || (tok[4] != NULL)) {
+      wv->eval_skipped++;
+      continue;
+    }
+    for (a = 0, ok = 1; ok && (a < n); a++) {
+      idx[a] = SearchVocab(wv, tok[a]);
+      ok = (idx[a] >= 0) && (idx[a] < wv->eval_rows);
+    }
+    if (!ok) {
+      wv->eval_skipped++;
+      continue;
+    }
+    if (n == 4) {
+      wv->eval_question = (long long *)realloc(wv->eval_question, (wv->eval_questions + 1) * 4 * sizeof(long long));
+      memcpy(&wv->eval_question[wv->eval_questions * 4], idx, 4 * sizeof(long long));
+      wv->eval_questions++;
+    } else {
+      wv->eval_pair = (long long *)realloc(wv->eval_pair, (wv->eval_pairs + 1) * 2 * sizeof(long long));
+      wv->eval_human = (real *)realloc(wv->eval_human, (wv->eval_pairs + 1) * sizeof(real));
+      memcpy(&wv->eval_pair[wv->eval_pairs * 2], idx, 2 * sizeof(long long));
+      wv->eval_human[wv->eval_pairs] = human;
+      wv->eval_pairs++;
+    }
+  }
+  fclose(fin);
+  if (wv->eval_questions + wv->eval_pairs == 0) {
+    Fail(wv, "ERROR: none of the %lld questions in eval file %s can be answered with the %lld most frequent words", lines, wv->eval_file, wv->eval_rows);
+  }
+  if (wv->debug_mode > 0) printf("Eval set: %lld analogy questions, %lld similarity pairs, %lld skipped (words outside the top %lld)\n",
+   wv->eval_questions, wv->eval_pairs, wv->eval_skipped, wv->eval_rows);
+}
+
+/**
+ * ======== EvalRank ========
+ * 把v[0..n)替换成它们的秩(从1开始,相同的值取平均秩),用于Spearman相关系数.
+ */
+struct eval_rank {
+  double v;
+  long long i;
+};
+
+int EvalRankCompare(const void *a, const void *b) {
+  double x = ((const struct eval_rank *)a)->v, y = ((const struct eval_rank *)b)->v;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void EvalRank(double *v, long long n) {
+  long long a, b, c;
+  struct eval_rank *r = (struct eval_rank *)malloc(n * sizeof(struct eval_rank));
+  for (a = 0; a < n; a++) {
+    r[a].v = v[a];
+    r[a].i = a;
+  }
+  qsort(r, n, sizeof(struct eval_rank), EvalRankCompare);
+  for (a = 0; a < n; a = b) {
+    for (b = a + 1; (b < n) && (r[b].v == r[a].v); b++);
+    for (c = a; c < b; c++) v[r[c].i] = (a + b + 1) / 2.0;
+  }
+  free(r);
+}
+
+/**
+ * ======== EvalModel ========
+ * 复制syn0的前eval_rows行(训练线程继续更新,复制到的就是这一刻的快照)并归一化,计算类比正确率和相似度的Spearman系数.
+ * 类比题每query_batch题一批,用eval_threads个线程找top-1;结果写到r(time, epochs由调用者填写).
+ * 内存不够时返回0,成功返回1.
+ */
+int EvalModel(struct word2vec *wv, struct eval_result *r) {
+  struct w2vq_index q;
+  long long a, j, n, correct = 0, batch = wv->query_batch > 0 ? wv->query_batch : 1, *exclude, *ids;
+  double *x, *y, mx = 0, my = 0, sxy = 0, sxx = 0, syy = 0;
+  float *queries = NULL, *scores;
+  if (w2vq_init(&q, wv->syn0, wv->eval_rows, wv->layer1_size, wv->layer1_size) != 0) return 0;
+  // 类比题:b - a + c的top-1(排除a, b, c)
+  exclude = (long long *)malloc(batch * 3 * sizeof(long long));
+  ids = (long long *)malloc(batch * sizeof(long long));
+  scores = (float *)malloc(batch * sizeof(float));
+  if ((posix_memalign((void **)&queries, 64, batch * q.stride * sizeof(float)) != 0) || (exclude == NULL) || (ids == NULL) || (scores == NULL)) {
+    free(exclude);
+    free(ids);
+    free(scores);
+    free(queries);
+    w2vq_free(&q);
+    return 0;
+  }
+  for (a = 0; a < wv->eval_questions; a += n) {
+    n = wv->eval_questions - a < batch ? wv->eval_questions - a : batch;
+    for (j = 0; j < n; j++) w2vq_make_query(&q, wv->eval_question[(a + j) * 4], wv->eval_question[(a + j) * 4 + 1], wv->eval_question[(a + j) * 4 + 2],
+     &queries[j * q.stride], &exclude[j * 3]);
+    w2vq_search(&q, queries, n, exclude, 1, wv->eval_threads, ids, scores);
+    for (j = 0; j < n; j++) if (ids[j] == wv->eval_question[(a + j) * 4 + 3]) correct++;
+  }
+  r->analogy = wv->eval_questions > 0 ? correct / (double)wv->eval_questions : 0;
+  // 相似度题:余弦相似度和人工分数的秩的Pearson相关系数
+  r->similarity = 0;
+  if (wv->eval_pairs > 1) {
+    x = (double *)malloc(wv->eval_pairs * sizeof(double));
+    y = (double *)malloc(wv->eval_pairs * sizeof(double));
+    if ((x == NULL) || (y == NULL)) {
+      free(x);
+      free(y);
+      free(exclude);
+      free(ids);
+      free(scores);
+      free(queries);
+      w2vq_free(&q);
+      return 0;
+    }
+    for (j = 0; j < wv->eval_pairs; j++) {
+      x[j] = w2vq_dot(&q.vectors[wv->eval_pair[j * 2] * q.stride], &q.vectors[wv->eval_pair[j * 2 + 1] * q.stride], q.stride);
+      y[j] = wv->eval_human[j];
+    }
+    EvalRank(x, wv->eval_pairs);
+    EvalRank(y, wv->eval_pairs);
+    for (j = 0; j < wv->eval_pairs; j++) {
+      mx += x[j];
+      my += y[j];
+    }
+    mx /= wv->eval_pairs;
+    my /= wv->eval_pairs;
+    for (j = 0; j < wv->eval_pairs; j++) {
+      sxy += (x[j] - mx) * (y[j] - my);
+      sxx += (x[j] - mx) * (x[j] - mx);
+      syy += (y[j] - my) * (y[j] - my);
+    }
+    if ((sxx > 0) && (syy > 0)) r->similarity = sxy / sqrt(sxx * syy);
+    free(x);
+    free(y);
+  }
+  if ((wv->eval_questions > 0) && (wv->eval_pairs > 0)) r->score = (r->analogy + r->similarity) / 2;
+  else r->score = wv->eval_questions > 0 ? r->analogy : r->similarity;
+  free(exclude);
+  free(ids);
+  free(scores);
+  free(queries);
+  w2vq_free(&q);
+  return 1;
+}
+
+/**
+ * ======== EvalThread ========
+ * 后台评估线程:评估一次,结果在eval_last中,结束时清除eval_busy,由监控线程回收并调用EvalReport.
+ * 内存不够时置thread_failed和training_stop,训练线程结束后由TrainModel报告.
+ */
+void *EvalThread(void *arg) {
+  struct word2vec *wv = (struct word2vec *)arg;
+  if (!EvalModel(wv, &wv->eval_last)) {
+    wv->thread_failed = 1;
+    wv->training_stop = 1;
+  }
+  __sync_synchronize();
+  wv->eval_busy = 0;
+  return NULL;
+}
+
+/**
+ * ======== EvalReport ========
+ * 输出一次评估的结果(分数曲线写到telemetry),更新最好的分数;不是训练结束后的评估(final为0)时,
+ * 分数达到eval_target或者连续eval_patience次没有提高时置training_stop,提前结束训练.
+ */
+void EvalReport(struct word2vec *wv, struct eval_result *r, int final) {
+  wv->eval_count++;
+  if (wv->debug_mode > 0) {
+    printf("%sEval at %.2f epochs, %.3fs:", (wv->debug_mode > 1) && !final ? "\n" : "", r->epochs, r->time);
+    if (wv->eval_questions > 0) printf(" analogy %.2f%%", r->analogy * 100);
+    if (wv->eval_pairs > 0) printf(" similarity %.4f", r->similarity);
+    printf(" score %.4f\n", r->score);
+  }
+  if (wv->telemetry != NULL) {
+    fprintf(wv->telemetry, "{\"event\":\"eval\",\"time\":%.3f,\"epochs\":%.4f,\"final\":%d", r->time, r->epochs, final);
+    if (wv->eval_questions > 0) fprintf(wv->telemetry, ",\"analogy\":%.6f", r->analogy);
+    if (wv->eval_pairs > 0) fprintf(wv->telemetry, ",\"similarity\":%.6f", r->similarity);
+    fprintf(wv->telemetry, ",\"score\":%.6f}\n", r->score);
+    fflush(wv->telemetry);
+  }
+  if ((wv->eval_count == 1) || (r->score > wv->eval_best.score + wv->eval_min_delta)) {
+    wv->eval_best = *r;
+    wv->eval_stale = 0;
+  } else wv->eval_stale++;
+  if (final || wv->training_stop) return;
+  if ((wv->eval_target > 0) && (r->score >= wv->eval_target)) {
+    if (wv->debug_mode > 0) printf("Eval score %.4f reached the target %.4f after %.3fs, stopping\n", r->score, wv->eval_target, r->time);
+    wv->training_stop = 1;
+  } else if ((wv->eval_patience > 0) && (wv->eval_stale >= wv->eval_patience)) {
+    if (wv->debug_mode > 0) printf("Eval score has not improved by %g in %d evaluations, stopping\n", wv->eval_min_delta, wv->eval_stale);
+    wv->training_stop = 1;
+  }
+}
+
+/**
+ * ======== MonitorThread ========
+ * 监控线程:每隔telemetry_interval秒汇总一次各训练线程的thread_stat,
+ * 输出进度,墙上时间吞吐量(总的和每个线程的),学习率,以及这段时间内抽样样本的平均loss.
+ *
+ * 训练线程只写自己的thread_stat,这里只读,整个过程不加锁;读到的是近似值,用于监控足够了.
+ * 指定了-checkpoint时,同时负责定期启动检查点子进程并回收;指定了-eval时,负责按进度启动后台评估线程并输出结果.
+ */
+void *MonitorThread(void *arg) {
+  struct word2vec *wv = (struct word2vec *)arg;
+  long long a, words, loss_count, last_loss_count = 0, epoch = 0;
+  double now, elapsed, last = wv->train_start, loss, last_loss = 0, window_loss, last_epoch = 0, epochs, eval_next;
+  pthread_t eval_pt;
+  int eval_started = 0;
+  double last_checkpoint = wv->train_start, checkpoint_begin = 0, last_writeback = wv->train_start;
+  real cur_alpha;
+  pid_t checkpoint_pid = 0;
+  int status;
+  struct timespec nap = {0, 50000000};
+  // 下一个评估点(轮数);从检查点恢复时从恢复的进度之后开始
+  eval_next = wv->eval_every > 0 ? (floor(wv->word_count_actual / (double)(wv->train_words + 1) / wv->eval_every) + 1) * wv->eval_every : wv->iter;
+  while (1) {
+    nanosleep(&nap, NULL);
+    now = WallTime();
+    // 上一次评估结束了就回收线程并输出;到了评估点并且没有正在进行的评估时,在后台线程评估syn0的快照
+    if (eval_started && !wv->eval_busy) {
+      pthread_join(eval_pt, NULL);
+      eval_started = 0;
+      if (!wv->thread_failed) EvalReport(wv, &wv->eval_last, 0);
+    }
+    epochs = wv->word_count_actual / (double)(wv->train_words + 1);
+    if ((wv->eval_file[0] != 0) && !eval_started && !wv->training_done && !wv->training_stop && (epochs >= eval_next) && (eval_next < wv->iter)) {
+      wv->eval_last.time = now - wv->train_start;
+      wv->eval_last.epochs = epochs;
+      wv->eval_busy = 1;
+      pthread_create(&eval_pt, NULL, EvalThread, wv);
+      eval_started = 1;
+      while (eval_next <= epochs) eval_next += wv->eval_every;
+    }
+    // 上一个检查点写完了就回收子进程;到了间隔并且没有正在写的检查点时再fork一个
+    if ((checkpoint_pid > 0) && (waitpid(checkpoint_pid, &status, WNOHANG) == checkpoint_pid)) {
+      FinishCheckpoint(wv, status, now - checkpoint_begin);
+      checkpoint_pid = 0;
+    }
+    if ((wv->checkpoint_file[0] != 0) && (checkpoint_pid <= 0) && !wv->training_done && (now - last_checkpoint >= wv->checkpoint_interval)) {
+      last_checkpoint = checkpoint_begin = now;
+      checkpoint_pid = StartCheckpoint(wv);
+    }
+    if ((wv->ooc_tails > 0) && !wv->training_done && (now - last_writeback >= wv->ooc_writeback)) {
+      OocWriteback(wv);
+      last_writeback = now = WallTime();
+    }
+    // 按顺序输出已结束的轮次
+    while ((epoch < wv->iter) && (wv->epoch_end[epoch] != 0)) {
+      if ((wv->epoch_end[epoch] > 0) && (wv->telemetry != NULL)) {
+        fprintf(wv->telemetry, "{\"event\":\"epoch\",\"epoch\":%lld,\"time\":%.3f,\"seconds\":%.3f,\"shuffle\":%d}\n",
+         epoch + 1, wv->epoch_end[epoch], wv->epoch_end[epoch] - last_epoch, wv->shuffle_blocks);
+        fflush(wv->telemetry);
+      }
+      if (wv->epoch_end[epoch] > 0) last_epoch = wv->epoch_end[epoch];
+      epoch++;
+    }
+    if (!wv->training_done && (now - last < wv->telemetry_interval)) continue;
+    last = now;
+    elapsed = now - wv->train_start;
+    words = 0;
+    loss = 0;
+    loss_count = 0;
+    cur_alpha = wv->starting_alpha;
+    for (a = 0; a < wv->num_threads; a++) {
+      words += wv->thread_stats[a].words;
+      loss += wv->thread_stats[a].loss;
+      loss_count += wv->thread_stats[a].loss_count;
+      if (wv->thread_stats[a].alpha < cur_alpha) cur_alpha = wv->thread_stats[a].alpha;
+    }
+    // 只统计上次输出以来的样本,反映当前的loss
+    window_loss = (loss_count > last_loss_count) ? (loss - last_loss) / (loss_count - last_loss_count) : 0;
+    last_loss = loss;
+    last_loss_count = loss_count;
+    // 进度包括恢复前已训练的词,吞吐量只算本次训练的词
+    if (wv->debug_mode > 1) {
+      printf("%cAlpha: %f  Progress: %.2f%%  Words/sec: %.2fk  Words/thread/sec: %.2fk  Loss: %.4f  ", 13, cur_alpha,
+       (wv->resumed_words + words) / (real)(wv->iter * wv->train_words + 1) * 100, words / elapsed / 1000, words / elapsed / 1000 / wv->num_threads, window_loss);
+      fflush(stdout);
+    }
+    if (wv->telemetry != NULL) {
+      fprintf(wv->telemetry, "{\"event\":\"progress\",\"time\":%.3f,\"progress\":%.6f,\"alpha\":%f,\"words\":%lld,\"words_per_sec\":%.1f,\"loss\":%.6f,\"thread_words_per_sec\":[",
+       elapsed, (wv->resumed_words + words) / (double)(wv->iter * wv->train_words + 1), cur_alpha, words, words / elapsed, window_loss);
+      for (a = 0; a < wv->num_threads; a++) fprintf(wv->telemetry, "%s%.1f", a ? "," : "", wv->thread_stats[a].words / elapsed);
+      fprintf(wv->telemetry, "]}\n");
+      fflush(wv->telemetry);
+    }
+    if (wv->training_done) break;
+  }
+  if (wv->debug_mode > 1) printf("\n");
+  // 训练结束时还在进行的评估,等它结束
+  if (eval_started) {
+    pthread_join(eval_pt, NULL);
+    if (!wv->thread_failed) EvalReport(wv, &wv->eval_last, 0);
+  }
+  // 训练结束时还在写的检查点,等它写完
+  if ((checkpoint_pid > 0) && (waitpid(checkpoint_pid, &status, 0) == checkpoint_pid)) FinishCheckpoint(wv, status, WallTime() - checkpoint_begin);
+  return NULL;
+}
+
+/**
+ * ======== TrainCbowWord ========
+ * 模型m的一次CBOW训练:句子sen中sentence_position位置的词为中心词,上下文窗口缩小b,
+ * 用上下文词向量的均值预测中心词,更新syn1/syn1neg以及上下文词的syn0.
+ *
+ * neu1, neu1e是调用线程的工作缓冲区(至少m->layer1_size);random是调用线程的随机数状态;
+ * track非0时,这次训练中每个二分类的loss累加到stat中.
+ */
+void TrainCbowWord(struct word2vec *wv, struct train_model *m, long long *sen, long long sentence_length, long long sentence_position, long long b,
+                   real *neu1, real *neu1e, real cur_alpha, unsigned long long *random,
+                   struct thread_stat *stat, int track) {
+  long long a, c, d, cw, last_word, l2, target, label, word = sen[sentence_position];
+  unsigned long long next_random = *random;
+  real f, g;
+  // 模型m的参数和权重
+  long long layer1_size = m->layer1_size;
+  int window = m->window, hs = m->hs, negative = m->negative;
+  real *syn0 = m->syn0, *syn1 = m->syn1, *syn1neg = m->syn1neg;
+  
+  // 模型参数初始化
+  //cbow模型中,xw向量,输入向量累和 neu1 projection layer向量
+  for (c = 0; c < layer1_size; c++) neu1[c] = 0;
+  //e,用来对词向量进行更新 output layer every non-leaf node's theta parameters,the dimension of vector theta is same with the neu1
+  for (c = 0; c < layer1_size; c++) neu1e[c] = 0;
+  
+  /* 
+   * ====================================
+   *        CBOW Architecture
+   * ====================================
+   */
+  // in -> hidden, sum up all the word vectors of all the words in the window
+  // 输入层->隐层;将window里词的词向量累加,得到映射层向量xw
+  cw = 0;//cw保存选择词的数目,词向量的个数
+  /*
+  * 扫描目标单词的左右几个单词
+  * ===================================
+  * sentence_position:i 处理的当前中心词
+  * 上下文边界取值c: [i-(window-b), i+(window-b)];
+  * window-b是上下文边界范围;中心词i前面window-b个,后面window-b个;window-b=c,一共2c个上下文向量,一般情况;
+  * 如果上下文取值超出句子边界(超过句子头,超出句子尾),上下文向量就不一定了,所以需要cw来统计取值到的上下文向量个数
+  * 当a=window时,c=i-window+a=i-window+window=i;等于当前中心词,跳过;
+  * 这样就保证neu1是sentence_position中心词的上下文向量累积和,而且不包括当前中心词.
+  */
+  for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
+    c = sentence_position - window + a;
+    if (c < 0) continue;
+    if (c >= sentence_length) continue;
+    last_word = sen[c];
+    if (last_word == -1) continue;
+    //syn0: 应该是将所有的词向量拼接到一个长向量里了;向量长度为:layer1_size*n_words,所以需要确定是word在常向量里的位置
+    // syn0 词典词向量数组; 将读取的上下文累加,得到projection layer向量neu1
+    for (c = 0; c < layer1_size; c++) neu1[c] += syn0[c + wv->word_row[last_word] * layer1_size];//syn0[index] index词的词向量
+    cw++;//统计读取词向量数目
+  }
+  if (cw) {
+    // 对projection layer累加向量neu1取平均;
+    for (c = 0; c < layer1_size; c++) neu1[c] /= cw;//对累加向量取均值
+    /* 
+    * 开始训练
+    * 不同策略的训练过程有所不同
+    */
+   //=======================================================================
+    /*
+    * 1.hierarchical softmax sgd更新方法:每个样本(w,context(w))进行一次更新
+    * 这种策略依赖于huffman树,每个非叶子结点对应有一个参数,参数维度和词向量维度相同;
+    * 而每次分支,也就是说每个非叶子结点都看做是一次二分类过程,分类方法采用logistic regression方法;
+    * 而分类结果由每条分支的Huffman编码确定,word2vec认为左分支编码为1,分为负类;右分支编码为0,分为正类;
+    * huffman树的构造主要是用来拟合条件概率p(w|context(w)),我们用一个函数来拟合这个条件概率F(w,context(w);\theta) = p(w|context(w)),
+    * 避免繁琐的统计过程来计算条件概率,大大节省了空间以及时间.
+    * 依据huffman树结构,比如说叶子节点w对应的huffman编码为111,那么条件概率p(w|context(w))计算过程为:
+    * p(w|context(w)) = (1-sigma(theta_1*c))*(1-sigma(theta_2*c))*(1-sigma(theta_4*c)) 
+    * 所以,我们需要先得到非叶子结点的参数theta,然后才能计算条件概率;
+    */
+    // 针对当前中心词,计算条件概率p(w|context(w));计算过程依赖于中心词word的huffman code;codelen存储huffman code的code length
+    if (hs) for (d = 0; d < wv->vocab[word].codelen; d++) {//word中心词
+      //1. 前向传播
+      f = 0;//保存sigma(theta*c),分为正类的概率(编码为0)
+      //vocab结构体中point存储着叶子节点路径[点集,从根节点到这个叶子节点]
+      l2 = wv->vocab[word].point[d] * layer1_size;//得到当前非叶子结点index,然后计算在参数数组中的偏移位置
+      // Propagate hidden -> output
+      // 一次分类:非叶子结点分类logistic regression
+      for (c = 0; c < layer1_size; c++) f += neu1[c] * syn1[c + l2];
+      if (track) {
+        stat->loss += SampleLoss(f, 1 - wv->vocab[word].code[d]);
+        stat->loss_count++;
+      }
+      if (f <= -MAX_EXP) continue;
+      else if (f >= MAX_EXP) continue;
+      else f = wv->expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))];
+      //2. 反向传播 sgd更新
+      //L(w,j)对theta偏导数以及L(w,j)对c_w偏导数中的重合量,两个梯度中都有这个量
+      //为了方便,我们提前计算,之后重复使用
+      g = (1 - wv->vocab[word].code[d] - f) * cur_alpha;
+      // Propagate errors output -> hidden;可以看做是output->hidden的反向传播过程
+      // 计算当前非叶子结点对上下文向量c_w的更新量;由于c_w参与了路径上的所有非叶子结点的分类过程,
+      // 所以对context(w)上下文中的每个向量更新时,都需要先累计所有分类过程的更新量,最后再对上下文中词向量进行更新
+      // 累计梯度更新量;对c_w的梯度
+      for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1[c + l2];
+      // 更新当前非叶子结点的参数theta
+      for (c = 0; c < layer1_size; c++) syn1[c + l2] += g * neu1[c];
+    }
+    /* 
+    * 2.NEGATIVE SAMPLING方法
+    * 网络结构也是三层(如果输入层算一层的话): Input -> Projection -> Output
+    * Input layer是上下文向量集context(w);
+    * Projection layer是上下文向量和c(w),有可能会取平均;上下文向量context(w)也是通过采样选择的;
+    * Output layer是vocab_size大小的词向量集;
+    * 
+    * Same with hierarchical softmax neural network, 这个网络结构也是用来计算条件概率p(w|context(w)).
+    * 这种方法依赖于负采样策略;
+    * 
+    * 负采样策略:简单来说是对vocab_size大小的词集的带权负采样过程,权重是word在语料中的词频大小,通常会做归一化;权重越大,越有可能被选中,权重小,选中可能性就比较小.
+    * 这里将vocab_size个词的归一化权重,累积到[0,1]线段上,不同权的词所占的长度不同,但这个长度正好是它的权重大小-----权重统计;
+    * 我们的采样过程,始终要对应到采样的词上,但并不是直接选词,还要考虑到权重;所以,这里存在一个与权重相关的映射关系,考虑到[0,1]线段;
+    * 我们将这个线段分为M份(M >> N),然后生成一个大小在M范围内的随机数,然后这个随机数在映射到[0,1]线段上,看它落在哪个区间,这个区间对应权重的词,就是我们的取样词.
+    * 
+    * 存在一个trick:[0,1]线段的每个词的权重,并不是真正的词频,而是取了一个3/4次幂,为什么是这个数?因为效果好.
+    * 
+    * 最重要的条件概率p(w|context(w))怎么计算?举例来说,已知中心词w和上下文词向量context(w),以及中心词w的负采样样本neg(w);neg(w)中不包含中心词w本身;
+    * 这个计算过程包括多个分类过程,每个分类过程:在上下文context(w)已知的情况下,计算p(u|context(w))出现的概率,其中词u取值范围$u \in \{w\} \cup neg(w)$,
+    * 语言描述就是说,u属于中心词w和w的负采样本集neg(w)两个集合的并集内;那么正负类的确定,如果u=w,就属于正类,反之,属于负类,将两个统一后,label表示分类结果,可以得到:
+    * p(u|context(w))={sigma(u*c)}^label * {1-sigma(u*c)}^(1-label).
+    * 了解了上下文已知的情况下,每个词的分类效果,那么条件概率p(w|context(w))怎么计算呢?
+    * 
+    * 类似于cbow+hs方法,条件概率是多次分类过程的连乘积;negative sampling方法,这个条件概率是negative+1个分类过程决定;
+    * p(w|context(w))=p(w|context(w))* \prod_{u \in neg(w)} p(u|context(w))
+    * 
+    * 这是一个样本的条件概率
+    */
+    if (negative > 0) for (d = 0; d < negative + 1; d++) {
+      if (d == 0) {//处理当前中心词
+        target = word;
+        label = 1;
+      } else {//neg(w)采样
+        next_random = next_random * (unsigned long long)25214903917 + 11;
+        target = wv->table[(next_random >> 16) % table_size];//负采样结果,词下标
+        if (target == 0) target = next_random % (wv->vocab_size - 1) + 1;
+        // 如果采样到当前中心词,跳过,进行下一次采样
+        if (target == word) continue;
+        label = 0;
+      }
+      // 获取当前词的词向量
+      l2 = wv->word_row[target] * layer1_size;// 计算偏置
+      f = 0;//sigmoid函数值
+      // 前向传播
+      //neu1存储projection 的上下文词向量和c(w);syn1neg存储词向量数组,输出层结果,
+      for (c = 0; c < layer1_size; c++) f += neu1[c] * syn1neg[c + l2];//找到抽样词的词向量
+      if (track) {
+        stat->loss += SampleLoss(f, label);
+        stat->loss_count++;
+      }
+      //计算 关于上下文和c(w)和当前抽样词word u梯度的重合部分g
+      if (f > MAX_EXP) g = (label - 1) * cur_alpha;//sigmoid = 1
+      else if (f < -MAX_EXP) g = (label - 0) * cur_alpha;//sigmoid = 0
+      else g = (label - wv->expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * cur_alpha;
+      // 更新c(w)
+      for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1neg[c + l2];
+      // 更新抽样词u的词向量v(u)
+      for (c = 0; c < layer1_size; c++) syn1neg[c + l2] += g * neu1[c];
+    }
+    // hidden -> in
+    // 对上下文context(w)中词向量更新[组成上下文的每个词向量]
+    for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
+      c = sentence_position - window + a;
+      if (c < 0) continue;
+      if (c >= sentence_length) continue;
+      last_word = sen[c];
+      if (last_word == -1) continue;
+      // 更新context(w)中的词向量
+      for (c = 0; c < layer1_size; c++) syn0[c + wv->word_row[last_word] * layer1_size] += neu1e[c];
+    }
+  }
+  *random = next_random;
+}
+
+/**
+ * ======== TrainSkipGramWord ========
+ * Skip-gram Architecture
+ * Skip-gram模型的一次训练,参数同TrainCbowWord(没有neu1).
+ * 
+ * 神经网路的用途在于计算条件概率p(context(w)|w),用神经网络来拟合条件概率函数F(w,context(w),theta) = p(context(w)|w)
+ * 
+ * sen - This is the array of words in the sentence. Subsampling has already been
+ *       applied. I don't know what the word representation is...
+ *
+ * sentence_position - This is the index of the current input word.
+ *
+ * a - Offset into the current window, relative to the window start.
+ *     a will range from 0 to (window * 2) (TODO - not sure if it's inclusive or
+ *      not).
+ *
+ * c - 'c' is the index of the current context word *within the sentence*
+ *
+ * syn0 - The hidden layer weights.
+ *
+ * l1 - Index into the hidden layer (syn0). Index of the start of the
+ *      weights for the current input word.
+ */
+void TrainSkipGramWord(struct word2vec *wv, struct train_model *m, long long *sen, long long sentence_length, long long sentence_position, long long b,
+                       real *neu1e, real cur_alpha, unsigned long long *random,
+                       struct thread_stat *stat, int track) {
+  long long a, c, d, last_word, l1, l2, target, label, word = sen[sentence_position];
+  unsigned long long next_random = *random;
+  real f, g;
+  long long layer1_size = m->layer1_size;
+  int window = m->window, hs = m->hs, negative = m->negative;
+  real *syn0 = m->syn0, *syn1 = m->syn1, *syn1neg = m->syn1neg;
+  
+  // Loop over the positions in the context window (skipping the word at
+  // the center). 'a' is just the offset within the window, it's not 
+  // the index relative to the beginning of the sentence.
+  // 上下文抽样context(w)
+  for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
+    
+    // Convert the window offset 'a' into an index 'c' into the sentence 
+    // array.
+    c = sentence_position - window + a;//上下文抽样词u
+    
+    // Verify c isn't outisde the bounds of the sentence.
+    if (c < 0) continue;
+    if (c >= sentence_length) continue;
+    
+    // Get the context word. That is, get the id of the word (its index in
+    // the vocab table).
+    // 上下文抽样词u,得到index
+    last_word = sen[c];
+    
+    // At this point we have two words identified:
+    //   'word' - The word at our current position in the sentence (in the
+    //            center of a context window).
+    //   'last_word' - The word at a position within the context window.
+    
+    // Verify that the word exists in the vocab (I don't think this should
+    // ever be the case?)
+    if (last_word == -1) continue;
+    
+    // Calculate the index of the start of the weights for 'last_word'.
+    // 得到上下文抽样词的词向量,先计算词向量在总词向量数组中的偏置
+    l1 = wv->word_row[last_word] * layer1_size;
+    // 累计更新,关于v(w);
+    for (c = 0; c < layer1_size; c++) neu1e[c] = 0;
+
+    /*
+    * 1. HIERARCHICAL SOFTMAX
+    * =======================================
+    * 拟合的函数形式F(w,context(w),theta) = p(context(w)|w).
+    * 首先,需要知道的一点是由中心词w预测上下文context(w);上下文context(w)并不是一个词,或者说不是一个向量,
+    * 包括中心词前c个向量,后c个向量.所以条件概率p(context(w)|w)会和之前的p(w|context(w))有所不同.
+    * 假设,中心词w的上下文向量context(w),其中抽样词u \in context(w).
+    * 那么,条件概率p(context(w)|w)计算方法:
+    * p(context(w)|w) = \prod p(u|w)
+    * 
+    * 这样就转换成求每个条件向量p(u|w),把v(w)当做输出向量,u当做预测.但是,由于context(w)中包含不同的u.
+    * 
+    * 为了和之前的更新方式同意起来,代码一致.
+    * 
+    * Google工程师发现:如果w为中心词时,u在w的上下文窗口内;那么,当u为中心词时,w也在u的上下文窗口内.
+    * 那么,cost function可以转换,变成和cbow形式差不多的形式,只不过context(w)变成了一个向量,这里是抽样词,
+    * 也就是说cbow的p(w|context(w)),skip-gram原来的p(u|w)变成p(w|u),u是上下文,不过变成了一个向量;w还是中心词.
+    * 
+    * 这样两种模型loss function几乎相同,统一起来了.
+    * 
+    * 语料库的loss function为:
+    * \sum_{s=1}^S \sum_{t=1}^T \sum_{-c<=j<=c}log(w_{t+j}|w_t) = \sum_{s=1}^S \sum_{t=1}^T \sum_{-c<=j<=c}log(w_t|w_{t+j})
+    * 
+    * 意思是:计算语料库中所有句子的语言概率---遍历语料库中所有句子,每条句子每个中心词,每个中心词对应的上下文的条件概率.
+    * 从右到左,最里的sum是计算上下文概率p(context(w)|w),再外一层是计算句子概率,最外层是计算整个语料库所有句子的语言概率和.
+    * 
+    * 
+    * 转换成和cbow类似的分类过程,也是p(w|context(w)),不过context(w)是由一个向量组成.
+    * p(w|u)
+    */
+    if (hs) for (d = 0; d < wv->vocab[word].codelen; d++) {//计算p(w|u) u是上下文抽样词的一个;进行codelen次分类过程
+      f = 0;
+      l2 = wv->vocab[word].point[d] * layer1_size;
+      // Propagate hidden -> output
+      // syn0抽样词,和cbow中的c(w)一样; syn1是每个非叶子结点的参数theta
+      // l1上下文抽样词下标;l2非叶子结点分类过程对应参数
+      for (c = 0; c < layer1_size; c++) f += syn0[c + l1] * syn1[c + l2];
+      if (track) {
+        stat->loss += SampleLoss(f, 1 - wv->vocab[word].code[d]);
+        stat->loss_count++;
+      }
+      if (f <= -MAX_EXP) continue;
+      else if (f >= MAX_EXP) continue;
+      else f = wv->expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))];
+      // 'g' is the gradient multiplied by the learning rate
+      // 计算两个梯度中的重合量,方便重复使用
+      g = (1 - wv->vocab[word].code[d] - f) * cur_alpha;
+      // Propagate errors output -> hidden
+      // 计算关于u累积量,因为u参与了所有word的分类过程,所以要累计,最后在用累计量对u词向量进行一次更新
+      for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1[c + l2];
+      // Learn weights hidden -> output
+      // 更新每个分类过程的参数
+      for (c = 0; c < layer1_size; c++) syn1[c + l2] += g * syn0[c + l1];
+    }
+    
+    /* 
+    * 2. NEGATIVE SAMPLING p(context(w)|w)
+    * ===========================================================
+    * 和cbow+neg方法类似,并不是对所有词向量更新,只更新负采样的样本集
+    * 
+    * 同时和skip-gram模型的特点
+    * p(context(w)|w) = \prod_{u \in context(w)} p(u|w) = \prod_{u \in context(w)}p(w|u)
+    * 
+    */
+    if (negative > 0) for (d = 0; d < negative + 1; d++) {//负采样过程
+      // On the first iteration, we're going to train the positive sample.
+      // 使用负采样,抽取一个负样本;d=0时,采样正样本,所以负采样次数为negative + 1次
+      if (d == 0) {
+        target = word;
+        label = 1;
+      // On the other iterations, we'll train the negative samples.
+      } else {
+        // Pick a random word to use as a 'negative sample'; do this using 
+        // the unigram table.
+        
+        // Get a random integer.
+        next_random = next_random * (unsigned long long)25214903917 + 11;
+        
+        // 'target' becomes the index of the word in the vocab to use as
+        // the negative sample.
+        target = wv->table[(next_random >> 16) % table_size];
+        
+        // If the target is the special end of sentence token, then just
+        // pick a random word from the vocabulary instead.
+        if (target == 0) target = next_random % (wv->vocab_size - 1) + 1;
+        
+        // Don't use the positive sample as a negative sample!
+        if (target == word) continue;
+        
+        // Mark this as a negative example.
+        label = 0;
+      }
+      
+      // Get the index of the target word in the output layer.
+      l2 = wv->word_row[target] * layer1_size;
+      
+      // At this point, our two words are represented by their index into
+      // the layer weights.
+      // l1 - The index of our input word within the hidden layer weights.
+      // l2 - The index of our output word within the output layer weights.
+      // label - Whether this is a positive (1) or negative (0) example.
+      
+      // Calculate the dot-product between the input words weights (in 
+      // syn0) and the output word's weights (in syn1neg).
+      f = 0;
+      //syn0 上下文向量,条件; syn1neg 负采样样本
+      for (c = 0; c < layer1_size; c++) f += syn0[c + l1] * syn1neg[c + l2];
+      if (track) {
+        stat->loss += SampleLoss(f, label);
+        stat->loss_count++;
+      }
+      
+      // This block does two things:
+      //   1. Calculates the output of the network for this training
+      //      pair, using the expTable to evaluate the output layer
+      //      activation function.
+      //   2. Calculate the error at the output, stored in 'g', by
+      //      subtracting the network output from the desired output, 
+      //      and finally multiply this by the learning rate.
+      // 计算两个梯度计算过程的重合量
+      if (f > MAX_EXP) g = (label - 1) * cur_alpha;
+      else if (f < -MAX_EXP) g = (label - 0) * cur_alpha;
+      else g = (label - wv->expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * cur_alpha;
+      
+      // Multiply the error by the output layer weights.
+      // (I think this is the gradient calculation?)
+      // Accumulate these gradients over all of the negative samples.
+      // 关于条件u的累计梯度更新量
+      for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1neg[c + l2];
+      
+      // Update the output layer weights by multiplying the output error
+      // by the hidden layer weights.
+      // 负采样抽样样本梯度更新
+      for (c = 0; c < layer1_size; c++) syn1neg[c + l2] += g * syn0[c + l1];
+    }
+    // Once the hidden layer gradients for all of the negative samples have
+    // been accumulated, update the hidden layer weights.
+    // 负采样完成后,对条件u对应向量进行一次性更新
+    for (c = 0; c < layer1_size; c++) syn0[c + l1] += neu1e[c];
+  }
+  *random = next_random;
+}
+
+/**
+ * ======== ReadSentence ========
+ * 回调提供语料(sentence_fn)时,训练线程从这里取下一句:词换成词典下标(不在词典中的为-1)放到*line,最后加上</s>(下标0),
+ * 返回*line中的词数;*line的空间不够时扩大,*line_max为它的大小.
+ * 回调不是线程安全的,并且返回的词只在下一次调用之前有效,所以读句子和查词典都在chunk_lock内.
+ * 一轮读完时记下这一轮结束的时间,回到第一句开始下一轮;iter轮都读完,或者training_stop时返回-1.
+ * 内存不够时置thread_failed和training_stop,也返回-1.
+ */
+long long ReadSentence(struct word2vec *wv, long long **line, long long *line_max) {
+  const char *const *tokens;
+  char word[MAX_STRING];
+  long long a, n = -1, *buf;
+  pthread_mutex_lock(&wv->chunk_lock);
+  while (!wv->training_stop && (wv->sentence_pass < wv->iter)) {
+    n = wv->sentence_fn(wv->sentence_arg, &tokens);
+    if (n >= 0) break;
+    wv->epoch_end[wv->sentence_pass] = WallTime() - wv->train_start;
+    if (++wv->sentence_pass < wv->iter) wv->sentence_fn(wv->sentence_arg, NULL);
+  }
+  if ((n >= 0) && (n + 1 > *line_max)) {
+    buf = (long long *)realloc(*line, (n + 1) * sizeof(long long));
+    if (buf == NULL) {
+      wv->thread_failed = 1;
+      wv->training_stop = 1;
+      n = -1;
+    } else {
+      *line = buf;
+      *line_max = n + 1;
+    }
+  }
+  if (n >= 0) {
+    for (a = 0; a < n; a++) {
+      snprintf(word, MAX_STRING, "%s", tokens[a]);
+      (*line)[a] = SearchVocab(wv, word);
+    }
+    (*line)[n] = 0;
+  }
+  pthread_mutex_unlock(&wv->chunk_lock);
+  return n < 0 ? -1 : n + 1;
+}
+
+/**
+ * ======== TrainModelThread ========
+ * This function performs the training of the model.
+ * 模型训练子例程,方便多线程调用
+ * train_thread: 线程的参数,训练状态和线程号.
+ */
+struct train_thread {
+  struct word2vec *wv;
+  long long id;
+};
+
+void *TrainModelThread(void *arg) {
+  struct word2vec *wv = ((struct train_thread *)arg)->wv;
+  long long id = ((struct train_thread *)arg)->id;
+  
+  /*
+   * word - Stores the index of a word in the vocab table.
+   * word_count - Stores the total number of training words processed.
+   */
+  long long b, word, sentence_length = 0, sentence_position = 0;
+  long long word_count = 0, last_word_count = 0, sen[MAX_SENTENCE_LENGTH + 1];
+  long long pos = 0, chunk = -1, chunk_end = 0, positions = 0;
+  int chunk_left = 0, done = 0, track;
+  unsigned long long next_random = id;
+  struct phrase_reader reader;
+  // 回调提供语料时当前句子的词下标,见ReadSentence
+  long long *line = NULL, line_len = 0, line_pos = 0, line_max = 0;
+  
+  // 本线程的统计计数,见thread_stat;学习率cur_alpha每个线程各自维护,不再多线程同时写全局alpha
+  struct thread_stat *stat = &wv->thread_stats[id];
+  // 每个模型的学习率按各自的初始学习率衰减
+  real *cur_alpha = (real *)malloc(wv->num_models * sizeof(real));
+  long long m, max_size = 0;
+  for (m = 0; m < wv->num_models; m++) {
+    cur_alpha[m] = wv->models[m].alpha * (1 - wv->word_count_actual / (real)(wv->iter * wv->train_words + 1));
+    if (wv->models[m].layer1_size > max_size) max_size = wv->models[m].layer1_size;
+  }
+  
+  // 本线程的硬件计数器(只统计本线程)
+  int fds[PERF_EVENTS];
+  long long perf_start[PERF_EVENTS];
+  if (wv->perf_mode) {
+    PerfOpen(fds, 0);
+    PerfStart(fds, perf_start);
+  }
+  
+  // neu1 is only used by the CBOW architecture.
+  // neu1仅仅在CBOW模型中使用
+  real *neu1 = (real *)calloc(max_size, sizeof(real));
+  
+  // neu1e is used by both architectures.
+  // neu1e在两个模型中都用到;输出层对projection layer向量的梯度更新量
+  real *neu1e = (real *)calloc(max_size, sizeof(real));
+  
+  
+  // Open the training file; the chunks this thread works on are taken from
+  // the shared scheduler, see 'GetChunk'.
+  // 打开训练文件;线程处理哪些数据块由GetChunk从全局计数器动态领取,不再按线程号静态划分
+  FILE *fi = wv->sentence_fn == NULL ? OpenTrainFile(wv) : NULL;
+  
+  // This loop covers the whole training operation...
+  while (1) {
+    // This block adjusts the training 'alpha' parameter; progress is
+    // reported by 'MonitorThread'.
+    if (word_count - last_word_count > 10000) {
+      // 原子累加全局词数,各线程据此计算学习率
+      __sync_fetch_and_add(&wv->word_count_actual, word_count - last_word_count);
+      last_word_count = word_count;
+      // 修改学习率;动态修改,随着训练过程地进行,学习率逐渐降低
+      for (m = 0; m < wv->num_models; m++) {
+        cur_alpha[m] = wv->models[m].alpha * (1 - wv->word_count_actual / (real)(wv->iter * wv->train_words + 1));
+        if (cur_alpha[m] < wv->models[m].alpha * 0.0001) cur_alpha[m] = wv->models[m].alpha * 0.0001;
+      }
+      stat->alpha = cur_alpha[0];
+    }
+    
+    // 评估决定提前结束训练:当前句子训练完就退出,不再读新句子
+    if ((sentence_length == 0) && wv->training_stop) break;
+    
+    // This 'if' block retrieves the next sentence from the training text and
+    // stores it in 'sen'.
+    // TODO - Under what condition would sentence_length not be zero?
+    // 从训练数据中,读取下一条句子,句子长度为MAX_SENTENCE_LENGTH
+    if (sentence_length == 0) {//是否需要读取一个新句子get a new sentence,保存到sen数组中[sen数组保存处理的当前句]
+      while (1) {
+        if (wv->sentence_fn != NULL) {
+          // 回调提供的语料:当前句子读完时,如果已经读到半句,先训练这半句;否则取下一句,所有轮次都读完则训练结束
+          if (line_pos == line_len) {
+            if (sentence_length > 0) break;
+            line_len = ReadSentence(wv, &line, &line_max);
+            line_pos = 0;
+            if (line_len < 0) {
+              line_len = 0;
+              done = 1;
+              break;
+            }
+          }
+          word = line[line_pos++];
+        } else {
+          // 当前块已读完:如果已经读到半句,先训练这半句;否则记下这个块已训练完,领取下一个块,没有块可领则训练结束
+          if (!chunk_left) {
+            if (sentence_length > 0) break;
+            // 这个块已训练完,不再登记为未完成
+            stat->chunk = -1;
+            if (chunk >= 0) ChunkDone(wv, chunk);
+            chunk = -1;
+            if (!GetChunk(wv, fi, stat, &chunk, &chunk_end)) {
+              done = 1;
+              break;
+            }
+            chunk_left = 1;
+            reader.chunk = ChunkBlock(wv, chunk);
+            reader.has_next = 0;
+            wv->thread_chunks[id]++;
+          }
+          
+          // Read the next word (or phrase) from the training data and lookup its
+          // index in the vocab table. 'word' is the word's vocab index.
+          word = ReadTokenIndex(wv, fi, &reader, &pos);
+          
+          // 文件结束,或者读完这个词后越过了块尾(这个词起始于块尾之后,属于下一个块),丢弃并结束当前块
+          if ((pos < 0) || (pos > chunk_end)) {
+            chunk_left = 0;
+            continue;
+          }
+          // 恰好读到块尾,这个词仍属于当前块
+          if (pos == chunk_end) chunk_left = 0;
+        }
+        
+        // If the word doesn't exist in the vocabulary, skip it.
+        if (word == -1) continue;
+        
+        // Track the total number of training words processed.
+        word_count++;
+        
+        // 'vocab' word 0 is a special token "</s>" which indicates the end of 
+        // a sentence.
+        if (word == 0) break;//句子终止符
+        
+        /* 
+         * =================================
+         *   Subsampling of Frequent Words
+         * =================================
+         * This code randomly discards training words, but is designed to 
+         * keep the relative frequencies the same. That is, less frequent
+         * words will be discarded less often. 
+         *
+         * We first calculate the probability that we want to *keep* the word;
+         * this is the value 'ran'. Then, to decide whether to keep the word,
+         * we generate a random fraction (0.0 - 1.0), and if 'ran' is smaller
+         * than this number, we discard the word. This means that the smaller 
+         * 'ran' is, the more likely it is that we'll discard this word. 
+         *
+         * The quantity (vocab[word].cn / sample_words) is the fraction of all 
+         * the training words which are 'word'. Let's represent this fraction
+         * by x.
+         *
+         * Using the default 'sample' value of 0.001, the equation for ran is:
+         *   ran = (sqrt(x / 0.001) + 1) * (0.001 / x)
+         * 
+         * You can plot this function to see it's behavior; it has a curved 
+         * L shape.
+         * 
+         * Here are some interesting points in this function (again this is
+         * using the default sample value of 0.001).
+         *   - ran = 1 (100% chance of being kept) when x <= 0.0026.
+         *      - That is, any word which is 0.0026 of the words *or fewer* 
+         *        will be kept 100% of the time. Only words which represent 
+         *        more than 0.26% of the total words will be subsampled.
+         *   - ran = 0.5 (50% chance of being kept) when x = 0.00746. 
+         *   - ran = 0.033 (3.3% chance of being kept) when x = 1.
+         *       - That is, if a word represented 100% of the training set
+         *         (which of course would never happen), it would only be
+         *         kept 3.3% of the time.
+         *
+         * NOTE: Seems like it would be more efficient to pre-calculate this 
+         *       probability for each word and store it in the vocab table...
+         *
+         * Words that are discarded by subsampling aren't added to our training
+         * 'sentence'. This means the discarded word is neither used as an 
+         * input word or a context word for other inputs.
+         */
+        /** 
+         * 对高频词进行降采样 subsamping for frequent words
+         * 
+         */
+        if (wv->sample > 0) {//是否对高频词进行subsampling过程
+          // Calculate the probability of keeping 'word'.
+          // 计算词word保存的概率ran: ran = \sqrt(sample/f(w)) + sample/f(w);f(w)表示w的归一化频率;sample,降采样力度;
+          // 生成随机数大于ran,则跳过这个高频词
+          // 这里的ran计算公式 = (sqrt(f(w)/sample)+1)*(sample/f(w))
+          real ran = (sqrt(wv->vocab[word].cn / (wv->sample * wv->sample_words)) + 1) * (wv->sample * wv->sample_words) / wv->vocab[word].cn;
+          
+          // Generate a random number.
+          // The multiplier is 25.xxx billion, so 'next_random' is a 64-bit integer.
+          // 生成一个随机数
+          next_random = next_random * (unsigned long long)25214903917 + 11;
+
+          // If the probability is less than a random fraction, discard the word.
+          //
+          // (next_random & 0xFFFF) extracts just the lower 16 bits of the 
+          // random number. Dividing this by 65536 (2^16) gives us a fraction
+          // between 0 and 1. So the code is just generating a random fraction.
+          // 随机数归一化,然后和保存概率ran比较,判断词word是否应该删除
+          if (ran < (next_random & 0xFFFF) / (real)65536) continue;//大于保存概率,跳过
+        }
+        
+        // If we kept the word, add it to the sentence.
+        // 如果保留,添加到句子(数组)中,添加的是这个词word在字典中对应的下标index
+        sen[sentence_length] = word;
+        sentence_length++;
+        
+        // Verify the sentence isn't too long.
+        // 如果句子长度过长,截断处理
+        if (sentence_length >= MAX_SENTENCE_LENGTH) break;
+      }
+      //句子中指针位置,中心词w位置
+      sentence_position = 0;
+      stat->words = word_count;
+      // 这一句之后从pos继续读;检查点时正在训练的这一句恢复后不会重新训练
+      stat->chunk_pos = pos;
+    }
+    // 没有读到有效的词(空句或全部被降采样):所有块都已领取完则训练结束,否则继续读取下一句
+    if (sentence_length == 0) {
+      if (done) break;
+      continue;
+    }
+    
+    // Get the next word in the sentence. The word is represented by its index
+    // into the vocab table.
+    // 得到当前中心词;在句子中取一个词word,取出的是word在字典中对应的下标index
+    word = sen[sentence_position];
+    
+    if (word == -1) continue;//如果没找到,继续
+
+    
+    // 每LOSS_SAMPLE个中心词抽样一个,统计它所有二分类的loss(只统计第一个模型)
+    track = (++positions % LOSS_SAMPLE) == 0;
+    
+    // 同一个中心词依次训练每个模型
+    for (m = 0; m < wv->num_models; m++) {
+      // b随机初始化, b是中心词两边读取词长度大小
+      next_random = next_random * (unsigned long long)25214903917 + 11;
+      // 'b' becomes a random integer between 0 and 'window'.
+      // This is the amount we will shrink the window size by.
+      // 确定b大小,[0,window);
+      b = next_random % wv->models[m].window;//每个中心词对应上下文取值边界范围,由于是随机数,导致每个中心词上下文取值范围是不同的,window还有什么用,只是指定了一个范围
+      
+      // 训练当前中心词,见TrainCbowWord / TrainSkipGramWord
+      if (wv->models[m].cbow) TrainCbowWord(wv, &wv->models[m], sen, sentence_length, sentence_position, b, neu1, neu1e, cur_alpha[m], &next_random, stat, track && (m == 0));
+      else TrainSkipGramWord(wv, &wv->models[m], sen, sentence_length, sentence_position, b, neu1e, cur_alpha[m], &next_random, stat, track && (m == 0));
+    }
+    
+    // Advance to the next word in the sentence.
+    // 获取下一个训练样本--当前句子,更换w,context(w)
+    sentence_position++;
+    
+    // Check if we've reached the end of the sentence.
+    // If so, set sentence_length to 0 and we'll read a new sentence at the
+    // beginning of this loop.
+    // 如果到当前句子末尾,读取下一个句子
+    if (sentence_position >= sentence_length) {
+      sentence_length = 0;
+      continue;
+    }
+  }
+  __sync_fetch_and_add(&wv->word_count_actual, word_count - last_word_count);
+  stat->words = word_count;
+  if (wv->perf_mode) {
+    PerfStop(fds, perf_start, &wv->perf_thread[id * PERF_EVENTS]);
+    PerfClose(fds);
+  }
+  // 记录线程退出时间,所有线程结束后据此计算每个线程的空闲时间
+  wv->thread_finish[id] = WallTime();
+  if (fi != NULL) fclose(fi);
+  free(line);
+  free(neu1);
+  free(neu1e);
+  free(cur_alpha);
+  pthread_exit(NULL);
+}
+
+/**
+ * ======== Aligned Model Writer ========
+ * -binary 2 时输出word2vec-model.h定义的对齐格式.
+ * 词表部分(偏移表,词,哈希表)由调用线程写;向量矩阵按行切分给num_threads个线程,
+ * 每个线程把一批行(每行补0到stride)拼进缓冲区,用pwrite一次写到文件中对应的位置.
+ */
+#define MODEL_WRITE_ROWS 4096
+struct model_write_task {
+  struct word2vec *wv;
+  int fd, ok;
+  long long first, last, stride;
+  uint64_t pos;
+};
+
+/**
+ * ======== PwriteAll ========
+ * pwrite()直到写完len字节,返回0表示写失败.
+ */
+int PwriteAll(int fd, const void *buf, long long len, long long pos) {
+  const char *p = (const char *)buf;
+  long long n;
+  while (len > 0) {
+    n = pwrite(fd, p, len > (1 << 30) ? (1 << 30) : len, pos);
+    if (n <= 0) return 0;
+    p += n;
+    pos += n;
+    len -= n;
+  }
+  return 1;
+}
+
+void *WriteModelThread(void *arg) {
+  struct model_write_task *t = (struct model_write_task *)arg;
+  struct word2vec *wv = t->wv;
+  long long a, b, n;
+  float *buf = (float *)calloc(MODEL_WRITE_ROWS * t->stride, sizeof(float));
+  t->ok = buf != NULL;
+  for (a = t->first; t->ok && (a < t->last); a += n) {
+    n = t->last - a < MODEL_WRITE_ROWS ? t->last - a : MODEL_WRITE_ROWS;
+    for (b = 0; b < n; b++) memcpy(&buf[b * t->stride], &wv->syn0[(a + b) * wv->layer1_size], wv->layer1_size * sizeof(real));
+    t->ok = PwriteAll(t->fd, buf, n * t->stride * sizeof(float), t->pos + a * t->stride * sizeof(float));
+  }
+  free(buf);
+  return NULL;
+}
+
+/**
+ * ======== WriteAlignedModel ========
+ * 把词典和syn0的前rows行按对齐格式写到fd;其中最后buckets行是哈希桶,只写有独立行的前rows - buckets个词.
+ */
+void WriteAlignedModel(struct word2vec *wv, int fd, long long rows, long long buckets) {
+  struct w2vm_header h;
+  struct model_write_task *tasks;
+  pthread_t *pt;
+  uint64_t *offsets, pos;
+  uint32_t *hash;
+  char *strings;
+  long long a, words = rows - buckets;
+  int ok;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, W2VM_MAGIC, 8);
+  h.version = W2VM_VERSION;
+  h.header_size = sizeof(h);
+  h.words = words;
+  h.rows = rows;
+  h.buckets = buckets;
+  h.dim = wv->layer1_size;
+  h.stride = w2vm_align(wv->layer1_size * sizeof(float)) / sizeof(float);
+  // 各部分的位置
+  offsets = (uint64_t *)malloc((words + 1) * sizeof(uint64_t));
+  for (a = 0; a < words; a++) {
+    offsets[a] = h.strings_size;
+    h.strings_size += strlen(wv->vocab[a].word) + 1;
+  }
+  offsets[words] = h.strings_size;
+  for (h.hash_size = 1; h.hash_size < 2 * (uint64_t)words; h.hash_size *= 2);
+  h.offsets_pos = w2vm_align(sizeof(h));
+  h.strings_pos = h.offsets_pos + (words + 1) * sizeof(uint64_t);
+  h.hash_pos = w2vm_align(h.strings_pos + h.strings_size);
+  h.vectors_pos = w2vm_align(h.hash_pos + h.hash_size * sizeof(uint32_t));
+  h.file_size = h.vectors_pos + h.rows * h.stride * sizeof(float);
+  // 词和哈希表
+  strings = (char *)malloc(h.strings_size);
+  hash = (uint32_t *)malloc(h.hash_size * sizeof(uint32_t));
+  if ((strings == NULL) || (hash == NULL)) Fail(wv, "Memory allocation failed");
+  for (a = 0; a < (long long)h.hash_size; a++) hash[a] = W2VM_EMPTY;
+  for (a = 0; a < words; a++) {
+    strcpy(strings + offsets[a], wv->vocab[a].word);
+    pos = w2vm_hash(wv->vocab[a].word) & (h.hash_size - 1);
+    while (hash[pos] != W2VM_EMPTY) pos = (pos + 1) & (h.hash_size - 1);
+    hash[pos] = a;
+  }
+  ok = ftruncate(fd, h.file_size) == 0;
+  if (ok) ok = PwriteAll(fd, &h, sizeof(h), 0);
+  if (ok) ok = PwriteAll(fd, offsets, (words + 1) * sizeof(uint64_t), h.offsets_pos);
+  if (ok) ok = PwriteAll(fd, strings, h.strings_size, h.strings_pos);
+  if (ok) ok = PwriteAll(fd, hash, h.hash_size * sizeof(uint32_t), h.hash_pos);
+  free(offsets);
+  free(strings);
+  free(hash);
+  // 向量矩阵,多线程写
+  pt = (pthread_t *)malloc(wv->num_threads * sizeof(pthread_t));
+  tasks = (struct model_write_task *)calloc(wv->num_threads, sizeof(struct model_write_task));
+  for (a = 0; ok && (a < wv->num_threads); a++) {
+    tasks[a].wv = wv;
+    tasks[a].fd = fd;
+    tasks[a].first = rows * a / wv->num_threads;
+    tasks[a].last = rows * (a + 1) / wv->num_threads;
+    tasks[a].stride = h.stride;
+    tasks[a].pos = h.vectors_pos;
+    pthread_create(&pt[a], NULL, WriteModelThread, &tasks[a]);
+  }
+  for (a = 0; ok && (a < wv->num_threads); a++) pthread_join(pt[a], NULL);
+  for (a = 0; ok && (a < wv->num_threads); a++) ok = tasks[a].ok;
+  free(pt);
+  free(tasks);
+  if (!ok) {
+    Fail(wv, "ERROR: writing %s failed", wv->output_file);
+  }
+}
+
+/**
+ * ======== FormatFixed ========
+ * 把x按printf("%.*f", precision, x)的格式写到buf,返回长度,结果和printf逐字节相同.
+ *
+ * precision <= 9时,float转成double再乘以10^precision是精确的(float的24位尾数加上5^9的21位,不超过double的53位),
+ * 再用llrint按默认舍入模式(就近,恰好一半时取偶数)取整,和glibc对精确十进制值的舍入方式一致;
+ * 符号用signbit取,-0.0和舍入为0的负数同样输出"-0.000000".
+ * 其他情况(精度更高,数值太大,inf/nan)交给snprintf.
+ */
+const long long pow10_table[19] = {1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL, 100000000LL,
+ 1000000000LL, 10000000000LL, 100000000000LL, 1000000000000LL, 10000000000000LL, 100000000000000LL,
+ 1000000000000000LL, 10000000000000000LL, 100000000000000000LL, 1000000000000000000LL};
+
+int FormatDigits(char *buf, unsigned long long n, int width) {
+  char tmp[24];
+  int len = 0, i;
+  do {
+    tmp[len++] = '0' + n % 10;
+    n /= 10;
+  } while (n > 0);
+  while (len < width) tmp[len++] = '0';
+  for (i = 0; i < len; i++) buf[i] = tmp[len - 1 - i];
+  return len;
+}
+
+int FormatFixed(char *buf, real x, int precision) {
+  double v;
+  unsigned long long n;
+  int len = 0;
+  if ((precision < 0) || (precision > 9)) return snprintf(buf, 64 + precision, "%.*f", precision, x);
+  v = fabs((double)x) * pow10_table[precision];
+  if (!(v < 4e18)) return snprintf(buf, 64 + precision, "%.*f", precision, x);
+  n = llrint(v);
+  if (signbit(x)) buf[len++] = '-';
+  len += FormatDigits(buf + len, n / pow10_table[precision], 1);
+  if (precision > 0) {
+    buf[len++] = '.';
+    len += FormatDigits(buf + len, n % pow10_table[precision], precision);
+  }
+  return len;
+}
+
+/**
+ * ======== FormatShortest ========
+ * 输出能读回(strtof)同一个float的最短十进制表示,返回长度.
+ * 1e-5 <= |x| < 1e7时从1位有效数字开始逐位增加,用整数运算得到候选值并检查能否还原;
+ * 最后再用strtof确认一次,其他情况(以及确认失败时)用"%.*g"逐位尝试.
+ */
+int FormatShortest(char *buf, real x) {
+  double ax = fabs((double)x), v;
+  unsigned long long m = 0;
+  int d, e, k = 0, nd, len = 0, point, found = 0, i;
+  char digits[24];
+  if ((ax >= 1e-5) && (ax < 1e7)) {
+    e = (int)floor(log10(ax));
+    for (d = 1; d <= 9; d++) {
+      k = d - 1 - e;
+      m = llrint(k >= 0 ? ax * pow10_table[k] : ax / pow10_table[-k]);
+      v = k >= 0 ? m / (double)pow10_table[k] : m * (double)pow10_table[-k];
+      if ((real)v == (real)ax) {
+        found = 1;
+        break;
+      }
+    }
+    if (found) {
+      // 去掉末尾的0
+      while ((k > 0) && (m % 10 == 0)) {
+        m /= 10;
+        k--;
+      }
+      nd = FormatDigits(digits, m, 1);
+      if (signbit(x)) buf[len++] = '-';
+      if (k <= 0) {
+        memcpy(buf + len, digits, nd);
+        len += nd;
+        for (i = 0; i < -k; i++) buf[len++] = '0';
+      } else if (nd > k) {
+        point = nd - k;
+        memcpy(buf + len, digits, point);
+        len += point;
+        buf[len++] = '.';
+        memcpy(buf + len, digits + point, k);
+        len += k;
+      } else {
+        buf[len++] = '0';
+        buf[len++] = '.';
+        for (i = 0; i < k - nd; i++) buf[len++] = '0';
+        memcpy(buf + len, digits, nd);
+        len += nd;
+      }
+      buf[len] = 0;
+      if (strtof(buf, NULL) == x) return len;
+    }
+  }
+  for (d = 1; d < 9; d++) {
+    len = snprintf(buf, 32, "%.*g", d, x);
+    if (strtof(buf, NULL) == x) return len;
+  }
+  return snprintf(buf, 32, "%.9g", x);
+}
+
+/**
+ * ======== Text Export ========
+ * -binary 0 时的多线程文本输出.词向量按EXPORT_ROWS行一块,每轮num_threads块,每个线程格式化一块到自己的缓冲区,
+ * 一轮结束后按顺序写出;内存只和每轮的块数有关,输出和原来逐个fprintf("%s ")/fprintf("%lf ")的格式逐字节相同.
+ */
+#define EXPORT_ROWS 4096
+struct export_task {
+  struct word2vec *wv;
+  long long first, last, len, size;
+  char *buf;
+};
+
+void *ExportTextThread(void *arg) {
+  struct export_task *t = (struct export_task *)arg;
+  struct word2vec *wv = t->wv;
+  long long a, b, need = MAX_STRING + 2 + wv->layer1_size * (66 + wv->export_precision);
+  char *buf;
+  t->len = 0;
+  for (a = t->first; a < t->last; a++) {
+    // 保证缓冲区放得下一行;分配失败时len置-1,由WriteTextVectors报告
+    if (t->len + need > t->size) {
+      buf = (char *)realloc(t->buf, 2 * (t->len + need));
+      if (buf == NULL) {
+        t->len = -1;
+        return NULL;
+      }
+      t->buf = buf;
+      t->size = 2 * (t->len + need);
+    }
+    b = strlen(wv->vocab[a].word);
+    memcpy(t->buf + t->len, wv->vocab[a].word, b);
+    t->len += b;
+    t->buf[t->len++] = ' ';
+    for (b = 0; b < wv->layer1_size; b++) {
+      if (wv->export_precision > 0) t->len += FormatFixed(t->buf + t->len, wv->syn0[wv->word_row[a] * wv->layer1_size + b], wv->export_precision);
+      else t->len += FormatShortest(t->buf + t->len, wv->syn0[wv->word_row[a] * wv->layer1_size + b]);
+      t->buf[t->len++] = ' ';
+    }
+    t->buf[t->len++] = '\n';
+  }
+  return NULL;
+}
+
+/**
+ * ======== WriteTextVectors ========
+ * 把前words个词的词向量按文本格式写到fo(文件头由调用者写).
+ */
+void WriteTextVectors(struct word2vec *wv, FILE *fo, long long words) {
+  long long a, round, rows = (long long)wv->num_threads * EXPORT_ROWS;
+  int failed = 0;
+  pthread_t *pt = (pthread_t *)malloc(wv->num_threads * sizeof(pthread_t));
+  struct export_task *tasks = (struct export_task *)calloc(wv->num_threads, sizeof(struct export_task));
+  for (round = 0; (round < words) && !failed; round += rows) {
+    for (a = 0; a < wv->num_threads; a++) {
+      tasks[a].wv = wv;
+      tasks[a].first = round + a * EXPORT_ROWS;
+      tasks[a].last = tasks[a].first + EXPORT_ROWS;
+      if (tasks[a].first > words) tasks[a].first = words;
+      if (tasks[a].last > words) tasks[a].last = words;
+      pthread_create(&pt[a], NULL, ExportTextThread, &tasks[a]);
+    }
+    for (a = 0; a < wv->num_threads; a++) pthread_join(pt[a], NULL);
+    for (a = 0; (a < wv->num_threads) && !failed; a++) {
+      if (tasks[a].len < 0) failed = 1;
+      else if (fwrite(tasks[a].buf, 1, tasks[a].len, fo) != (size_t)tasks[a].len) failed = 2;
+    }
+  }
+  for (a = 0; a < wv->num_threads; a++) free(tasks[a].buf);
+  free(tasks);
+  free(pt);
+  if (failed == 1) Fail(wv, "Memory allocation failed");
+  if (failed == 2) Fail(wv, "ERROR: writing %s failed", wv->output_file);
+}
+
+/**
+ * ======== K-means Engine ========
+ * 多线程的球面k-means,见KMeans.
+ *
+ * kmeans_cent: 质心矩阵(classes x layer1_size),每行归一化;
+ * kmeans_cl: 每个词的类别;
+ * kmeans_inv_norm: 每个词向量长度的倒数,用于把点积换算成余弦相似度;
+ * kmeans_dist: k-means++初始化时每个词到已选质心的最近距离(1 - 余弦相似度);
+ * kmeans_next: k-means++初始化时新选出的质心编号;
+ * kmeans_task: 每个线程处理一段连续的词[first, last),类内向量和sum,类内词数count都是线程私有的部分和,
+ *              最后再汇总,分配时不需要加锁.
+ */
+#define KMEANS_BLOCK 32
+struct kmeans_task {
+  struct word2vec *wv;
+  long long first, last, changed, *count;
+  double total;
+  real *sum;
+};
+
+/**
+ * ======== KMeansDot ========
+ * 点积,8路部分和互相独立,-O3时编译器可以把它向量化(不需要-ffast-math).
+ */
+real KMeansDot(const real *x, const real *y, long long n) {
+  real s[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  long long a, b;
+  for (a = 0; a + 8 <= n; a += 8) for (b = 0; b < 8; b++) s[b] += x[a + b] * y[a + b];
+  for (; a < n; a++) s[0] += x[a] * y[a];
+  return ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7]));
+}
+
+/**
+ * ======== RunKMeansThreads ========
+ * 在num_threads个线程上执行fn,参数为各自的kmeans_task,等待全部结束.
+ */
+void RunKMeansThreads(struct word2vec *wv, void *(*fn)(void *)) {
+  long long a;
+  pthread_t *pt = (pthread_t *)malloc(wv->num_threads * sizeof(pthread_t));
+  for (a = 0; a < wv->num_threads; a++) {
+    wv->kmeans_tasks[a].wv = wv;
+    pthread_create(&pt[a], NULL, fn, &wv->kmeans_tasks[a]);
+  }
+  for (a = 0; a < wv->num_threads; a++) pthread_join(pt[a], NULL);
+  free(pt);
+}
+
+/**
+ * ======== SplitKMeansTasks ========
+ * 把[0, n)平均分给num_threads个kmeans_task.
+ */
+void SplitKMeansTasks(struct word2vec *wv, long long n) {
+  long long a;
+  for (a = 0; a < wv->num_threads; a++) {
+    wv->kmeans_tasks[a].first = n * a / wv->num_threads;
+    wv->kmeans_tasks[a].last = n * (a + 1) / wv->num_threads;
+  }
+}
+
+/**
+ * ======== KMeansSeedThread ========
+ * k-means++:用新选出的质心kmeans_next更新本线程每个词的最近距离,total为这些距离的平方和.
+ */
+void *KMeansSeedThread(void *arg) {
+  struct kmeans_task *t = (struct kmeans_task *)arg;
+  struct word2vec *wv = t->wv;
+  real *c = &wv->kmeans_cent[wv->kmeans_next * wv->layer1_size];
+  double d;
+  long long a;
+  t->total = 0;
+  for (a = t->first; a < t->last; a++) {
+    d = 1 - KMeansDot(&wv->syn0[a * wv->layer1_size], c, wv->layer1_size) * wv->kmeans_inv_norm[a];
+    if (d < 0) d = 0;
+    if (d < wv->kmeans_dist[a]) wv->kmeans_dist[a] = d;
+    t->total += wv->kmeans_dist[a] * wv->kmeans_dist[a];
+  }
+  return NULL;
+}
+
+/**
+ * ======== KMeansAssignThread ========
+ * 把本线程的词分配给余弦相似度最大的质心,同时累加下一轮质心需要的类内向量和与词数;
+ * changed为类别有变化的词数,total为inertia:所有词的|x| - x·c之和(c为单位长度的质心),即按词向量长度加权的1 - 余弦相似度;
+ * 质心取类内原始词向量的均值(和原来的实现一样),它最小化的正是这个量,所以inertia每轮单调不增.
+ * 按KMEANS_BLOCK个词一块计算:一个质心依次和块内所有词做点积,质心矩阵每块只读一遍.
+ */
+void *KMeansAssignThread(void *arg) {
+  struct kmeans_task *t = (struct kmeans_task *)arg;
+  struct word2vec *wv = t->wv;
+  long long a, c, w, end, best[KMEANS_BLOCK];
+  real x, bestv[KMEANS_BLOCK], *v;
+  memset(t->sum, 0, wv->classes * wv->layer1_size * sizeof(real));
+  memset(t->count, 0, wv->classes * sizeof(long long));
+  t->changed = 0;
+  t->total = 0;
+  for (w = t->first; w < t->last; w += KMEANS_BLOCK) {
+    end = w + KMEANS_BLOCK < t->last ? w + KMEANS_BLOCK : t->last;
+    for (a = w; a < end; a++) {
+      bestv[a - w] = -1e30;
+      best[a - w] = 0;
+    }
+    for (c = 0; c < wv->classes; c++) {
+      v = &wv->kmeans_cent[c * wv->layer1_size];
+      for (a = w; a < end; a++) {
+        x = KMeansDot(&wv->syn0[a * wv->layer1_size], v, wv->layer1_size);
+        if (x > bestv[a - w]) {
+          bestv[a - w] = x;
+          best[a - w] = c;
+        }
+      }
+    }
+    for (a = w; a < end; a++) {
+      if (wv->kmeans_cl[a] != best[a - w]) t->changed++;
+      wv->kmeans_cl[a] = best[a - w];
+      if (wv->kmeans_inv_norm[a] > 0) t->total += 1 / wv->kmeans_inv_norm[a] - bestv[a - w];
+      v = &t->sum[best[a - w] * wv->layer1_size];
+      for (c = 0; c < wv->layer1_size; c++) v[c] += wv->syn0[a * wv->layer1_size + c];
+      t->count[best[a - w]]++;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * ======== KMeansInit ========
+ * k-means++初始化:第一个质心随机选一个词,之后每个质心按"到已选质心最近距离的平方"加权随机选词.
+ * 距离更新多线程进行;选词时先按各线程的距离平方和确定落在哪个线程的范围,再在该范围内查找.
+ */
+void KMeansInit(struct word2vec *wv, long long rows) {
+  unsigned long long next_random = wv->kmeans_seed;
+  long long a, b, w;
+  double r, total;
+  for (a = 0; a < rows; a++) wv->kmeans_dist[a] = 1e30;
+  for (a = 0; a < wv->classes; a++) {
+    next_random = next_random * (unsigned long long)25214903917 + 11;
+    r = (next_random >> 16) / (double)(1LL << 48);
+    w = (long long)(r * rows);
+    if (a > 0) {
+      total = 0;
+      for (b = 0; b < wv->num_threads; b++) total += wv->kmeans_tasks[b].total;
+      // 所有词都已和某个质心重合(距离都为0)时退化为均匀随机选取
+      if (total > 0) {
+        r *= total;
+        for (b = 0; (b < wv->num_threads - 1) && (r >= wv->kmeans_tasks[b].total); b++) r -= wv->kmeans_tasks[b].total;
+        for (w = wv->kmeans_tasks[b].first; w < wv->kmeans_tasks[b].last - 1; w++) {
+          r -= wv->kmeans_dist[w] * wv->kmeans_dist[w];
+          if (r < 0) break;
+        }
+      }
+    }
+    for (b = 0; b < wv->layer1_size; b++) wv->kmeans_cent[a * wv->layer1_size + b] = wv->syn0[w * wv->layer1_size + b] * wv->kmeans_inv_norm[w];
+    wv->kmeans_next = a;
+    if (a + 1 < wv->classes) RunKMeansThreads(wv, KMeansSeedThread);
+  }
+}
+
+/**
+ * ======== Mini-batch K-means ========
+ * 类别数很大(几万到十几万)时,精确的Lloyd迭代每轮要算rows x classes个点积,这里改为:
+ *   1. mini-batch k-means:每批随机取kmeans_batch个词分配类别,质心按"分配到该类的所有词的均值"增量更新;
+ *   2. 近似最近质心索引(IVF):把质心粗聚成sqrt(classes)组,查找时先和各组中心比较,只扫描最相似的kmeans_probe组内的质心.
+ *      质心在训练中不断移动,每个epoch开始时重建索引.
+ * 一个epoch为rows / kmeans_batch批;最多kmeans_iter个epoch,估计的inertia不再下降时提前结束;
+ * 最后用索引给所有词分配类别,输出和-classes原来的格式相同.
+ *
+ * kmeans_mean: 每个质心的累计均值(未归一化),kmeans_cent是它归一化后的结果,用于查找;
+ * kmeans_seen: 累计分配到每个质心的词数,决定增量更新的步长;
+ * kmeans_coarse, kmeans_nlist: 粗聚类中心(归一化)和组数;
+ * kmeans_list_start, kmeans_list_ids: 每组包含的质心,kmeans_list_ids[kmeans_list_start[l]..kmeans_list_start[l + 1])为第l组;
+ * kmeans_owner: 每个质心所属的组;
+ * kmeans_items, kmeans_item_cl: 要分配的词和分配结果,kmeans_items为NULL时依次分配所有词.
+ */
+
+/**
+ * ======== KMeansCoarseThread ========
+ * 把本线程范围内的质心分配到最相似的粗聚类中心.
+ */
+void *KMeansCoarseThread(void *arg) {
+  struct kmeans_task *t = (struct kmeans_task *)arg;
+  struct word2vec *wv = t->wv;
+  long long c, l;
+  real x, bestv;
+  for (c = t->first; c < t->last; c++) {
+    bestv = -1e30;
+    for (l = 0; l < wv->kmeans_nlist; l++) {
+      x = KMeansDot(&wv->kmeans_cent[c * wv->layer1_size], &wv->kmeans_coarse[l * wv->layer1_size], wv->layer1_size);
+      if (x > bestv) {
+        bestv = x;
+        wv->kmeans_owner[c] = l;
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * ======== KMeansBuildIndex ========
+ * 重建近似最近质心索引:均匀取sqrt(classes)个质心作为粗聚类的初始中心,分配,用组内质心的均值更新中心,再分配一次,
+ * 然后按组整理成kmeans_list_start / kmeans_list_ids.
+ */
+void KMeansBuildIndex(struct word2vec *wv) {
+  long long a, b, c, l;
+  real *v, len;
+  for (l = 0; l < wv->kmeans_nlist; l++) memcpy(&wv->kmeans_coarse[l * wv->layer1_size], &wv->kmeans_cent[(l * wv->classes / wv->kmeans_nlist) * wv->layer1_size], wv->layer1_size * sizeof(real));
+  SplitKMeansTasks(wv, wv->classes);
+  for (a = 0; a < 2; a++) {
+    RunKMeansThreads(wv, KMeansCoarseThread);
+    if (a == 1) break;
+    // 组中心更新为组内质心的均值(归一化),空组保留原来的中心
+    for (l = 0; l < wv->kmeans_nlist; l++) wv->kmeans_list_start[l] = 0;
+    for (c = 0; c < wv->classes; c++) wv->kmeans_list_start[wv->kmeans_owner[c]]++;
+    for (l = 0; l < wv->kmeans_nlist; l++) if (wv->kmeans_list_start[l] > 0) for (b = 0; b < wv->layer1_size; b++) wv->kmeans_coarse[l * wv->layer1_size + b] = 0;
+    for (c = 0; c < wv->classes; c++) {
+      v = &wv->kmeans_coarse[wv->kmeans_owner[c] * wv->layer1_size];
+      for (b = 0; b < wv->layer1_size; b++) v[b] += wv->kmeans_cent[c * wv->layer1_size + b];
+    }
+    for (l = 0; l < wv->kmeans_nlist; l++) {
+      v = &wv->kmeans_coarse[l * wv->layer1_size];
+      len = sqrt(KMeansDot(v, v, wv->layer1_size));
+      if (len > 0) for (b = 0; b < wv->layer1_size; b++) v[b] /= len;
+    }
+  }
+  // 按组整理(计数排序)
+  for (l = 0; l <= wv->kmeans_nlist; l++) wv->kmeans_list_start[l] = 0;
+  for (c = 0; c < wv->classes; c++) wv->kmeans_list_start[wv->kmeans_owner[c] + 1]++;
+  for (l = 0; l < wv->kmeans_nlist; l++) wv->kmeans_list_start[l + 1] += wv->kmeans_list_start[l];
+  for (c = 0; c < wv->classes; c++) wv->kmeans_list_ids[wv->kmeans_list_start[wv->kmeans_owner[c]]++] = c;
+  for (l = wv->kmeans_nlist; l > 0; l--) wv->kmeans_list_start[l] = wv->kmeans_list_start[l - 1];
+  wv->kmeans_list_start[0] = 0;
+}
+
+/**
+ * ======== KMeansSearchThread ========
+ * 用索引给本线程范围内的词(kmeans_items)找最相似的质心,结果写到kmeans_item_cl;
+ * total累加inertia(|x| - x·c,见KMeansAssignThread).只在非空的组中选probe个组,保证每个词都至少和一个质心比较过.
+ */
+void *KMeansSearchThread(void *arg) {
+  struct kmeans_task *t = (struct kmeans_task *)arg;
+  struct word2vec *wv = t->wv;
+  long long i, w, l, c, j, k, n, probe = wv->kmeans_probe < wv->kmeans_nlist ? wv->kmeans_probe : wv->kmeans_nlist;
+  if (probe < 1) probe = 1;
+  long long *top = (long long *)malloc(probe * sizeof(long long));
+  real x, bestv, *top_score = (real *)malloc(probe * sizeof(real)), *v;
+  t->total = 0;
+  for (i = t->first; i < t->last; i++) {
+    w = wv->kmeans_items != NULL ? wv->kmeans_items[i] : i;
+    v = &wv->syn0[w * wv->layer1_size];
+    // 最相似的probe个非空组,top_score降序,共n个(非空组不足probe个时n < probe)
+    n = 0;
+    for (l = 0; l < wv->kmeans_nlist; l++) {
+      if (wv->kmeans_list_start[l] == wv->kmeans_list_start[l + 1]) continue;
+      x = KMeansDot(v, &wv->kmeans_coarse[l * wv->layer1_size], wv->layer1_size);
+      if ((n == probe) && (x <= top_score[probe - 1])) continue;
+      if (n < probe) n++;
+      for (k = n - 1; (k > 0) && (top_score[k - 1] < x); k--) {
+        top_score[k] = top_score[k - 1];
+        top[k] = top[k - 1];
+      }
+      top_score[k] = x;
+      top[k] = l;
+    }
+    bestv = -1e30;
+    wv->kmeans_item_cl[i] = 0;
+    for (k = 0; k < n; k++) for (j = wv->kmeans_list_start[top[k]]; j < wv->kmeans_list_start[top[k] + 1]; j++) {
+      c = wv->kmeans_list_ids[j];
+      x = KMeansDot(v, &wv->kmeans_cent[c * wv->layer1_size], wv->layer1_size);
+      if (x > bestv) {
+        bestv = x;
+        wv->kmeans_item_cl[i] = c;
+      }
+    }
+    if (wv->kmeans_inv_norm[w] > 0) t->total += 1 / wv->kmeans_inv_norm[w] - bestv;
+  }
+  free(top);
+  free(top_score);
+  return NULL;
+}
+
+/**
+ * ======== KMeansMiniBatch ========
+ * syn0前rows行的classes类mini-batch球面k-means,结果写到cl.初始质心为随机选取的classes个不同的词.
+ */
+void KMeansMiniBatch(struct word2vec *wv, int *cl, long long rows) {
+  unsigned long long next_random = wv->kmeans_seed;
+  long long a, b, c, e, i, w, batches, *perm;
+  double start, total, inertia, last_inertia = 0, len, eta;
+  real *v, *m;
+  char *touched;
+  if (wv->classes > rows) {
+    Fail(wv, "ERROR: -classes %lld is larger than the vocabulary (%lld words)", wv->classes, rows);
+  }
+  wv->kmeans_cent = (real *)malloc(wv->classes * wv->layer1_size * sizeof(real));
+  wv->kmeans_mean = (real *)malloc(wv->classes * wv->layer1_size * sizeof(real));
+  wv->kmeans_seen = (long long *)malloc(wv->classes * sizeof(long long));
+  wv->kmeans_inv_norm = (real *)malloc(rows * sizeof(real));
+  wv->kmeans_nlist = (long long)sqrt((double)wv->classes);
+  if (wv->kmeans_nlist < 1) wv->kmeans_nlist = 1;
+  wv->kmeans_coarse = (real *)malloc(wv->kmeans_nlist * wv->layer1_size * sizeof(real));
+  wv->kmeans_list_start = (long long *)malloc((wv->kmeans_nlist + 1) * sizeof(long long));
+  wv->kmeans_list_ids = (long long *)malloc(wv->classes * sizeof(long long));
+  wv->kmeans_owner = (long long *)malloc(wv->classes * sizeof(long long));
+  wv->kmeans_items = (long long *)malloc(wv->kmeans_batch * sizeof(long long));
+  wv->kmeans_item_cl = (int *)malloc((wv->kmeans_batch > rows ? wv->kmeans_batch : rows) * sizeof(int));
+  wv->kmeans_tasks = (struct kmeans_task *)calloc(wv->num_threads, sizeof(struct kmeans_task));
+  perm = (long long *)malloc(rows * sizeof(long long));
+  touched = (char *)calloc(wv->classes, sizeof(char));
+  if ((wv->kmeans_cent == NULL) || (wv->kmeans_mean == NULL) || (wv->kmeans_item_cl == NULL) || (perm == NULL)) Fail(wv, "Memory allocation failed");
+  for (a = 0; a < rows; a++) {
+    len = sqrt(KMeansDot(&wv->syn0[a * wv->layer1_size], &wv->syn0[a * wv->layer1_size], wv->layer1_size));
+    wv->kmeans_inv_norm[a] = len > 0 ? 1 / len : 0;
+    perm[a] = a;
+  }
+  // 随机选classes个不同的词作为初始质心(部分Fisher-Yates洗牌)
+  for (c = 0; c < wv->classes; c++) {
+    next_random = next_random * (unsigned long long)25214903917 + 11;
+    w = c + (next_random >> 16) % (rows - c);
+    i = perm[c];
+    perm[c] = perm[w];
+    perm[w] = i;
+    for (b = 0; b < wv->layer1_size; b++) {
+      wv->kmeans_mean[c * wv->layer1_size + b] = wv->syn0[perm[c] * wv->layer1_size + b];
+      wv->kmeans_cent[c * wv->layer1_size + b] = wv->syn0[perm[c] * wv->layer1_size + b] * wv->kmeans_inv_norm[perm[c]];
+    }
+    wv->kmeans_seen[c] = 1;
+  }
+  free(perm);
+  batches = rows / wv->kmeans_batch;
+  if (batches < 1) batches = 1;
+  for (e = 0; e < wv->kmeans_iter; e++) {
+    start = WallTime();
+    KMeansBuildIndex(wv);
+    inertia = 0;
+    for (a = 0; a < batches; a++) {
+      for (i = 0; i < wv->kmeans_batch; i++) {
+        next_random = next_random * (unsigned long long)25214903917 + 11;
+        wv->kmeans_items[i] = (next_random >> 16) % rows;
+      }
+      SplitKMeansTasks(wv, wv->kmeans_batch);
+      RunKMeansThreads(wv, KMeansSearchThread);
+      for (b = 0; b < wv->num_threads; b++) inertia += wv->kmeans_tasks[b].total;
+      // 增量更新:第n个分配到该类的词,步长1 / n,质心始终是所有分配过的词的均值
+      for (i = 0; i < wv->kmeans_batch; i++) {
+        c = wv->kmeans_item_cl[i];
+        wv->kmeans_seen[c]++;
+        eta = 1.0 / wv->kmeans_seen[c];
+        m = &wv->kmeans_mean[c * wv->layer1_size];
+        v = &wv->syn0[wv->kmeans_items[i] * wv->layer1_size];
+        for (b = 0; b < wv->layer1_size; b++) m[b] += eta * (v[b] - m[b]);
+        touched[c] = 1;
+      }
+      for (c = 0; c < wv->classes; c++) if (touched[c]) {
+        touched[c] = 0;
+        m = &wv->kmeans_mean[c * wv->layer1_size];
+        len = sqrt(KMeansDot(m, m, wv->layer1_size));
+        if (len > 0) for (b = 0; b < wv->layer1_size; b++) wv->kmeans_cent[c * wv->layer1_size + b] = m[b] / len;
+      }
+    }
+    // 按抽样估计全部词的inertia
+    inertia *= rows / (double)(batches * wv->kmeans_batch);
+    if (wv->debug_mode > 0) printf("Mini-batch k-means epoch %lld: %lld batches of %d, inertia %.4f (estimated), %.3fs\n", e + 1, batches,
+     wv->kmeans_batch, inertia, WallTime() - start);
+    if ((e > 0) && (inertia >= last_inertia)) break;
+    last_inertia = inertia;
+  }
+  // 最终分配所有词
+  start = WallTime();
+  KMeansBuildIndex(wv);
+  free(wv->kmeans_items);
+  wv->kmeans_items = NULL;
+  SplitKMeansTasks(wv, rows);
+  RunKMeansThreads(wv, KMeansSearchThread);
+  total = 0;
+  for (b = 0; b < wv->num_threads; b++) total += wv->kmeans_tasks[b].total;
+  for (a = 0; a < rows; a++) cl[a] = wv->kmeans_item_cl[a];
+  if (wv->debug_mode > 0) printf("Mini-batch k-means final assignment: inertia %.4f, %.3fs\n", total, WallTime() - start);
+  free(touched);
+  free(wv->kmeans_tasks);
+  free(wv->kmeans_item_cl);
+  free(wv->kmeans_owner);
+  free(wv->kmeans_list_ids);
+  free(wv->kmeans_list_start);
+  free(wv->kmeans_coarse);
+  free(wv->kmeans_inv_norm);
+  free(wv->kmeans_seen);
+  free(wv->kmeans_mean);
+  free(wv->kmeans_cent);
+}
+
+/**
+ * ======== KMeans ========
+ * 对syn0的前rows行做classes类的球面k-means,结果写到cl.
+ * 每轮:多线程分配并累加部分和,汇总后更新质心;空类保留原来的质心.所有词的类别都不再变化时提前结束.
+ */
+void KMeans(struct word2vec *wv, int *cl, long long rows) {
+  long long a, b, c, d, changed, count;
+  double start, total, len;
+  real *v;
+  if (wv->kmeans_batch > 0) {
+    KMeansMiniBatch(wv, cl, rows);
+    return;
+  }
+  wv->kmeans_cl = cl;
+  wv->kmeans_cent = (real *)malloc(wv->classes * wv->layer1_size * sizeof(real));
+  wv->kmeans_inv_norm = (real *)malloc(rows * sizeof(real));
+  wv->kmeans_dist = (double *)malloc(rows * sizeof(double));
+  wv->kmeans_tasks = (struct kmeans_task *)calloc(wv->num_threads, sizeof(struct kmeans_task));
+  if ((wv->kmeans_cent == NULL) || (wv->kmeans_inv_norm == NULL) || (wv->kmeans_dist == NULL)) Fail(wv, "Memory allocation failed");
+  SplitKMeansTasks(wv, rows);
+  for (a = 0; a < wv->num_threads; a++) {
+    wv->kmeans_tasks[a].sum = (real *)malloc(wv->classes * wv->layer1_size * sizeof(real));
+    wv->kmeans_tasks[a].count = (long long *)malloc(wv->classes * sizeof(long long));
+    if ((wv->kmeans_tasks[a].sum == NULL) || (wv->kmeans_tasks[a].count == NULL)) Fail(wv, "Memory allocation failed");
+  }
+  for (a = 0; a < rows; a++) {
+    len = sqrt(KMeansDot(&wv->syn0[a * wv->layer1_size], &wv->syn0[a * wv->layer1_size], wv->layer1_size));
+    wv->kmeans_inv_norm[a] = len > 0 ? 1 / len : 0;
+    cl[a] = -1;
+  }
+  start = WallTime();
+  KMeansInit(wv, rows);
+  if (wv->debug_mode > 0) printf("K-means init (k-means++): %.3fs\n", WallTime() - start);
+  for (a = 0; a < wv->kmeans_iter; a++) {
+    start = WallTime();
+    RunKMeansThreads(wv, KMeansAssignThread);
+    changed = 0;
+    total = 0;
+    for (b = 0; b < wv->num_threads; b++) {
+      changed += wv->kmeans_tasks[b].changed;
+      total += wv->kmeans_tasks[b].total;
+    }
+    // 汇总各线程的部分和,更新质心
+    for (c = 0; c < wv->classes; c++) {
+      count = 0;
+      for (b = 0; b < wv->num_threads; b++) count += wv->kmeans_tasks[b].count[c];
+      if (count == 0) continue;
+      v = &wv->kmeans_cent[c * wv->layer1_size];
+      for (b = 0; b < wv->layer1_size; b++) v[b] = 0;
+      for (b = 0; b < wv->num_threads; b++) for (d = 0; d < wv->layer1_size; d++) v[d] += wv->kmeans_tasks[b].sum[c * wv->layer1_size + d];
+      len = sqrt(KMeansDot(v, v, wv->layer1_size));
+      if (len > 0) for (b = 0; b < wv->layer1_size; b++) v[b] /= len;
+    }
+    if (wv->debug_mode > 0) printf("K-means iteration %lld: %lld words changed class, inertia %.4f, %.3fs\n", a + 1, changed, total,
+     WallTime() - start);
+    if (changed == 0) break;
+  }
+  for (a = 0; a < wv->num_threads; a++) {
+    free(wv->kmeans_tasks[a].sum);
+    free(wv->kmeans_tasks[a].count);
+  }
+  free(wv->kmeans_tasks);
+  free(wv->kmeans_cent);
+  free(wv->kmeans_inv_norm);
+  free(wv->kmeans_dist);
+}
+
+/**
+ * ======== QueryLookup / QueryWord ========
+ * 查询引擎用到的词和行号互相转换,行号就是词典下标;ctx指向query_ctx:训练状态和查询矩阵的行数.
+ */
+struct query_ctx {
+  struct word2vec *wv;
+  long long rows;
+};
+
+long long QueryLookup(void *ctx, const char *word) {
+  struct query_ctx *c = (struct query_ctx *)ctx;
+  // 只有查询矩阵中的行可以查询,分桶时共用桶的词不在其中
+  long long a = SearchVocab(c->wv, (char *)word);
+  return a < c->rows ? a : -1;
+}
+
+const char *QueryWord(void *ctx, long long row) {
+  return ((struct query_ctx *)ctx)->wv->vocab[row].word;
+}
+
+/**
+ * ======== RunQueries ========
+ * 把syn0的前rows行复制成归一化的对齐矩阵,按批回答query_file中的查询,结果写到query_output_file(默认stdout),最后报告每秒查询数.
+ */
+void RunQueries(struct word2vec *wv, long long rows) {
+  struct w2vq_index q;
+  struct query_ctx ctx = {wv, rows};
+  long long n;
+  double seconds;
+  FILE *fi = fopen(wv->query_file, "rb"), *fo = stdout;
+  if (fi == NULL) {
+    Fail(wv, "ERROR: cannot open query file %s", wv->query_file);
+  }
+  if ((wv->query_output_file[0] != 0) && ((fo = fopen(wv->query_output_file, "wb")) == NULL)) {
+    Fail(wv, "ERROR: cannot open query output file %s", wv->query_output_file);
+  }
+  if (wv->query_topk < 1) wv->query_topk = 1;
+  if (wv->query_batch < 1) wv->query_batch = 1;
+  if (w2vq_init(&q, wv->syn0, rows, wv->layer1_size, wv->layer1_size) != 0) {
+    Fail(wv, "Memory allocation failed");
+  }
+  n = w2vq_run(&q, fi, fo, wv->query_topk, wv->query_batch, wv->num_threads, QueryLookup, QueryWord, &ctx, &seconds);
+  fclose(fi);
+  if (fo != stdout) fclose(fo);
+  else fflush(fo);
+  w2vq_free(&q);
+  if (wv->debug_mode > 0) printf("Answered %lld queries in %.3fs: %.0f queries/sec\n", n, seconds, n / (seconds + 1e-9));
+}
+
+/**
+ * ======== BuildHnsw ========
+ * 用num_threads个线程在syn0的前rows行上构建HNSW索引,保存到hnsw_file;索引的行号就是词典下标,和输出的词向量文件一致.
+ */
+void BuildHnsw(struct word2vec *wv, long long rows) {
+  struct w2vh_index g;
+  double start = WallTime();
+  if (wv->hnsw_m < 2) wv->hnsw_m = 2;
+  if (w2vh_build(&g, wv->syn0, rows, wv->layer1_size, wv->layer1_size, wv->hnsw_m, wv->hnsw_ef, wv->num_threads, 1) != 0) {
+    Fail(wv, "Memory allocation failed");
+  }
+  if (w2vh_save(&g, wv->hnsw_file) != 0) {
+    Fail(wv, "ERROR: cannot write HNSW index %s", wv->hnsw_file);
+  }
+  if (wv->debug_mode > 0) printf("HNSW index: %lld nodes, %lld levels, built in %.3fs\n", g.rows, g.max_level + 1, WallTime() - start);
+  w2vh_free(&g);
+}
+
+/**
+ * ======== ExportPQ ========
+ * 在归一化的syn0前words行上训练PQ码本,编码这些词并保存到pq_file;
+ * debug_mode > 0时报告压缩比,平均重建误差(|x - x'|^2,x为单位向量),
+ * 以及均匀抽取的词用ADC查到的10个近邻和精确近邻的重合比例(recall@10).
+ */
+void ExportPQ(struct word2vec *wv, long long words) {
+  struct w2vpq_model pq;
+  struct query_ctx ctx = {wv, words};
+  long long a, b, c, n, rows, exact[10], ids[10];
+  float *x, *table, *v, scores[10], t;
+  double start = WallTime(), recall = 0, err = 0;
+  int found, d;
+  x = (float *)malloc(words * wv->layer1_size * sizeof(float));
+  if (x == NULL) {
+    Fail(wv, "Memory allocation failed");
+  }
+  for (a = 0; a < words; a++) {
+    for (b = 0; b < wv->layer1_size; b++) x[a * wv->layer1_size + b] = wv->syn0[a * wv->layer1_size + b];
+    w2vq_normalize(&x[a * wv->layer1_size], wv->layer1_size);
+  }
+  if ((wv->pq_m < 1) || (wv->pq_m > wv->layer1_size)) wv->pq_m = wv->layer1_size < 32 ? wv->layer1_size : 32;
+  if (w2vpq_train(&pq, x, words, wv->layer1_size, wv->pq_m, wv->pq_train, wv->pq_iter, wv->num_threads, 1) != 0) {
+    Fail(wv, "Memory allocation failed");
+  }
+  if (w2vpq_save(&pq, wv->pq_file, QueryWord, &ctx) != 0) {
+    Fail(wv, "ERROR: cannot write PQ file %s", wv->pq_file);
+  }
+  if (wv->debug_mode > 0) {
+    v = (float *)malloc(wv->layer1_size * sizeof(float));
+    table = (float *)malloc(wv->pq_m * W2VPQ_KSUB * sizeof(float));
+    for (a = 0; a < words; a++) {
+      w2vpq_decode(&pq, a, v);
+      for (b = 0; b < wv->layer1_size; b++) {
+        t = x[a * wv->layer1_size + b] - v[b];
+        err += t * t;
+      }
+    }
+    rows = words < 200 ? words : 200;
+    for (a = 0; a < rows; a++) {
+      c = a * words / rows;
+      found = 0;
+      for (b = 0; b < words; b++) if (b != c)
+        w2vq_heap_push(scores, exact, 10, &found, w2vq_dot(&x[c * wv->layer1_size], &x[b * wv->layer1_size], wv->layer1_size), b);
+      w2vpq_table(&pq, &x[c * wv->layer1_size], table);
+      n = w2vpq_search(&pq, table, 10, c, ids, scores);
+      for (b = 0; b < n; b++) for (d = 0; d < found; d++) if (ids[b] == exact[d]) recall++;
+    }
+    printf("PQ: %d bytes per word (%.1fx smaller than %lld floats), reconstruction error %.4f, recall@10 %.3f, %.3fs\n", wv->pq_m,
+     wv->layer1_size * sizeof(real) / (double)wv->pq_m, wv->layer1_size, err / words, recall / (rows * (words > 10 ? 10 : words - 1)),
+     WallTime() - start);
+    free(v);
+    free(table);
+  }
+  w2vpq_free(&pq);
+  free(x);
+}
+
+/**
+ * ======== WriteVectors ========
+ * 按-binary指定的格式把前words个词的词向量(syn0中按word_row取行)写到fo:0为文本,1为二进制,2为对齐的二进制格式.
+ * buckets > 0时words为整个词典,对齐格式只写有独立行的前bucket_words个词,再加上buckets行哈希桶.
+ */
+void WriteVectors(struct word2vec *wv, FILE *fo, long long words, long long buckets) {
+  long long a, b;
+  if (wv->binary == 2) {
+    // 对齐的二进制格式,可以直接mmap,见word2vec-model.h
+    WriteAlignedModel(wv, fileno(fo), (buckets > 0 ? wv->bucket_words : words) + buckets, buckets);
+    return;
+  }
+  // 保存,将内容写到fo文件中,先写字典长度,词向量长度参数
+  fprintf(fo, "%lld %lld\n", words, wv->layer1_size);
+  // 文本格式由多个线程格式化,见WriteTextVectors
+  if (!wv->binary) WriteTextVectors(wv, fo, words);
+  else for (a = 0; a < words; a++) {
+    // 保存格式: word --- word_vector
+    // 先写词word
+    fprintf(fo, "%s ", wv->vocab[a].word);
+    // 保存这个词的词向量(二进制)
+    for (b = 0; b < wv->layer1_size; b++) fwrite(&wv->syn0[wv->word_row[a] * wv->layer1_size + b], sizeof(real), 1, fo);
+    fprintf(fo, "\n");
+  }
+}
+
+/**
+ * ======== PcaCovarianceThread ========
+ * 累加[first, last)中词向量的协方差(未除以词数,只算上三角):每次取PCA_BLOCK个词,减去均值后转置存放,
+ * 这样计算第i, j维的乘积和时两行都是连续的,一块数据在L1/L2中被用layer1_size^2 / 2次.
+ */
+void *PcaCovarianceThread(void *arg) {
+  struct pca_task *t = (struct pca_task *)arg;
+  struct word2vec *wv = t->wv;
+  long long a, b, i, j, n;
+  double *blk = (double *)malloc(wv->layer1_size * PCA_BLOCK * sizeof(double)), *xi, *xj, s;
+  for (a = t->first; a < t->last; a += PCA_BLOCK) {
+    n = t->last - a < PCA_BLOCK ? t->last - a : PCA_BLOCK;
+    for (i = 0; i < wv->layer1_size; i++) for (b = 0; b < PCA_BLOCK; b++)
+      blk[i * PCA_BLOCK + b] = b < n ? wv->syn0[(a + b) * wv->layer1_size + i] - wv->pca_mean[i] : 0;
+    for (i = 0; i < wv->layer1_size; i++) {
+      xi = &blk[i * PCA_BLOCK];
+      for (j = i; j < wv->layer1_size; j++) {
+        xj = &blk[j * PCA_BLOCK];
+        s = 0;
+        for (b = 0; b < PCA_BLOCK; b++) s += xi[b] * xj[b];
+        t->cov[i * wv->layer1_size + j] += s;
+      }
+    }
+  }
+  free(blk);
+  return NULL;
+}
+
+/**
+ * ======== PcaProjectThread ========
+ * 把[first, last)中的词向量减去均值后投影到主成分上,写到pca_out.
+ */
+void *PcaProjectThread(void *arg) {
+  struct pca_task *t = (struct pca_task *)arg;
+  struct word2vec *wv = t->wv;
+  long long a, b;
+  real *x = (real *)malloc(wv->layer1_size * sizeof(real));
+  for (a = t->first; a < t->last; a++) {
+    for (b = 0; b < wv->layer1_size; b++) x[b] = wv->syn0[a * wv->layer1_size + b] - wv->pca_mean[b];
+    for (b = 0; b < wv->pca_dim; b++) wv->pca_out[a * wv->pca_dim + b] = KMeansDot(x, &wv->pca_comp[b * wv->layer1_size], wv->layer1_size);
+  }
+  free(x);
+  return NULL;
+}
+
+/**
+ * ======== RunPcaThreads ========
+ * 把前rows个词平均分给num_threads个线程执行fn,等待全部结束.
+ */
+void RunPcaThreads(struct word2vec *wv, struct pca_task *tasks, void *(*fn)(void *), long long rows) {
+  long long a;
+  pthread_t *pt = (pthread_t *)malloc(wv->num_threads * sizeof(pthread_t));
+  for (a = 0; a < wv->num_threads; a++) {
+    tasks[a].wv = wv;
+    tasks[a].first = rows * a / wv->num_threads;
+    tasks[a].last = rows * (a + 1) / wv->num_threads;
+    pthread_create(&pt[a], NULL, fn, &tasks[a]);
+  }
+  for (a = 0; a < wv->num_threads; a++) pthread_join(pt[a], NULL);
+  free(pt);
+}
+
+/**
+ * ======== JacobiEigen ========
+ * 循环Jacobi方法求对称矩阵m(n x n,会被破坏)的全部特征值w和特征向量(v的第k列对应w[k]):
+ * 依次对每个非对角元做一次旋转把它消成0,直到非对角元的平方和相对对角元可以忽略.
+ */
+void JacobiEigen(double *m, long long n, double *w, double *v) {
+  long long p, q, k, sweep;
+  double off, diag, theta, t, c, s, x, y;
+  for (p = 0; p < n * n; p++) v[p] = 0;
+  for (p = 0; p < n; p++) v[p * n + p] = 1;
+  for (sweep = 0; sweep < 100; sweep++) {
+    off = diag = 0;
+    for (p = 0; p < n; p++) {
+      diag += m[p * n + p] * m[p * n + p];
+      for (q = p + 1; q < n; q++) off += m[p * n + q] * m[p * n + q];
+    }
+    if (off <= 1e-24 * diag) break;
+    for (p = 0; p < n; p++) for (q = p + 1; q < n; q++) {
+      if (fabs(m[p * n + q]) <= 1e-300) continue;
+      theta = (m[q * n + q] - m[p * n + p]) / (2 * m[p * n + q]);
+      t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+      c = 1 / sqrt(t * t + 1);
+      s = t * c;
+      // m = J^T m J,先更新第p, q列,再更新第p, q行;v = v J
+      for (k = 0; k < n; k++) {
+        x = m[k * n + p];
+        y = m[k * n + q];
+        m[k * n + p] = c * x - s * y;
+        m[k * n + q] = s * x + c * y;
+      }
+      for (k = 0; k < n; k++) {
+        x = m[p * n + k];
+        y = m[q * n + k];
+        m[p * n + k] = c * x - s * y;
+        m[q * n + k] = s * x + c * y;
+      }
+      for (k = 0; k < n; k++) {
+        x = v[k * n + p];
+        y = v[k * n + q];
+        v[k * n + p] = c * x - s * y;
+        v[k * n + q] = s * x + c * y;
+      }
+    }
+  }
+  for (p = 0; p < n; p++) w[p] = m[p * n + p];
+}
+
+/**
+ * ======== ExportPCA ========
+ * 多线程计算syn0前rows行的协方差矩阵,Jacobi求特征分解,取特征值最大的pca_dim个主成分,
+ * 把减去均值后的词向量投影到主成分上,按-binary的格式写到pca_file;
+ * 均值和主成分以文本格式写到pca_matrix_file:第一行为"layer1_size pca_dim",然后"mean"和"pc1".."pc<pca_dim>"各一行.
+ * 报告保留的方差比例(explained variance)和各步耗时.
+ */
+void ExportPCA(struct word2vec *wv, long long rows) {
+  struct pca_task *tasks;
+  long long a, b, c, *order, saved_size = wv->layer1_size;
+  double *cov, *w, *v, total = 0, kept = 0, start = WallTime(), t_cov, t_eig;
+  real *saved_syn0 = wv->syn0;
+  FILE *fo;
+  if ((wv->pca_dim < 1) || (wv->pca_dim > wv->layer1_size)) wv->pca_dim = wv->layer1_size;
+  if (wv->pca_matrix_file[0] == 0) {
+    strncpy(wv->pca_matrix_file, wv->pca_file, MAX_STRING - 6);
+    wv->pca_matrix_file[MAX_STRING - 6] = 0;
+    strcat(wv->pca_matrix_file, ".proj");
+  }
+  // 均值
+  wv->pca_mean = (double *)calloc(wv->layer1_size, sizeof(double));
+  for (a = 0; a < rows; a++) for (b = 0; b < wv->layer1_size; b++) wv->pca_mean[b] += wv->syn0[a * wv->layer1_size + b];
+  for (b = 0; b < wv->layer1_size; b++) wv->pca_mean[b] /= rows;
+  // 协方差:各线程的部分和相加,再补全下三角
+  tasks = (struct pca_task *)calloc(wv->num_threads, sizeof(struct pca_task));
+  for (a = 0; a < wv->num_threads; a++) tasks[a].cov = (double *)calloc(wv->layer1_size * wv->layer1_size, sizeof(double));
+  RunPcaThreads(wv, tasks, PcaCovarianceThread, rows);
+  cov = tasks[0].cov;
+  for (a = 1; a < wv->num_threads; a++) {
+    for (b = 0; b < wv->layer1_size * wv->layer1_size; b++) cov[b] += tasks[a].cov[b];
+    free(tasks[a].cov);
+  }
+  for (a = 0; a < wv->layer1_size; a++) for (b = a; b < wv->layer1_size; b++)
+    cov[b * wv->layer1_size + a] = cov[a * wv->layer1_size + b] = cov[a * wv->layer1_size + b] / rows;
+  t_cov = WallTime() - start;
+  // 特征分解,按特征值降序取前pca_dim个
+  w = (double *)malloc(wv->layer1_size * sizeof(double));
+  v = (double *)malloc(wv->layer1_size * wv->layer1_size * sizeof(double));
+  order = (long long *)malloc(wv->layer1_size * sizeof(long long));
+  JacobiEigen(cov, wv->layer1_size, w, v);
+  t_eig = WallTime() - start - t_cov;
+  for (a = 0; a < wv->layer1_size; a++) {
+    for (b = a; (b > 0) && (w[order[b - 1]] < w[a]); b--) order[b] = order[b - 1];
+    order[b] = a;
+    total += w[a];
+  }
+  wv->pca_comp = (real *)malloc(wv->pca_dim * wv->layer1_size * sizeof(real));
+  for (c = 0; c < wv->pca_dim; c++) {
+    kept += w[order[c]];
+    for (b = 0; b < wv->layer1_size; b++) wv->pca_comp[c * wv->layer1_size + b] = v[b * wv->layer1_size + order[c]];
+  }
+  // 投影
+  wv->pca_out = (real *)malloc(rows * wv->pca_dim * sizeof(real));
+  if (wv->pca_out == NULL) {
+    Fail(wv, "Memory allocation failed");
+  }
+  RunPcaThreads(wv, tasks, PcaProjectThread, rows);
+  // 降维后的词向量用和-output相同的写法输出,写的时候让syn0指向降维结果
+  fo = fopen(wv->pca_file, "wb");
+  if (fo == NULL) {
+    Fail(wv, "ERROR: cannot open PCA output file %s", wv->pca_file);
+  }
+  wv->syn0 = wv->pca_out;
+  wv->layer1_size = wv->pca_dim;
+  WriteVectors(wv, fo, rows, 0);
+  wv->syn0 = saved_syn0;
+  wv->layer1_size = saved_size;
+  fclose(fo);
+  fo = fopen(wv->pca_matrix_file, "wb");
+  if (fo == NULL) {
+    Fail(wv, "ERROR: cannot open PCA matrix file %s", wv->pca_matrix_file);
+  }
+  fprintf(fo, "%lld %d\nmean", wv->layer1_size, wv->pca_dim);
+  for (b = 0; b < wv->layer1_size; b++) fprintf(fo, " %.9g", wv->pca_mean[b]);
+  for (c = 0; c < wv->pca_dim; c++) {
+    fprintf(fo, "\npc%lld", c + 1);
+    for (b = 0; b < wv->layer1_size; b++) fprintf(fo, " %.9g", wv->pca_comp[c * wv->layer1_size + b]);
+  }
+  fprintf(fo, "\n");
   fclose(fo);
+  if (wv->debug_mode > 0) printf("PCA: %lld -> %d dimensions, explained variance %.4f (covariance %.3fs, eigensolver %.3fs, total %.3fs)\n",
+   wv->layer1_size, wv->pca_dim, total > 0 ? kept / total : 0, t_cov, t_eig, WallTime() - start);
+  free(cov);
+  free(tasks);
+  free(w);
+  free(v);
+  free(order);
+  free(wv->pca_mean);
+  free(wv->pca_comp);
+  free(wv->pca_out);
+}
+
+/**
+ * ======== TrainModel ========
+ * Main entry point to the training process.
+ */
+void TrainModel(struct word2vec *wv) {
+  long a, b, m;
+  double finish, loss;
+  long long loss_count, words, covered;
+  char name[MAX_STRING];
+  FILE *fo;
+  pthread_t monitor, *pt;
+  struct train_thread *args;
+  
+  // 回调提供的语料只能顺序读一遍,不能切块
+  if ((wv->sentence_fn != NULL) && ((wv->phrase_threshold > 0) || wv->shuffle_blocks || (wv->checkpoint_file[0] != 0)))
+    Fail(wv, "ERROR: -phrase, -shuffle and -checkpoint need the corpus as a file or text");
+  if (wv->sentence_fn != NULL) {
+    if (wv->debug_mode > 0) printf("Starting training using sentences from a callback\n");
+  } else if (wv->train_data != NULL) {
+    if (wv->debug_mode > 0) printf("Starting training using %lld bytes of text in memory\n", wv->train_data_size);
+  } else printf("Starting training using file %s\n", wv->train_file);
+  
+  wv->starting_alpha = wv->alpha;//初始学习率;学习率动态变动
+  
+  // 打开telemetry输出文件(JSON lines)
+  if (wv->telemetry_file[0] != 0) {
+    wv->telemetry = fopen(wv->telemetry_file, "wb");
+    if (wv->telemetry == NULL) {
+      Fail(wv, "ERROR: cannot open telemetry file %s", wv->telemetry_file);
+    }
+  }
+  
+  // 打开进程级硬件计数器,必须在创建训练线程之前打开,训练线程才能继承
+  if (wv->perf_mode) {
+    for (a = 0; a < PHASE_COUNT; a++) for (b = 0; b < PERF_EVENTS; b++) wv->perf_phase[a][b] = -1;
+    wv->perf_thread = (long long *)malloc(wv->num_threads * PERF_EVENTS * sizeof(long long));
+    for (a = 0; a < wv->num_threads * PERF_EVENTS; a++) wv->perf_thread[a] = -1;
+    if (PerfOpen(wv->perf_fds, 1) == 0) {
+      printf("WARNING: perf_event_open failed, hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid)\n");
+      wv->perf_mode = 0;
+    }
+  }
+  
+  // Either load a pre-existing vocabulary, or learn the vocabulary from 
+  // the training file.
+  // 区分是否指定词库;如果指定,读取词库文件;否则,从训练语料中学习;
+  // 从检查点恢复时,词典和训练进度都从检查点读
+  PhaseBegin(wv);
+  // 先统计短语,建词典和训练时合并短语
+  if (wv->phrase_threshold > 0) {
+    LearnPhrases(wv);
+    PhaseEnd(wv, PHASE_PHRASE);
+    PhaseBegin(wv);
+  }
+  // 增量训练:新语料的词典先不按min_count筛选,和旧模型的词典合并时只筛选新词
+  if (wv->resume) ReadCheckpointVocab(wv);
+  else if (wv->load_model_file[0] != 0) {
+    b = wv->min_count;
+    wv->min_count = 1;
+    if (wv->read_vocab_file[0] != 0) ReadVocab(wv); else LearnVocabFromTrainFile(wv);
+    wv->min_count = b;
+    ReadModelVocab(wv);
+  } else if (wv->read_vocab_file[0] != 0) ReadVocab(wv); else LearnVocabFromTrainFile(wv);
+  if (wv->sample_words == 0) wv->sample_words = wv->train_words;
+  PhaseEnd(wv, PHASE_VOCAB);
+  
+  // Save the vocabulary.判断是否需要保存词库
+  if (wv->save_vocab_file[0] != 0) SaveVocab(wv);
+  
+  // Stop here if no output_file was specified. 如果没有指定保存文件,直接退出;[保存文件是指词向量保存文件]
+  if ((wv->output_file[0] == 0) && !wv->in_memory) return;
+  
+  // Allocate the weight matrices and initialize them.
+  // 网络初始化
+  PhaseBegin(wv);
+  if (wv->num_models <= 1) {
+    InitNet(wv);
+    if (wv->resume) ReadCheckpointWeights(wv);
+    else if (wv->load_model_file[0] != 0) ReadModelWeights(wv);
+    // 只有命令行参数指定的一个模型;学习率可能来自检查点或旧模型
+    if (wv->models == NULL) wv->models = (struct train_model *)calloc(1, sizeof(struct train_model));
+    wv->num_models = 1;
+    GetModel(wv, &wv->models[0]);
+    wv->models[0].alpha = wv->starting_alpha;
+  } else {
+    // 多个模型共用词到行的映射和Huffman树,各自分配权重
+    InitRows(wv);
+    for (a = 0; a < wv->num_models; a++) {
+      SetModel(wv, &wv->models[a]);
+      InitWeights(wv);
+      GetModel(wv, &wv->models[a]);
+    }
+    CreateBinaryTree(wv);
+    SetModel(wv, &wv->models[0]);
+  }
+  PhaseEnd(wv, PHASE_INIT);
+
+  // If we're using negative sampling, initialize the unigram table, which
+  // is used to pick words to use as "negative samples" (with more frequent
+  // words being picked more often).
+  // 如果使用负采样,初始化unigram table;多个模型时只要有一个模型使用负采样  
+  for (a = 0, b = 0; a < wv->num_models; a++) if (wv->models[a].negative > 0) b = 1;
+  if (b) {
+    PhaseBegin(wv);
+    InitUnigramTable(wv);
+    PhaseEnd(wv, PHASE_TABLE);
+  }
+  
+  // 训练过程中评估用的测试集
+  if (wv->eval_file[0] != 0) ReadEval(wv);
+  
+  // 切分语料块,线程从全局计数器动态领取;识别短语时建词典之前已经切好
+  if ((wv->chunk_start == NULL) && (wv->sentence_fn == NULL)) InitChunks(wv);
+  // 每一轮已训练完的块数;从检查点恢复时,领取序号小于next_chunk并且不在未完成列表中的块都已训练完
+  wv->epoch_blocks = (long long *)calloc(wv->iter, sizeof(long long));
+  wv->epoch_end = (double *)calloc(wv->iter, sizeof(double));
+  for (a = 0; a < wv->next_chunk; a++) wv->epoch_blocks[a / wv->num_chunks]++;
+  for (a = 0; a < wv->pending_count; a++) wv->epoch_blocks[wv->pending_chunk[a] / wv->num_chunks]--;
+  if (wv->sentence_fn == NULL) for (a = 0; a < wv->iter; a++) if (wv->epoch_blocks[a] == wv->num_chunks) wv->epoch_end[a] = -1;
+  wv->thread_chunks = (long long *)calloc(wv->num_threads, sizeof(long long));
+  wv->thread_finish = (double *)calloc(wv->num_threads, sizeof(double));
+  // 每个线程的统计计数,按cache line对齐分配
+  a = posix_memalign((void **)&wv->thread_stats, 64, wv->num_threads * sizeof(struct thread_stat));
+  if (wv->thread_stats == NULL) Fail(wv, "Memory allocation failed");
+  memset(wv->thread_stats, 0, wv->num_threads * sizeof(struct thread_stat));
+  for (a = 0; a < wv->num_threads; a++) {
+    wv->thread_stats[a].alpha = wv->starting_alpha;
+    wv->thread_stats[a].chunk = -1;
+  }
+  
+  // Record the start time of training.
+  // 计时,墙上时间
+  PhaseBegin(wv);
+  wv->ooc_faults = MajorFaults();
+  wv->train_start = WallTime();
+  wv->training_done = 0;
+  wv->training_stop = 0;
+  wv->thread_failed = 0;
+  wv->eval_count = 0;
+  if (wv->sentence_fn != NULL) {
+    wv->sentence_pass = 0;
+    wv->sentence_fn(wv->sentence_arg, NULL);
+  }
+  pthread_create(&monitor, NULL, MonitorThread, wv);
+  
+  // Run training, which occurs in the 'TrainModelThread' function.
+  // 多线程训练,加快训练速度
+  // 创建num_threads个线程,指定线程地址,线程属性,线程调用函数,传递给线程调用函数的参数(引用传递,传递指针)
+  //线程指针pthread_t
+  pt = (pthread_t *)malloc(wv->num_threads * sizeof(pthread_t));//多线程;线程数组
+  args = (struct train_thread *)malloc(wv->num_threads * sizeof(struct train_thread));
+  for (a = 0; a < wv->num_threads; a++) {
+    args[a].wv = wv;
+    args[a].id = a;
+    pthread_create(&pt[a], NULL, TrainModelThread, &args[a]);
+  }
+  for (a = 0; a < wv->num_threads; a++) pthread_join(pt[a], NULL);//用于等待其他线程;一个线程仅允许一个线程使用pthread_join()等待它的终止
+  wv->training_done = 1;
+  pthread_join(monitor, NULL);
+  free(pt);
+  free(args);
+  PhaseEnd(wv, PHASE_TRAIN);
+  if (wv->thread_failed) Fail(wv, "Memory allocation failed");
+  
+  // 训练汇总:墙上时间吞吐量和全程抽样loss
+  loss = 0;
+  loss_count = 0;
+  for (a = 0; a < wv->num_threads; a++) {
+    loss += wv->thread_stats[a].loss;
+    loss_count += wv->thread_stats[a].loss_count;
+  }
+  if (loss_count > 0) loss /= loss_count;
+  // 只统计本次训练的词,不包括恢复前的
+  words = wv->word_count_actual - wv->resumed_words;
+  if (wv->debug_mode > 0) printf("Trained %lld words in %.3fs: %.2fk words/sec, loss %.4f\n", words,
+   wv->phase_seconds[PHASE_TRAIN], words / (wv->phase_seconds[PHASE_TRAIN] + 1e-9) / 1000, loss);
+  if (wv->telemetry != NULL) fprintf(wv->telemetry, "{\"event\":\"summary\",\"words\":%lld,\"seconds\":%.6f,\"words_per_sec\":%.1f,\"loss\":%.6f,\"threads\":%d}\n",
+   words, wv->phase_seconds[PHASE_TRAIN], words / (wv->phase_seconds[PHASE_TRAIN] + 1e-9), loss, wv->num_threads);
+  
+  // 外存模式:内存中的行覆盖的训练词比例,训练期间的major fault数
+  if (wv->ooc_dir[0] != 0) {
+    // 加载旧模型时cn包括旧模型的词频,所以和抽样一样除以sample_words
+    covered = 0;
+    for (a = 0; a < wv->vocab_size; a++) if (wv->word_row[a] < wv->ooc_head) covered += wv->vocab[a].cn;
+    wv->ooc_faults = MajorFaults() - wv->ooc_faults;
+    if (wv->debug_mode > 0) printf("Out of core: %lld of %lld rows in memory cover %.2f%% of the training words, %lld major faults (%.3f per 1000 words)\n",
+     wv->ooc_head, wv->vocab_rows, covered * 100.0 / (wv->sample_words + 1), wv->ooc_faults, wv->ooc_faults * 1000.0 / (words + 1));
+    if (wv->telemetry != NULL) fprintf(wv->telemetry, "{\"event\":\"ooc\",\"memory_rows\":%lld,\"rows\":%lld,\"coverage\":%.6f,\"major_faults\":%lld}\n",
+     wv->ooc_head, wv->vocab_rows, covered / (double)(wv->sample_words + 1), wv->ooc_faults);
+  }
+  
+  // 训练结束后再评估一次;提前结束时报告结束的进度,最后报告最好的分数
+  if (wv->eval_file[0] != 0) {
+    if (wv->training_stop && (wv->debug_mode > 0)) printf("Stopped early after %.2f of %lld epochs\n", wv->word_count_actual / (double)(wv->train_words + 1), wv->iter);
+    wv->eval_last.time = WallTime() - wv->train_start;
+    wv->eval_last.epochs = wv->word_count_actual / (double)(wv->train_words + 1);
+    if (!EvalModel(wv, &wv->eval_last)) Fail(wv, "Memory allocation failed");
+    EvalReport(wv, &wv->eval_last, 1);
+    if (wv->debug_mode > 0) printf("Best eval score %.4f at %.2f epochs, %.3fs\n", wv->eval_best.score, wv->eval_best.epochs, wv->eval_best.time);
+    if (wv->telemetry != NULL) fprintf(wv->telemetry, "{\"event\":\"eval_summary\",\"best_score\":%.6f,\"best_epochs\":%.4f,\"best_time\":%.3f,\"evaluations\":%d,\"stopped_early\":%d}\n",
+     wv->eval_best.score, wv->eval_best.epochs, wv->eval_best.time, wv->eval_count, wv->training_stop);
+    free(wv->eval_question);
+    free(wv->eval_pair);
+    free(wv->eval_human);
+    wv->eval_question = wv->eval_pair = NULL;
+    wv->eval_human = NULL;
+  }
+  
+  // 线程空闲时间:从该线程领不到新块退出,到最后一个线程结束之间的时间
+  if (wv->debug_mode > 0) {
+    finish = 0;
+    for (a = 0; a < wv->num_threads; a++) if (wv->thread_finish[a] > finish) finish = wv->thread_finish[a];
+    printf("Chunks: %lld x %lld iterations%s\n", wv->num_chunks, wv->iter, wv->chunk_order != NULL ? ", shuffled" : "");
+    for (a = 0; a < wv->num_threads; a++) printf("Thread %ld: %lld chunks, idle %.3fs\n", a, wv->thread_chunks[a], finish - wv->thread_finish[a]);
+    // 每一轮的墙上时间(恢复前已结束的轮次不输出)
+    for (a = 0, finish = 0; a < wv->iter; a++) if (wv->epoch_end[a] > 0) {
+      printf("Epoch %ld: %.3fs\n", a + 1, wv->epoch_end[a] - finish);
+      finish = wv->epoch_end[a];
+    }
+  }
+  free(wv->thread_chunks);
+  free(wv->thread_finish);
+  free(wv->thread_stats);
+  free(wv->chunk_start);
+  free(wv->chunk_order);
+  free(wv->epoch_blocks);
+  free(wv->epoch_end);
+  free(wv->pending_chunk);
+  free(wv->pending_pos);
+  wv->thread_chunks = wv->chunk_start = wv->chunk_order = wv->epoch_blocks = wv->pending_chunk = wv->pending_pos = NULL;
+  wv->thread_finish = wv->epoch_end = NULL;
+  wv->thread_stats = NULL;
+  
+  // 输出最终的词向量训练结果,每个模型输出到各自的文件
+  PhaseBegin(wv);
+  for (m = 0; m < wv->num_models; m++) {
+    SetModel(wv, &wv->models[m]);
+    // 词向量留在内存中,由word2vec-lib.c读取
+    if (wv->in_memory) continue;
+    fo = fopen(wv->output_file, "wb");
+    if (fo == NULL) {
+      Fail(wv, "ERROR: cannot open output file %s", wv->output_file);
+    }
+
+    // 词向量已经训练完,之后对词向量的不同应用
+    if (wv->classes == 0) {// 词向量保存
+      // Save the word vectors, see WriteVectors
+      WriteVectors(wv, fo, wv->vocab_size, wv->bucket_count);
+    } else {// 词向量kmeans聚类
+      // Run K-means on the word vectors, see KMeans
+      // 分桶时对syn0的所有行聚类,共用一行的词类别相同
+      int *cl = (int *)malloc(wv->vocab_rows * sizeof(int));
+      KMeans(wv, cl, wv->vocab_rows);
+      // Save the K-means classes
+      for (a = 0; a < wv->vocab_size; a++) fprintf(fo, "%s %d\n", wv->vocab[a].word, cl[wv->word_row[a]]);
+      free(cl);
+    }
+    fclose(fo);
+  }
+  // 保存完整模型(词典,词频,权重),供之后-load-model增量训练
+  if ((wv->save_model_file[0] != 0) && !WriteCheckpoint(wv, wv->save_model_file)) {
+    Fail(wv, "ERROR: cannot write model file %s", wv->save_model_file);
+  }
+  PhaseEnd(wv, PHASE_SAVE);
+  // 在训练得到的词向量上回答查询;分桶时查询,索引,压缩和降维只针对有独立行的词(syn0的前bucket_words行)
+  b = wv->bucket_count > 0 ? wv->bucket_words : wv->vocab_size;
+  if (wv->query_file[0] != 0) RunQueries(wv, b);
+  if (wv->hnsw_file[0] != 0) BuildHnsw(wv, b);
+  if (wv->pq_file[0] != 0) ExportPQ(wv, b);
+  if (wv->pca_file[0] != 0) ExportPCA(wv, b);
+  
+  // 硬件计数汇总:每个阶段,每个训练线程
+  if (wv->perf_mode) {
+    for (a = 0; a < PHASE_COUNT; a++) if (((a != PHASE_TABLE) || (wv->negative > 0)) && ((a != PHASE_PHRASE) || (wv->phrase_threshold > 0))) PerfPrint(wv, "phase", phase_names[a], wv->perf_phase[a]);
+    for (a = 0; a < wv->num_threads; a++) {
+      sprintf(name, "%ld", a);
+      PerfPrint(wv, "thread", name, &wv->perf_thread[a * PERF_EVENTS]);
+    }
+    PerfClose(wv->perf_fds);
+    free(wv->perf_thread);
+    wv->perf_thread = NULL;
+  }
+  if (wv->telemetry != NULL) fclose(wv->telemetry);
+  wv->telemetry = NULL;
 }
 //解析命令行:根据参数名称,在运行参数中查找,如果找到返回,对应下标;之后根据下标对程序中相应参数进行赋值
-int ArgPos(char *str, int argc, char **argv) {
+int ArgPos(struct word2vec *wv, char *str, int argc, char **argv) {
   int a;
   for (a = 1; a < argc; a++) if (!strcmp(str, argv[a])) {
-    if (a == argc - 1) {
-      printf("Argument missing for %s\n", str);
-      exit(1);
-    }
+    if (a == argc - 1) Fail(wv, "Argument missing for %s", str);
     return a;//找到,返回下标
   }
   return -1;
 }
 
-int main(int argc, char **argv) {
+/**
+ * ======== ReadModels ========
+ * 读-models文件,一行一个模型,写法和命令行参数相同,例如:
+ *   -cbow 0 -size 300 -window 10 -negative 10 -output sg300.txt
+ * 可以指定-cbow, -size, -window, -negative, -hs, -alpha, -output,其余的沿用命令行中的值;
+ * 指定了-cbow而没有指定-alpha时,学习率取该结构的默认值(CBOW 0.05, skip-gram 0.025).空行和#开头的行跳过.
+ */
+void ReadModels(struct word2vec *wv) {
+  char line[MAX_STRING * 10], *args[64], *tok;
+  int argc, i;
+  struct train_model *m;
+  FILE *fi = fopen(wv->models_file, "rb");
+  if (fi == NULL) {
+    Fail(wv, "ERROR: cannot open models file %s", wv->models_file);
+  }
+  wv->num_models = 0;
+  while (fgets(line, sizeof(line), fi) != NULL) {
+    argc = 1;
+    args[0] = wv->models_file;
+    for (tok = strtok(line, " \t\r\n"); (tok != NULL) && (argc < 64); tok = strtok(NULL, " \t\r\n")) args[argc++] = tok;
+    if ((argc == 1) || (args[1][0] == '#')) continue;
+    wv->models = (struct train_model *)realloc(wv->models, (wv->num_models + 1) * sizeof(struct train_model));
+    if (wv->models == NULL) Fail(wv, "Memory allocation failed");
+    m = &wv->models[wv->num_models];
+    GetModel(wv, m);
+    m->output_file[0] = 0;
+    if ((i = ArgPos(wv, (char *)"-cbow", argc, args)) > 0) {
+      m->cbow = atoi(args[i + 1]);
+      m->alpha = m->cbow ? 0.05 : 0.025;
+    }
+    if ((i = ArgPos(wv, (char *)"-size", argc, args)) > 0) m->layer1_size = atoi(args[i + 1]);
+    if ((i = ArgPos(wv, (char *)"-window", argc, args)) > 0) m->window = atoi(args[i + 1]);
+    if ((i = ArgPos(wv, (char *)"-negative", argc, args)) > 0) m->negative = atoi(args[i + 1]);
+    if ((i = ArgPos(wv, (char *)"-hs", argc, args)) > 0) m->hs = atoi(args[i + 1]);
+    if ((i = ArgPos(wv, (char *)"-alpha", argc, args)) > 0) m->alpha = atof(args[i + 1]);
+    if ((i = ArgPos(wv, (char *)"-output", argc, args)) > 0) strcpy(m->output_file, args[i + 1]);
+    if ((m->output_file[0] == 0) && !wv->in_memory) {
+      Fail(wv, "ERROR: model %d in %s has no -output", wv->num_models + 1, wv->models_file);
+    }
+    if ((m->layer1_size < 1) || (m->window < 1)) {
+      Fail(wv, "ERROR: model %d in %s has an invalid -size or -window", wv->num_models + 1, wv->models_file);
+    }
+    wv->num_models++;
+  }
+  fclose(fi);
+  if (wv->num_models == 0) {
+    Fail(wv, "ERROR: no models in %s", wv->models_file);
+  }
+  // 检查点,增量训练,外存模式和训练后的查询/索引/压缩/降维都只针对一个模型
+  if ((wv->num_models > 1) && ((wv->checkpoint_file[0] != 0) || (wv->load_model_file[0] != 0) || (wv->save_model_file[0] != 0) || (wv->query_file[0] != 0) ||
+   (wv->hnsw_file[0] != 0) || (wv->pq_file[0] != 0) || (wv->pca_file[0] != 0) || (wv->ooc_dir[0] != 0))) {
+    Fail(wv, "ERROR: -models cannot be combined with -checkpoint, -load-model, -save-model, -queries, -hnsw, -pq, -pca or -ooc-dir");
+  }
+  SetModel(wv, &wv->models[0]);
+  if (wv->debug_mode > 0) for (i = 0; i < wv->num_models; i++) printf("Model %d: %s size %lld window %d negative %d hs %d alpha %f -> %s\n", i + 1,
+   wv->models[i].cbow ? "cbow" : "skip-gram", wv->models[i].layer1_size, wv->models[i].window, wv->models[i].negative, wv->models[i].hs, wv->models[i].alpha, wv->models[i].output_file);
+}
+
+/**
+ * ======== ParseArgs ========
+ * 解析命令行参数,设置wv中对应的成员;word2vec-lib.c中的w2v_train用同样的参数配置训练.
+ */
+void ParseArgs(struct word2vec *wv, int argc, char **argv) {
   int i;
+  wv->output_file[0] = 0;//输出文件
+  wv->save_vocab_file[0] = 0;//输出词的文件
+  wv->read_vocab_file[0] = 0;//读入指定词的文件
+  wv->telemetry_file[0] = 0;//监控数据输出文件
+  wv->checkpoint_file[0] = 0;//检查点文件
+  wv->load_model_file[0] = 0;//增量训练读入的模型
+  wv->save_model_file[0] = 0;//训练结束后保存的模型
+  wv->query_file[0] = 0;//训练结束后回答的查询
+  wv->query_output_file[0] = 0;//查询结果输出文件
+  wv->hnsw_file[0] = 0;//HNSW索引文件
+  wv->pq_file[0] = 0;//PQ压缩的词向量文件
+  wv->pca_file[0] = 0;//PCA降维后的词向量文件
+  wv->pca_matrix_file[0] = 0;//PCA投影矩阵文件
+
+  //解析word2vec所需要的参数
+  if ((i = ArgPos(wv, (char *)"-size", argc, argv)) > 0) wv->layer1_size = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-train", argc, argv)) > 0) strcpy(wv->train_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-save-vocab", argc, argv)) > 0) strcpy(wv->save_vocab_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-read-vocab", argc, argv)) > 0) strcpy(wv->read_vocab_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-debug", argc, argv)) > 0) wv->debug_mode = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-binary", argc, argv)) > 0) wv->binary = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-precision", argc, argv)) > 0) wv->export_precision = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-cbow", argc, argv)) > 0) wv->cbow = atoi(argv[i + 1]);
+  if (wv->cbow) wv->alpha = 0.05;
+  if ((i = ArgPos(wv, (char *)"-load-model", argc, argv)) > 0) strcpy(wv->load_model_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-save-model", argc, argv)) > 0) strcpy(wv->save_model_file, argv[i + 1]);
+  // 增量训练没有指定-alpha时,学习率由旧模型决定,见ReadModelVocab
+  if (wv->load_model_file[0] != 0) wv->alpha = 0;
+  if ((i = ArgPos(wv, (char *)"-alpha", argc, argv)) > 0) wv->alpha = atof(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-output", argc, argv)) > 0) strcpy(wv->output_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-window", argc, argv)) > 0) wv->window = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-sample", argc, argv)) > 0) wv->sample = atof(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-hs", argc, argv)) > 0) wv->hs = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-negative", argc, argv)) > 0) wv->negative = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-threads", argc, argv)) > 0) wv->num_threads = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-iter", argc, argv)) > 0) wv->iter = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-min-count", argc, argv)) > 0) wv->min_count = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-classes", argc, argv)) > 0) wv->classes = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-kmeans-iter", argc, argv)) > 0) wv->kmeans_iter = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-kmeans-seed", argc, argv)) > 0) wv->kmeans_seed = atoll(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-kmeans-batch", argc, argv)) > 0) wv->kmeans_batch = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-kmeans-probe", argc, argv)) > 0) wv->kmeans_probe = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-queries", argc, argv)) > 0) strcpy(wv->query_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-query-output", argc, argv)) > 0) strcpy(wv->query_output_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-topk", argc, argv)) > 0) wv->query_topk = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-query-batch", argc, argv)) > 0) wv->query_batch = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-hnsw", argc, argv)) > 0) strcpy(wv->hnsw_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-hnsw-m", argc, argv)) > 0) wv->hnsw_m = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-hnsw-ef", argc, argv)) > 0) wv->hnsw_ef = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-pq", argc, argv)) > 0) strcpy(wv->pq_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-pq-m", argc, argv)) > 0) wv->pq_m = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-pq-iter", argc, argv)) > 0) wv->pq_iter = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-pq-train", argc, argv)) > 0) wv->pq_train = atoll(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-pca", argc, argv)) > 0) strcpy(wv->pca_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-pca-dim", argc, argv)) > 0) wv->pca_dim = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-pca-matrix", argc, argv)) > 0) strcpy(wv->pca_matrix_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-phrase", argc, argv)) > 0) wv->phrase_threshold = atof(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-buckets", argc, argv)) > 0) wv->bucket_count = atoll(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-bucket-min-count", argc, argv)) > 0) wv->bucket_min_count = atoll(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-ooc-dir", argc, argv)) > 0) strcpy(wv->ooc_dir, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-ooc-memory", argc, argv)) > 0) wv->ooc_memory = atoll(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-ooc-writeback", argc, argv)) > 0) wv->ooc_writeback = atof(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-models", argc, argv)) > 0) strcpy(wv->models_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-huge-pages", argc, argv)) > 0) wv->huge_pages = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-chunks", argc, argv)) > 0) wv->num_chunks = atoll(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-shuffle", argc, argv)) > 0) wv->shuffle_blocks = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-prefetch", argc, argv)) > 0) wv->prefetch_blocks = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-eval", argc, argv)) > 0) strcpy(wv->eval_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-eval-every", argc, argv)) > 0) wv->eval_every = atof(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-eval-vocab", argc, argv)) > 0) wv->eval_vocab = atoll(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-eval-threads", argc, argv)) > 0) wv->eval_threads = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-eval-patience", argc, argv)) > 0) wv->eval_patience = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-eval-min-delta", argc, argv)) > 0) wv->eval_min_delta = atof(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-eval-target", argc, argv)) > 0) wv->eval_target = atof(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-telemetry", argc, argv)) > 0) strcpy(wv->telemetry_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-telemetry-interval", argc, argv)) > 0) wv->telemetry_interval = atof(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-perf", argc, argv)) > 0) wv->perf_mode = atoi(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-checkpoint", argc, argv)) > 0) strcpy(wv->checkpoint_file, argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-checkpoint-interval", argc, argv)) > 0) wv->checkpoint_interval = atof(argv[i + 1]);
+  if ((i = ArgPos(wv, (char *)"-resume", argc, argv)) > 0) wv->resume = atoi(argv[i + 1]);
+  if (wv->resume && (wv->checkpoint_file[0] == 0)) {
+    Fail(wv, "ERROR: -resume needs the checkpoint file given by -checkpoint");
+  }
+  // 外存模式的尾部是MAP_SHARED文件映射,fork出的检查点子进程看到的不是快照,而是训练线程仍在修改的行
+  if ((wv->checkpoint_file[0] != 0) && (wv->ooc_dir[0] != 0)) {
+    Fail(wv, "ERROR: -checkpoint cannot be combined with -ooc-dir");
+  }
+  if (wv->models_file[0] != 0) ReadModels(wv);
+}
+
+/**
+ * ======== NewWord2vec ========
+ * 创建训练状态,参数为默认值(和命令行的默认值相同),其余成员为0或NULL.
+ */
+struct word2vec *NewWord2vec() {
+  struct word2vec *wv = (struct word2vec *)calloc(1, sizeof(struct word2vec));
+  if (wv == NULL) return NULL;
+  wv->cbow = 1;
+  wv->debug_mode = 2;
+  wv->window = 5;
+  wv->min_count = 5;
+  wv->num_threads = 12;
+  wv->min_reduce = 1;
+  wv->vocab_max_size = 1000;
+  wv->layer1_size = 100;
+  wv->iter = 5;
+  wv->alpha = 0.025;
+  wv->sample = 1e-3;
+  wv->negative = 5;
+  wv->telemetry_interval = 1;
+  wv->checkpoint_interval = 1800;
+  pthread_mutex_init(&wv->chunk_lock, NULL);
+  wv->export_precision = 6;
+  wv->kmeans_iter = 10;
+  wv->kmeans_probe = 8;
+  wv->kmeans_seed = 1;
+  wv->query_topk = 10;
+  wv->query_batch = 256;
+  wv->hnsw_m = 16;
+  wv->hnsw_ef = 200;
+  wv->pq_m = 32;
+  wv->pq_iter = 10;
+  wv->pq_train = 65536;
+  wv->pca_dim = 100;
+  wv->bucket_min_count = 100;
+  wv->huge_pages = 1;
+  wv->ooc_memory = 4096;
+  wv->ooc_writeback = 10;
+  wv->prefetch_blocks = -1;
+  wv->eval_every = 1;
+  wv->eval_min_delta = 0.001;
+  wv->eval_threads = 1;
+  wv->eval_vocab = 30000;
+  return wv;
+}
+
+/**
+ * ======== FreeWord2vec ========
+ * 释放训练状态和它的所有数组,Fail之后也可以调用(释放数组的代码都把指针置为NULL).
+ * 当前模型的权重(syn0等)和models中的一个相同,只释放一次.
+ */
+void FreeWord2vec(struct word2vec *wv) {
+  long long a;
+  if (wv == NULL) return;
+  for (a = 0; a < wv->num_models; a++) {
+    if (wv->models[a].syn0 == wv->syn0) wv->syn0 = NULL;
+    if (wv->models[a].syn1 == wv->syn1) wv->syn1 = NULL;
+    if (wv->models[a].syn1neg == wv->syn1neg) wv->syn1neg = NULL;
+    HugeFree(wv, wv->models[a].syn0);
+    HugeFree(wv, wv->models[a].syn1);
+    HugeFree(wv, wv->models[a].syn1neg);
+  }
+  HugeFree(wv, wv->syn0);
+  HugeFree(wv, wv->syn1);
+  HugeFree(wv, wv->syn1neg);
+  HugeFree(wv, wv->table);
+  if (wv->vocab != NULL) for (a = 0; a < wv->vocab_size; a++) {
+    free(wv->vocab[a].word);
+    free(wv->vocab[a].code);
+    free(wv->vocab[a].point);
+  }
+  free(wv->vocab);
+  free(wv->vocab_hash);
+  free(wv->expTable);
+  free(wv->word_row);
+  free(wv->model_row);
+  free(wv->models);
+  PhraseTableFree(&wv->phrases);
+  free(wv->chunk_start);
+  free(wv->chunk_order);
+  free(wv->thread_chunks);
+  free(wv->thread_finish);
+  free(wv->thread_stats);
+  free(wv->pending_chunk);
+  free(wv->pending_pos);
+  free(wv->epoch_blocks);
+  free(wv->epoch_end);
+  free(wv->perf_thread);
+  free(wv->eval_question);
+  free(wv->eval_pair);
+  free(wv->eval_human);
+  if (wv->telemetry != NULL) fclose(wv->telemetry);
+  pthread_mutex_destroy(&wv->chunk_lock);
+  free(wv);
+}
+
+/**
+ * ======== InitTables ========
+ * 分配词典和词的hash表,预先计算sigmoid表expTable;TrainModel之前调用.
+ */
+void InitTables(struct word2vec *wv) {
+  int a;
+  // Allocate the vocabulary table.存储词结构体的词典;vocab如果空间不够,会动态扩展
+  wv->vocab = (struct vocab_word *)calloc(wv->vocab_max_size, sizeof(struct vocab_word));
+  // 存储词的hash的数组
+  wv->vocab_hash = (int *)calloc(vocab_hash_size, sizeof(int));
+  // sigmoid计算结果保存表; 申请数组大小为EXP_TABLE_SIZE+1,多一个 for safe
+  wv->expTable = (real *)malloc((EXP_TABLE_SIZE + 1) * sizeof(real));
+  /**预先计算sigmoid函数, sigmoid(x)=1/(1+exp(-x))=exp(x)/(1+exp(x));
+   *为了解决低效率问题,对sigmoid函数作近似计算;
+   * 我们发现:sigmoid(x)在x=0附近变化剧烈,往两边逐渐趋于平缓,
+   * 当x<-6或x>6时函数值基本不变,前者趋于0,后者趋于1.
+  */
+  // sigmoid取值范围[-6, 6); 一共有EXP_TABLE_SIZE个点;
+  for (a = 0; a < EXP_TABLE_SIZE; a++) {
+    // 计算exp()
+    wv->expTable[a] = exp((a / (real)EXP_TABLE_SIZE * 2 - 1) * MAX_EXP); // Precompute the exp() table
+    wv->expTable[a] = wv->expTable[a] / (wv->expTable[a] + 1);                   // Precompute f(x) = x / (x + 1)
+  }
+}
+
+// 其他程序(如word2vec-bench.c)直接#include本文件复用训练代码时,定义WORD2VEC_NO_MAIN去掉main
+#ifndef WORD2VEC_NO_MAIN
+int main(int argc, char **argv) {
+  struct word2vec *wv;
   //判断参数个数
   if (argc == 1) {
     printf("WORD VECTOR estimation toolkit v 0.1c\n\n");//Word Vector 计算
@@ -1510,63 +5127,139 @@ int main(int argc, char **argv) {
     printf("\t\tSet the starting learning rate; default is 0.025 for skip-gram and 0.05 for CBOW\n");
     printf("\t-classes <int>\n");//输出词类别,而不是词向量;默认类别数目是0(输出词向量)
     printf("\t\tOutput word classes rather than word vectors; default number of classes is 0 (vectors are written)\n");
+    printf("\t-kmeans-iter <int>\n");//k-means最多迭代次数,默认10,类别不再变化时提前结束
+    printf("\t\tMaximum number of k-means iterations for -classes; default is 10, stops early when no word changes class\n");
+    printf("\t-kmeans-seed <int>\n");//k-means++初始化的随机数种子,默认1
+    printf("\t\tRandom seed for the k-means++ initialization; default is 1\n");
+    printf("\t-kmeans-batch <int>\n");//大于0时使用mini-batch k-means和近似最近质心索引,适合很大的类别数;默认0(精确k-means)
+    printf("\t\tUse mini-batch k-means with <int> words per batch and an approximate centroid index, for very large\n");
+    printf("\t\t-classes; -kmeans-iter then counts epochs; default is 0 (exact k-means)\n");
+    printf("\t-kmeans-probe <int>\n");//mini-batch模式下每次查找扫描的质心组数,默认8
+    printf("\t\tNumber of centroid groups scanned per lookup with -kmeans-batch; default is 8\n");
+    printf("\t-queries <file>\n");//训练结束后回答文件中的查询:每行一个词(相似词)或者三个词a b c(类比b - a + c)
+    printf("\t\tAfter training, answer the queries in <file>: one word per line for nearest neighbours, or three\n");
+    printf("\t\twords a b c for the analogy b - a + c\n");
+    printf("\t-query-output <file>\n");//查询结果输出文件,默认stdout
+    printf("\t\tWrite the query results to <file>; default is stdout\n");
+    printf("\t-topk <int>\n");//每个查询返回的词数,默认10
+    printf("\t\tNumber of words returned per query; default is 10\n");
+    printf("\t-query-batch <int>\n");//每批一起计算的查询数,默认256
+    printf("\t\tNumber of queries scored together as one batch; default is 256\n");
+    printf("\t-hnsw <file>\n");//训练结束后构建HNSW近似最近邻索引并保存到文件
+    printf("\t\tAfter training, build an HNSW approximate nearest neighbour index over the vectors and save it to <file>\n");
+    printf("\t-hnsw-m <int>\n");//HNSW每层的最大邻居数,默认16
+    printf("\t\tMaximum number of links per node and layer in the HNSW index; default is 16\n");
+    printf("\t-hnsw-ef <int>\n");//HNSW构建时的候选集大小,默认200
+    printf("\t\tCandidate list size while building the HNSW index; default is 200\n");
+    printf("\t-pq <file>\n");//训练结束后用乘积量化压缩词向量,保存到文件
+    printf("\t\tAfter training, compress the normalized vectors with product quantization and save them to <file>\n");
+    printf("\t-pq-m <int>\n");//PQ段数,即每个词的字节数,默认32
+    printf("\t\tNumber of PQ subspaces, i.e. bytes per word; default is 32\n");
+    printf("\t-pq-iter <int>\n");//每段k-means的迭代次数,默认10
+    printf("\t\tK-means iterations per PQ subspace; default is 10\n");
+    printf("\t-pq-train <int>\n");//训练码本用的词数,默认65536,0表示全部
+    printf("\t\tNumber of words used to train the PQ codebooks; default is 65536, 0 = all\n");
+    printf("\t-pca <file>\n");//训练结束后用PCA降维,降维后的词向量按-binary的格式写到文件
+    printf("\t\tAfter training, reduce the vectors with PCA and save them to <file> in the format given by -binary\n");
+    printf("\t-pca-dim <int>\n");//降维后的维度,默认100
+    printf("\t\tDimension of the reduced vectors; default is 100\n");
+    printf("\t-pca-matrix <file>\n");//投影矩阵(均值和主成分)输出文件,默认为<-pca文件>.proj
+    printf("\t\tSave the mean and the principal components to <file>; default is the -pca file name plus .proj\n");
+    printf("\t-phrase <float>\n");//短语得分阈值,大于0时先统计短语,建词典和训练时把短语合并成一个词;默认0(不识别短语)
+    printf("\t\tJoin word pairs scoring above <float> into phrases (a_b) while reading the corpus, as word2phrase does;\n");
+    printf("\t\tdefault is 0 (off), word2phrase uses 100\n");
+    printf("\t-buckets <int>\n");//哈希桶数,大于0时低频词共用桶的向量,syn0/syn1neg的行数不随词典增长;默认0(不分桶)
+    printf("\t\tWords occurring less than -bucket-min-count times share <int> hashed rows instead of having their own;\n");
+    printf("\t\tthis caps the size of the weight matrices, default is 0 (off)\n");
+    printf("\t-bucket-min-count <int>\n");//词频不低于这个值的词有自己的行,默认100
+    printf("\t\tWords occurring at least <int> times keep their own rows when -buckets is set; default is 100\n");
+    printf("\t-ooc-dir <dir>\n");//外存模式:低频词的syn0/syn1neg行映射到<dir>下的临时文件(本地NVMe),高频词的行留在内存中
+    printf("\t\tTrain embedding matrices larger than RAM: rows of rare words live in files mapped from <dir> (use a local SSD),\n");
+    printf("\t\tthe most frequent words stay pinned in memory; cannot be combined with -checkpoint\n");
+    printf("\t-ooc-memory <int>\n");//外存模式下syn0和syn1neg在内存中的部分一共多少MB,默认4096
+    printf("\t\tMemory in MB for the in-memory rows of syn0 and syn1neg together with -ooc-dir; default is 4096\n");
+    printf("\t-ooc-writeback <float>\n");//外存模式下每隔多少秒把脏页写回文件,默认10
+    printf("\t\tWrite dirty file-backed rows back every <float> seconds with -ooc-dir; default is 10\n");
+    printf("\t-models <file>\n");//一次读语料同时训练<file>中的多个模型,一行一个模型,例如: -cbow 0 -size 300 -window 10 -output sg300.txt
+    printf("\t\tTrain several models in one pass over the corpus, one model per line of <file>, e.g.\n");
+    printf("\t\t'-cbow 0 -size 300 -window 10 -negative 10 -output sg300.txt'; -cbow, -size, -window, -negative, -hs, -alpha\n");
+    printf("\t\tand -output can be set per model, everything else (vocabulary, sampling, threads) is shared\n");
+    printf("\t-huge-pages <int>\n");//syn0/syn1neg/unigram table使用大页:0不用,1为2MB大页(默认),2先尝试1GB大页
+    printf("\t\tBack the weight matrices and the sampling table with huge pages: 0 = off, 1 = 2 MB pages (default),\n");
+    printf("\t\t2 = try 1 GB pages first; falls back to transparent huge pages and then to normal pages\n");
     printf("\t-debug <int>\n");//设置debug模型,默认是2,显示训练期间debug信息
     printf("\t\tSet the debug mode (default = 2 = more info during training)\n");
     printf("\t-binary <int>\n");//是否以2进制形式保存词向量;默认是0(关闭,不以二进制形式保存)
     printf("\t\tSave the resulting vectors in binary moded; default is 0 (off)\n");
+    printf("\t\t2 writes an aligned model file that can be mmap'd directly, see word2vec-model.h\n");
+    printf("\t-precision <int>\n");//文本输出的小数位数,默认6;0表示能精确读回的最短表示
+    printf("\t\tDigits after the decimal point in text output; default is 6, 0 = shortest form that reads back exactly\n");
     printf("\t-save-vocab <file>\n");//实值词典保存的文件
     printf("\t\tThe vocabulary will be saved to <file>\n");
     printf("\t-read-vocab <file>\n");//设置词典读取文件,不是从训练数据中构造的(已有,直接读取);
     printf("\t\tThe vocabulary will be read from <file>, not constructed from the training data\n");
+    printf("\t-telemetry <file>\n");//训练监控数据以JSON lines格式写入文件
+    printf("\t\tWrite progress, throughput, loss and phase timings to <file> as JSON lines\n");
+    printf("\t-telemetry-interval <float>\n");//监控输出间隔,默认1秒
+    printf("\t\tSeconds between progress reports; default is 1\n");
+    printf("\t-perf <int>\n");//是否统计硬件计数器(perf_event_open),默认0
+    printf("\t\tRecord hardware performance counters per phase and per training thread; default is 0 (off)\n");
+    printf("\t-checkpoint <file>\n");//定期把训练状态写到检查点文件,中断后可以用-resume继续
+    printf("\t\tPeriodically save the training state to <file> so that an interrupted run can be resumed\n");
+    printf("\t-checkpoint-interval <float>\n");//检查点间隔,默认1800秒
+    printf("\t\tSeconds between checkpoints; default is 1800\n");
+    printf("\t-resume <int>\n");//是否从-checkpoint指定的检查点继续训练,默认0
+    printf("\t\tResume training from the file given by -checkpoint; default is 0 (off). -size, -hs, -negative, -cbow and -window\n");
+    printf("\t\tmust match the checkpoint; -iter, -chunks, -shuffle, -buckets and -alpha are taken from the checkpoint\n");
+    printf("\t-save-model <file>\n");//训练结束后保存完整模型(词典,词频,权重),用于增量训练
+    printf("\t\tSave the vocabulary with counts and all weights to <file> for later incremental training\n");
+    printf("\t-load-model <file>\n");//在-train指定的新语料上继续训练已有模型,新词追加到词典
+    printf("\t\tContinue training the model saved in <file> on the new data given by -train, adding new words\n");
+    printf("\t\tto the vocabulary; the learning rate starts at half of the saved one unless -alpha is given\n");
+    printf("\t-chunks <int>\n");//语料切分块数,线程动态领取;默认0,自动取线程数*32
+    printf("\t\tSplit the training file into <int> chunks handed out to threads on demand; default is 0 (32 per thread)\n");
+    printf("\t-shuffle <int>\n");//每一轮按不同的伪随机顺序访问语料块,适合按主题或时间排序的语料;默认0
+    printf("\t\tVisit the chunks in a different pseudo-random order every iteration; default is 0 (file order).\n");
+    printf("\t\tWith -chunks 0 the file is split into 4 MB chunks (at least 32 per thread)\n");
+    printf("\t-prefetch <int>\n");//打乱块顺序时预读之后第<int>次领取的块;默认-1,取线程数;0不预读
+    printf("\t\tWith -shuffle, ask the kernel to read ahead the chunk handed out <int> chunks later;\n");
+    printf("\t\tdefault is -1 (the number of threads), 0 disables read-ahead\n");
+    printf("\t-eval <file>\n");//训练过程中在后台评估的测试集:每行四个词的类比题,或者两个词加人工分数的相似度题
+    printf("\t\tEvaluate a snapshot of the word vectors in the background during training; <file> holds analogy\n");
+    printf("\t\tquestions (a b c d) and/or similarity pairs (word1 word2 score), lines starting with ':' are skipped\n");
+    printf("\t-eval-every <float>\n");//每隔多少轮评估一次,默认1
+    printf("\t\tEvaluate every <float> iterations (and once after training); default is 1\n");
+    printf("\t-eval-vocab <int>\n");//只用词频最高的<int>个词评估,默认30000;0表示整个词典
+    printf("\t\tRestrict questions and answers to the <int> most frequent words; default is 30000 (0 = all)\n");
+    printf("\t-eval-threads <int>\n");//评估线程数,默认1
+    printf("\t\tUse <int> threads to score the analogy questions; default is 1\n");
+    printf("\t-eval-patience <int>\n");//分数连续<int>次没有提高时提前结束训练;默认0,不提前结束
+    printf("\t\tStop training when the score has not improved for <int> evaluations; default is 0 (never)\n");
+    printf("\t-eval-min-delta <float>\n");//分数至少提高多少才算提高,默认0.001
+    printf("\t\tMinimum score gain that counts as an improvement; default is 0.001\n");
+    printf("\t-eval-target <float>\n");//分数达到<float>时提前结束训练;默认0,不设目标
+    printf("\t\tStop training once the score reaches <float>; default is 0 (no target)\n");
     printf("\t-cbow <int>\n");//是否使用CBOW模型,默认是1[使用CBOW],如果是0[使用skip-gram模型]
     printf("\t\tUse the continuous bag of words model; default is 1 (use 0 for skip-gram model)\n");
     printf("\nExamples:\n");//运行实例
     printf("./word2vec -train data.txt -output vec.txt -size 200 -window 5 -sample 1e-4 -negative 5 -hs 0 -binary 0 -cbow 1 -iter 3\n\n");
     return 0;
   }
-  output_file[0] = 0;//输出文件
-  save_vocab_file[0] = 0;//输出词的文件
-  read_vocab_file[0] = 0;//读入指定词的文件
-
-  //解析word2vec所需要的参数
-  if ((i = ArgPos((char *)"-size", argc, argv)) > 0) layer1_size = atoi(argv[i + 1]);
-  if ((i = ArgPos((char *)"-train", argc, argv)) > 0) strcpy(train_file, argv[i + 1]);
-  if ((i = ArgPos((char *)"-save-vocab", argc, argv)) > 0) strcpy(save_vocab_file, argv[i + 1]);
-  if ((i = ArgPos((char *)"-read-vocab", argc, argv)) > 0) strcpy(read_vocab_file, argv[i + 1]);
-  if ((i = ArgPos((char *)"-debug", argc, argv)) > 0) debug_mode = atoi(argv[i + 1]);
-  if ((i = ArgPos((char *)"-binary", argc, argv)) > 0) binary = atoi(argv[i + 1]);
-  if ((i = ArgPos((char *)"-cbow", argc, argv)) > 0) cbow = atoi(argv[i + 1]);
-  if (cbow) alpha = 0.05;
-  if ((i = ArgPos((char *)"-alpha", argc, argv)) > 0) alpha = atof(argv[i + 1]);
-  if ((i = ArgPos((char *)"-output", argc, argv)) > 0) strcpy(output_file, argv[i + 1]);
-  if ((i = ArgPos((char *)"-window", argc, argv)) > 0) window = atoi(argv[i + 1]);
-  if ((i = ArgPos((char *)"-sample", argc, argv)) > 0) sample = atof(argv[i + 1]);
-  if ((i = ArgPos((char *)"-hs", argc, argv)) > 0) hs = atoi(argv[i + 1]);
-  if ((i = ArgPos((char *)"-negative", argc, argv)) > 0) negative = atoi(argv[i + 1]);
-  if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) num_threads = atoi(argv[i + 1]);
-  if ((i = ArgPos((char *)"-iter", argc, argv)) > 0) iter = atoi(argv[i + 1]);
-  if ((i = ArgPos((char *)"-min-count", argc, argv)) > 0) min_count = atoi(argv[i + 1]);
-  if ((i = ArgPos((char *)"-classes", argc, argv)) > 0) classes = atoi(argv[i + 1]);
-  
-  // Allocate the vocabulary table.存储词结构体的词典;vocab如果空间不够,会动态扩展
-  vocab = (struct vocab_word *)calloc(vocab_max_size, sizeof(struct vocab_word));
-  // 存储词的hash的数组
-  vocab_hash = (int *)calloc(vocab_hash_size, sizeof(int));
-  // sigmoid计算结果保存表; 申请数组大小为EXP_TABLE_SIZE+1,多一个 for safe
-  expTable = (real *)malloc((EXP_TABLE_SIZE + 1) * sizeof(real));
-  /**预先计算sigmoid函数, sigmoid(x)=1/(1+exp(-x))=exp(x)/(1+exp(x));
-   *为了解决低效率问题,对sigmoid函数作近似计算;
-   * 我们发现:sigmoid(x)在x=0附近变化剧烈,往两边逐渐趋于平缓,
-   * 当x<-6或x>6时函数值基本不变,前者趋于0,后者趋于1.
-  */
-  // sigmoid取值范围[-6, 6); 一共有EXP_TABLE_SIZE个点;
-  for (i = 0; i < EXP_TABLE_SIZE; i++) {
-    // 计算exp()
-    expTable[i] = exp((i / (real)EXP_TABLE_SIZE * 2 - 1) * MAX_EXP); // Precompute the exp() table
-    expTable[i] = expTable[i] / (expTable[i] + 1);                   // Precompute f(x) = x / (x + 1)
+  wv = NewWord2vec();
+  if (wv == NULL) {
+    printf("Memory allocation failed\n");
+    return 1;
   }
+  // 出错时Fail回到这里
+  if (setjmp(wv->fail) != 0) {
+    printf("%s\n", wv->error);
+    return 1;
+  }
+  ParseArgs(wv, argc, argv);
+  InitTables(wv);
   //模型训练
-  TrainModel();
-
+  TrainModel(wv);
+  FreeWord2vec(wv);
   return 0;
 }
+#endif
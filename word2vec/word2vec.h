@@ -0,0 +1,98 @@
+//  word2vec.h: 训练库的C接口(实现见word2vec-lib.c)
+//
+//  在自己的程序中训练词向量,不需要先把语料写到磁盘再调用word2vec命令行:
+//  语料来自内存中的词序列(或者训练时由回调函数逐句提供),训练结果(词表和词向量矩阵)直接返回到内存中,没有文件读写.
+//  参数和命令行相同,写成一个字符串,例如"-size 100 -window 5 -negative 5 -iter 5";
+//  -models可以一次训练多个模型,这时不需要-output,结果按模型序号取.
+//
+//  每个w2v_context是独立的,不同的context可以在不同线程中同时训练.
+//  w2v_train在调用进程中运行word2vec.c的训练代码,训练状态都在每次训练自己的struct word2vec中,不fork子进程;
+//  训练出错时w2v_train返回-1,w2v_error给出和word2vec命令行相同的错误信息,调用进程不会退出.
+//  -checkpoint和-resume需要fork,库中不能使用.
+//
+//  编译: gcc word2vec-lib.c -o libword2vec.so -shared -fPIC -fvisibility=hidden -lm -pthread -O3 -march=native -funroll-loops
+//  链接: gcc app.c -o app -L. -lword2vec
+//
+//  用法:
+//    struct w2v_context *c = w2v_create("-cbow 0 -size 100 -window 5 -negative 5 -iter 5");
+//    const char *s[] = {"the", "quick", "brown", "fox"};
+//    w2v_add_sentence(c, s, 4);
+//    ...
+//    if (w2v_train(c, 8) != 0) printf("%s\n", w2v_error(c));
+//    long long dim, words = w2v_words(c);
+//    const float *v = w2v_vectors(c, 0, &dim);  // words x dim,第i行是w2v_word(c, i)的向量,词按词频降序
+//    w2v_free(c);
+
+#ifndef WORD2VEC_H
+#define WORD2VEC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define W2V_API __attribute__((visibility("default")))
+
+struct w2v_context;
+
+/*
+ * ======== w2v_sentence_fn ========
+ * 逐句提供语料的回调:把这一句的词放到*tokens,返回词数;返回负数表示没有更多句子.
+ * tokens为NULL时回到第一句:建词典读一遍,之后每轮训练(-iter)再读一遍.
+ * *tokens指向的内存只需要在下一次调用之前有效;回调总是在同一时间只被一个线程调用.
+ */
+typedef long long (*w2v_sentence_fn)(void *arg, const char *const **tokens);
+
+/**
+ * ======== w2v_create ========
+ * 用命令行格式的参数(-train和-output除外)创建context,失败返回NULL.
+ */
+W2V_API struct w2v_context *w2v_create(const char *options);
+
+/**
+ * ======== w2v_add_sentence / w2v_add_text ========
+ * 向语料追加内容,成功返回0:
+ *   w2v_add_sentence - 一句,n个词;词中不能有空白字符(空格,tab,换行)
+ *   w2v_add_text - 和训练文件相同格式的文本,size个字节;换行表示句子结束
+ */
+W2V_API int w2v_add_sentence(struct w2v_context *c, const char *const *tokens, long long n);
+W2V_API int w2v_add_text(struct w2v_context *c, const char *text, long long size);
+
+/**
+ * ======== w2v_set_sentences ========
+ * 语料由fn在训练时逐句提供,不复制到内存中;和w2v_add_sentence / w2v_add_text不能同时使用.
+ * 不能和-phrase, -shuffle一起使用(它们需要按位置重读语料).成功返回0.
+ */
+W2V_API int w2v_set_sentences(struct w2v_context *c, w2v_sentence_fn fn, void *arg);
+
+/**
+ * ======== w2v_train ========
+ * 在已追加的语料上建词典并训练,threads > 0时覆盖-threads;成功返回0,失败返回-1(原因见w2v_error).
+ * 可以追加更多语料后再次调用,每次都从头训练,之前的结果被替换.
+ */
+W2V_API int w2v_train(struct w2v_context *c, int threads);
+
+/**
+ * ======== 训练结果 ========
+ * w2v_models - 模型数(没有-models时为1)
+ * w2v_words - 词数;w2v_word - 第i个词
+ * w2v_vectors - 第model个模型的词向量矩阵,words x dim个float,按行存储;dim不为NULL时返回维度
+ * 结果属于context,在下一次w2v_train或w2v_free之前有效.
+ */
+W2V_API int w2v_models(const struct w2v_context *c);
+W2V_API long long w2v_words(const struct w2v_context *c);
+W2V_API const char *w2v_word(const struct w2v_context *c, long long i);
+W2V_API const float *w2v_vectors(const struct w2v_context *c, int model, long long *dim);
+
+/**
+ * ======== w2v_error ========
+ * 最近一次失败的原因.
+ */
+W2V_API const char *w2v_error(const struct w2v_context *c);
+
+W2V_API void w2v_free(struct w2v_context *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif